@@ -28,6 +28,8 @@
 #include <flexisip/event.hh>
 #include <flexisip/transaction.hh>
 #include <flexisip/eventlogs.hh>
+#include <flexisip/utils/domain-matcher.hh>
+#include <flexisip/utils/network-table.hh>
 
 #include <sofia-sip/sip.h>
 #include <sofia-sip/sip_protos.h>
@@ -37,10 +39,12 @@
 #include <sofia-sip/nta.h>
 #include <sofia-sip/nta_stateless.h>
 #include <sofia-sip/nth.h>
+#include <sofia-sip/su_wait.h>
 
 #include <string>
 #include <sstream>
 #include <memory>
+#include <unordered_map>
 #include <ifaddrs.h>
 
 #if ENABLE_MDNS
@@ -106,6 +110,8 @@ class Agent : public IncomingAgent,
 	StatCounter64 *mCountReply407 = nullptr; // proxy auth
 	StatCounter64 *mCountReply408 = nullptr; // request timeout
 	StatCounter64 *mCountReplyResUnknown = nullptr;
+	StatCounter64 *mCountProcessedMessages = nullptr;
+	StatCounter64 *mCountMessageAllocations = nullptr;
 	void onDeclare(GenericStruct *root);
 	ConfigValueListener *mBaseConfigListener;
 
@@ -200,44 +206,44 @@ public:
 	void applyProxyToProxyTransportSettings(tport_t *tp);
 private:
 	// Private types
-	class Network {
-		struct sockaddr_storage mPrefix;
-		struct sockaddr_storage mMask;
-		std::string mIP;
-
-	  public:
-		Network(const Network &net);
-		Network(const struct ifaddrs *ifaddr);
-		bool isInNetwork(const struct sockaddr *addr) const;
-		const std::string getIP() const;
-		static std::string print(const struct ifaddrs *ifaddr);
-	};
-
 	// Private methods
 	int onIncomingMessage(msg_t *msg, const sip_t *sip);
 	void send(const std::shared_ptr<MsgSip> &msg, url_string_t const *u, tag_type_t tag, tag_value_t value, ...) override;
 	void reply(const std::shared_ptr<MsgSip> &msg, int status, char const *phrase, tag_type_t tag, tag_value_t value, ...) override;
 	void discoverInterfaces();
+	void startInterfacesMonitor();
+	void stopInterfacesMonitor();
 	void startLogWriter();
 	std::string computeResolvedPublicIp(const std::string &host, int family = AF_UNSPEC) const;
 	void checkAllowedParams(const url_t *uri);
 	void initializePreferredRoute();
 	void loadModules();
 	void startMdns();
+	void compileAliases();
+	void compileTports();
 
 	static int messageCallback(nta_agent_magic_t *context, nta_agent_t *agent, msg_t *msg, sip_t *sip);
 	static void printEventTailSeparator();
+	static int onInterfacesChanged(su_root_magic_t *magic, su_wait_t *wait, su_wakeup_arg_t *arg);
 
 	// Private attributes
 	std::string mServerString;
 	std::list<Module *> mModules;
 	std::list<std::string> mAliases;
+	HostMatcher mAliasesMatcher;
+	HostMatcher mTportsMatcher;
+	HostMatcher mDefaultPortTportsMatcher; // transports listening on the default port of their protocol
 	url_t *mPreferredRouteV4 = nullptr;
 	url_t *mPreferredRouteV6 = nullptr;
 	const url_t *mNodeUri = nullptr;
 	const url_t *mClusterUri = nullptr;
 	const url_t *mDefaultUri = nullptr;
-	std::list<Network> mNetworks;
+	NetworkTable mNetworks;
+	// Results of getPreferredIp() by destination, flushed when the interfaces change.
+	mutable std::unordered_map<std::string, std::pair<std::string, std::string>> mPreferredIpCache;
+	int mInterfacesMonitorSocket = -1;
+	int mInterfacesMonitorIndex = -1;
+	su_wait_t mInterfacesMonitorWait[1];
 	std::string mUniqueId;
 	std::string mRtpBindIp = "0.0.0.0";
 	std::string mRtpBindIp6 = "::0";
@@ -257,6 +263,7 @@ private:
 	std::vector<belle_sip_mdns_register_t *> mMdnsRegisterList;
 #endif
 
+	static constexpr size_t sPreferredIpCacheSize = 1024;
 	static constexpr const char* sInternalTransportIdent = "internal-transport";
 	static const std::string sEventSeparator;
 };
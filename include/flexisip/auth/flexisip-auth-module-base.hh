@@ -52,6 +52,17 @@ public:
 
 	NonceStore &nonceStore() {return mNonceStore;}
 
+	/**
+	 * @brief Switch to stateless nonces.
+	 *
+	 * Nonces then carry their issue time and a HMAC computed with this secret over the realm, the user URI
+	 * and the issue time, so that any instance sharing the secret can validate them without any lookup.
+	 * Only the nonce counts of qop=auth are still tracked locally.
+	 * @param[in] secret The secret shared by all the instances of a cluster. Empty to use the nonces of Sofia-SIP.
+	 */
+	void setNonceSecret(const std::string &secret) {mNonceSecret = secret;}
+	bool statelessNonces() const {return !mNonceSecret.empty();}
+
 protected:
 	void onCheck(AuthStatus &as, msg_auth_t *credentials, auth_challenger_t const *ach) override;
 	void onChallenge(AuthStatus &as, auth_challenger_t const *ach) override;
@@ -70,8 +81,22 @@ protected:
 	void finish(FlexisipAuthStatus &as);
 	void onError(FlexisipAuthStatus &as);
 
+	/**
+	 * Check the nonce of a digest response. Expired nonces set the 'stale' flag of 'as'.
+	 * @return false if the nonce isn't valid.
+	 */
+	bool validateNonce(FlexisipAuthStatus &as, auth_response_t &ar);
+
 	NonceStore mNonceStore;
 	bool mQOPAuth = false;
+
+private:
+	std::string computeNonceHmac(const FlexisipAuthStatus &as, uint64_t issued) const;
+	std::string makeStatelessNonce(const FlexisipAuthStatus &as) const;
+	bool validateStatelessNonce(FlexisipAuthStatus &as, const char *nonce) const;
+
+	std::string mNonceSecret;
+	int mNonceExpire = 0;
 };
 
 }
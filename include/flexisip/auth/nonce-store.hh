@@ -18,36 +18,75 @@
 
 #pragma once
 
-#include <ctime>
-#include <map>
-#include <mutex>
+#include <atomic>
+#include <cstdint>
+#include <memory>
 #include <string>
 
 #include <sofia-sip/msg_types.h>
 
 namespace flexisip {
 
+class StatCounter64;
+
+/*
+ * Fixed-size open-addressing table of the issued nonces and of their last nonce count.
+ * Nonces are keyed by a 64 bits hash. Each entry records the generation (a time bucket) in which it was issued:
+ * entries older than the nonce lifetime are considered free and are reclaimed by the following insertions, so
+ * there is no cleanup pass. All operations are lock-free.
+ */
 class NonceStore {
 public:
-	void setNonceExpires(int value) {mNonceExpires = value;}
+	static constexpr size_t sDefaultCapacity = 1 << 16;
+
+	NonceStore(size_t capacity = sDefaultCapacity);
+
+	/*
+	 * Resizes the table to hold at least 'capacity' nonces, forgetting the stored ones.
+	 * Must be called before the store is used.
+	 */
+	void setCapacity(size_t capacity);
+	void setNonceExpires(int value);
+	/* Counts the live nonces evicted to make room for new ones, i.e. when the table is too small for the load. */
+	void setEvictionCounter(StatCounter64 *counter) {mCountEvictions = counter;}
 	int getNc(const std::string &nonce);
 	void insert(const msg_auth_t *response);
 	void insert(const std::string &nonce);
-	void updateNc(const std::string &nonce, int newnc);
+	/*
+	 * Atomically replaces the nonce count if 'newnc' is greater than the stored one.
+	 * Returns false if the nonce is unknown, expired or if 'newnc' is a replay.
+	 */
+	bool updateNc(const std::string &nonce, int newnc);
 	void erase(const std::string &nonce);
-	void cleanExpired();
 
 private:
-	struct NonceCount {
-		NonceCount(int c, time_t ex) : nc(c), expires(ex) {
-		}
-		int nc;
-		std::time_t expires;
+
+	static constexpr unsigned sMaxProbes = 16;
+	static constexpr uint32_t sGenerationsPerLifetime = 16;
+	static constexpr uint32_t sClaimedGeneration = UINT32_MAX;
+
+	struct Slot {
+		std::atomic<uint64_t> key{0};
+		std::atomic<uint64_t> state{0}; // generation << 32 | nonce count, a null generation meaning a free slot
 	};
 
-	std::map<std::string, NonceCount> mNc;
-	std::mutex mMutex;
-	int mNonceExpires = 3600;
+	static uint64_t makeState(uint32_t generation, uint32_t nc) {return (uint64_t(generation) << 32) | nc;}
+	static uint32_t generationOf(uint64_t state) {return uint32_t(state >> 32);}
+	static uint32_t ncOf(uint64_t state) {return uint32_t(state);}
+	static uint64_t hashNonce(const std::string &nonce);
+
+	uint32_t currentGeneration() const;
+	bool isAlive(uint64_t state, uint32_t generation) const {
+		uint32_t slotGeneration = generationOf(state);
+		return slotGeneration != 0 && slotGeneration != sClaimedGeneration
+			&& generation - slotGeneration <= sGenerationsPerLifetime;
+	}
+	Slot *find(uint64_t key, uint32_t generation, uint64_t &state);
+
+	std::unique_ptr<Slot[]> mSlots;
+	size_t mMask;
+	std::atomic<int> mGenerationSeconds{3600 / sGenerationsPerLifetime};
+	StatCounter64 *mCountEvictions = nullptr;
 };
 
 }
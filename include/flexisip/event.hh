@@ -40,6 +40,7 @@ class OutgoingAgent;
 class IncomingTransaction;
 class OutgoingTransaction;
 class EventLog;
+class SdpModifier;
 
 class MsgSip {
 	friend class Agent;
@@ -61,13 +62,33 @@ class MsgSip {
 	msg_header_t *findHeader(const std::string &name);
 	const msg_header_t *findHeader(const std::string &name) const {return const_cast<MsgSip *>(this)->findHeader(name);}
 
-	void serialize() const {msg_serialize(mMsg, (msg_pub_t *)getSip());}
+	void serialize() const {
+		commitSdp();
+		msg_serialize(mMsg, (msg_pub_t *)getSip());
+	}
 	const char *print();
 	std::string printContext() const;
 
+	/**
+	 * Get the SDP body of the message. It is parsed on first call only and then shared by all the modules
+	 * processing the message, which modify it in place and flag it with SdpModifier::setModified().
+	 * The modified SDP is written back into the message once, when the message is sent, copied or serialized.
+	 * @param[in] nortproxy name of the attribute marking media lines that must not be masqueraded.
+	 * @return nullptr if the message has no SDP body or if it can't be parsed.
+	 */
+	std::shared_ptr<SdpModifier> getSdpModifier(const std::string &nortproxy = "");
+
+	/**
+	 * Write the SDP body back into the message if it has been modified since the last call.
+	 * @return 0 on success, -1 if the SDP couldn't be printed.
+	 */
+	int commitSdp() const;
+
   private:
 	void assignMsg(msg_t *msg);
 	msg_t *mMsg;
+	std::shared_ptr<SdpModifier> mSdpModifier;
+	bool mSdpParsed = false;
 };
 
 class SipEvent : public std::enable_shared_from_this<SipEvent> {
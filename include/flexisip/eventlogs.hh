@@ -18,11 +18,21 @@
 
 #pragma once
 
+#include <array>
+#include <chrono>
+#include <condition_variable>
+#include <ctime>
+#include <deque>
+#include <list>
 #include <memory>
 #include <mutex>
 #include <queue>
+#include <sstream>
 #include <string>
-#include <array>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
 
 #include <sofia-sip/sip.h>
 #include <sofia-sip/sip_protos.h>
@@ -208,13 +218,41 @@ protected:
 class FilesystemEventLogWriter: public EventLogWriter {
 public:
 
-	FilesystemEventLogWriter(const std::string &rootpath);
-	void write(std::shared_ptr<const EventLog> evlog) override {evlog->write(*this);}
+	/**
+	 * @param[in] rootpath absolute path of the directory where logs are written.
+	 * @param[in] maxOpenFiles number of log files kept open between two writes.
+	 */
+	FilesystemEventLogWriter(const std::string &rootpath, unsigned int maxOpenFiles = 64);
+	~FilesystemEventLogWriter() override;
+
+	/**
+	 * Format the event and queue its lines for writing. The event is formatted on the calling thread because its
+	 * owner may still update it, files are accessed from a background thread only.
+	 */
+	void write(std::shared_ptr<const EventLog> evlog) override;
 	bool isReady() const {return mIsReady;}
 
 private:
+	using OpenFileList = std::list<std::pair<std::string, int>>;
+
+	// A formatted line, waiting to be appended to the log file of a user or of an error code.
+	struct LogLine {
+		std::string user;
+		std::string domain;
+		const char *kind;
+		time_t date;
+		int errorCode; // the line goes to the errors directory if not null
+		std::string line;
+	};
 
-	int openPath(const url_t *uri, const char *kind, time_t curtime, int errorcode = 0);
+	void run();
+	void flush();
+
+	void appendLog(const url_t *uri, const char *kind, time_t curtime, const std::string &logstr, int errorcode = 0);
+	bool makePath(std::ostringstream &path, const LogLine &log);
+	bool createDirectory(const std::string &path);
+	int getFd(const std::string &path);
+	void closeFiles();
 
 	void writeRegistrationLog(const RegistrationLog &evlog) override;
 	void writeCallLog(const CallLog &clog) override;
@@ -226,6 +264,22 @@ private:
 
 	std::string mRootPath{};
 	bool mIsReady{false};
+
+	std::thread mThread{};
+	std::mutex mMutex{};
+	std::condition_variable mCondition{};
+	std::vector<LogLine> mQueue{};
+	bool mShutdown{false};
+
+	// The following members are only accessed from the writer thread.
+	std::unordered_map<std::string, std::vector<std::string>> mPendingWrites{};
+	OpenFileList mOpenFiles{}; // Most recently used first.
+	std::unordered_map<std::string, OpenFileList::iterator> mOpenFilesByPath{};
+	std::unordered_set<std::string> mKnownDirectories{};
+	unsigned int mMaxOpenFiles{0};
+	int mCurrentDay{-1};
+
+	static constexpr std::size_t sMaxQueueSize = 10000;
 };
 
 }
@@ -234,16 +288,24 @@ private:
 
 #include <soci/soci.h>
 
-#include "utils/threadpool.hh"
-
 namespace flexisip {
 
+class StatCounter64;
+
 class DataBaseEventLogWriter: public EventLogWriter {
 public:
+	/**
+	 * @param[in] maxQueueSize maximum number of events waiting to be written.
+	 * @param[in] nbThreadsMax number of writer threads, each one holding its own database connection.
+	 * @param[in] batchSize maximum number of events written within a single transaction.
+	 * @param[in] batchMaxDelay maximum time an event may wait for its batch to be complete.
+	 */
 	DataBaseEventLogWriter(
 		const std::string &backendString, const std::string &connectionString,
-		unsigned int maxQueueSize, unsigned int nbThreadsMax
+		unsigned int maxQueueSize, unsigned int nbThreadsMax,
+		unsigned int batchSize = 1, std::chrono::milliseconds batchMaxDelay = std::chrono::milliseconds{0}
 	);
+	~DataBaseEventLogWriter() override;
 
 	void write(std::shared_ptr<const EventLog> evlog) override;
 	bool isReady() const {return mIsReady;}
@@ -293,7 +355,59 @@ private:
 		PostgresqlInfo() noexcept;
 	};
 
-	static void writeEventLog(soci::session &session, const EventLog &evlog, int typeId);
+	/**
+	 * Flat representation of an event, as it is inserted in the database.
+	 * Events are converted on the caller thread so that the writer threads
+	 * only have to bind values to already prepared statements.
+	 */
+	struct EventRow {
+		int typeId{0};
+		std::string from{};
+		std::string to{};
+		std::string userAgent{};
+		std::tm date{};
+		int statusCode{0};
+		std::string reason{};
+		std::string completed{};
+		std::string callId{};
+		std::string priority{};
+
+		// Columns of the table specific to the event type (event_registration_log, event_call_log...).
+		int specificTypeId{0};
+		std::array<std::string, 3> specificColumns{};
+
+		std::chrono::steady_clock::time_point enqueueTime{};
+	};
+
+	/**
+	 * A writer thread with its own connection to the database and the
+	 * statements prepared on it.
+	 */
+	class Worker {
+	public:
+		Worker(DataBaseEventLogWriter &writer, soci::connection_pool &pool);
+		Worker(const Worker &) = delete;
+
+		void start();
+		void join();
+
+	private:
+		void run();
+		/* Returns the number of rows written, the rows of a failed batch being written one by one. */
+		std::size_t writeBatch(const std::vector<EventRow> &batch);
+		bool writeRows(const EventRow *rows, std::size_t count);
+		void prepareStatements();
+		void resetStatements();
+
+		DataBaseEventLogWriter &mWriter;
+		soci::session mSession;
+		EventRow mRow{};
+		std::unique_ptr<soci::statement> mEventStatement{};
+		std::array<std::unique_ptr<soci::statement>, 5> mSpecificStatements{};
+		std::thread mThread{};
+	};
+
+	static void writeEventLog(EventRow &row, const EventLog &evlog, int typeId);
 
 	void writeRegistrationLog(const RegistrationLog &evlog) override;
 	void writeCallLog(const CallLog &evlog) override;
@@ -301,19 +415,32 @@ private:
 	void writeAuthLog(const AuthLog &evlog) override;
 	void writeCallQualityStatisticsLog(const CallQualityStatisticsLog &evlog) override;
 
-	void writeEventFromQueue();
+	void enqueue(EventRow &&row);
+	bool popBatch(std::vector<EventRow> &batch);
+	void onBatchWritten(std::size_t written, std::size_t dropped);
 
 	bool mIsReady{false};
+	bool mShutdown{false};
 	std::mutex mMutex{};
-	std::queue<std::shared_ptr<const EventLog>> mListLogs{};
+	std::condition_variable mCondition{};
+	std::deque<EventRow> mRows{};
 
 	std::unique_ptr<soci::connection_pool> mConnectionPool{};
-	std::unique_ptr<ThreadPool> mThreadPool{};
+	std::vector<std::unique_ptr<Worker>> mWorkers{};
 
 	unsigned int mMaxQueueSize{0};
+	unsigned int mBatchSize{1};
+	std::chrono::milliseconds mBatchMaxDelay{0};
 
+	std::string mInsertEventReq{};
 	std::array<std::string, 5> mInsertReq{};
 
+	StatCounter64 *mCountBatches{nullptr};
+	StatCounter64 *mCountWrittenEvents{nullptr};
+	StatCounter64 *mCountDroppedEvents{nullptr};
+	StatCounter64 *mLastBatchSize{nullptr};
+	StatCounter64 *mLastQueueLatency{nullptr};
+
 	static constexpr unsigned int sRequiredSchemaVersion = 1;
 };
 
@@ -79,7 +79,7 @@ class ForkContext : public std::enable_shared_from_this<ForkContext> {
 	std::list<std::shared_ptr<BranchInfo>> mCurrentBranches;
 	float mCurrentPriority;
 	bool mFinished = false;
-	std::list<std::string> mKeys;
+	std::list<AorKey> mKeys;
 	void init();
 	void processLateTimeout();
 	std::shared_ptr<BranchInfo> _findBestBranch(const int urgentReplies[], bool ignore503And408);
@@ -152,8 +152,8 @@ class ForkContext : public std::enable_shared_from_this<ForkContext> {
 	// Start the processing of the highest priority branches that are not completed yet
 	void start();
 
-	void addKey(const std::string &key);
-	const std::list<std::string> &getKeys()const;
+	void addKey(const AorKey &key);
+	const std::list<AorKey> &getKeys()const;
 
 	/*
 	 * Informs the forked call context that a new register from a potential destination of the fork just arrived.
@@ -101,6 +101,7 @@ protected:
 	std::string mRealmRegexStr;
 	std::regex mRealmRegex;
 	std::shared_ptr<SipBooleanExpression> mNo403Expr;
+	StatCounter64 *mCountNonceEvictions = nullptr;
 
 	static const std::array<std::string, 2> sValidAlgos;
 };
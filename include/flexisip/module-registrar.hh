@@ -21,12 +21,20 @@
 #include <flexisip/module.hh>
 #include <flexisip/agent.hh>
 #include <flexisip/registrardb.hh>
+#include <flexisip/utils/static-records.hh>
+#include <flexisip/utils/timer.hh>
 
 #include <sofia-sip/sip_status.h>
 #include <sofia-sip/su_random.h>
 
 #include <signal.h>
 
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <unordered_map>
+#include <vector>
+
 namespace flexisip {
 
 struct RegistrarStats {
@@ -104,7 +112,7 @@ class ResponseContext {
   public:
 	const std::shared_ptr<RequestSipEvent> reqSipEvent;
 
-	static std::shared_ptr<ResponseContext> createInTransaction(std::shared_ptr<RequestSipEvent> ev, int globalDelta, const std::string &tag);
+	static std::shared_ptr<ResponseContext> createInTransaction(std::shared_ptr<RequestSipEvent> ev, int globalDelta);
 
 	ResponseContext(std::shared_ptr<RequestSipEvent> &ev, int globalDelta);
 
@@ -146,8 +154,13 @@ class ModuleRegistrar : public Module, public ModuleToolbox {
 	void readStaticRecords();
 
   private:
+	// Maximum number of static bindings sent to the registrar database per main loop iteration.
+	static constexpr size_t sStaticBindingsBatchSize = 500;
+
 	static void sighandler(int signum, siginfo_t *info, void *ptr);
 
+	void processStaticBindings();
+
 	void updateLocalRegExpire();
 
 	bool isManagedDomain(const url_t *url);
@@ -158,6 +171,7 @@ class ModuleRegistrar : public Module, public ModuleToolbox {
 	bool mUpdateOnResponse;
 	bool mAllowDomainRegistrations;
 	std::list<std::string> mDomains;
+	DomainMatcher mDomainMatcher;
 	std::list<std::string> mUniqueIdParams;
 	std::string mServiceRoute;
 	static std::list<std::string> mPushNotifParams;
@@ -167,6 +181,10 @@ class ModuleRegistrar : public Module, public ModuleToolbox {
 	su_timer_t *mStaticRecordsTimer;
 	int mStaticRecordsTimeout;
 	int mStaticRecordsVersion;
+	uint32_t mStaticRecordsCSeq = 0; // CSeq of the bindings of the last load of the file
+	StaticRecords mStaticRecords;
+	std::deque<StaticRecords::Binding> mStaticBindings; // bindings waiting to be sent to the registrar database
+	std::unique_ptr<sofiasip::Timer> mStaticBindingsTimer;
 	bool mAssumeUniqueDomains;
 	struct sigaction mSigaction;
 	static ModuleInfo<ModuleRegistrar> sInfo;
@@ -77,7 +77,7 @@ class ModuleRouter : public Module, public ModuleToolbox, public ForkContextList
 	}
 
 	bool isManagedDomain(const url_t *url) {
-		return ModuleToolbox::isManagedDomain(getAgent(), mDomains, url);
+		return ModuleToolbox::isManagedDomain(getAgent(), mDomainMatcher, url);
 	}
 
   protected:
@@ -85,14 +85,15 @@ class ModuleRouter : public Module, public ModuleToolbox, public ForkContextList
 				  std::shared_ptr<ForkContext> context, const std::string &targetUris);
 	virtual bool lateDispatch(const std::shared_ptr<RequestSipEvent> &ev, const std::shared_ptr<ExtendedContact> &contact,
 				  std::shared_ptr<ForkContext> context, const std::string &targetUris);
-	std::string routingKey(const url_t *sipUri);
+	AorKey routingKey(const url_t *sipUri);
 	std::vector<std::string> split(const char *data, const char *delim);
 
 	std::list<std::string> mDomains;
+	DomainMatcher mDomainMatcher;
 	std::shared_ptr<ForkContextConfig> mForkCfg;
 	std::shared_ptr<ForkContextConfig> mMessageForkCfg;
 	std::shared_ptr<ForkContextConfig> mOtherForkCfg;
-	typedef std::multimap<std::string, std::shared_ptr<ForkContext>> ForkMap;
+	typedef std::unordered_multimap<AorKey, std::shared_ptr<ForkContext>> ForkMap;
 	ForkMap mForks;
 	bool mUseGlobalDomain = false;
 
@@ -25,6 +25,7 @@
 #include "flexisip/configmanager.hh"
 #include "flexisip/entryfilter.hh"
 #include "flexisip/event.hh"
+#include "flexisip/utils/domain-matcher.hh"
 
 namespace flexisip {
 
@@ -235,6 +236,7 @@ public:
 	static bool transportEquals(const char *tr1, const char *tr2);
 	static bool isNumeric(const char *host);
 	static bool isManagedDomain(const Agent *agent, const std::list<std::string> &domains, const url_t *url);
+	static bool isManagedDomain(const Agent *agent, const DomainMatcher &domains, const url_t *url);
 	static void addRoutingParam(
 		su_home_t *home, sip_contact_t *contacts, const std::string &routingParam, const char *domain
 	);
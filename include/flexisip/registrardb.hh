@@ -28,6 +28,8 @@
 #include <mutex>
 #include <set>
 #include <string>
+#include <unordered_map>
+#include <vector>
 
 #include <sofia-sip/sip.h>
 #include <sofia-sip/su_random.h>
@@ -36,6 +38,7 @@
 #include <flexisip/agent.hh>
 #include <flexisip/logmanager.hh>
 #include <flexisip/module.hh>
+#include <flexisip/utils/aor-key.hh>
 
 #include "utils/sip-uri.hh"
 
@@ -68,7 +71,9 @@ struct ExtendedContact {
 	std::string mUniqueId{};
 	std::list<std::string> mPath{}; //list of urls as string (not enclosed with brakets)
 	std::string mUserAgent{};
-	sip_contact_t *mSipContact{nullptr}; // Full contact
+	/* Full contact. It is parsed when the contact is created rather than on first use, and the path and accept lists
+	 * aren't packed together: these fields are read directly all over the proxy and its serializers. */
+	sip_contact_t *mSipContact{nullptr};
 	float mQ{1.0f};
 	time_t mExpireAt{std::numeric_limits<time_t>::max()};
 	time_t mExpireNotAtMessage{std::numeric_limits<time_t>::max()};  // real expires time but not for message
@@ -142,6 +147,14 @@ struct ExtendedContact {
 		init();
 	}
 
+	// Used by the binary deserializer, which fills the remaining fields itself.
+	ExtendedContact(const char *contactId, const char *uniqueId)
+	:
+		mContactId{contactId ? contactId : ""},
+		mUniqueId{uniqueId ? uniqueId : ""}
+	{
+	}
+
 	ExtendedContact(const ExtendedContactCommon &common, const sip_contact_t *sip_contact, int global_expire, uint32_t cseq,
 					time_t updateTime, bool alias, const std::list<std::string> &acceptHeaders, const std::string &userAgent)
 		: mContactId(common.mContactId), mCallId(common.mCallId), mUniqueId(common.mUniqueId), mPath(common.mPath),
@@ -194,12 +207,30 @@ class Record {
 	friend class RegistrarDb;
 
   private:
+	using Contacts = std::list<std::shared_ptr<ExtendedContact>>;
+	// The order gives the first of several contacts matching a key, as a walk over the contacts would.
+	struct IndexedContact {
+		Contacts::iterator mContact;
+		uint64_t mOrder;
+	};
+	using ContactIndex = std::unordered_multimap<size_t, IndexedContact>;
+
 	static void init();
 
+	void indexContact(Contacts::iterator it);
+	void unindexContact(Contacts::iterator it);
+	Contacts::iterator eraseContact(Contacts::iterator it);
+	void clearContacts();
+
 	sofiasip::Home mHome;
-	std::list<std::shared_ptr<ExtendedContact>> mContacts;
+	Contacts mContacts;
 	std::list<std::shared_ptr<ExtendedContact>> mContactsToRemove;
-	std::string mKey;
+	// Contacts by hash of their unique id (when they have one) and of their call-id, so that bindings are found and
+	// removed without walking through the contacts.
+	ContactIndex mContactsByUniqueId;
+	ContactIndex mContactsByCallId;
+	uint64_t mNextContactOrder = 0;
+	AorKey mKey;
 	SipUri mAor;
 	bool mIsDomain = false; /*is a domain registration*/
 	bool mOnlyStaticContacts = true;
@@ -224,11 +255,11 @@ class Record {
 	void insertOrUpdateBinding(const std::shared_ptr<ExtendedContact> &ec, const std::shared_ptr<ContactUpdateListener> &listener);
 	const std::shared_ptr<ExtendedContact> extractContactByUniqueId(std::string uid);
 	sip_contact_t *getContacts(su_home_t *home, time_t now);
-	void pushContact(const std::shared_ptr<ExtendedContact> &ct) {mContacts.push_back(ct);}
-
-	std::list<std::shared_ptr<ExtendedContact>>::iterator removeContact(const std::shared_ptr<ExtendedContact> &ct) {
-		return mContacts.erase(find(mContacts.begin(), mContacts.end(), ct));
+	void pushContact(const std::shared_ptr<ExtendedContact> &ct) {
+		indexContact(mContacts.insert(mContacts.end(), ct));
 	}
+
+	Contacts::iterator removeContact(const std::shared_ptr<ExtendedContact> &ct);
 	bool isInvalidRegister(const std::string &call_id, uint32_t cseq);
 	void clean(time_t time, const std::shared_ptr<ContactUpdateListener> &listener);
 	void update(const sip_t *sip, int globalExpire, bool alias, int version, const std::shared_ptr<ContactUpdateListener> &listener);
@@ -240,7 +271,7 @@ class Record {
 
 	void print(std::ostream &stream) const;
 	bool isEmpty() const {return mContacts.empty();}
-	const std::string &getKey() const {return mKey;}
+	const AorKey &getKey() const {return mKey;}
 	int count() {return mContacts.size();}
 	const std::list<std::shared_ptr<ExtendedContact>> &getExtendedContacts() const {return mContacts;}
 	const std::list<std::shared_ptr<ExtendedContact>> &getContactsToRemove() const {return mContactsToRemove;}
@@ -267,7 +298,7 @@ class Record {
 	void appendContactsFrom(const std::shared_ptr<Record> &src);
 
 	// An empty AOR leads to an empty key.
-	static std::string defineKeyFromUrl(const url_t *aor);
+	static AorKey defineKeyFromUrl(const url_t *aor);
 	static SipUri makeUrlFromKey(const std::string &key);
 	static std::string extractUniqueId(const sip_contact_t *contact);
 
@@ -319,6 +350,38 @@ class ListContactUpdateListener {
 	std::vector<std::shared_ptr<Record>> records;
 };
 
+/*
+ * Collects the records fetched on behalf of RegistrarDb::fetchList(), and notifies the ListContactUpdateListener
+ * once every one of them has been answered.
+ */
+class ListFetchContactUpdateListener : public ContactUpdateListener {
+  public:
+	ListFetchContactUpdateListener(const std::shared_ptr<ListContactUpdateListener> &listener, size_t count)
+		: mListListener(listener), mCount(count) {}
+
+	void onRecordFound(const std::shared_ptr<Record> &r) override;
+	void onError() override;
+	void onInvalid() override;
+	void onContactUpdated(const std::shared_ptr<ExtendedContact> &ec) override {}
+
+  private:
+	void updateCount();
+
+	std::shared_ptr<ListContactUpdateListener> mListListener;
+	size_t mCount;
+};
+
+/*
+ * Receives the records walked through by RegistrarDb::dump(), one batch at a time.
+ */
+class DumpListener {
+  public:
+	virtual ~DumpListener() = default;
+	/* cursor is the one to give to the next call of RegistrarDb::dump(), "0" once every record has been given. */
+	virtual void onRecordsDumped(const std::vector<std::shared_ptr<Record>> &records, const std::string &cursor) = 0;
+	virtual void onError() = 0;
+};
+
 class ContactRegisteredListener {
   public:
 	virtual ~ContactRegisteredListener();
@@ -336,6 +399,7 @@ struct BindingParameters {
 	bool withGruu;
 	int globalExpire;
 	int version;
+	uint32_t cseq; // 0 to bind without any CSeq
 	std::string callId;
 	std::string path;
 
@@ -344,6 +408,7 @@ struct BindingParameters {
 		withGruu = false;
 		globalExpire = 0;
 		version = 0;
+		cseq = 0;
 		callId = "";
 		path = "";
 	}
@@ -366,6 +431,14 @@ class RegistrarDb {
 	void fetch(const SipUri &url, const std::shared_ptr<ContactUpdateListener> &listener, bool recursive = false);
 	void fetch(const SipUri &url, const std::shared_ptr<ContactUpdateListener> &listener, bool includingDomains, bool recursive);
 	void fetchList(const std::vector<SipUri > urls, const std::shared_ptr<ListContactUpdateListener> &listener);
+	/*
+	 * Walks through the records of the database incrementally, like Redis SCAN: the first call is made with cursor
+	 * "0" and each following one with the cursor given to the listener, until it is "0" again. About count records are
+	 * given by each call. Records added or removed during the walk may be missed.
+	 */
+	void dump(const std::string &cursor, size_t count, const std::shared_ptr<DumpListener> &listener) {
+		doDump(cursor, count, listener);
+	}
 	void notifyContactListener (const std::shared_ptr<Record> &r /*might be empty record*/, const std::string &uid);
 	void updateRemoteExpireTime(const std::string &key, time_t expireat);
 	unsigned long countLocalActiveRecords() {
@@ -395,15 +468,21 @@ class RegistrarDb {
 
   protected:
 	class LocalRegExpire {
-		std::map<std::string, time_t> mRegMap;
+		// Keys ordered by expiration time, so that a sweep only visits the expired ones.
+		using ExpiryIndex = std::multimap<time_t, AorKey>;
+		std::unordered_map<AorKey, ExpiryIndex::iterator> mRegMap;
+		ExpiryIndex mExpiryIndex;
 		std::mutex mMutex;
 		std::list<LocalRegExpireListener *> mLocalRegListenerList;
 		Agent *mAgent;
 
 	  public:
-		void remove(const std::string key) {
+		void remove(const AorKey &key) {
 			std::lock_guard<std::mutex> lock(mMutex);
-			mRegMap.erase(key);
+			auto it = mRegMap.find(key);
+			if (it == mRegMap.end()) return;
+			mExpiryIndex.erase(it->second);
+			mRegMap.erase(it);
 		}
 		void update(const std::shared_ptr<Record> &record);
 		size_t countActives();
@@ -412,6 +491,7 @@ class RegistrarDb {
 		void clearAll() {
 			std::lock_guard<std::mutex> lock(mMutex);
 			mRegMap.clear();
+			mExpiryIndex.clear();
 		}
 
 		void subscribe(LocalRegExpireListener *listener);
@@ -422,6 +502,10 @@ class RegistrarDb {
 	virtual void doClear(const sip_t *sip, const std::shared_ptr<ContactUpdateListener> &listener) = 0;
 	virtual void doFetch(const SipUri &url, const std::shared_ptr<ContactUpdateListener> &listener) = 0;
 	virtual void doFetchInstance(const SipUri &url, const std::string &uniqueId, const std::shared_ptr<ContactUpdateListener> &listener) = 0;
+	/* Fetches several AORs at once. The default implementation issues one doFetch() per AOR. */
+	virtual void doFetchList(const std::vector<SipUri> &urls, const std::shared_ptr<ListContactUpdateListener> &listener);
+	/* The default implementation reports an error: the backend can't be walked through. */
+	virtual void doDump(const std::string &cursor, size_t count, const std::shared_ptr<DumpListener> &listener);
 	virtual void doMigration() = 0;
 
 	int count_sip_contacts(const sip_contact_t *contact);
@@ -18,9 +18,12 @@
 
 #pragma once
 
+#include <array>
 #include <cstring>
 #include <stdexcept>
 #include <string>
+#include <type_traits>
+#include <typeinfo>
 #include <unordered_map>
 
 #include <sofia-sip/msg.h>
@@ -60,7 +63,32 @@ class OutgoingAgent {
 };
 
 class Transaction {
+	private:
+		template <typename StrT>
+		using EnableIfName = typename std::enable_if<std::is_constructible<std::string, StrT>::value>::type;
+
 	public:
+		static constexpr int sPropertySlotCount = 16;
+
+		/**
+		 * @brief Name of a transaction property bound to the type of its value.
+		 * A slot of the transaction property array is reserved for the name when the key is created,
+		 * so that accessing the property through the key requires neither a lookup nor an allocation.
+		 * Keys are meant to be created once, when the module using them is loaded.
+		 */
+		template <typename T> class PropertyKey {
+			public:
+				explicit PropertyKey(std::string name) : mName{std::move(name)}, mSlot{Transaction::getPropertySlot(mName, true)} {}
+
+				const std::string &getName() const noexcept {return mName;}
+
+			private:
+				friend class Transaction;
+
+				std::string mName;
+				int mSlot;
+		};
+
 		Transaction(Agent *agent) noexcept : mAgent{agent} {}
 		Transaction(const Transaction &) = delete;
 		Transaction(Transaction &&) = delete;
@@ -68,26 +96,65 @@ class Transaction {
 
 		Agent *getAgent() const noexcept {return mAgent;}
 
-		template <typename T, typename StrT> void setProperty(StrT &&name, const std::shared_ptr<T> &value) noexcept {
+		template <typename T> void setProperty(const PropertyKey<T> &key, const std::shared_ptr<T> &value) noexcept {
+			if (key.mSlot >= 0) setSlot(mPropertySlots[key.mSlot], value, typeid(T).name());
+			else setProperty<T>(key.mName, value);
+		}
+
+		template <typename T> void setProperty(const PropertyKey<T> &key, const std::weak_ptr<T> &value) noexcept {
+			if (key.mSlot >= 0) setWeakSlot(mPropertySlots[key.mSlot], value, typeid(T).name());
+			else setProperty<T>(key.mName, value);
+		}
+
+		template <typename T> std::shared_ptr<T> getProperty(const PropertyKey<T> &key) const {
+			auto prop = key.mSlot >= 0 ? getSlot(mPropertySlots[key.mSlot]) : _getProperty(key.mName);
+			return castProperty<T>(prop);
+		}
+
+		template <typename T> void removeProperty(const PropertyKey<T> &key) noexcept {
+			if (key.mSlot >= 0) clearSlot(mPropertySlots[key.mSlot]);
+			else removeProperty(key.mName);
+		}
+
+		/*
+		 * String keyed accessors. Names are mapped to the same slots than the keys of the same name; when all the
+		 * slots are taken, the properties are stored in maps.
+		 */
+		template <typename T, typename StrT, typename = EnableIfName<StrT>>
+		void setProperty(StrT &&name, const std::shared_ptr<T> &value) noexcept {
 			auto typeName = typeid(T).name();
+			auto slot = getPropertySlot(name, true);
+			if (slot >= 0) {
+				setSlot(mPropertySlots[slot], value, typeName);
+				return;
+			}
 			mWeakProperties.erase(name); // ensures the property value isn't in the two lists both.
 			mProperties[std::forward<StrT>(name)] = Property{value, typeName};
 		}
 
-		template <typename T, typename StrT> void setProperty(StrT &&name, const std::weak_ptr<T> &value) noexcept {
+		template <typename T, typename StrT, typename = EnableIfName<StrT>>
+		void setProperty(StrT &&name, const std::weak_ptr<T> &value) noexcept {
 			auto typeName = typeid(T).name();
+			auto slot = getPropertySlot(name, true);
+			if (slot >= 0) {
+				setWeakSlot(mPropertySlots[slot], value, typeName);
+				return;
+			}
 			mProperties.erase(name); // ensures the property value isn't in the two lists both.
 			mWeakProperties[std::forward<StrT>(name)] = WProperty{value, typeName};
 		}
 
 		template <typename T> std::shared_ptr<T> getProperty(const std::string &name) const {
-			auto prop = _getProperty(name);
-			if (prop.value == nullptr) return nullptr;
-			if (std::strcmp(prop.type, typeid(T).name()) != 0) {throw std::bad_cast{};}
-			return std::static_pointer_cast<T>(prop.value);
+			auto slot = getPropertySlot(name, false);
+			return castProperty<T>(slot >= 0 ? getSlot(mPropertySlots[slot]) : _getProperty(name));
 		}
 
 		void removeProperty(const std::string &name) noexcept {
+			auto slot = getPropertySlot(name, false);
+			if (slot >= 0) {
+				clearSlot(mPropertySlots[slot]);
+				return;
+			}
 			mProperties.erase(name);
 			mWeakProperties.erase(name);
 		}
@@ -109,15 +176,56 @@ class Transaction {
 			std::weak_ptr<void> value{};
 			const char *type{nullptr};
 		};
+		struct PropertySlot {
+			std::shared_ptr<void> value{};
+			std::weak_ptr<void> weakValue{};
+			const char *type{nullptr};
+		};
+
+		/**
+		 * @brief Get the slot reserved for a property name.
+		 * @param[in] create Whether a slot must be reserved if the name has none yet.
+		 * @return The slot index, or -1 if the name has no slot.
+		 */
+		static int getPropertySlot(const std::string &name, bool create) noexcept;
+
+		static void setSlot(PropertySlot &slot, std::shared_ptr<void> value, const char *type) noexcept {
+			slot.value = std::move(value);
+			slot.weakValue.reset();
+			slot.type = type;
+		}
+		static void setWeakSlot(PropertySlot &slot, std::weak_ptr<void> value, const char *type) noexcept {
+			slot.value.reset();
+			slot.weakValue = std::move(value);
+			slot.type = type;
+		}
+		static void clearSlot(PropertySlot &slot) noexcept {
+			slot.value.reset();
+			slot.weakValue.reset();
+			slot.type = nullptr;
+		}
+		static Property getSlot(const PropertySlot &slot) noexcept {
+			return slot.value ? Property{slot.value, slot.type} : Property{slot.weakValue.lock(), slot.type};
+		}
+
+		template <typename T> static std::shared_ptr<T> castProperty(const Property &prop) {
+			if (prop.value == nullptr) return nullptr;
+			// type_info names are unique strings on most platforms, compare the pointers first.
+			auto typeName = typeid(T).name();
+			if (prop.type != typeName && std::strcmp(prop.type, typeName) != 0) {throw std::bad_cast{};}
+			return std::static_pointer_cast<T>(prop.value);
+		}
 
 		Property _getProperty(const std::string &name) const noexcept;
 
 		void looseProperties() noexcept {
+			for (auto &slot : mPropertySlots) clearSlot(slot);
 			mProperties.clear();
 			mWeakProperties.clear();
 		}
 
 		Agent *mAgent{nullptr};
+		std::array<PropertySlot, sPropertySlotCount> mPropertySlots{};
 		std::unordered_map<std::string, Property> mProperties{};
 		std::unordered_map<std::string, WProperty> mWeakProperties{};
 };
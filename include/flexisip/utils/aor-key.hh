@@ -0,0 +1,80 @@
+/*
+	Flexisip, a flexible SIP proxy server with media capabilities.
+	Copyright (C) 2010-2020  Belledonne Communications SARL, All rights reserved.
+
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU Affero General Public License as
+	published by the Free Software Foundation, either version 3 of the
+	License, or (at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU Affero General Public License for more details.
+
+	You should have received a copy of the GNU Affero General Public License
+	along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include <functional>
+#include <memory>
+#include <ostream>
+#include <string>
+
+namespace flexisip {
+
+/**
+ * @brief Key of an address of record in the registrar.
+ * The key string and its hash are computed once and stored in an immutable block shared by all the copies of
+ * the key, so that the record, the registrar indexes and the fork map all refer to the same storage.
+ */
+class AorKey {
+public:
+	AorKey() = default;
+	explicit AorKey(std::string key) : mData{std::make_shared<const Data>(std::move(key))} {}
+
+	const std::string &str() const noexcept {return mData ? mData->value : emptyString();}
+	const char *c_str() const noexcept {return str().c_str();}
+	size_t size() const noexcept {return str().size();}
+	bool empty() const noexcept {return str().empty();}
+	size_t hash() const noexcept {return mData ? mData->hash : std::hash<std::string>()(emptyString());}
+
+	operator const std::string &() const noexcept {return str();}
+
+	friend bool operator==(const AorKey &lhs, const AorKey &rhs) noexcept {
+		return lhs.mData == rhs.mData || (lhs.hash() == rhs.hash() && lhs.str() == rhs.str());
+	}
+	friend bool operator!=(const AorKey &lhs, const AorKey &rhs) noexcept {return !(lhs == rhs);}
+	friend bool operator<(const AorKey &lhs, const AorKey &rhs) noexcept {return lhs.str() < rhs.str();}
+
+private:
+	struct Data {
+		explicit Data(std::string key) : value{std::move(key)}, hash{std::hash<std::string>()(value)} {}
+
+		const std::string value;
+		const size_t hash;
+	};
+
+	static const std::string &emptyString() noexcept {
+		static const std::string empty{};
+		return empty;
+	}
+
+	std::shared_ptr<const Data> mData{};
+};
+
+inline std::ostream &operator<<(std::ostream &os, const AorKey &key) {
+	return os << key.str();
+}
+
+} // namespace flexisip
+
+namespace std {
+
+template <> struct hash<flexisip::AorKey> {
+	size_t operator()(const flexisip::AorKey &key) const noexcept {return key.hash();}
+};
+
+} // namespace std
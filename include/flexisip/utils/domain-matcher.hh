@@ -0,0 +1,93 @@
+/*
+	Flexisip, a flexible SIP proxy server with media capabilities.
+	Copyright (C) 2010-2020  Belledonne Communications SARL, All rights reserved.
+
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU Affero General Public License as
+	published by the Free Software Foundation, either version 3 of the
+	License, or (at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU Affero General Public License for more details.
+
+	You should have received a copy of the GNU Affero General Public License
+	along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include <list>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include <netinet/in.h>
+
+namespace flexisip {
+
+/**
+ * @brief List of domains compiled once for matching, without any allocation per lookup.
+ * Matching follows ModuleToolbox::matchesOneOf(): a domain starting with '*' matches
+ * everything, a domain containing a '*' matches any item containing both the part before
+ * and the part after the wildcard, other domains must be equal to the item.
+ */
+class DomainMatcher {
+public:
+	DomainMatcher() = default;
+	explicit DomainMatcher(const std::list<std::string> &domains);
+
+	bool match(const char *item) const;
+	bool empty() const {return !mMatchAll && mDomains.empty() && mWildcards.empty();}
+
+private:
+	std::unordered_multimap<size_t, std::string> mDomains; // by hash of the domain
+	std::vector<std::pair<std::string, std::string>> mWildcards; // parts before and after the '*'
+	bool mMatchAll = false;
+};
+
+/**
+ * @brief Set of hosts, optionally bound to a port, compiled for matching without any
+ * allocation per lookup. Hosts are compared like ModuleToolbox::urlHostMatch() does:
+ * case-insensitively, and by their binary form for IPv6 addresses.
+ */
+class HostMatcher {
+public:
+	/**
+	 * @brief Add a host to the set.
+	 * @param[in] port Port the host must be matched with, nullptr to match it with any port.
+	 */
+	void add(const char *host, const char *port = nullptr);
+	void clear() {mHosts.clear();}
+
+	/**
+	 * @brief Check whether the given host and port are in the set. A trailing '.' of
+	 * the host and brackets around IPv6 addresses are ignored.
+	 */
+	bool match(const char *host, const char *port = nullptr) const;
+
+private:
+	struct Entry {
+		std::string host; // lowercase, empty for IPv6 addresses
+		in6_addr ipv6;
+		std::string port; // empty for any port
+	};
+
+	/* Normalized form of a host: its bounds without brackets and trailing dot, and its binary form if it's IPv6. */
+	struct Key {
+		const char *host;
+		size_t len;
+		bool isIpv6;
+		in6_addr ipv6;
+		size_t hash;
+	};
+
+	static bool makeKey(const char *host, Key &key);
+	static bool matches(const Entry &entry, const Key &key, const char *port);
+
+	std::unordered_multimap<size_t, Entry> mHosts; // by hash of the normalized host
+};
+
+} // namespace flexisip
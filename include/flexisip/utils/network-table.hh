@@ -0,0 +1,79 @@
+/*
+	Flexisip, a flexible SIP proxy server with media capabilities.
+	Copyright (C) 2010-2020  Belledonne Communications SARL, All rights reserved.
+
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU Affero General Public License as
+	published by the Free Software Foundation, either version 3 of the
+	License, or (at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU Affero General Public License for more details.
+
+	You should have received a copy of the GNU Affero General Public License
+	along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include <netinet/in.h>
+#include <sys/socket.h>
+
+namespace flexisip {
+
+/**
+ * @brief Table of the networks the local interfaces belong to, compiled into one binary
+ * trie per address family so that the network of an address is found by longest prefix match.
+ */
+class NetworkTable {
+public:
+	NetworkTable();
+
+	/**
+	 * @brief Add the network of an interface address.
+	 * @param[in] addr Address of the interface, which is returned by lookups matching its network.
+	 * @param[in] netmask Netmask of the interface.
+	 * @return false if the address family isn't supported.
+	 */
+	bool add(const struct sockaddr *addr, const struct sockaddr *netmask);
+	void clear();
+	bool empty() const {return mEntries.empty();}
+
+	/**
+	 * @brief Find the interface address of the most specific network containing an address.
+	 * @param[in] family AF_INET or AF_INET6.
+	 * @param[in] addr Binary address in network byte order (struct in_addr or struct in6_addr).
+	 * @return The interface address, or nullptr if no network contains the address.
+	 */
+	const std::string *lookup(int family, const void *addr) const;
+
+	/**
+	 * @brief Convert a numeric host, IPv6 addresses being possibly enclosed in brackets,
+	 * to its binary form.
+	 * @param[out] addr Buffer of at least sizeof(struct in6_addr) bytes.
+	 * @return false if the host isn't a numeric IPv4 or IPv6 address.
+	 */
+	static bool parseAddress(const char *host, int &family, void *addr);
+
+private:
+	struct Node {
+		int32_t children[2] = {-1, -1};
+		int32_t entry = -1; // index in mEntries of the network ending at this node
+	};
+
+	int32_t &root(int family) {return family == AF_INET ? mRootV4 : mRootV6;}
+	int32_t newNode();
+
+	std::vector<Node> mNodes;
+	std::vector<std::string> mEntries;
+	int32_t mRootV4;
+	int32_t mRootV6;
+};
+
+} // namespace flexisip
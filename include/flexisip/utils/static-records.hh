@@ -0,0 +1,79 @@
+/*
+	Flexisip, a flexible SIP proxy server with media capabilities.
+	Copyright (C) 2010-2020  Belledonne Communications SARL, All rights reserved.
+
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU Affero General Public License as
+	published by the Free Software Foundation, either version 3 of the
+	License, or (at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU Affero General Public License for more details.
+
+	You should have received a copy of the GNU Affero General Public License
+	along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include <cstdint>
+#include <deque>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace flexisip {
+
+/**
+ * @brief Content of the static records file, diffed against its previous load.
+ * Only the contacts of the lines that were added or removed are bound or unbound, the unchanged ones being refreshed
+ * by slices of 1/sRefreshRounds at each load.
+ */
+class StaticRecords {
+public:
+	struct Binding {
+		std::string from;
+		std::string contact;
+		int expire; // 0 to unbind the contact
+		uint32_t cseq;
+	};
+	struct LoadStats {
+		size_t added = 0;
+		size_t removed = 0;
+		size_t refreshed = 0;
+	};
+
+	// Unchanged lines are refreshed once every sRefreshRounds loads of the file.
+	static constexpr int sRefreshRounds = 4;
+
+	/**
+	 * @brief Load the content of the file, appending the bindings to send to the registrar database.
+	 * The contacts of the removed lines are unbound before the new ones are bound, so that a contact moved to another
+	 * line is bound again.
+	 * @param[in] expire Expire of the bindings of the added and refreshed lines.
+	 * @param[in] cseq CSeq of the bindings, which must be greater than the one of the previous load.
+	 * @param[in] fileName Only used in the warnings about invalid lines.
+	 */
+	LoadStats load(const char *data, size_t size, int expire, uint32_t cseq, std::deque<Binding> &bindings,
+		const std::string &fileName);
+
+	size_t size() const {return mRecords.size();}
+	void clear();
+
+private:
+	/* Contacts of a line of the static records file. Lines that couldn't be parsed have no contact. */
+	struct Record {
+		std::string from;
+		std::vector<std::string> contacts;
+	};
+
+	static void parse(const std::string &line, Record &record);
+	static void queueBindings(std::deque<Binding> &queue, const Record &record, int expire, uint32_t cseq);
+
+	std::unordered_map<uint64_t, Record> mRecords; // records of the last load, by line hash
+	unsigned mLoads = 0;
+};
+
+}
@@ -17,6 +17,8 @@
 */
 
 #include <algorithm>
+#include <cerrno>
+#include <cstring>
 #include <memory>
 #include <sstream>
 
@@ -24,6 +26,12 @@
 #include <netdb.h>
 #include <sys/socket.h>
 #include <sys/types.h>
+#include <unistd.h>
+
+#ifdef __linux__
+#include <linux/netlink.h>
+#include <linux/rtnetlink.h>
+#endif
 
 #include <sofia-sip/sip.h>
 #include <sofia-sip/su_tagarg.h>
@@ -40,6 +48,8 @@
 #include "etchosts.hh"
 #include "domain-registrations.hh"
 #include "plugin/plugin-loader.hh"
+#include "utils/allocation-counter.hh"
+#include "utils/object-pool.hh"
 
 #define IPADDR_SIZE 64
 
@@ -98,6 +108,12 @@ void Agent::onDeclare(GenericStruct *root) {
 	mCountReply488 = createCounter(global, key, help, "488");
 	mCountReplyResUnknown = createCounter(global, key, help, "unknown");
 
+	if (AllocationCounter::isEnabled()) {
+		mCountProcessedMessages = global->createStat("count-processed-messages", "Number of incoming messages processed.");
+		mCountMessageAllocations = global->createStat("count-message-allocations",
+			"Number of heap allocations made while processing the incoming messages.");
+	}
+
 	string uniqueId = global->get<ConfigString>("unique-id")->read();
 	if (!uniqueId.empty()) {
 		if (uniqueId.length() == 16) {
@@ -124,7 +140,9 @@ void Agent::startLogWriter() {
 				cr->get<ConfigString>("database-backend")->read(),
 				cr->get<ConfigString>("database-connection-string")->read(),
 				cr->get<ConfigInt>("database-max-queue-size")->read(),
-				cr->get<ConfigInt>("database-nb-threads-max")->read()
+				cr->get<ConfigInt>("database-nb-threads-max")->read(),
+				cr->get<ConfigInt>("database-batch-size")->read(),
+				chrono::milliseconds{cr->get<ConfigInt>("database-batch-max-delay")->read()}
 			);
 			if (!dbw->isReady()) {
 				LOGF("DataBaseEventLogWriter: unable to use database.");
@@ -136,7 +154,8 @@ void Agent::startLogWriter() {
 			#endif
 		} else {
 			const auto &logdir = cr->get<ConfigString>("filesystem-directory")->read();
-			unique_ptr<FilesystemEventLogWriter> lw(new FilesystemEventLogWriter(logdir));
+			auto maxOpenFiles = cr->get<ConfigInt>("filesystem-max-open-files")->read();
+			unique_ptr<FilesystemEventLogWriter> lw(new FilesystemEventLogWriter(logdir, maxOpenFiles));
 			if (lw->isReady()) mLogWriter = move(lw);
 		}
 	}
@@ -397,6 +416,7 @@ void Agent::start(const string &transport_override, const string &passphrase) {
 	tport_t *primaries = tport_primaries(nta_agent_tports(mAgent));
 	if (primaries == NULL)
 		LOGF("No sip transport defined.");
+	compileTports();
 
 	startMdns();
 
@@ -604,7 +624,7 @@ Agent::Agent(su_root_t *root) {
 	mHttpEngine = nth_engine_create(root, NTHTAG_ERROR_MSG(0), TAG_END());
 	GenericStruct *cr = GenericManager::get()->getRoot();
 
-	EtcHostsResolver::get();
+	EtcHostsResolver::get()->startWatching(root);
 
 	// 1. Create module instances.
 	for (ModuleInfoBase *moduleInfo : sortModuleInfoByPriority(ModuleInfoManager::get()->getRegisteredModuleInfo())) {
@@ -627,21 +647,7 @@ Agent::Agent(su_root_t *root) {
 
 	onDeclare(cr);
 
-	struct ifaddrs *net_addrs;
-	int err = getifaddrs(&net_addrs);
-	if (err == 0) {
-		struct ifaddrs *ifa = net_addrs;
-		while (ifa != NULL) {
-			if (ifa->ifa_netmask != NULL && ifa->ifa_addr != NULL) {
-				LOGD("New network: %s", Network::print(ifa).c_str());
-				mNetworks.push_front(Network(ifa));
-			}
-			ifa = ifa->ifa_next;
-		}
-		freeifaddrs(net_addrs);
-	} else {
-		LOGE("Can't find interface addresses: %s", strerror(err));
-	}
+	discoverInterfaces();
 	mRoot = root;
 	mAgent = nta_agent_create(root, (url_string_t *)-1, &Agent::messageCallback, (nta_agent_magic_t *)this, TAG_END());
 	su_home_init(&mHome);
@@ -649,6 +655,7 @@ Agent::Agent(su_root_t *root) {
 	mPreferredRouteV6 = NULL;
 	mDrm = new DomainRegistrationManager(this);
 	mProxyToProxyKeepAliveInterval = 0;
+	startInterfacesMonitor();
 }
 
 Agent::~Agent() {
@@ -659,6 +666,8 @@ Agent::~Agent() {
 #endif
 
 	mTerminating = true;
+	stopInterfacesMonitor();
+	EtcHostsResolver::get()->stopWatching();
 	for (Module *module : mModules)
 		delete module;
 
@@ -691,6 +700,7 @@ bool Agent::doOnConfigStateChanged(const ConfigValue &conf, ConfigState state) {
 
 	if (conf.getName() == "aliases" && state == ConfigState::Commited) {
 		mAliases = ((ConfigStringList *)(&conf))->read();
+		compileAliases();
 		LOGD("Global aliases updated");
 		return true;
 	}
@@ -705,6 +715,7 @@ void Agent::loadConfig(GenericManager *cm) {
 	}
 	cm->getRoot()->get<GenericStruct>("global")->setConfigListener(this);
 	mAliases = cm->getGlobal()->get<ConfigStringList>("aliases")->read();
+	compileAliases();
 	LOGD("List of host aliases:");
 	for (list<string>::iterator it = mAliases.begin(); it != mAliases.end(); ++it) {
 		LOGD("%s", (*it).c_str());
@@ -751,107 +762,27 @@ string Agent::computeResolvedPublicIp(const string &host, int family) const {
 }
 
 pair<string, string> Agent::getPreferredIp(const string &destination) const {
-	int err;
-	struct addrinfo hints;
-	string dest = (destination[0] == '[') ? destination.substr(1, destination.size() - 2) : destination;
-	memset(&hints, 0, sizeof(hints));
-	hints.ai_family = AF_UNSPEC;
-	hints.ai_flags = AI_NUMERICHOST;
-
-	struct addrinfo *result;
-	err = getaddrinfo(dest.c_str(), NULL, &hints, &result);
-	if (err == 0) {
-		for (auto it = mNetworks.begin(); it != mNetworks.end(); ++it) {
-			if (it->isInNetwork(result->ai_addr)) {
-				freeaddrinfo(result);
-				return make_pair(it->getIP(), it->getIP());
-			}
-		}
-		freeaddrinfo(result);
-	} else {
-		LOGE("getPreferredIp() getaddrinfo() error while resolving '%s': %s", dest.c_str(), gai_strerror(err));
-	}
-	return strchr(dest.c_str(), ':') == NULL ? make_pair(getResolvedPublicIp(), getRtpBindIp())
-											 : make_pair(getResolvedPublicIp(true), getRtpBindIp(true));
-}
-
-Agent::Network::Network(const Network &net) : mIP(net.mIP) {
-	memcpy(&mPrefix, &net.mPrefix, sizeof(mPrefix));
-	memcpy(&mMask, &net.mMask, sizeof(mMask));
-}
-
-Agent::Network::Network(const struct ifaddrs *ifaddr) {
-	int err = 0;
-	char ipAddress[IPADDR_SIZE];
-	memset(&mPrefix, 0, sizeof(mPrefix));
-	memset(&mMask, 0, sizeof(mMask));
-	if (ifaddr->ifa_addr->sa_family == AF_INET) {
-		typedef struct sockaddr_in sockt;
-		sockt *if_addr = (sockt *)ifaddr->ifa_addr;
-		sockt *if_mask = (sockt *)ifaddr->ifa_netmask;
-		sockt *prefix = (sockt *)&mPrefix;
-		sockt *mask = (sockt *)&mMask;
-
-		mPrefix.ss_family = AF_INET;
-		prefix->sin_addr.s_addr = if_addr->sin_addr.s_addr & if_mask->sin_addr.s_addr;
-		mask->sin_addr.s_addr = if_mask->sin_addr.s_addr; // 1 chunk of 32 bits
-		err = getnameinfo(ifaddr->ifa_addr, sizeof(sockt), ipAddress, IPADDR_SIZE, NULL, 0, NI_NUMERICHOST);
-	} else if (ifaddr->ifa_addr->sa_family == AF_INET6) {
-		typedef struct sockaddr_in6 sockt;
-		sockt *if_addr = (sockt *)ifaddr->ifa_addr;
-		sockt *if_mask = (sockt *)ifaddr->ifa_netmask;
-		sockt *prefix = (sockt *)&mPrefix;
-		sockt *mask = (sockt *)&mMask;
-
-		mPrefix.ss_family = AF_INET6;
-		for (int i = 0; i < 8; ++i) { // 8 chunks of 8 bits
-			prefix->sin6_addr.s6_addr[i] = if_addr->sin6_addr.s6_addr[i] & if_mask->sin6_addr.s6_addr[i];
-			mask->sin6_addr.s6_addr[i] = if_mask->sin6_addr.s6_addr[i];
-		}
-		err = getnameinfo(ifaddr->ifa_addr, sizeof(sockt), ipAddress, IPADDR_SIZE, NULL, 0, NI_NUMERICHOST);
-	}
-	if (err == 0) {
-		mIP = string(ipAddress);
-	} else {
-		LOGE("getnameinfo error: %s", strerror(errno));
-	}
-}
-
-const string Agent::Network::getIP() const {
-	return mIP;
-}
-
-bool Agent::Network::isInNetwork(const struct sockaddr *addr) const {
-	if (addr->sa_family != mPrefix.ss_family) {
-		return false;
+	auto cached = mPreferredIpCache.find(destination);
+	if (cached != mPreferredIpCache.end()) return cached->second;
+
+	int family;
+	uint8_t addr[sizeof(struct in6_addr)];
+	if (!NetworkTable::parseAddress(destination.c_str(), family, addr)) {
+		LOGE("getPreferredIp() '%s' is not a numeric address", destination.c_str());
+		return strchr(destination.c_str(), ':') == NULL ? make_pair(getResolvedPublicIp(), getRtpBindIp())
+														: make_pair(getResolvedPublicIp(true), getRtpBindIp(true));
 	}
 
-	if (addr->sa_family == AF_INET) {
-		typedef struct sockaddr_in sockt;
-		sockt *prefix = (sockt *)&mPrefix;
-		sockt *mask = (sockt *)&mMask;
-		sockt *if_addr = (sockt *)addr;
-
-		uint32_t test = if_addr->sin_addr.s_addr & mask->sin_addr.s_addr;
-		return test == prefix->sin_addr.s_addr;
-	} else if (addr->sa_family == AF_INET6) {
-		typedef struct sockaddr_in6 sockt;
-		sockt *prefix = (sockt *)&mPrefix;
-		sockt *mask = (sockt *)&mMask;
-		sockt *if_addr = (sockt *)addr;
-
-		for (int i = 0; i < 8; ++i) {
-			uint8_t test = if_addr->sin6_addr.s6_addr[i] & mask->sin6_addr.s6_addr[i];
-			if (test != prefix->sin6_addr.s6_addr[i])
-				return false;
-		}
-		return true;
-	} else {
-		LOGF("Network::isInNetwork: cannot happen");
-	}
+	const string *localIp = mNetworks.lookup(family, addr);
+	auto result = localIp ? make_pair(*localIp, *localIp)
+						  : (family == AF_INET ? make_pair(getResolvedPublicIp(), getRtpBindIp())
+											   : make_pair(getResolvedPublicIp(true), getRtpBindIp(true)));
+	if (mPreferredIpCache.size() >= sPreferredIpCacheSize) mPreferredIpCache.clear();
+	mPreferredIpCache.emplace(destination, result);
+	return result;
 }
 
-string Agent::Network::print(const struct ifaddrs *ifaddr) {
+static string printInterface(const struct ifaddrs *ifaddr) {
 	stringstream ss;
 	int err;
 	unsigned int size =
@@ -875,6 +806,95 @@ string Agent::Network::print(const struct ifaddrs *ifaddr) {
 	return ss.str();
 }
 
+void Agent::discoverInterfaces() {
+	struct ifaddrs *net_addrs;
+	int err = getifaddrs(&net_addrs);
+	if (err != 0) {
+		LOGE("Can't find interface addresses: %s", strerror(errno));
+		return;
+	}
+	mNetworks.clear();
+	mPreferredIpCache.clear();
+	for (struct ifaddrs *ifa = net_addrs; ifa != NULL; ifa = ifa->ifa_next) {
+		if (ifa->ifa_netmask != NULL && ifa->ifa_addr != NULL && mNetworks.add(ifa->ifa_addr, ifa->ifa_netmask)) {
+			LOGD("New network: %s", printInterface(ifa).c_str());
+		}
+	}
+	freeifaddrs(net_addrs);
+}
+
+#ifdef __linux__
+
+void Agent::startInterfacesMonitor() {
+	int fd = socket(AF_NETLINK, SOCK_RAW | SOCK_NONBLOCK | SOCK_CLOEXEC, NETLINK_ROUTE);
+	if (fd < 0) {
+		LOGE("Cannot create netlink socket, interface changes won't be followed: %s", strerror(errno));
+		return;
+	}
+	struct sockaddr_nl nl;
+	memset(&nl, 0, sizeof(nl));
+	nl.nl_family = AF_NETLINK;
+	nl.nl_groups = RTMGRP_IPV4_IFADDR | RTMGRP_IPV6_IFADDR;
+	if (bind(fd, (struct sockaddr *)&nl, sizeof(nl)) != 0 || su_wait_create(mInterfacesMonitorWait, fd, SU_WAIT_IN) != 0) {
+		LOGE("Cannot listen to netlink address events, interface changes won't be followed: %s", strerror(errno));
+		close(fd);
+		return;
+	}
+	mInterfacesMonitorSocket = fd;
+	mInterfacesMonitorIndex = su_root_register(mRoot, mInterfacesMonitorWait, &Agent::onInterfacesChanged,
+											   (su_wakeup_arg_t *)this, su_pri_normal);
+}
+
+void Agent::stopInterfacesMonitor() {
+	if (mInterfacesMonitorSocket < 0) return;
+	if (mInterfacesMonitorIndex >= 0) su_root_deregister(mRoot, mInterfacesMonitorIndex);
+	else su_wait_destroy(mInterfacesMonitorWait);
+	close(mInterfacesMonitorSocket);
+	mInterfacesMonitorSocket = -1;
+	mInterfacesMonitorIndex = -1;
+}
+
+int Agent::onInterfacesChanged(su_root_magic_t *magic, su_wait_t *wait, su_wakeup_arg_t *arg) {
+	Agent *agent = (Agent *)arg;
+	char buffer[8192];
+	bool changed = false;
+
+	// Drain all pending notifications, so that a burst of address changes triggers a single discovery.
+	ssize_t len;
+	while ((len = recv(agent->mInterfacesMonitorSocket, buffer, sizeof(buffer), 0)) != 0) {
+		if (len < 0) {
+			if (errno == EINTR) continue;
+			if (errno == EAGAIN || errno == EWOULDBLOCK) break;
+			// ENOBUFS means that notifications were dropped: some changes may have been missed.
+			LOGW("Error reading network interfaces notifications: %s", strerror(errno));
+			changed = true;
+			break;
+		}
+		for (auto *hdr = (struct nlmsghdr *)buffer; NLMSG_OK(hdr, (size_t)len); hdr = NLMSG_NEXT(hdr, len)) {
+			if (hdr->nlmsg_type == RTM_NEWADDR || hdr->nlmsg_type == RTM_DELADDR) changed = true;
+		}
+	}
+	if (changed) {
+		LOGI("Network interfaces changed, discovering them again");
+		agent->discoverInterfaces();
+	}
+	return 0;
+}
+
+#else
+
+void Agent::startInterfacesMonitor() {
+}
+
+void Agent::stopInterfacesMonitor() {
+}
+
+int Agent::onInterfacesChanged(su_root_magic_t *magic, su_wait_t *wait, su_wakeup_arg_t *arg) {
+	return 0;
+}
+
+#endif
+
 int Agent::countUsInVia(sip_via_t *via) const {
 	int count = 0;
 	for (sip_via_t *v = via; v != NULL; v = v->v_next) {
@@ -886,44 +906,36 @@ int Agent::countUsInVia(sip_via_t *via) const {
 }
 
 bool Agent::isUs(const char *host, const char *port, bool check_aliases) const {
-	char *tmp = NULL;
-	size_t end;
-	tport_t *tport = tport_primaries(nta_agent_tports(mAgent));
-
-	// skip possibly trailing '.' at the end of host
-	if (host[end = (strlen(host) - 1)] == '.') {
-		tmp = (char *)alloca(end + 1);
-		memcpy(tmp, host, end);
-		tmp[end] = '\0';
-		host = tmp;
-	}
-	const char *matched_port = port;
-
-	if (check_aliases) {
-		/*the checking of aliases ignores the port number, since a domain name in a Route header might resolve to
-		 * multiple ports
-			* thanks to SRV records*/
-		list<string>::const_iterator it;
-		for (it = mAliases.begin(); it != mAliases.end(); ++it) {
-			if (ModuleToolbox::urlHostMatch(host, (*it).c_str()))
-				return true;
-		}
+	/*the checking of aliases ignores the port number, since a domain name in a Route header might resolve to
+	 * multiple ports thanks to SRV records*/
+	if (check_aliases && mAliasesMatcher.match(host))
+		return true;
+
+	// Without port, a transport matches on the default port of its protocol only.
+	return port ? mTportsMatcher.match(host, port) : mDefaultPortTportsMatcher.match(host);
+}
+
+void Agent::compileAliases() {
+	mAliasesMatcher.clear();
+	for (const auto &alias : mAliases) {
+		mAliasesMatcher.add(alias.c_str());
 	}
+}
 
-	for (; tport != NULL; tport = tport_next(tport)) {
+void Agent::compileTports() {
+	mTportsMatcher.clear();
+	mDefaultPortTportsMatcher.clear();
+	for (tport_t *tport = tport_primaries(nta_agent_tports(mAgent)); tport != NULL; tport = tport_next(tport)) {
 		const tp_name_t *tn = tport_name(tport);
-		if (port == NULL) {
-			if (strcasecmp(tn->tpn_proto, "tls") == 0)
-				matched_port = "5061";
-			else
-				matched_port = "5060";
-		}
-		if (strcmp(matched_port, tn->tpn_port) == 0) {
-			if (ModuleToolbox::urlHostMatch(host, tn->tpn_canon) || ModuleToolbox::urlHostMatch(host, tn->tpn_host))
-				return true;
+		mTportsMatcher.add(tn->tpn_canon, tn->tpn_port);
+		mTportsMatcher.add(tn->tpn_host, tn->tpn_port);
+
+		const char *defaultPort = strcasecmp(tn->tpn_proto, "tls") == 0 ? "5061" : "5060";
+		if (strcmp(tn->tpn_port, defaultPort) == 0) {
+			mDefaultPortTportsMatcher.add(tn->tpn_canon);
+			mDefaultPortTportsMatcher.add(tn->tpn_host);
 		}
 	}
-	return false;
 }
 
 sip_via_t *Agent::getNextVia(sip_t *response) {
@@ -1138,17 +1150,22 @@ int Agent::onIncomingMessage(msg_t *msg, const sip_t *sip) {
 		LOGI("Skipping incoming message on expired agent");
 		return -1;
 	}
+	uint64_t allocations = mCountMessageAllocations ? AllocationCounter::get() : 0;
 	// Assuming sip is derived from msg
-	auto ms = make_shared<MsgSip>(msg);
+	auto ms = makePooledShared<MsgSip>(msg);
 	if (sip->sip_request) {
-		auto ev = make_shared<RequestSipEvent>(shared_from_this(), ms, getIncomingTport(msg, this));
+		auto ev = makePooledShared<RequestSipEvent>(shared_from_this(), ms, getIncomingTport(msg, this));
 		sendRequestEvent(ev);
 	} else {
-		auto ev = make_shared<ResponseSipEvent>(shared_from_this(), ms);
+		auto ev = makePooledShared<ResponseSipEvent>(shared_from_this(), ms);
 		sendResponseEvent(ev);
 	}
 	printEventTailSeparator();
 	msg_destroy(msg);
+	if (mCountMessageAllocations) {
+		mCountProcessedMessages->incr();
+		mCountMessageAllocations->set(mCountMessageAllocations->read() + AllocationCounter::get() - allocations);
+	}
 	return 0;
 }
 
@@ -1199,6 +1216,7 @@ void Agent::stopTimer(su_timer_t *t) {
 
 void Agent::send(const shared_ptr<MsgSip> &ms, url_string_t const *u, tag_type_t tag, tag_value_t value, ...) {
 	ta_list ta;
+	ms->commitSdp();
 	ta_start(ta, tag, value);
 	msg_t *msg = msg_ref_create(ms->getMsg());
 	nta_msg_tsend(mAgent, msg, u, ta_tags(ta), TAG_END());
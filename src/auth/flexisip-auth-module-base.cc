@@ -16,10 +16,14 @@
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+#include <bctoolbox/crypto.h>
+
 #include <sofia-sip/auth_plugin.h>
+#include <sofia-sip/base64.h>
 #include <sofia-sip/msg_header.h>
 
 #include "flexisip/auth/flexisip-auth-module-base.hh"
+#include "flexisip/common.hh"
 #include "flexisip/logmanager.hh"
 #include "flexisip/module.hh"
 
@@ -41,7 +45,7 @@ AuthModule(root,
 		   AUTHTAG_QOP(qopAuth ? "auth" : nullptr),
 		   TAG_END()
 ),
-	mQOPAuth(qopAuth) {
+	mQOPAuth(qopAuth), mNonceExpire(nonceExpire) {
 	mNonceStore.setNonceExpires(nonceExpire);
 }
 
@@ -101,6 +105,11 @@ void FlexisipAuthModuleBase::onChallenge(AuthStatus &as, auth_challenger_t const
 	msg_header_t *response = as.response();
 	as.response(nullptr);
 
+	if (response && statelessNonces()) {
+		string nonce = "nonce=\"" + makeStatelessNonce(flexisipAs) + "\"";
+		msg_header_replace_param(as.home(), response->sh_common, su_strdup(as.home(), nonce.c_str()));
+	}
+
 	msg_header_t *lastChallenge = nullptr;
 	for (const std::string &algo : flexisipAs.usedAlgo()) {
 		msg_header_t *challenge;
@@ -125,7 +134,7 @@ void FlexisipAuthModuleBase::onChallenge(AuthStatus &as, auth_challenger_t const
 		SLOGE << "No available algorithm while challenge making";
 		as.status(500);
 		as.phrase("Internal error");
-	} else {
+	} else if (!statelessNonces()) {
 		mNonceStore.insert(as.response()->sh_auth);
 	}
 }
@@ -134,6 +143,73 @@ void FlexisipAuthModuleBase::onCancel(AuthStatus &as) {
 	auth_cancel_default(mAm, as.getPtr());
 }
 
+bool FlexisipAuthModuleBase::validateNonce(FlexisipAuthStatus &as, auth_response_t &ar) {
+	if (!statelessNonces()) {
+		return auth_validate_digest_nonce(mAm, as.getPtr(), &ar, msg_now()) >= 0;
+	}
+	return validateStatelessNonce(as, ar.ar_nonce);
+}
+
+/* The HMAC binds the nonce to the realm and the user it has been issued for. */
+string FlexisipAuthModuleBase::computeNonceHmac(const FlexisipAuthStatus &as, uint64_t issued) const {
+	string data = as.realm() ? as.realm() : "";
+	data += '\n';
+	if (as.userUri()) {
+		data += as.userUri()->url_user ? as.userUri()->url_user : "";
+		data += '@';
+		data += as.userUri()->url_host ? as.userUri()->url_host : "";
+	}
+	data += '\n';
+	for (int shift = 56; shift >= 0; shift -= 8) data += char(issued >> shift);
+
+	uint8_t hmac[16];
+	bctbx_hmacSha256(reinterpret_cast<const uint8_t *>(mNonceSecret.data()), mNonceSecret.size(),
+		reinterpret_cast<const uint8_t *>(data.data()), data.size(), sizeof(hmac), hmac);
+	return string(reinterpret_cast<const char *>(hmac), sizeof(hmac));
+}
+
+/* Nonce format: base64(issue time as 64 bits big endian || truncated HMAC-SHA256) */
+string FlexisipAuthModuleBase::makeStatelessNonce(const FlexisipAuthStatus &as) const {
+	uint64_t issued = getCurrentTime();
+	string raw;
+	for (int shift = 56; shift >= 0; shift -= 8) raw += char(issued >> shift);
+	raw += computeNonceHmac(as, issued);
+
+	char nonce[BASE64_SIZE(32) + 1];
+	base64_e(nonce, sizeof(nonce), const_cast<char *>(raw.data()), raw.size());
+	return nonce;
+}
+
+bool FlexisipAuthModuleBase::validateStatelessNonce(FlexisipAuthStatus &as, const char *nonce) const {
+	char raw[32];
+	if (nonce == nullptr || base64_d(raw, sizeof(raw), nonce) != 24) {
+		LOGD("Invalid stateless nonce %s", nonce ? nonce : "(null)");
+		return false;
+	}
+
+	uint64_t issued = 0;
+	for (int i = 0; i < 8; ++i) issued = (issued << 8) | uint8_t(raw[i]);
+	string expected = computeNonceHmac(as, issued);
+	// Constant time comparison
+	uint8_t diff = 0;
+	for (size_t i = 0; i < expected.size(); ++i) diff |= uint8_t(raw[8 + i] ^ expected[i]);
+	if (diff != 0) {
+		LOGD("Stateless nonce %s has an invalid HMAC", nonce);
+		return false;
+	}
+
+	uint64_t now = getCurrentTime();
+	if (issued > now + 60 /* clock skew between instances */) {
+		LOGD("Stateless nonce %s issued in the future", nonce);
+		return false;
+	}
+	if (now > issued + mNonceExpire) {
+		LOGD("Stateless nonce %s is stale", nonce);
+		as.stale(true);
+	}
+	return true;
+}
+
 void FlexisipAuthModuleBase::finish(FlexisipAuthStatus &as) {
 	as.getPtr()->as_callback(as.magic(), as.getPtr());
 }
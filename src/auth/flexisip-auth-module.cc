@@ -153,8 +153,7 @@ void FlexisipAuthModule::checkAuthHeader(FlexisipAuthStatus &as, msg_auth_t *au,
 			return;
 		}
 
-		msg_time_t now = msg_now();
-		if (as.nonceIssued() == 0 /* Already validated nonce */ && auth_validate_digest_nonce(mAm, as.getPtr(), ar, now) < 0) {
+		if (as.nonceIssued() == 0 /* Already validated nonce */ && !validateNonce(as, *ar)) {
 			as.blacklist(mAm->am_blacklist);
 			challenge(as, ach);;
 			finish(as);
@@ -168,16 +167,24 @@ void FlexisipAuthModule::checkAuthHeader(FlexisipAuthStatus &as, msg_auth_t *au,
 		}
 
 		if (mQOPAuth) {
-			int pnc = mNonceStore.getNc(ar->ar_nonce);
 			int nnc = (int)strtoul(ar->ar_nc, NULL, 16);
-			if (pnc == -1 || pnc >= nnc) {
-				LOGE("Bad nonce count %d -> %d for %s", pnc, nnc, ar->ar_nonce);
+			int storedNc = mNonceStore.getNc(ar->ar_nonce);
+			if (statelessNonces() && storedNc == -1) {
+				// Stateless nonces are only recorded once a response using them has been verified, so an unknown one
+				// must be at its first use. Otherwise its entry is gone and replays can't be told apart anymore.
+				if (nnc != 1) {
+					LOGD("Unknown stateless nonce %s with nc=%d, considered stale", ar->ar_nonce, nnc);
+					as.stale(true);
+					challenge(as, ach);
+					finish(as);
+					return;
+				}
+			} else if (statelessNonces() ? nnc <= storedNc : !mNonceStore.updateNc(ar->ar_nonce, nnc)) {
+				LOGE("Bad nonce count %d -> %d for %s", storedNc, nnc, ar->ar_nonce);
 				as.blacklist(mAm->am_blacklist);
 				challenge(as, ach);
 				finish(as);
 				return;
-			} else {
-				mNonceStore.updateNc(ar->ar_nonce, nnc);
 			}
 		}
 
@@ -243,6 +250,18 @@ void FlexisipAuthModule::checkPassword(FlexisipAuthStatus &as, const auth_challe
 		return;
 	}
 
+	// The nonce count of stateless nonces is only recorded for verified responses, so that bogus ones can neither
+	// fill the nonce store nor consume the counts of the legitimate client.
+	if (mQOPAuth && statelessNonces()) {
+		int nnc = (int)strtoul(ar.ar_nc, NULL, 16);
+		if (mNonceStore.getNc(ar.ar_nonce) == -1) mNonceStore.insert(ar.ar_nonce);
+		if (!mNonceStore.updateNc(ar.ar_nonce, nnc)) {
+			LOGE("Bad nonce count %d -> %d for %s", mNonceStore.getNc(ar.ar_nonce), nnc, ar.ar_nonce);
+			onAccessForbidden(as, ach);
+			return;
+		}
+	}
+
 	// assert(apw);
 	as.user(ar.ar_username);
 	as.anonymous(false);
@@ -270,18 +289,20 @@ int FlexisipAuthModule::checkPasswordForAlgorithm(FlexisipAuthStatus &as, const
 		return -1;
 	}
 
-	string a1;
-	if (!passwd.empty()) {
-		a1 = passwd;
-	} else {
+	// Stored passwords are the hexadecimal form of HA1, which is checked in binary form from now on.
+	DigestValue a1;
+	bool validPasswd = !passwd.empty() && a1.fromHex(passwd.data(), passwd.size()) && a1.size() == algo->size();
+	if (!validPasswd) {
 		a1 = auth_digest_a1_for_algorithm(*algo, ar, "xyzzy");
 	}
 
 	if (ar.ar_md5sess)
 		a1 = auth_digest_a1sess_for_algorithm(*algo, ar, a1);
 
-	string response = auth_digest_response_for_algorithm(*algo, ar, as.method(), as.body(), as.bodyLen(), a1);
-	return (!passwd.empty() && response == ar.ar_response ? 0 : -1);
+	DigestValue response = auth_digest_response_for_algorithm(*algo, ar, as.method(), as.body(), as.bodyLen(), a1);
+	DigestValue expected;
+	bool validResponse = ar.ar_response && expected.fromHex(ar.ar_response, strlen(ar.ar_response));
+	return (validPasswd && validResponse && response == expected ? 0 : -1);
 }
 
 void FlexisipAuthModule::onAccessForbidden(FlexisipAuthStatus &as, const auth_challenger_t &ach, const char *phrase) {
@@ -295,51 +316,96 @@ void FlexisipAuthModule::onAccessForbidden(FlexisipAuthStatus &as, const auth_ch
 	as.blacklist(getPtr()->am_blacklist);
 }
 
-std::string FlexisipAuthModule::auth_digest_a1_for_algorithm(Digest &algo, const auth_response_t &ar, const std::string &secret) {
-	ostringstream data;
-	data << ar.ar_username << ':' << ar.ar_realm << ':' << secret;
-	string ha1 = algo.compute<string>(data.str());
-	SLOGD << "auth_digest_ha1() has A1 = " << algo.name() << "(" << ar.ar_username << ':' << ar.ar_realm << ":*******) = " << ha1 << endl;
+namespace {
+
+/*
+ * Builds the inputs of digests in a per-thread buffer that is reused, so that checking a response doesn't allocate.
+ * Only one instance may be in use at a time.
+ */
+class DigestInput {
+public:
+	DigestInput() : mBuffer(buffer()) {mBuffer.clear();}
+
+	DigestInput &operator<<(const char *str) {
+		if (str) mBuffer.append(str);
+		return *this;
+	}
+	DigestInput &operator<<(char c) {
+		mBuffer.push_back(c);
+		return *this;
+	}
+	DigestInput &operator<<(const DigestValue &value) {
+		char hex[2 * DigestValue::sMaxSize + 1];
+		value.toHex(hex);
+		mBuffer.append(hex);
+		return *this;
+	}
+
+	void clear() {mBuffer.clear();}
+	DigestValue hash(Digest &algo) const {
+		DigestValue value;
+		algo.compute(mBuffer.data(), mBuffer.size(), value);
+		return value;
+	}
+	const std::string &str() const {return mBuffer;}
+
+private:
+	static std::string &buffer() {
+		thread_local std::string sBuffer;
+		return sBuffer;
+	}
+
+	std::string &mBuffer;
+};
+
+} // namespace
+
+DigestValue FlexisipAuthModule::auth_digest_a1_for_algorithm(Digest &algo, const auth_response_t &ar, const std::string &secret) {
+	DigestInput data;
+	data << ar.ar_username << ':' << ar.ar_realm << ':' << secret.c_str();
+	DigestValue ha1 = data.hash(algo);
+	SLOGD << "auth_digest_ha1() has A1 = " << algo.name() << "(" << ar.ar_username << ':' << ar.ar_realm << ":*******) = " << ha1.toHex() << endl;
 	return ha1;
 }
 
-std::string FlexisipAuthModule::auth_digest_a1sess_for_algorithm(Digest &algo, const ::auth_response_t &ar, const std::string &ha1) {
-	ostringstream data;
+DigestValue FlexisipAuthModule::auth_digest_a1sess_for_algorithm(Digest &algo, const ::auth_response_t &ar, const DigestValue &ha1) {
+	DigestInput data;
 	data << ha1 << ':' << ar.ar_nonce << ':' << ar.ar_cnonce;
-	string newHa1 = algo.compute<string>(data.str());
-	SLOGD << "auth_sessionkey has A1' = " << algo.name() << "(" << data.str() << ") = " << newHa1 << endl;
+	DigestValue newHa1 = data.hash(algo);
+	SLOGD << "auth_sessionkey has A1' = " << algo.name() << "(" << data.str() << ") = " << newHa1.toHex() << endl;
 	return newHa1;
 }
 
-std::string FlexisipAuthModule::auth_digest_response_for_algorithm(
+DigestValue FlexisipAuthModule::auth_digest_response_for_algorithm(
 	Digest &algo,
 	const ::auth_response_t &ar,
 	const std::string &method_name,
 	const void *body, size_t bodyLen,
-	const std::string &ha1
+	const DigestValue &ha1
 ) {
 	/* Calculate Hentity */
-	string Hentity = ar.ar_auth_int ? algo.compute<string>(body, bodyLen) : "";
+	DigestValue Hentity;
+	if (ar.ar_auth_int) algo.compute(body, bodyLen, Hentity);
 
 	/* Calculate A2 */
-	ostringstream input;
+	DigestInput input;
+	input << method_name.c_str() << ':' << ar.ar_uri;
 	if (ar.ar_auth_int) {
-		input << method_name << ':' << ar.ar_uri << ':' << Hentity;
-	} else
-		input << method_name << ':' << ar.ar_uri;
-	string ha2 = algo.compute<string>(input.str());
+		input << ':' << Hentity;
+	}
+	DigestValue ha2 = input.hash(algo);
 	SLOGD << "A2 = " << algo.name() << "(" << input.str() << ")" << endl;
 
 	/* Calculate response */
-	ostringstream input2;
-	input2 << ha1 << ':' << ar.ar_nonce;
+	input.clear();
+	input << ha1 << ':' << ar.ar_nonce;
 	if (ar.ar_auth || ar.ar_auth_int) {
-		input2 << ':' << ar.ar_nc << ':' << ar.ar_cnonce << ':' << ar.ar_qop;
+		input << ':' << ar.ar_nc << ':' << ar.ar_cnonce << ':' << ar.ar_qop;
 	}
-	input2 << ':' << ha2;
-	string response = algo.compute<string>(input2.str());
+	input << ':' << ha2;
+	DigestValue response = input.hash(algo);
 	const char *qop = ar.ar_qop ? ar.ar_qop : "NONE";
-	SLOGD << "auth_response: " << response << " = " << algo.name() << "(" << input2.str() << ") (qop=" << qop << ")" << endl;
+	SLOGD << "auth_response: " << response.toHex() << " = " << algo.name() << "(" << input.str() << ") (qop=" << qop << ")" << endl;
 
 	return response;
 }
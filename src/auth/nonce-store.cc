@@ -16,10 +16,13 @@
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+#include <algorithm>
+
 #include <sofia-sip/msg_header.h>
 
 #include "flexisip/auth/nonce-store.hh"
 #include "flexisip/common.hh"
+#include "flexisip/configmanager.hh"
 #include "flexisip/logmanager.hh"
 
 using namespace std;
@@ -29,12 +32,53 @@ using namespace flexisip;
 //  NonceStore class
 // ====================================================================================================================
 
+constexpr size_t NonceStore::sDefaultCapacity;
+
+NonceStore::NonceStore(size_t capacity) {
+	setCapacity(capacity);
+}
+
+void NonceStore::setCapacity(size_t capacity) {
+	size_t size = sMaxProbes;
+	while (size < capacity) size <<= 1;
+	mSlots.reset(new Slot[size]);
+	mMask = size - 1;
+}
+
+void NonceStore::setNonceExpires(int value) {
+	mGenerationSeconds = max(1, value / int(sGenerationsPerLifetime));
+}
+
+uint64_t NonceStore::hashNonce(const string &nonce) {
+	// FNV-1a. Zero is reserved to empty slots.
+	uint64_t hash = 14695981039346656037ULL;
+	for (unsigned char c : nonce) {
+		hash ^= c;
+		hash *= 1099511628211ULL;
+	}
+	return hash ? hash : 1;
+}
+
+uint32_t NonceStore::currentGeneration() const {
+	return uint32_t(getCurrentTime() / mGenerationSeconds) + 1;
+}
+
+NonceStore::Slot *NonceStore::find(uint64_t key, uint32_t generation, uint64_t &state) {
+	for (unsigned i = 0; i < sMaxProbes; ++i) {
+		Slot &slot = mSlots[(key + i) & mMask];
+		if (slot.key.load() != key) continue;
+		state = slot.state.load();
+		// The slot may have been reclaimed between both loads.
+		if (slot.key.load() != key || !isAlive(state, generation)) continue;
+		return &slot;
+	}
+	return nullptr;
+}
+
 int NonceStore::getNc(const string &nonce) {
-	unique_lock<mutex> lck(mMutex);
-	auto it = mNc.find(nonce);
-	if (it != mNc.end())
-		return (*it).second.nc;
-	return -1;
+	uint64_t state;
+	if (find(hashNonce(nonce), currentGeneration(), state) == nullptr) return -1;
+	return int(ncOf(state));
 }
 
 void NonceStore::insert(const msg_auth_t *response) {
@@ -46,53 +90,62 @@ void NonceStore::insert(const msg_auth_t *response) {
 }
 
 void NonceStore::insert(const string &nonce) {
-	unique_lock<mutex> lck(mMutex);
-	time_t expiration = getCurrentTime() + mNonceExpires;
-	auto it = mNc.find(nonce);
-	if (it != mNc.end()) {
-		LOGE("Replacing nonce count for %s", nonce.c_str());
-		it->second.nc = 0;
-		it->second.expires = expiration;
-	} else {
-		mNc.insert(make_pair(nonce, NonceCount(0, expiration)));
+	uint64_t key = hashNonce(nonce);
+	uint32_t generation = currentGeneration();
+
+	for (int attempt = 0; attempt < 4; ++attempt) {
+		// Take the first free or expired slot of the probe window, or else evict the oldest entry.
+		Slot *victim = nullptr;
+		uint64_t victimState = 0;
+		for (unsigned i = 0; i < sMaxProbes; ++i) {
+			Slot &slot = mSlots[(key + i) & mMask];
+			uint64_t state = slot.state.load();
+			if (generationOf(state) == sClaimedGeneration) continue;
+			if (!isAlive(state, generation) || slot.key.load() == key) {
+				if (slot.key.load() == key) LOGE("Replacing nonce count for %s", nonce.c_str());
+				victim = &slot;
+				victimState = state;
+				break;
+			}
+			if (victim == nullptr || generationOf(state) < generationOf(victimState)) {
+				victim = &slot;
+				victimState = state;
+			}
+		}
+		if (victim == nullptr) continue;
+		if (isAlive(victimState, generation) && victim->key.load() != key) {
+			LOGW("Nonce store full, evicting an older nonce to store %s", nonce.c_str());
+			if (mCountEvictions) ++(*mCountEvictions);
+		}
+
+		if (!victim->state.compare_exchange_strong(victimState, makeState(sClaimedGeneration, 0))) continue;
+		victim->key.store(key);
+		victim->state.store(makeState(generation, 0));
+		return;
 	}
+	LOGE("Couldn't store nonce %s: too much contention", nonce.c_str());
 }
 
-void NonceStore::updateNc(const string &nonce, int newnc) {
-	unique_lock<mutex> lck(mMutex);
-	auto it = mNc.find(nonce);
-	if (it != mNc.end()) {
-		LOGD("Updating nonce %s with nc=%d", nonce.c_str(), newnc);
-		(*it).second.nc = newnc;
-	} else {
+bool NonceStore::updateNc(const string &nonce, int newnc) {
+	uint32_t generation = currentGeneration();
+	uint64_t state;
+	Slot *slot = find(hashNonce(nonce), generation, state);
+	if (slot == nullptr) {
 		LOGE("Couldn't update nonce %s: not found", nonce.c_str());
+		return false;
 	}
+	do {
+		if (!isAlive(state, generation) || int(ncOf(state)) >= newnc) return false;
+	} while (!slot->state.compare_exchange_weak(state, makeState(generationOf(state), uint32_t(newnc))));
+	LOGD("Updated nonce %s with nc=%d", nonce.c_str(), newnc);
+	return true;
 }
 
 void NonceStore::erase(const string &nonce) {
-	unique_lock<mutex> lck(mMutex);
+	uint64_t state;
+	Slot *slot = find(hashNonce(nonce), currentGeneration(), state);
 	LOGD("Erasing nonce %s", nonce.c_str());
-	mNc.erase(nonce);
-}
-
-void NonceStore::cleanExpired() {
-	unique_lock<mutex> lck(mMutex);
-	int count = 0;
-	time_t now = getCurrentTime();
-	size_t size = 0;
-	for (auto it = mNc.begin(); it != mNc.end();) {
-		if (now > it->second.expires) {
-			LOGD("Cleaning expired nonce %s", it->first.c_str());
-			auto eraseIt = it;
-			++it;
-			mNc.erase(eraseIt);
-			++count;
-		} else
-			++it;
-		size++;
-	}
-	if (count)
-		LOGD("Cleaned %d expired nonces, %zd remaining", count, size);
+	if (slot) slot->state.compare_exchange_strong(state, 0);
 }
 
 // ====================================================================================================================
@@ -145,7 +145,10 @@ void FileAuthDb::getPasswordFromBackend(const std::string &id, const std::string
 	string key(createPasswordKey(id, authid));
 
 	vector<passwd_algo_t> passwd;
-	if (getCachedPassword(key, domain, passwd) == VALID_PASS_FOUND) {
+	auto it = mPasswords.find(key + "@" + domain);
+	if (it != mPasswords.end()) {
+		passwd = it->second;
+		cachePassword(key, domain, passwd, mCacheExpire);
 		res = AuthDbResult::PASSWORD_FOUND;
 	}
 	if (listener) listener->onResult(res, passwd);
@@ -237,6 +240,7 @@ void FileAuthDb::sync() {
 	
 	LOGD("AuthDb file succesfully parsed: \n%s", fileContent.c_str());
 
+	unordered_map<string, vector<passwd_algo_t>> passwords;
 	auto authLines = pwdFile->getAuthLines();
 	for (auto it = authLines.begin(); it != authLines.end(); ++it) {
 		vector<passwd_algo_t> destPasswords;
@@ -252,16 +256,15 @@ void FileAuthDb::sync() {
 		cacheUserWithPhone(userLine->getPhone(), userLine->getDomain(), userLine->getUser());
 		parsePasswd(userLine->getPasswords(), unescapedUser, userLine->getDomain(), destPasswords);
 
-		if (find(domains.begin(), domains.end(), userLine->getDomain()) != domains.end()) {
+		if (find(domains.begin(), domains.end(), userLine->getDomain()) != domains.end()
+			|| find(domains.begin(), domains.end(), "*") != domains.end()) {
 			string key(createPasswordKey(userLine->getUser(), userLine->getUserId()));
-			cachePassword(key, userLine->getDomain(), destPasswords, mCacheExpire);
-		} else if (find(domains.begin(), domains.end(), "*") != domains.end()) {
-			string key(createPasswordKey(userLine->getUser(), userLine->getUserId()));
-			cachePassword(key, userLine->getDomain(), destPasswords, mCacheExpire);
+			passwords[key + "@" + userLine->getDomain()] = move(destPasswords);
 		} else {
 			LOGW("Domain '%s' is not handled by Authentication module", userLine->getDomain().c_str());
 		}
 	}
+	mPasswords = move(passwords);
 	LOGD("Syncing done");
 }
 
@@ -16,6 +16,7 @@
 	along with this program.  If not, see <http://www.gnu.org/licenses/>.
 */
 
+#include <regex>
 #include <thread>
 
 #include <soci/mysql/soci-mysql.h>
@@ -112,9 +113,32 @@ void SociAuthDB::declareConfig(GenericStruct *mc) {
 			"On the other hand, you should not keep too many open connections to your DB at the same time.",
 			"100"},
 
+		{Integer, "soci-batch-size",
+			"Maximum number of password requests resolved by a single SQL query.\n"
+			"Requests are accumulated until this amount is reached or until the oldest one has waited for "
+			"'soci-batch-max-delay' milliseconds. The query of a batch is made of the 'soci-password-request' "
+			"repeated for each request and joined with UNION ALL, so any request remains usable as is.\n"
+			"A value of 1 disables batching: each request is then executed by its own thread.",
+			"1"},
+
+		{Integer, "soci-batch-max-delay",
+			"Maximum time, in milliseconds, a password request may wait for its batch to be complete.",
+			"5"},
+
+		{Integer, "soci-batch-workers",
+			"Number of threads executing batches of password requests. Each one holds a connection of the pool "
+			"for its whole lifetime, with statements prepared once on it.",
+			"2"},
+
 		config_item_end};
 
 	mc->addChildrenValues(items);
+
+	mc->createStat("count-soci-batches", "Number of batches of password requests executed.");
+	mc->createStat("count-soci-batched-requests", "Number of password requests resolved in batches.");
+	mc->createStat("soci-last-batch-size", "Number of password requests of the last batch.");
+	mc->createStat("soci-last-batch-latency",
+		"Time, in milliseconds, between the queueing of the oldest request of the last batch and its result.");
 }
 
 SociAuthDB::SociAuthDB() {
@@ -131,11 +155,43 @@ SociAuthDB::SociAuthDB() {
 	unsigned int max_queue_size = (unsigned int)ma->get<ConfigInt>("soci-max-queue-size")->read();
 	check_domain_in_presence_results = mp->get<ConfigBoolean>("check-domain-in-presence-results")->read();
 
+	mMaxQueueSize = max_queue_size;
+	mBatchSize = max(ma->get<ConfigInt>("soci-batch-size")->read(), 1);
+	mBatchMaxDelay = milliseconds(ma->get<ConfigInt>("soci-batch-max-delay")->read());
+	mCountBatches = ma->get<StatCounter64>("count-soci-batches");
+	mCountBatchedRequests = ma->get<StatCounter64>("count-soci-batched-requests");
+	mLastBatchSize = ma->get<StatCounter64>("soci-last-batch-size");
+	mLastBatchLatency = ma->get<StatCounter64>("soci-last-batch-latency");
+
 	conn_pool.reset(new connection_pool(poolSize));
 	thread_pool.reset(new ThreadPool(poolSize, max_queue_size));
 
 	LOGD("[SOCI] Authentication provider for backend %s created. Pooled for %zu connections", backend.c_str(), poolSize);
 	connectDatabase();
+
+	if (mBatchSize > 1) {
+		// Leave at least one connection to the requests still executed by the thread pool.
+		size_t nbWorkers = max(ma->get<ConfigInt>("soci-batch-workers")->read(), 1);
+		if (poolSize > 1) nbWorkers = min(nbWorkers, poolSize - 1);
+		LOGD("[SOCI] Password requests resolved by batches of %zu with %zu workers", mBatchSize, nbWorkers);
+		for (size_t i = 0; i < nbWorkers; i++) {
+			mBatchWorkers.emplace_back(make_unique<BatchWorker>(*this));
+		}
+		for (auto &worker : mBatchWorkers) {
+			worker->start();
+		}
+	}
+}
+
+SociAuthDB::~SociAuthDB() {
+	{
+		unique_lock<mutex> lock(mBatchMutex);
+		mShutdown = true;
+	}
+	mBatchCondition.notify_all();
+	for (auto &worker : mBatchWorkers) {
+		worker->join();
+	}
 }
 
 void SociAuthDB::connectDatabase() {
@@ -164,6 +220,47 @@ void SociAuthDB::closeOpenedSessions() {
 	_connected = false;
 }
 
+bool SociAuthDB::readPasswordRow(const row &r, size_t firstColumn, const string &unescapedId, const string &domain,
+	vector<passwd_algo_t> &passwd) {
+	passwd_algo_t pass;
+	size_t columns = r.size() - firstColumn;
+
+	/* If size == 1 then we only have the password so we assume MD5 */
+	if (columns == 1) {
+		pass.algo = "MD5";
+		pass.pass = r.get<string>(firstColumn);
+	} else if (columns > 1) {
+		string password = r.get<string>(firstColumn);
+		string algo = r.get<string>(firstColumn + 1);
+
+		if (algo == "CLRTXT") {
+			if (passwd.empty()) {
+				pass.algo = algo;
+				pass.pass = password;
+				passwd.push_back(pass);
+
+				string input;
+				input = unescapedId + ":" + domain + ":" + password;
+
+				pass.pass = Md5().compute<string>(input);
+				pass.algo = "MD5";
+				passwd.push_back(pass);
+
+				pass.pass = Sha256().compute<string>(input);
+				pass.algo = "SHA-256";
+				passwd.push_back(pass);
+
+				return false;
+			}
+		} else {
+			pass.algo = algo;
+			pass.pass = password;
+		}
+	}
+	passwd.push_back(pass);
+	return true;
+}
+
 void SociAuthDB::getPasswordWithPool(const string &id, const string &domain,
 									const string &authid, AuthDbListener *listener) {
 	vector<passwd_algo_t> passwd;
@@ -175,42 +272,7 @@ void SociAuthDB::getPasswordWithPool(const string &id, const string &domain,
 		sociHelper.execute([&](session &sql){
 			rowset<row> results =  (sql.prepare << get_password_request, use(unescapedIdStr, "id"), use(domain, "domain"), use(authid, "authid"));
 			for (rowset<row>::const_iterator it = results.begin(); it != results.end(); it++) {
-				row const& r = *it;
-				passwd_algo_t pass;
-
-				/* If size == 1 then we only have the password so we assume MD5 */
-				if (r.size() == 1) {
-					pass.algo = "MD5";
-					pass.pass = r.get<string>(0);
-				} else if (r.size() > 1) {
-					string password = r.get<string>(0);
-					string algo = r.get<string>(1);
-
-					if (algo == "CLRTXT") {
-						if (passwd.empty()) {
-							pass.algo = algo;
-							pass.pass = password;
-							passwd.push_back(pass);
-
-							string input;
-							input = unescapedIdStr + ":" + domain + ":" + password;
-
-							pass.pass = Md5().compute<string>(input);
-							pass.algo = "MD5";
-							passwd.push_back(pass);
-
-							pass.pass = Sha256().compute<string>(input);
-							pass.algo = "SHA-256";
-							passwd.push_back(pass);
-
-							break;
-						}
-					} else {
-						pass.algo = algo;
-						pass.pass = password;
-					}
-				}
-				passwd.push_back(pass);
+				if (!readPasswordRow(*it, 0, unescapedIdStr, domain, passwd)) break;
 			}
 		});
 
@@ -223,6 +285,153 @@ void SociAuthDB::getPasswordWithPool(const string &id, const string &domain,
 	}
 }
 
+/*
+ * The configured request only returns the passwords of one user, without any column telling which user they belong
+ * to. The batch request is therefore made of one instance of it per request, each one with its own placeholders
+ * (':id0', ':domain0', ...), prefixed by the index of the request and joined with UNION ALL.
+ */
+string SociAuthDB::buildBatchPasswordRequest(size_t size) const {
+	static const regex placeholder(":(id|domain|authid)\\b");
+	ostringstream request;
+	for (size_t i = 0; i < size; i++) {
+		if (i != 0) request << " union all ";
+		request << "select '" << i << "' as batch_index, t" << i << ".* from ("
+			<< regex_replace(get_password_request, placeholder, "$&" + to_string(i)) << ") t" << i;
+	}
+	return request.str();
+}
+
+bool SociAuthDB::popBatch(vector<PasswordRequest> &batch) {
+	unique_lock<mutex> lock(mBatchMutex);
+	while (true) {
+		mBatchCondition.wait(lock, [this]() {return !mPasswordRequests.empty() || mShutdown;});
+		if (mPasswordRequests.empty()) return false; // Shutdown requested and nothing left to resolve.
+
+		if (mPasswordRequests.size() < mBatchSize && !mShutdown) {
+			// Wait for the batch to be complete, at most until the oldest request reaches the max delay.
+			auto deadline = mPasswordRequests.front().enqueueTime + mBatchMaxDelay;
+			mBatchCondition.wait_until(lock, deadline, [this]() {
+				return mPasswordRequests.size() >= mBatchSize || mShutdown;
+			});
+			// Another worker may have taken the pending requests in the meantime.
+			if (mPasswordRequests.empty()) continue;
+		}
+
+		auto count = min(mPasswordRequests.size(), mBatchSize);
+		batch.assign(make_move_iterator(mPasswordRequests.begin()),
+			make_move_iterator(mPasswordRequests.begin() + count));
+		mPasswordRequests.erase(mPasswordRequests.begin(), mPasswordRequests.begin() + count);
+		return true;
+	}
+}
+
+void SociAuthDB::onBatchResolved(vector<PasswordRequest> &batch, vector<vector<passwd_algo_t>> &results, bool success) {
+	{
+		unique_lock<mutex> lock(mBatchMutex);
+		auto latency = steady_clock::now() - batch.front().enqueueTime;
+		mCountBatches->incr();
+		mCountBatchedRequests->set(mCountBatchedRequests->read() + batch.size());
+		mLastBatchSize->set(batch.size());
+		mLastBatchLatency->set(duration_cast<milliseconds>(latency).count());
+	}
+
+	for (size_t i = 0; i < batch.size(); i++) {
+		auto &request = batch[i];
+		auto &passwd = results[i];
+		if (!success) {
+			if (request.listener) request.listener->onResult(AUTH_ERROR, PwList());
+			continue;
+		}
+		if (!passwd.empty()) cachePassword(createPasswordKey(request.id, request.authid), request.domain, passwd, mCacheExpire);
+		if (request.listener) request.listener->onResult(passwd.empty() ? PASSWORD_NOT_FOUND : PASSWORD_FOUND, passwd);
+	}
+}
+
+SociAuthDB::BatchWorker::BatchWorker(SociAuthDB &db) : mDb{db}, mSession{*db.conn_pool} {}
+
+void SociAuthDB::BatchWorker::start() {
+	mThread = thread(&BatchWorker::run, this);
+}
+
+void SociAuthDB::BatchWorker::join() {
+	if (mThread.joinable()) mThread.join();
+}
+
+void SociAuthDB::BatchWorker::run() {
+	vector<PasswordRequest> batch{};
+	vector<vector<passwd_algo_t>> results{};
+	while (mDb.popBatch(batch)) {
+		results.assign(batch.size(), {});
+		auto success = resolve(batch, results);
+		mDb.onBatchResolved(batch, results, success);
+		batch.clear();
+	}
+}
+
+SociAuthDB::BatchWorker::PreparedBatch &SociAuthDB::BatchWorker::getPreparedBatch(size_t size) {
+	auto &prepared = mStatements[size];
+	if (prepared) return *prepared;
+
+	prepared = make_unique<PreparedBatch>();
+	prepared->ids.resize(size);
+	prepared->domains.resize(size);
+	prepared->authids.resize(size);
+
+	auto prepare = (mSession.prepare << mDb.buildBatchPasswordRequest(size));
+	for (size_t i = 0; i < size; i++) {
+		auto index = to_string(i);
+		prepare, use(prepared->ids[i], "id" + index), use(prepared->domains[i], "domain" + index),
+			use(prepared->authids[i], "authid" + index);
+	}
+	prepare, into(prepared->row);
+	prepared->statement = make_unique<soci::statement>(prepare);
+	return *prepared;
+}
+
+void SociAuthDB::BatchWorker::execute(vector<PasswordRequest> &batch, vector<vector<passwd_algo_t>> &results) {
+	auto &prepared = getPreparedBatch(batch.size());
+	// Statements are bound to the buffers of the prepared batch, so they only have to be updated.
+	for (size_t i = 0; i < batch.size(); i++) {
+		prepared.ids[i] = urlUnescape(batch[i].id);
+		prepared.domains[i] = batch[i].domain;
+		prepared.authids[i] = batch[i].authid;
+	}
+
+	vector<bool> complete(batch.size(), false);
+	prepared.statement->execute();
+	while (prepared.statement->fetch()) {
+		auto index = stoul(prepared.row.get<string>(0));
+		if (index >= batch.size() || complete[index]) continue;
+		complete[index] = !readPasswordRow(prepared.row, 1, prepared.ids[index], prepared.domains[index],
+			results[index]);
+	}
+}
+
+bool SociAuthDB::BatchWorker::resolve(vector<PasswordRequest> &batch, vector<vector<passwd_algo_t>> &results) {
+	// Like SociHelper::execute(), the batch is run once more after a reconnection: the session of the worker is
+	// held for its whole life, so the server may have closed it after an idle timeout.
+	for (int attempt = 0; attempt < 2; attempt++) {
+		try {
+			execute(batch, results);
+			return true;
+		} catch (const exception &e) { // soci errors are std::runtime_error, unexpected columns raise std::bad_cast
+			SLOGE << "[SOCI] batch of " << batch.size() << " password requests failed: " << e.what();
+		}
+
+		// The connection may have been lost, statements are prepared again on the reconnected session.
+		mStatements.clear();
+		for (auto &passwd : results) passwd.clear();
+		try {
+			mSession.close();
+			mSession.reconnect();
+		} catch (const exception &e) {
+			SLOGE << "[SOCI] reconnect error: " << e.what();
+			return false;
+		}
+	}
+	return false;
+}
+
 void SociAuthDB::getUserWithPhoneWithPool(const string &phone, const string &domain, AuthDbListener *listener) {
 	string user;
 
@@ -349,6 +558,26 @@ void SociAuthDB::getPasswordFromBackend(const string &id, const string &domain,
 		return;
 	}
 
+	if (!mBatchWorkers.empty()) {
+		size_t queueSize = 0;
+		{
+			unique_lock<mutex> lock(mBatchMutex);
+			if (mPasswordRequests.size() < mMaxQueueSize) {
+				mPasswordRequests.push_back({id, domain, authid, listener, steady_clock::now()});
+				queueSize = mPasswordRequests.size();
+			}
+		}
+		if (queueSize == 0) {
+			SLOGE << "[SOCI] Auth queue is full, cannot fullfil password request for " << id << " / " << domain
+				<< " / " << authid;
+			if (listener) listener->onResult(AUTH_ERROR, PwList());
+		} else if (queueSize == 1 || queueSize % mBatchSize == 0) {
+			// Wake up a worker to arm the batch delay for the first request, then once per complete batch.
+			mBatchCondition.notify_one();
+		}
+		return;
+	}
+
 	// create a thread to grab a pool connection and use it to retrieve the auth information
 	auto func = bind(&SociAuthDB::getPasswordWithPool, this, id, domain, authid, listener);
 
@@ -32,6 +32,16 @@ void AuthDbBackend::ListenerToFunctionWrapper::onResult(AuthDbResult result, con
 	delete this;
 }
 
+void AuthDbBackend::PendingLookupListener::onResult(AuthDbResult result, const std::string &passwd) {
+	mBackend.onPasswordFetched(mCacheKey, result, {});
+	delete this;
+}
+
+void AuthDbBackend::PendingLookupListener::onResult(AuthDbResult result, const std::vector<passwd_algo_t> &passwd) {
+	mBackend.onPasswordFetched(mCacheKey, result, passwd);
+	delete this;
+}
+
 unique_ptr<AuthDbBackend> AuthDbBackend::sUnique;
 
 AuthDbListener::~AuthDbListener(){
@@ -78,6 +88,10 @@ AuthDbBackend::AuthDbBackend() {
 	GenericStruct *ma = cr->get<GenericStruct>("module::Authentication");
 	list<string> domains = ma->get<ConfigStringList>("auth-domains")->read();
 	mCacheExpire = ma->get<ConfigInt>("cache-expire")->read();
+	mNegativeCacheExpire = ma->get<ConfigInt>("negative-cache-expire")->read();
+	int maxEntries = ma->get<ConfigInt>("cache-max-entries")->read();
+	// The bound is enforced per shard.
+	mCacheMaxEntries = maxEntries > 0 ? max<size_t>(1, maxEntries / sCacheShardCount) : 0;
 }
 
 AuthDbBackend::~AuthDbBackend() {
@@ -107,44 +121,96 @@ string AuthDbBackend::createPasswordKey(const string &user, const string &auth_u
 	return key.str();
 }
 
+string AuthDbBackend::createCacheKey(const string &key, const string &domain) {
+	return key + "@" + domain;
+}
+
+AuthDbBackend::CacheShard &AuthDbBackend::getCacheShard(const string &cacheKey) {
+	return mCacheShards[hash<string>()(cacheKey) % sCacheShardCount];
+}
+
 AuthDbBackend::CacheResult AuthDbBackend::getCachedPassword(const string &key, const string &domain, vector<passwd_algo_t> &pass) {
 	time_t now = getCurrentTime();
-	auto &passwords = mCachedPasswords[domain];
-	unique_lock<mutex> lck(mCachedPasswordMutex);
-	auto it = passwords.find(key);
-	if (it != passwords.end()) {
-		pass = it->second.pass;
-		if (now < it->second.expire_date) {
-			return VALID_PASS_FOUND;
-		} else {
-			passwords.erase(it);
-			return EXPIRED_PASS_FOUND;
-		}
+	string cacheKey = createCacheKey(key, domain);
+	CacheShard &shard = getCacheShard(cacheKey);
+	unique_lock<mutex> lck(shard.mutex);
+	auto it = shard.entries.find(cacheKey);
+	if (it == shard.entries.end()) return NO_PASS_FOUND;
+
+	CachedPassword &cached = it->second;
+	if (now >= cached.expire_date) {
+		pass = move(cached.pass);
+		shard.lru.erase(cached.lruPos);
+		shard.entries.erase(it);
+		return pass.empty() ? NO_PASS_FOUND : EXPIRED_PASS_FOUND;
 	}
-	return NO_PASS_FOUND;
+	shard.lru.splice(shard.lru.begin(), shard.lru, cached.lruPos);
+	if (cached.pass.empty()) return NEGATIVE_PASS_FOUND;
+	pass = cached.pass;
+	return VALID_PASS_FOUND;
 }
 
 void AuthDbBackend::clearCache() {
-	mCachedPasswords.clear();
+	for (auto &shard : mCacheShards) {
+		unique_lock<mutex> lck(shard.mutex);
+		shard.entries.clear();
+		shard.lru.clear();
+	}
+}
+
+void AuthDbBackend::storeCachedPassword(const string &cacheKey, const vector<passwd_algo_t> &pass, time_t expireDate) {
+	time_t now = getCurrentTime();
+	CacheShard &shard = getCacheShard(cacheKey);
+	unique_lock<mutex> lck(shard.mutex);
+	auto it = shard.entries.find(cacheKey);
+	if (it != shard.entries.end()) {
+		it->second.pass = pass;
+		it->second.expire_date = expireDate;
+		shard.lru.splice(shard.lru.begin(), shard.lru, it->second.lruPos);
+		return;
+	}
+
+	shard.lru.push_front(cacheKey);
+	shard.entries.emplace(cacheKey, CachedPassword{pass, expireDate, shard.lru.begin()});
+	// Drop least recently used entries over the bound, and expired ones lying at the tail on the way.
+	while (shard.lru.size() > 1) {
+		auto last = shard.entries.find(shard.lru.back());
+		bool overBound = mCacheMaxEntries > 0 && shard.entries.size() > mCacheMaxEntries;
+		if (!overBound && now < last->second.expire_date) break;
+		shard.entries.erase(last);
+		shard.lru.pop_back();
+	}
 }
 
 bool AuthDbBackend::cachePassword(const string &key, const string &domain, const vector<passwd_algo_t> &pass, int expires) {
 	if (pass.empty()) throw invalid_argument("empty password list");
-	time_t now = getCurrentTime();
-	map<string, CachedPassword> &passwords = mCachedPasswords[domain];
-	unique_lock<mutex> lck(mCachedPasswordMutex);
-	map<string, CachedPassword>::iterator it = passwords.find(key);
 	if (expires == -1)
 		expires = mCacheExpire;
-	if (it != passwords.end()) {
-		it->second.pass = pass;
-		it->second.expire_date = now + expires;
-	} else {
-		passwords.insert(make_pair(key, CachedPassword(pass, now + expires)));
-	}
+	storeCachedPassword(createCacheKey(key, domain), pass, getCurrentTime() + expires);
 	return true;
 }
 
+void AuthDbBackend::onPasswordFetched(const string &cacheKey, AuthDbResult result, const vector<passwd_algo_t> &pass) {
+	// Positive results are cached by the backends themselves, with their own expiration.
+	if (result == PASSWORD_NOT_FOUND && mNegativeCacheExpire > 0) {
+		storeCachedPassword(cacheKey, {}, getCurrentTime() + mNegativeCacheExpire);
+	}
+
+	vector<AuthDbListener *> waiters;
+	CacheShard &shard = getCacheShard(cacheKey);
+	{
+		unique_lock<mutex> lck(shard.mutex);
+		auto it = shard.pending.find(cacheKey);
+		if (it != shard.pending.end()) {
+			waiters = move(it->second);
+			shard.pending.erase(it);
+		}
+	}
+	for (auto *listener : waiters) {
+		if (listener) listener->onResult(result, pass);
+	}
+}
+
 bool AuthDbBackend::cacheUserWithPhone(const string &phone, const string &domain, const string &user) {
 	unique_lock<mutex> lck(mCachedUserWithPhoneMutex);
 
@@ -167,6 +233,9 @@ void AuthDbBackend::getPassword(const std::string &user, const std::string &doma
 		case VALID_PASS_FOUND:
 			if (listener) listener->onResult(AuthDbResult::PASSWORD_FOUND, pass);
 			return;
+		case NEGATIVE_PASS_FOUND:
+			if (listener) listener->onResult(AuthDbResult::PASSWORD_NOT_FOUND, pass);
+			return;
 		case EXPIRED_PASS_FOUND:
 			// Might check here if connection is failing
 			// If it is the case use fallback password and
@@ -176,8 +245,17 @@ void AuthDbBackend::getPassword(const std::string &user, const std::string &doma
 			break;
 	}
 
-	// if we reach here, password wasn't cached: we have to grab the password from the actual backend
-	getPasswordFromBackend(user, domain, auth_username, listener);
+	// if we reach here, password wasn't cached: we have to grab the password from the actual backend,
+	// unless a lookup for the same user is already in progress, in which case we just wait for its result.
+	string cacheKey = createCacheKey(key, domain);
+	CacheShard &shard = getCacheShard(cacheKey);
+	{
+		unique_lock<mutex> lck(shard.mutex);
+		auto &waiters = shard.pending[cacheKey];
+		waiters.push_back(listener);
+		if (waiters.size() > 1) return;
+	}
+	getPasswordFromBackend(user, domain, auth_username, new PendingLookupListener(*this, cacheKey));
 }
 
 void AuthDbBackend::getPassword(const std::string &user, const std::string &domain, const std::string &auth_username, const ResultCb &cb) {
@@ -27,9 +27,12 @@
 #include <vector>
 #include <stdio.h>
 
+#include <array>
+#include <list>
 #include <map>
 #include <set>
 #include <thread>
+#include <unordered_map>
 
 #include "sofia-sip/auth_module.h"
 #include "sofia-sip/auth_plugin.h"
@@ -78,7 +81,8 @@ protected:
 	enum CacheResult {
 		VALID_PASS_FOUND,
 		EXPIRED_PASS_FOUND,
-		NO_PASS_FOUND
+		NO_PASS_FOUND,
+		NEGATIVE_PASS_FOUND // the backend recently answered that this user doesn't exist
 	};
 
 	AuthDbBackend();
@@ -99,13 +103,38 @@ protected:
 	static std::string urlUnescape(const std::string &str);
 
 	int mCacheExpire;
+	int mNegativeCacheExpire;
+	size_t mCacheMaxEntries;
 
 private:
+	static constexpr size_t sCacheShardCount = 16;
+
+	/* An empty password list is a negative entry, i.e. a cached PASSWORD_NOT_FOUND. */
 	struct CachedPassword {
 		std::vector<passwd_algo_t> pass;
 		time_t expire_date;
-		CachedPassword(const std::vector<passwd_algo_t> &ipass, time_t idate) : pass(ipass), expire_date(idate) {
-		}
+		std::list<std::string>::iterator lruPos;
+	};
+
+	struct CacheShard {
+		std::mutex mutex;
+		std::unordered_map<std::string, CachedPassword> entries;
+		std::list<std::string> lru; // most recently used first
+		// Listeners waiting for a backend lookup already in progress, by cache key.
+		std::unordered_map<std::string, std::vector<AuthDbListener *>> pending;
+	};
+
+	/* Receives the result of a backend lookup and dispatches it to every listener waiting for the same key. */
+	struct PendingLookupListener : public AuthDbListener {
+	public:
+		PendingLookupListener(AuthDbBackend &backend, const std::string &cacheKey)
+			: mBackend(backend), mCacheKey(cacheKey) {}
+
+		void onResult(AuthDbResult result, const std::string &passwd) override;
+		void onResult(AuthDbResult result, const std::vector<passwd_algo_t> &passwd) override;
+
+		AuthDbBackend &mBackend;
+		std::string mCacheKey;
 	};
 
 	struct ListenerToFunctionWrapper : public AuthDbListener {
@@ -120,10 +149,14 @@ private:
 		ResultCb mCb;
 	};
 
+	static std::string createCacheKey(const std::string &key, const std::string &domain);
+	CacheShard &getCacheShard(const std::string &cacheKey);
+	void storeCachedPassword(const std::string &cacheKey, const std::vector<passwd_algo_t> &pass, time_t expireDate);
+	void onPasswordFetched(const std::string &cacheKey, AuthDbResult result, const std::vector<passwd_algo_t> &pass);
+
 	static std::unique_ptr<AuthDbBackend> sUnique;
 
-	std::map<std::string, std::map<std::string, CachedPassword>> mCachedPasswords;
-	std::mutex mCachedPasswordMutex;
+	std::array<CacheShard, sCacheShardCount> mCacheShards;
 	std::mutex mCachedUserWithPhoneMutex;
 	std::map<std::string, std::string> mPhone2User;
 };
@@ -224,6 +257,9 @@ class FileAuthDb : public AuthDbBackend {
 private:
 	std::string mFileString;
 	time_t mLastSync;
+	// Passwords of the users of the file, by password key and domain. The bounded password cache of AuthDbBackend
+	// may evict its entries at any time, it can't be the only copy of the file.
+	std::unordered_map<std::string, std::vector<passwd_algo_t>> mPasswords;
 	void parsePasswd(const std::vector<passwd_algo_t> &srcPasswords, const std::string &user, const std::string &domain, std::vector<passwd_algo_t> &destPasswords);
 	std::shared_ptr<belr::Parser<std::shared_ptr<FileAuthDbParserElem>>> setupParser();
 
@@ -242,6 +278,10 @@ public:
 
 #if ENABLE_SOCI
 
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+
 #include "soci/soci.h"
 #include "utils/threadpool.hh"
 
@@ -249,6 +289,8 @@ namespace flexisip {
 
 class SociAuthDB : public AuthDbBackend {
 public:
+	~SociAuthDB() override;
+
 	void getUserWithPhoneFromBackend(const std::string & , const std::string &, AuthDbListener *listener) override;
 	void getUsersWithPhonesFromBackend(std::list<std::tuple<std::string,std::string,AuthDbListener*>> &creds) override;
 	void getPasswordFromBackend(const std::string &id, const std::string &domain,
@@ -257,6 +299,46 @@ public:
 	static void declareConfig(GenericStruct *mc);
 
 private:
+	struct PasswordRequest {
+		std::string id;
+		std::string domain;
+		std::string authid;
+		AuthDbListener *listener;
+		std::chrono::steady_clock::time_point enqueueTime;
+	};
+
+	/*
+	 * Thread resolving batches of password requests with a single SQL query each.
+	 * It holds one connection of the pool for its whole lifetime, along with the statements prepared on it.
+	 */
+	class BatchWorker {
+	public:
+		BatchWorker(SociAuthDB &db);
+
+		void start();
+		void join();
+
+	private:
+		// A statement prepared for a given batch size, bound to its own parameter and row buffers.
+		struct PreparedBatch {
+			std::vector<std::string> ids;
+			std::vector<std::string> domains;
+			std::vector<std::string> authids;
+			soci::row row;
+			std::unique_ptr<soci::statement> statement;
+		};
+
+		void run();
+		bool resolve(std::vector<PasswordRequest> &batch, std::vector<std::vector<passwd_algo_t>> &results);
+		void execute(std::vector<PasswordRequest> &batch, std::vector<std::vector<passwd_algo_t>> &results);
+		PreparedBatch &getPreparedBatch(size_t size);
+
+		SociAuthDB &mDb;
+		soci::session mSession;
+		std::map<size_t, std::unique_ptr<PreparedBatch>> mStatements;
+		std::thread mThread;
+	};
+
 	SociAuthDB();
 
 	void connectDatabase();
@@ -269,6 +351,11 @@ private:
 
 	void notifyAllListeners(std::list<std::tuple<std::string, std::string, AuthDbListener *>> &creds, const std::set<std::pair<std::string, std::string>> &presences);
 
+	static bool readPasswordRow(const soci::row &r, std::size_t firstColumn, const std::string &unescapedId,
+		const std::string &domain, std::vector<passwd_algo_t> &passwd);
+	std::string buildBatchPasswordRequest(std::size_t size) const;
+	bool popBatch(std::vector<PasswordRequest> &batch);
+	void onBatchResolved(std::vector<PasswordRequest> &batch, std::vector<std::vector<passwd_algo_t>> &results, bool success);
 
 	std::size_t poolSize;
 	std::unique_ptr<soci::connection_pool> conn_pool;
@@ -282,6 +369,20 @@ private:
 	bool check_domain_in_presence_results = false;
 	bool _connected = false;
 
+	// Batched password lookups, enabled when mBatchSize > 1.
+	std::size_t mMaxQueueSize;
+	std::size_t mBatchSize;
+	std::chrono::milliseconds mBatchMaxDelay;
+	std::deque<PasswordRequest> mPasswordRequests;
+	std::mutex mBatchMutex;
+	std::condition_variable mBatchCondition;
+	bool mShutdown = false;
+	std::vector<std::unique_ptr<BatchWorker>> mBatchWorkers;
+	StatCounter64 *mCountBatches = nullptr;
+	StatCounter64 *mCountBatchedRequests = nullptr;
+	StatCounter64 *mLastBatchSize = nullptr;
+	StatCounter64 *mLastBatchLatency = nullptr;
+
 	friend AuthDbBackend;
 };
 
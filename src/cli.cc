@@ -25,6 +25,9 @@
 #include <cerrno>
 #include <cstring>
 #include <poll.h>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
 
 #include "cli.hh"
 #include "recordserializer.hh"
@@ -456,6 +459,188 @@ void ProxyCommandLineInterface::handle_registrar_clear_command(unsigned int sock
 	RegistrarDb::get()->clear(sip, listener);
 }
 
+namespace {
+
+/*
+ * A batch of a REGISTRAR_DUMP, filled on the main loop and written to the socket by the CLI thread.
+ */
+struct DumpBatch {
+	mutex mMutex;
+	condition_variable mCondition;
+	bool mDone = false;
+	bool mError = false;
+	vector<string> mLines;
+	string mCursor;
+	chrono::steady_clock::duration mTime{}; // spent on the main loop
+
+	// Only accessed from the main loop.
+	bool mInDump = false;
+	chrono::steady_clock::time_point mStart;
+
+	void finish(bool error, vector<string> &&lines, const string &cursor) {
+		if (mInDump) mTime = chrono::steady_clock::now() - mStart;
+		lock_guard<mutex> lock(mMutex);
+		mError = error;
+		mLines = move(lines);
+		mCursor = cursor;
+		mDone = true;
+		mCondition.notify_one();
+	}
+};
+
+class DumpBatchListener : public DumpListener {
+public:
+	DumpBatchListener(const shared_ptr<DumpBatch> &batch) : mBatch(batch) {}
+
+	void onRecordsDumped(const vector<shared_ptr<Record>> &records, const string &cursor) override {
+		auto start = chrono::steady_clock::now();
+		vector<string> lines{};
+		lines.reserve(records.size());
+		for (const auto &r : records) {
+			string serialized{};
+			if (RecordSerializerJson::get()->serialize(r.get(), serialized)) lines.push_back(move(serialized));
+		}
+		// The backends answering asynchronously only hold the main loop for the serialization.
+		if (!mBatch->mInDump) mBatch->mTime = chrono::steady_clock::now() - start;
+		mBatch->finish(false, move(lines), cursor);
+	}
+	void onError() override {
+		mBatch->finish(true, {}, "0");
+	}
+
+private:
+	shared_ptr<DumpBatch> mBatch;
+};
+
+struct DumpRequest {
+	shared_ptr<DumpBatch> mBatch;
+	string mCursor;
+	size_t mCount;
+};
+
+void dumpOnMainLoop(su_root_magic_t *rm, su_msg_r msg, void *u) {
+	unique_ptr<DumpRequest> request{*static_cast<DumpRequest **>(su_msg_data(msg))};
+	const auto &batch = request->mBatch;
+	batch->mStart = chrono::steady_clock::now();
+	batch->mInDump = true;
+	RegistrarDb::get()->dump(request->mCursor, request->mCount, make_shared<DumpBatchListener>(batch));
+	batch->mInDump = false;
+}
+
+/*
+ * Writes data without blocking the CLI thread for ever: gives up when the reader doesn't read anything for
+ * sSendTimeoutMs or when the CLI is stopped.
+ */
+constexpr int sSendTimeoutMs = 10000;
+
+bool sendAll(unsigned int socket, int controlFd, const string &data) {
+	size_t sent = 0;
+	while (sent < data.size()) {
+		ssize_t n = send(socket, data.data() + sent, data.size() - sent, MSG_NOSIGNAL | MSG_DONTWAIT);
+		if (n >= 0) {
+			sent += n;
+			continue;
+		}
+		if (errno == EINTR) continue;
+		if (errno != EAGAIN && errno != EWOULDBLOCK) return false;
+
+		struct pollfd pfd[2];
+		memset(pfd, 0, sizeof(pfd));
+		pfd[0].fd = socket;
+		pfd[0].events = POLLOUT;
+		pfd[1].fd = controlFd;
+		pfd[1].events = POLLIN;
+		int ret = poll(pfd, 2, sSendTimeoutMs);
+		if (ret == -1 && errno == EINTR) continue;
+		if (ret <= 0) {
+			if (ret == 0) errno = ETIMEDOUT;
+			return false;
+		}
+		if (pfd[1].revents) {
+			errno = ECANCELED; // The CLI is being stopped.
+			return false;
+		}
+	}
+	return true;
+}
+
+} // namespace
+
+/*
+ * Writes every record of the registrar as one JSON object per line. The records are read and serialized on the main
+ * loop by batches, whose size is adjusted so that each one takes about the configured time slice, while the CLI
+ * thread writes them: a slow reader delays the next batch instead of piling the records up, and a reader that stops
+ * reading is dropped after a timeout. The stream ends with an "END" line once every record has been written, or with
+ * an "ERROR" line if the dump was interrupted.
+ */
+void ProxyCommandLineInterface::handle_registrar_dump_command(unsigned int socket, const std::vector<std::string> &args) {
+	size_t maxBatchSize = 1000;
+	if (!args.empty()) {
+		char *end = nullptr;
+		maxBatchSize = strtoul(args.front().c_str(), &end, 10);
+		if (*end != '\0' || maxBatchSize == 0) {
+			answer(socket, "Error: the REGISTRAR_DUMP argument must be a positive batch size");
+			return;
+		}
+	}
+
+	auto *registrarConf = GenericManager::get()->getRoot()->get<GenericStruct>("module::Registrar");
+	auto timeSlice = chrono::milliseconds(max(1, registrarConf->get<ConfigInt>("dump-time-slice")->read()));
+	su_root_t *root = mAgent->getRoot();
+
+	size_t batchSize = min<size_t>(maxBatchSize, 100);
+	string cursor = "0";
+	unsigned long count = 0;
+	bool complete = false;
+	do {
+		auto batch = make_shared<DumpBatch>();
+		su_msg_r msg = SU_MSG_R_INIT;
+		if (su_msg_create(msg, su_root_task(root), su_root_task(root), dumpOnMainLoop, sizeof(DumpRequest *)) == -1) {
+			SLOGE << "Cannot create registrar dump message";
+			break;
+		}
+		auto *request = new DumpRequest{batch, cursor, batchSize};
+		*static_cast<DumpRequest **>(su_msg_data(msg)) = request;
+		if (su_msg_send(msg) == -1) {
+			SLOGE << "Cannot send registrar dump message to the main loop";
+			delete request;
+			break;
+		}
+
+		unique_lock<mutex> lock(batch->mMutex);
+		// Wait by steps, so that stopping the CLI isn't delayed by a registrar that doesn't answer.
+		auto deadline = chrono::steady_clock::now() + chrono::seconds(30);
+		while (!batch->mCondition.wait_for(lock, chrono::seconds(1), [&batch]() {return batch->mDone;})) {
+			if (!isRunning() || chrono::steady_clock::now() >= deadline) break;
+		}
+		if (!batch->mDone) {
+			SLOGE << "Registrar dump aborted: no answer from the registrar";
+			break;
+		}
+		if (batch->mError) break;
+
+		bool sent = true;
+		for (const auto &line : batch->mLines) {
+			if (!(sent = sendAll(socket, getControlFd(), line + "\n"))) break;
+		}
+		if (!sent) {
+			SLOGD << "Registrar dump aborted: " << strerror(errno);
+			break;
+		}
+		count += batch->mLines.size();
+		cursor = batch->mCursor;
+		complete = (cursor == "0");
+
+		if (batch->mTime > timeSlice) batchSize = max<size_t>(batchSize / 2, 1);
+		else if (batch->mTime < timeSlice / 2) batchSize = min(batchSize * 2, maxBatchSize);
+	} while (!complete && isRunning());
+
+	sendAll(socket, getControlFd(), complete ? "END\n" : "ERROR\n");
+	SLOGD << "Registrar dump of " << count << " record(s) " << (complete ? "finished" : "interrupted");
+	shutdown(socket, SHUT_RDWR);
+	close(socket);
+}
+
 void ProxyCommandLineInterface::parseAndAnswer(unsigned int socket, const std::string &command, const std::vector<std::string> &args) {
 	if (command == "REGISTRAR_CLEAR")
 		handle_registrar_clear_command(socket, args);
@@ -463,6 +648,8 @@ void ProxyCommandLineInterface::parseAndAnswer(unsigned int socket, const std::s
 		handle_registrar_delete_command(socket, args);
 	else if (command == "REGISTRAR_GET")
 		handle_registrar_get_command(socket, args);
+	else if (command == "REGISTRAR_DUMP")
+		handle_registrar_dump_command(socket, args);
 	else
 		CommandLineInterface::parseAndAnswer(socket, command, args);
 }
@@ -36,6 +36,9 @@ public:
 	void stop();
 
 protected:
+	bool isRunning() const {return mRunning;}
+	/* Becomes readable when stop() is called. */
+	int getControlFd() const {return mControlFds[0];}
 	void answer(unsigned int socket, const std::string &message);
 	virtual void parseAndAnswer(unsigned int socket, const std::string &command, const std::vector<std::string> &args);
 
@@ -66,6 +69,7 @@ public:
 private:
 	void handle_registrar_clear_command(unsigned int socket, const std::vector<std::string> &args);
 	void handle_registrar_delete_command(unsigned int socket, const std::vector<std::string> &args);
+	void handle_registrar_dump_command(unsigned int socket, const std::vector<std::string> &args);
 	void handle_registrar_get_command(unsigned int socket, const std::vector<std::string> &args);
 	void parseAndAnswer(unsigned int socket, const std::string &command, const std::vector<std::string> &args) override;
 
@@ -0,0 +1,263 @@
+/*
+	Flexisip, a flexible SIP proxy server with media capabilities.
+	Copyright (C) 2010-2020  Belledonne Communications SARL, All rights reserved.
+
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU Affero General Public License as
+	published by the Free Software Foundation, either version 3 of the
+	License, or (at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU Affero General Public License for more details.
+
+	You should have received a copy of the GNU Affero General Public License
+	along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "dns-cache.hh"
+
+#include <flexisip/common.hh>
+#include <flexisip/utils/network-table.hh>
+
+#include <sofia-sip/sres_record.h>
+
+#include <algorithm>
+#include <arpa/inet.h>
+#include <cctype>
+#include <cstring>
+#include <stdexcept>
+
+using namespace std;
+
+namespace flexisip {
+
+constexpr int DnsCache::sIdleTimeout;
+constexpr unsigned DnsCache::sMaintenanceInterval;
+
+namespace {
+
+string makeKey(uint16_t type, const string &name) {
+	return to_string(type) + " " + name;
+}
+
+string toLower(const char *str) {
+	string result(str);
+	transform(result.begin(), result.end(), result.begin(), [](unsigned char c) {return tolower(c);});
+	return result;
+}
+
+} // namespace
+
+DnsCache::DnsCache(su_root_t *root, const string &resolvConf, int negativeTtl)
+	: mTimer(root, sMaintenanceInterval), mNegativeTtl(negativeTtl) {
+	mResolver = sres_resolver_create(root, resolvConf.empty() ? nullptr : resolvConf.c_str(), TAG_END());
+	if (mResolver == nullptr) {
+		throw runtime_error("cannot create DNS resolver");
+	}
+	mTimer.run([this]() {maintain();});
+}
+
+DnsCache::~DnsCache() {
+	mTimer.reset();
+	sres_resolver_destroy(mResolver);
+	for (auto query : mQueries) delete query;
+}
+
+void DnsCache::setStats(StatCounter64 *hits, StatCounter64 *misses, StatCounter64 *prefetches) {
+	mCountHits = hits;
+	mCountMisses = misses;
+	mCountPrefetches = prefetches;
+}
+
+bool DnsCache::resolve(const url_t *url, Destination &destination) {
+	if (url->url_type != url_sip || url->url_host == nullptr || url_has_param(url, "maddr")) return false;
+
+	char transport[16] = {0};
+	url_param(url->url_params, "transport", transport, sizeof(transport) - 1);
+	if (strcasecmp(transport, "tls") == 0) return false;
+
+	int family;
+	uint8_t address[sizeof(struct in6_addr)];
+	if (NetworkTable::parseAddress(url->url_host, family, address)) return false;
+
+	Result result = resolveName(toLower(url->url_host), url->url_port, transport, getCurrentTime(), destination);
+	if (result == Result::Found) {
+		if (mCountHits) ++(*mCountHits);
+		return true;
+	}
+	if (result == Result::Multiple) LOGD("DnsCache: several destinations for %s, left to the transaction", url->url_host);
+	if (mCountMisses) ++(*mCountMisses);
+	return false;
+}
+
+DnsCache::Result DnsCache::resolveName(const string &host, const char *port, const char *transport, time_t now,
+	Destination &destination) {
+	if (port != nullptr && port[0] != '\0') return resolveHost(host, port, transport, now, destination);
+
+	if (transport[0] != '\0') {
+		string lowerTransport = toLower(transport);
+		const Entry *srv = lookup(sres_type_srv, "_sip._" + lowerTransport + "." + host, now);
+		if (srv == nullptr) return Result::Pending;
+		if (!srv->srv.empty()) return resolveSrv(*srv, lowerTransport, now, destination);
+		return resolveHost(host, "", transport, now, destination);
+	}
+
+	const Entry *naptr = lookup(sres_type_naptr, host, now);
+	if (naptr == nullptr) return Result::Pending;
+	const Entry *selectedSrv = nullptr;
+	const char *selectedTransport = nullptr;
+	for (const auto &record : naptr->naptr) {
+		const char *naptrTransport = strcasecmp(record.services.c_str(), "SIP+D2U") == 0 ? "udp"
+			: strcasecmp(record.services.c_str(), "SIP+D2T") == 0 ? "tcp" : nullptr;
+		if (naptrTransport == nullptr) continue;
+		const Entry *srv = lookup(sres_type_srv, record.replacement, now);
+		if (srv == nullptr) return Result::Pending;
+		if (srv->srv.empty()) continue;
+		// The transaction would fall back on the next NAPTR record if the first one failed.
+		if (selectedSrv != nullptr) return Result::Multiple;
+		selectedSrv = srv;
+		selectedTransport = naptrTransport;
+	}
+	if (selectedSrv != nullptr) return resolveSrv(*selectedSrv, selectedTransport, now, destination);
+
+	// No usable NAPTR record: SRV records of each transport, then the address of the host (RFC 3263 section 4.1).
+	for (const char *srvTransport : {"udp", "tcp"}) {
+		const Entry *srv = lookup(sres_type_srv, string("_sip._") + srvTransport + "." + host, now);
+		if (srv == nullptr) return Result::Pending;
+		if (!srv->srv.empty()) return resolveSrv(*srv, srvTransport, now, destination);
+	}
+	return resolveHost(host, "", "", now, destination);
+}
+
+DnsCache::Result DnsCache::resolveSrv(const Entry &srv, const string &transport, time_t now, Destination &destination) {
+	const Srv *target = nullptr;
+	for (const auto &record : srv.srv) {
+		if (record.target.empty() || record.target == ".") continue;
+		// Several targets are chosen by weight and tried in turn by the transaction (RFC 2782).
+		if (target != nullptr) return Result::Multiple;
+		target = &record;
+	}
+	if (target == nullptr) return Result::NotFound;
+	return resolveHost(target->target, to_string(target->port), transport, now, destination);
+}
+
+DnsCache::Result DnsCache::resolveHost(const string &name, const string &port, const string &transport, time_t now,
+	Destination &destination) {
+	const Entry *a = lookup(sres_type_a, name, now);
+	const Entry *aaaa = lookup(sres_type_aaaa, name, now);
+	if (a == nullptr || aaaa == nullptr) return Result::Pending;
+	size_t count = a->addresses.size() + aaaa->addresses.size();
+	if (count == 0) return Result::NotFound;
+	// The transaction would try the other addresses if the first one failed.
+	if (count > 1) return Result::Multiple;
+	destination.host = a->addresses.empty() ? aaaa->addresses.front() : a->addresses.front();
+	destination.port = port;
+	destination.transport = transport;
+	return Result::Found;
+}
+
+const DnsCache::Entry *DnsCache::lookup(uint16_t type, const string &name, time_t now) {
+	string key = makeKey(type, name);
+	auto it = mEntries.find(key);
+	if (it == mEntries.end()) {
+		it = mEntries.emplace(key, Entry{}).first;
+		it->second.type = type;
+		it->second.name = name;
+	}
+	Entry &entry = it->second;
+	entry.lastUsed = now;
+	if (entry.valid && now < entry.expireAt) return &entry;
+	if (!entry.pending) query(key, entry);
+	return nullptr;
+}
+
+void DnsCache::query(const string &key, Entry &entry) {
+	auto *context = new Query{this, key};
+	if (sres_query(mResolver, &DnsCache::onAnswer, reinterpret_cast<sres_context_t *>(context), entry.type,
+		entry.name.c_str()) == nullptr) {
+		LOGE("DnsCache: cannot query records of type %u for %s", entry.type, entry.name.c_str());
+		delete context;
+		return;
+	}
+	entry.pending = true;
+	mQueries.insert(context);
+}
+
+void DnsCache::onAnswer(sres_context_t *context, sres_query_t *query, sres_record_t **answers) {
+	auto *q = reinterpret_cast<Query *>(context);
+	DnsCache *cache = q->cache;
+
+	cache->mQueries.erase(q);
+	cache->store(q->key, answers);
+	if (answers) sres_free_answers(cache->mResolver, answers);
+	delete q;
+}
+
+void DnsCache::store(const string &key, sres_record_t **answers) {
+	auto it = mEntries.find(key);
+	if (it == mEntries.end()) return;
+	Entry &entry = it->second;
+
+	entry.pending = false;
+	entry.addresses.clear();
+	entry.srv.clear();
+	entry.naptr.clear();
+	uint32_t ttl = UINT32_MAX;
+	for (int i = 0; answers && answers[i]; ++i) {
+		const sres_record_t *answer = answers[i];
+		if (answer->sr_record->r_type != entry.type || answer->sr_record->r_status != SRES_OK) continue;
+
+		char address[INET6_ADDRSTRLEN];
+		switch (entry.type) {
+			case sres_type_a:
+				inet_ntop(AF_INET, &answer->sr_a->a_addr, address, sizeof(address));
+				entry.addresses.emplace_back(address);
+				break;
+			case sres_type_aaaa:
+				inet_ntop(AF_INET6, &answer->sr_aaaa->aaaa_addr, address, sizeof(address));
+				entry.addresses.emplace_back(string("[") + address + "]");
+				break;
+			case sres_type_srv:
+				entry.srv.push_back(Srv{answer->sr_srv->srv_priority, answer->sr_srv->srv_weight,
+					answer->sr_srv->srv_port, toLower(answer->sr_srv->srv_target)});
+				break;
+			case sres_type_naptr:
+				entry.naptr.push_back(Naptr{answer->sr_naptr->na_order, answer->sr_naptr->na_prefer,
+					answer->sr_naptr->na_services, toLower(answer->sr_naptr->na_replace)});
+				break;
+		}
+		ttl = min<uint32_t>(ttl, answer->sr_record->r_ttl);
+	}
+	sort(entry.naptr.begin(), entry.naptr.end(), [](const Naptr &a, const Naptr &b) {
+		return a.order != b.order ? a.order < b.order : a.preference < b.preference;
+	});
+
+	entry.negative = entry.addresses.empty() && entry.srv.empty() && entry.naptr.empty();
+	entry.ttl = entry.negative ? mNegativeTtl : max(ttl, 1U);
+	entry.expireAt = getCurrentTime() + entry.ttl;
+	entry.valid = true;
+	LOGD("DnsCache: %s %s for %us", key.c_str(), entry.negative ? "not found" : "cached", entry.ttl);
+}
+
+void DnsCache::maintain() {
+	time_t now = getCurrentTime();
+	for (auto it = mEntries.begin(); it != mEntries.end();) {
+		Entry &entry = it->second;
+		bool used = now - entry.lastUsed <= sIdleTimeout;
+		if (!entry.pending && !used && now >= entry.expireAt) {
+			it = mEntries.erase(it);
+			continue;
+		}
+		// Records in use are queried again during the last tenth of their TTL.
+		if (!entry.pending && used && entry.valid && !entry.negative
+			&& entry.expireAt - now <= max<time_t>(1, entry.ttl / 10)) {
+			query(it->first, entry);
+			if (mCountPrefetches) ++(*mCountPrefetches);
+		}
+		++it;
+	}
+}
+
+} // namespace flexisip
@@ -0,0 +1,130 @@
+/*
+	Flexisip, a flexible SIP proxy server with media capabilities.
+	Copyright (C) 2010-2020  Belledonne Communications SARL, All rights reserved.
+
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU Affero General Public License as
+	published by the Free Software Foundation, either version 3 of the
+	License, or (at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU Affero General Public License for more details.
+
+	You should have received a copy of the GNU Affero General Public License
+	along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include <flexisip/configmanager.hh>
+#include <flexisip/utils/timer.hh>
+
+#include <sofia-sip/sresolv.h>
+#include <sofia-sip/url.h>
+
+#include <cstdint>
+#include <ctime>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+namespace flexisip {
+
+/**
+ * @brief Cache of the DNS records used to reach the next hops of the requests.
+ * The records are kept for their TTL, the names that don't exist for a configurable time, and the records still
+ * in use are queried again shortly before they expire, so that busy destinations are always found in the cache.
+ * All queries are asynchronous: a destination whose records aren't cached yet is left to sofia's resolver.
+ */
+class DnsCache {
+public:
+	struct Destination {
+		std::string host; // numeric address, IPv6 ones being enclosed in brackets
+		std::string port; // empty for the default port
+		std::string transport; // empty if not selected by the resolution
+	};
+
+	/**
+	 * @param[in] resolvConf File listing the name servers to query, in resolv.conf format. The system ones are used
+	 * if empty.
+	 * @param[in] negativeTtl Time in seconds during which a name that couldn't be resolved isn't queried again.
+	 */
+	DnsCache(su_root_t *root, const std::string &resolvConf, int negativeTtl);
+	~DnsCache();
+
+	void setStats(StatCounter64 *hits, StatCounter64 *misses, StatCounter64 *prefetches);
+
+	/**
+	 * @brief Find the destination of a SIP URI in the cache, following RFC 3263 (NAPTR, SRV, then A/AAAA records).
+	 * The records missing from the cache are queried in the background.
+	 * @return false if the resolution isn't entirely cached, or if the URI doesn't have to be resolved by the cache:
+	 * numeric hosts, 'maddr' parameter or TLS, which needs the name to check the certificate. Also false when the
+	 * records give several destinations: the weighted selection among SRV targets and the failover to the next
+	 * destination are then left to the transaction, which a single rewritten address would prevent.
+	 */
+	bool resolve(const url_t *url, Destination &destination);
+
+private:
+	enum class Result {Found, Pending, NotFound, Multiple};
+
+	struct Srv {
+		uint16_t priority;
+		uint16_t weight;
+		uint16_t port;
+		std::string target;
+	};
+	struct Naptr {
+		uint16_t order;
+		uint16_t preference;
+		std::string services;
+		std::string replacement;
+	};
+	struct Entry {
+		uint16_t type = 0;
+		std::string name;
+		time_t expireAt = 0;
+		time_t lastUsed = 0;
+		uint32_t ttl = 0;
+		bool valid = false; // an answer has been received
+		bool negative = false;
+		bool pending = false;
+		std::vector<std::string> addresses;
+		std::vector<Srv> srv;
+		std::vector<Naptr> naptr;
+	};
+	struct Query {
+		DnsCache *cache;
+		std::string key;
+	};
+
+	// Records used during this time are queried again before they expire, the others are forgotten.
+	static constexpr int sIdleTimeout = 300;
+	static constexpr unsigned sMaintenanceInterval = 1000;
+
+	const Entry *lookup(uint16_t type, const std::string &name, time_t now);
+	void query(const std::string &key, Entry &entry);
+	void store(const std::string &key, sres_record_t **answers);
+	void maintain();
+
+	Result resolveName(const std::string &host, const char *port, const char *transport, time_t now,
+		Destination &destination);
+	Result resolveHost(const std::string &name, const std::string &port, const std::string &transport, time_t now,
+		Destination &destination);
+	Result resolveSrv(const Entry &srv, const std::string &transport, time_t now, Destination &destination);
+
+	static void onAnswer(sres_context_t *context, sres_query_t *query, sres_record_t **answers);
+
+	sres_resolver_t *mResolver = nullptr;
+	sofiasip::Timer mTimer;
+	std::unordered_map<std::string, Entry> mEntries; // by record type and name
+	std::unordered_set<Query *> mQueries;
+	int mNegativeTtl;
+	StatCounter64 *mCountHits = nullptr;
+	StatCounter64 *mCountMisses = nullptr;
+	StatCounter64 *mCountPrefetches = nullptr;
+};
+
+} // namespace flexisip
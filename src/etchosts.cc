@@ -18,7 +18,14 @@
 
 #include "etchosts.hh"
 
+#include <cerrno>
 #include <cstdio>
+#include <cstring>
+
+#include <unistd.h>
+#ifdef __linux__
+#include <sys/inotify.h>
+#endif
 
 using namespace std;
 using namespace flexisip;
@@ -26,7 +33,12 @@ using namespace flexisip;
 EtcHostsResolver *EtcHostsResolver::sInstance = NULL;
 
 EtcHostsResolver::EtcHostsResolver() {
+	load();
+}
+
+void EtcHostsResolver::load() {
 	char line[256] = {0};
+	mMap.clear();
 	FILE *f = fopen("/etc/hosts", "r");
 	if (f == NULL) {
 		LOGE("Could not open /etc/hosts");
@@ -51,6 +63,72 @@ EtcHostsResolver::EtcHostsResolver() {
 	fclose(f);
 }
 
+#ifdef __linux__
+
+void EtcHostsResolver::startWatching(su_root_t *root) {
+	if (mWatchFd >= 0) return;
+	int fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+	if (fd < 0) {
+		LOGE("Cannot create inotify instance, /etc/hosts changes won't be followed: %s", strerror(errno));
+		return;
+	}
+	// The directory is watched since editors and configuration tools usually replace the file instead of writing it.
+	if (inotify_add_watch(fd, "/etc", IN_CLOSE_WRITE | IN_MOVED_TO | IN_CREATE | IN_DELETE) < 0
+		|| su_wait_create(mWatchWait, fd, SU_WAIT_IN) != 0) {
+		LOGE("Cannot watch /etc, /etc/hosts changes won't be followed: %s", strerror(errno));
+		close(fd);
+		return;
+	}
+	mRoot = root;
+	mWatchFd = fd;
+	mWatchIndex = su_root_register(mRoot, mWatchWait, &EtcHostsResolver::onHostsChanged, (su_wakeup_arg_t *)this,
+								   su_pri_normal);
+}
+
+void EtcHostsResolver::stopWatching() {
+	if (mWatchFd < 0) return;
+	if (mWatchIndex >= 0) su_root_deregister(mRoot, mWatchIndex);
+	else su_wait_destroy(mWatchWait);
+	close(mWatchFd);
+	mWatchFd = -1;
+	mWatchIndex = -1;
+	mRoot = nullptr;
+}
+
+int EtcHostsResolver::onHostsChanged(su_root_magic_t *magic, su_wait_t *wait, su_wakeup_arg_t *arg) {
+	EtcHostsResolver *resolver = (EtcHostsResolver *)arg;
+	char buffer[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+	bool changed = false;
+
+	ssize_t len;
+	while ((len = read(resolver->mWatchFd, buffer, sizeof(buffer))) > 0) {
+		for (char *ptr = buffer; ptr < buffer + len;) {
+			auto *event = (struct inotify_event *)ptr;
+			if (event->len > 0 && strcmp(event->name, "hosts") == 0) changed = true;
+			ptr += sizeof(struct inotify_event) + event->len;
+		}
+	}
+	if (changed) {
+		LOGI("/etc/hosts changed, reloading it");
+		resolver->load();
+	}
+	return 0;
+}
+
+#else
+
+void EtcHostsResolver::startWatching(su_root_t *root) {
+}
+
+void EtcHostsResolver::stopWatching() {
+}
+
+int EtcHostsResolver::onHostsChanged(su_root_magic_t *magic, su_wait_t *wait, su_wakeup_arg_t *arg) {
+	return 0;
+}
+
+#endif
+
 void EtcHostsResolver::atexit() {
 	if (sInstance != NULL) {
 		delete sInstance;
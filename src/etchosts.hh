@@ -20,8 +20,10 @@
 
 #include <flexisip/common.hh>
 
-#include <map>
+#include <sofia-sip/su_wait.h>
+
 #include <string>
+#include <unordered_map>
 
 namespace flexisip {
 
@@ -31,11 +33,21 @@ class EtcHostsResolver {
 	bool resolve(const std::string &name, std::string *result) const;
 	void setHost(const std::string &name, const std::string &result);
 
+	/* Reload the hosts file each time it is modified, as long as the main loop is running. */
+	void startWatching(su_root_t *root);
+	void stopWatching();
+
   private:
 	EtcHostsResolver();
+	void load();
+	static int onHostsChanged(su_root_magic_t *magic, su_wait_t *wait, su_wakeup_arg_t *arg);
 	static void atexit(); // Don't call directly!
-	std::map<std::string, std::string> mMap;
-	std::map<std::string, std::string> mOverrideMap;
+	std::unordered_map<std::string, std::string> mMap;
+	std::unordered_map<std::string, std::string> mOverrideMap;
+	su_root_t *mRoot = nullptr;
+	int mWatchFd = -1;
+	int mWatchIndex = -1;
+	su_wait_t mWatchWait[1];
 	static EtcHostsResolver *sInstance;
 };
 
@@ -25,6 +25,9 @@
 #include <sofia-sip/su_tagarg.h>
 #include <sofia-sip/msg_addr.h>
 
+#include "sdp-modifier.hh"
+#include "utils/object-pool.hh"
+
 using namespace std;
 
 namespace flexisip {
@@ -62,7 +65,7 @@ msg_header_t *MsgSip::findHeader(const std::string &name) {
 const char *MsgSip::print() {
 	// make sure the message is serialized before showing it; it can be very confusing.
 	size_t msg_size;
-	msg_serialize(mMsg, (msg_pub_t *)getSip());
+	serialize();
 	return msg_as_string(getHome(), mMsg, NULL, 0, &msg_size);
 }
 
@@ -86,8 +89,25 @@ std::string MsgSip::printContext() const {
 	return os.str();
 }
 
+shared_ptr<SdpModifier> MsgSip::getSdpModifier(const string &nortproxy) {
+	if (!mSdpParsed) {
+		mSdpParsed = true;
+		mSdpModifier = SdpModifier::createFromSipMsg(getHome(), getSip(), nortproxy);
+	} else if (mSdpModifier) {
+		mSdpModifier->setNortproxy(nortproxy);
+	}
+	return mSdpModifier;
+}
+
+int MsgSip::commitSdp() const {
+	if (!mSdpModifier || !mSdpModifier->isModified()) return 0;
+	return mSdpModifier->update(mMsg, getSip());
+}
+
 MsgSip::~MsgSip() {
 	// LOGD("Destroy MsgSip %p", this);
+	// The SDP parser is allocated from the home of the message, it must be freed first.
+	mSdpModifier.reset();
 	msg_destroy(mMsg);
 }
 
@@ -214,6 +234,7 @@ RequestSipEvent::RequestSipEvent(const shared_ptr<RequestSipEvent> &sipEvent)
 void RequestSipEvent::send(const shared_ptr<MsgSip> &msg, url_string_t const *u, tag_type_t tag, tag_value_t value,
 						   ...) {
 	if (mOutgoingAgent != NULL) {
+		msg->commitSdp();
 		if (LOGD_ENABLED()){
 			SLOGD << "Sending Request SIP message to " << (u ? url_as_string(msg->getHome(), (url_t const *)u) : "NULL")
 			  << "\n" << *msg;
@@ -249,7 +270,7 @@ void RequestSipEvent::setIncomingAgent(const shared_ptr<IncomingAgent> &agent) {
 std::shared_ptr<IncomingTransaction> RequestSipEvent::createIncomingTransaction() {
 	auto transaction = dynamic_pointer_cast<IncomingTransaction>(mIncomingAgent);
 	if (transaction == nullptr) {
-		transaction = make_shared<IncomingTransaction>(mIncomingAgent->getAgent());
+		transaction = makePooledShared<IncomingTransaction>(mIncomingAgent->getAgent());
 		mIncomingAgent = transaction;
 		transaction->handle(mMsgSip);
 		linkTransactions();
@@ -260,7 +281,7 @@ std::shared_ptr<IncomingTransaction> RequestSipEvent::createIncomingTransaction(
 std::shared_ptr<OutgoingTransaction> RequestSipEvent::createOutgoingTransaction() {
 	auto transaction = dynamic_pointer_cast<OutgoingTransaction>(mOutgoingAgent);
 	if (transaction == nullptr) {
-		transaction = make_shared<OutgoingTransaction>(mOutgoingAgent->getAgent());
+		transaction = makePooledShared<OutgoingTransaction>(mOutgoingAgent->getAgent());
 		mOutgoingAgent = transaction;
 		linkTransactions();
 	}
@@ -361,6 +382,7 @@ void ResponseSipEvent::send(const shared_ptr<MsgSip> &msg, url_string_t const *u
 			sip_via_remove(msg->getMsg(), msg->getSip());
 			via_popped = true;
 		}
+		msg->commitSdp();
 		if (msg->getSip()->sip_via)
 			checkContentLength(msg, msg->getSip()->sip_via);
 		if (LOGD_ENABLED()){
@@ -24,6 +24,7 @@
 #include <fcntl.h>
 #include <sys/stat.h>
 #include <sys/types.h>
+#include <sys/uio.h>
 
 #include <flexisip/configmanager.hh>
 #include <flexisip/eventlogs.hh>
@@ -45,6 +46,9 @@ EventLog::Init::Init() {
 		{String, "filesystem-directory", "Directory where event logs are written as a filesystem (case when filesystem "
 		 "output is choosed).",
 		 "/var/log/flexisip"},
+		{Integer, "filesystem-max-open-files", "Maximum number of event log files kept open by the filesystem logger "
+		 "between two writes.",
+		 "64"},
 		{String, "database-backend", "Choose the type of backend that Soci will use for the connection.\n"
 		 "Depending on your Soci package and the modules you installed, the supported databases are:"
 		 "`mysql`, `sqlite3` and `postgresql`",
@@ -65,6 +69,13 @@ EventLog::Init::Init() {
 		{Integer, "database-nb-threads-max", "Maximum number of threads for writing in database.\n"
 		 "If you get a `database is locked` error with sqlite3, you must set this variable to 1.",
 		 "10"},
+		{Integer, "database-batch-size", "Maximum number of events written in database within a single transaction.\n"
+		 "Events are accumulated until this amount is reached or until the oldest one has waited for "
+		 "'database-batch-max-delay' milliseconds. A value of 1 writes each event in its own transaction.",
+		 "50"},
+		{Integer, "database-batch-max-delay", "Maximum time, in milliseconds, an event may wait for its batch to "
+		 "be complete before being written in database.",
+		 "200"},
 
 		 // Deprecated parameters
 		{String, "dir", "Directory where event logs are written as a filesystem (case when filesystem output is choosed).",
@@ -80,6 +91,14 @@ EventLog::Init::Init() {
 	GenericManager::get()->getRoot()->addChild(ev);
 	ev->addChildrenValues(items);
 	ev->get<ConfigString>("dir")->setDeprecated({"2020-02-19", "2.0.0", "Replaced by 'filesystem-directory'"});
+
+	ev->createStat("count-database-batches", "Number of batches of events written in database.");
+	ev->createStat("count-database-written-events", "Number of events written in database.");
+	ev->createStat("count-database-dropped-events",
+		"Number of events dropped because the queue was full or the database transaction failed.");
+	ev->createStat("database-last-batch-size", "Number of events of the last batch written in database.");
+	ev->createStat("database-last-queue-latency",
+		"Time, in milliseconds, the oldest event of the last batch has spent in queue.");
 }
 
 EventLog::EventLog(const sip_t *sip):
@@ -226,7 +245,8 @@ static std::ostream &operator<<(std::ostream &ostr, MessageLog::ReportType type)
 	return ostr;
 }
 
-FilesystemEventLogWriter::FilesystemEventLogWriter(const std::string &rootpath) : mRootPath(rootpath) {
+FilesystemEventLogWriter::FilesystemEventLogWriter(const std::string &rootpath, unsigned int maxOpenFiles) :
+	mRootPath(rootpath), mMaxOpenFiles(max(maxOpenFiles, 1u)) {
 	if (rootpath[0] != '/') {
 		LOGE("Path for event log writer must be absolute.");
 		return;
@@ -234,67 +254,189 @@ FilesystemEventLogWriter::FilesystemEventLogWriter(const std::string &rootpath)
 	if (!createDirectoryIfNotExist(rootpath.c_str()))
 		return;
 
+	mThread = thread(&FilesystemEventLogWriter::run, this);
 	mIsReady = true;
 }
 
-int FilesystemEventLogWriter::openPath(const url_t *uri, const char *kind, time_t curtime, int errorcode) {
-	ostringstream path;
+FilesystemEventLogWriter::~FilesystemEventLogWriter() {
+	{
+		unique_lock<mutex> lock(mMutex);
+		mShutdown = true;
+	}
+	mCondition.notify_one();
+	if (mThread.joinable()) mThread.join();
+	closeFiles();
+}
+
+void FilesystemEventLogWriter::write(std::shared_ptr<const EventLog> evlog) {
+	{
+		unique_lock<mutex> lock(mMutex);
+		if (mQueue.size() >= sMaxQueueSize) {
+			lock.unlock();
+			LOGE("FilesystemEventLogWriter: too many events in queue! (%i)", (int)sMaxQueueSize);
+			return;
+		}
+	}
+	evlog->write(*this);
+	mCondition.notify_one();
+}
 
+void FilesystemEventLogWriter::run() {
+	vector<LogLine> lines{};
+	while (true) {
+		{
+			unique_lock<mutex> lock(mMutex);
+			mCondition.wait(lock, [this]() {return !mQueue.empty() || mShutdown;});
+			if (mQueue.empty()) return;
+			lines.swap(mQueue);
+		}
+		// Group all the pending lines first so that each file is written once per batch.
+		for (auto &log : lines) {
+			ostringstream path;
+			if (makePath(path, log)) mPendingWrites[path.str()].push_back(move(log.line));
+		}
+		lines.clear();
+		flush();
+	}
+}
+
+void FilesystemEventLogWriter::flush() {
+	// IOV_MAX is at least 1024 on Linux. Stay well below it.
+	constexpr size_t maxIovecs = 64;
+	iovec iov[maxIovecs];
+
+	for (auto &entry : mPendingWrites) {
+		const auto &path = entry.first;
+		const auto &logs = entry.second;
+		int fd = getFd(path);
+		if (fd == -1) continue;
+
+		for (size_t first = 0; first < logs.size(); first += maxIovecs) {
+			auto count = min(maxIovecs, logs.size() - first);
+			ssize_t expected = 0;
+			for (size_t i = 0; i < count; ++i) {
+				const auto &logstr = logs[first + i];
+				iov[i].iov_base = const_cast<char *>(logstr.data());
+				iov[i].iov_len = logstr.size();
+				expected += logstr.size();
+			}
+			auto written = ::writev(fd, iov, count);
+			if (written == -1) {
+				LOGE("Fail to write event log in %s: %s", path.c_str(), strerror(errno));
+				break;
+			} else if (written != expected) {
+				LOGE("Fail to write event log in %s: only %zd bytes out of %zd written", path.c_str(), written, expected);
+				break;
+			}
+		}
+	}
+	mPendingWrites.clear();
+}
+
+void FilesystemEventLogWriter::appendLog(
+	const url_t *uri, const char *kind, time_t curtime,
+	const std::string &logstr, int errorcode
+) {
+	LogLine log{"", "", kind, curtime, errorcode, logstr};
 	if (errorcode == 0) {
-		const char *username = uri->url_user;
-		const char *domain = uri->url_host;
+		log.user = uri->url_user ? uri->url_user : "anonymous";
+		log.domain = uri->url_host ? uri->url_host : "";
+	}
+	unique_lock<mutex> lock(mMutex);
+	mQueue.push_back(move(log));
+}
 
+bool FilesystemEventLogWriter::makePath(std::ostringstream &path, const LogLine &log) {
+	if (log.errorCode == 0) {
 		path << mRootPath << "/users";
 
-		if (!createDirectoryIfNotExist(path.str().c_str()))
-			return -1;
-
-		path << "/" << domain;
+		if (!createDirectory(path.str()))
+			return false;
 
-		if (!createDirectoryIfNotExist(path.str().c_str()))
-			return -1;
+		path << "/" << log.domain;
 
-		if (!username)
-			username = "anonymous";
+		if (!createDirectory(path.str()))
+			return false;
 
-		path << "/" << username;
+		path << "/" << log.user;
 
-		if (!createDirectoryIfNotExist(path.str().c_str()))
-			return -1;
-		path << "/" << kind;
+		if (!createDirectory(path.str()))
+			return false;
+		path << "/" << log.kind;
 
-		if (!createDirectoryIfNotExist(path.str().c_str()))
-			return -1;
+		if (!createDirectory(path.str()))
+			return false;
 	} else {
 		path << mRootPath << "/" << "errors/";
-		if (!createDirectoryIfNotExist(path.str().c_str()))
-			return -1;
-		path << kind;
-		if (!createDirectoryIfNotExist(path.str().c_str()))
-			return -1;
-		path << "/" << errorcode;
-		if (!createDirectoryIfNotExist(path.str().c_str()))
-			return -1;
+		if (!createDirectory(path.str()))
+			return false;
+		path << log.kind;
+		if (!createDirectory(path.str()))
+			return false;
+		path << "/" << log.errorCode;
+		if (!createDirectory(path.str()))
+			return false;
 	}
 
 	struct tm tm;
-	localtime_r(&curtime, &tm);
+	localtime_r(&log.date, &tm);
 	path << "/" << 1900 + tm.tm_year << "-" << std::setfill('0') << std::setw(2) << tm.tm_mon + 1 << "-" <<
 		std::setfill('0') << std::setw(2) << tm.tm_mday << ".log";
 
-	int fd = open(path.str().c_str(), O_WRONLY | O_CREAT | O_APPEND, S_IRUSR | S_IWUSR);
+	// Log files are rotated every day: the files of the previous day won't be written anymore.
+	int day = tm.tm_year * 1000 + tm.tm_yday;
+	if (day > mCurrentDay) {
+		if (mCurrentDay != -1) closeFiles();
+		mCurrentDay = day;
+	}
+	return true;
+}
+
+bool FilesystemEventLogWriter::createDirectory(const std::string &path) {
+	if (mKnownDirectories.find(path) != mKnownDirectories.end())
+		return true;
+	if (!createDirectoryIfNotExist(path.c_str()))
+		return false;
+	mKnownDirectories.insert(path);
+	return true;
+}
+
+int FilesystemEventLogWriter::getFd(const std::string &path) {
+	auto it = mOpenFilesByPath.find(path);
+	if (it != mOpenFilesByPath.end()) {
+		mOpenFiles.splice(mOpenFiles.begin(), mOpenFiles, it->second);
+		return it->second->second;
+	}
+
+	int fd = open(path.c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, S_IRUSR | S_IWUSR);
 	if (fd == -1) {
-		LOGE("Cannot open %s: %s", path.str().c_str(), strerror(errno));
+		LOGE("Cannot open %s: %s", path.c_str(), strerror(errno));
+		// The directory may have been removed behind our back.
+		mKnownDirectories.clear();
 		return -1;
 	}
+
+	if (mOpenFiles.size() >= mMaxOpenFiles) {
+		const auto &lru = mOpenFiles.back();
+		close(lru.second);
+		mOpenFilesByPath.erase(lru.first);
+		mOpenFiles.pop_back();
+	}
+	mOpenFiles.emplace_front(path, fd);
+	mOpenFilesByPath[path] = mOpenFiles.begin();
 	return fd;
 }
 
+void FilesystemEventLogWriter::closeFiles() {
+	for (const auto &file : mOpenFiles) {
+		close(file.second);
+	}
+	mOpenFiles.clear();
+	mOpenFilesByPath.clear();
+}
+
 void FilesystemEventLogWriter::writeRegistrationLog(const RegistrationLog &rlog) {
 	const char *label = "registers";
-	int fd = openPath(rlog.getFrom()->a_url, label, rlog.getDate());
-	if (fd == -1)
-		return;
 
 	ostringstream msg;
 	msg << PrettyTime(rlog.getDate()) << ": " << rlog.getType() << " " << rlog.getFrom();
@@ -304,10 +446,7 @@ void FilesystemEventLogWriter::writeRegistrationLog(const RegistrationLog &rlog)
 		msg << rlog.getUserAgent();
 	msg << endl;
 
-	if (::write(fd, msg.str().c_str(), msg.str().size()) == -1) {
-		LOGE("Fail to write registration log: %s", strerror(errno));
-	}
-	close(fd);
+	appendLog(rlog.getFrom()->a_url, label, rlog.getDate(), msg.str());
 	if (rlog.getStatusCode() >= 300) {
 		writeErrorLog(rlog, label, msg.str());
 	}
@@ -315,8 +454,6 @@ void FilesystemEventLogWriter::writeRegistrationLog(const RegistrationLog &rlog)
 
 void FilesystemEventLogWriter::writeCallLog(const CallLog &calllog) {
 	const char *label = "calls";
-	int fd1 = openPath(calllog.getFrom()->a_url, label, calllog.getDate());
-	int fd2 = openPath(calllog.getTo()->a_url, label, calllog.getDate());
 
 	ostringstream msg;
 
@@ -327,20 +464,12 @@ void FilesystemEventLogWriter::writeCallLog(const CallLog &calllog) {
 		msg << calllog.getStatusCode() << " " << calllog.getReason();
 	msg << endl;
 
-	if (fd1 == -1 || ::write(fd1, msg.str().c_str(), msg.str().size()) == -1) {
-		LOGE("Fail to write registration log: %s", strerror(errno));
-	}
+	appendLog(calllog.getFrom()->a_url, label, calllog.getDate(), msg.str());
 	// Avoid to write logs for users that possibly do not exist.
 	// However the error will be reported in the errors directory.
 	if (calllog.getStatusCode() != 404) {
-		if (fd2 == -1 || ::write(fd2, msg.str().c_str(), msg.str().size()) == -1) {
-			LOGE("Fail to write registration log: %s", strerror(errno));
-		}
+		appendLog(calllog.getTo()->a_url, label, calllog.getDate(), msg.str());
 	}
-	if (fd1 != -1)
-		close(fd1);
-	if (fd2 != -1)
-		close(fd2);
 	if (calllog.getStatusCode() >= 300) {
 		writeErrorLog(calllog, label, msg.str());
 	}
@@ -357,33 +486,13 @@ void FilesystemEventLogWriter::writeMessageLog(const MessageLog &mlog) {
 		msg << " (" << mlog.getUri() << ") ";
 	msg << mlog.getStatusCode() << " " << mlog.getReason() << endl;
 
-	if (mlog.getReportType() == MessageLog::ReportType::ReceivedFromUser){
-		int fd = openPath(mlog.getFrom()->a_url, label, mlog.getDate());
-		if (fd != -1){
-			if (::write(fd, msg.str().c_str(), msg.str().size()) == -1) {
-				LOGE("Fail to write message log: %s", strerror(errno));
-			}
-			close(fd);
-		}
-	}else { //MessageLog::DeliveredToUser
-		/*the event is added into the sender's log file and the receiver's log file, for convenience*/
-		int fd = openPath(mlog.getFrom()->a_url, label, mlog.getDate());
-		if (fd != -1){
-			if (::write(fd, msg.str().c_str(), msg.str().size()) == -1) {
-				LOGE("Fail to write message log: %s", strerror(errno));
-			}
-			close(fd);
-		}
+	/*the event is added into the sender's log file and, when delivered, into the receiver's log file, for convenience*/
+	appendLog(mlog.getFrom()->a_url, label, mlog.getDate(), msg.str());
+	if (mlog.getReportType() == MessageLog::ReportType::DeliveredToUser) {
 		// Avoid to write logs for users that possibly do not exist.
 		// However the error will be reported in the errors directory.
-		if (mlog.getStatusCode() != 404){
-			fd = openPath(mlog.getTo()->a_url, label, mlog.getDate());
-			if (fd != -1){
-				if (::write(fd, msg.str().c_str(), msg.str().size()) == -1) {
-					LOGE("Fail to write message log: %s", strerror(errno));
-				}
-				close(fd);
-			}
+		if (mlog.getStatusCode() != 404) {
+			appendLog(mlog.getTo()->a_url, label, mlog.getDate(), msg.str());
 		}
 	}
 	if (mlog.getStatusCode() >= 300) {
@@ -393,9 +502,6 @@ void FilesystemEventLogWriter::writeMessageLog(const MessageLog &mlog) {
 
 void FilesystemEventLogWriter::writeCallQualityStatisticsLog(const CallQualityStatisticsLog &mlog) {
 	const char *label = "statistics_reports";
-	int fd = openPath(mlog.getFrom()->a_url, label, mlog.getDate());
-	if (fd == -1)
-		return;
 	ostringstream msg;
 
 	msg << PrettyTime(mlog.getDate()) << " ";
@@ -403,11 +509,7 @@ void FilesystemEventLogWriter::writeCallQualityStatisticsLog(const CallQualitySt
 	msg << mlog.getStatusCode() << " " << mlog.getReason() << ": ";
 	msg << mlog.getReport() << endl;
 
-	if (::write(fd, msg.str().c_str(), msg.str().size()) == -1) {
-		LOGE("Fail to write registration log: %s", strerror(errno));
-	}
-
-	close(fd);
+	appendLog(mlog.getFrom()->a_url, label, mlog.getDate(), msg.str());
 	if (mlog.getStatusCode() >= 300) {
 		writeErrorLog(mlog, label, msg.str());
 	}
@@ -425,13 +527,7 @@ void FilesystemEventLogWriter::writeAuthLog(const AuthLog &alog) {
 	msg << alog.getStatusCode() << " " << alog.getReason() << endl;
 
 	if (alog.userExists()) {
-		int fd = openPath(alog.getFrom()->a_url, label, alog.getDate());
-		if (fd != -1) {
-			if (::write(fd, msg.str().c_str(), msg.str().size()) == -1) {
-				LOGE("Fail to write auth log: %s", strerror(errno));
-			}
-			close(fd);
-		}
+		appendLog(alog.getFrom()->a_url, label, alog.getDate(), msg.str());
 	}
 	writeErrorLog(alog, "auth", msg.str());
 }
@@ -440,13 +536,7 @@ void FilesystemEventLogWriter::writeErrorLog(
 	const EventLog &log, const char *kind,
 	const std::string &logstr
 ) {
-	int fd = openPath(NULL, kind, log.getDate(), log.getStatusCode());
-	if (fd == -1)
-		return;
-	if (::write(fd, logstr.c_str(), logstr.size()) == -1) {
-		LOGE("Fail to write error log: %s", strerror(errno));
-	}
-	close(fd);
+	appendLog(NULL, kind, log.getDate(), logstr, log.getStatusCode());
 }
 
 #if ENABLE_SOCI
@@ -692,13 +782,23 @@ DataBaseEventLogWriter::DataBaseEventLogWriter(
 	const std::string &backendString,
 	const std::string &connectionString,
 	unsigned int maxQueueSize,
-	unsigned int nbThreadsMax
+	unsigned int nbThreadsMax,
+	unsigned int batchSize,
+	std::chrono::milliseconds batchMaxDelay
 ) :
-	mMaxQueueSize{maxQueueSize}
+	mMaxQueueSize{maxQueueSize},
+	mBatchSize{max(batchSize, 1u)},
+	mBatchMaxDelay{batchMaxDelay}
 {
+	auto *cr = GenericManager::get()->getRoot()->get<GenericStruct>("event-logs");
+	mCountBatches = cr->get<StatCounter64>("count-database-batches");
+	mCountWrittenEvents = cr->get<StatCounter64>("count-database-written-events");
+	mCountDroppedEvents = cr->get<StatCounter64>("count-database-dropped-events");
+	mLastBatchSize = cr->get<StatCounter64>("database-last-batch-size");
+	mLastQueueLatency = cr->get<StatCounter64>("database-last-queue-latency");
+
 	try {
 		mConnectionPool = make_unique<soci::connection_pool>(nbThreadsMax);
-		mThreadPool = make_unique<ThreadPool>(nbThreadsMax, maxQueueSize);
 
 		for (unsigned int i = 0; i < nbThreadsMax; i++) {
 			mConnectionPool->at(i).open(backendString, connectionString);
@@ -723,6 +823,10 @@ DataBaseEventLogWriter::DataBaseEventLogWriter(
 		}
 
 		// Build insert requests.
+		mInsertEventReq = "INSERT INTO event_log "
+			"(type_id, sip_from, sip_to, user_agent, date, status_code, reason, completed, call_id, priority)"
+			"VALUES (:typeId, :sipFrom, :sipTo, :userAgent, :date, :statusCode, :reason, :completed, :callId, :priority)";
+
 		const auto &lastIdFunction = backend->lastIdFunction();
 		mInsertReq[SqlRegistrationEventLogId] =
 			"INSERT INTO event_registration_log VALUES (" + lastIdFunction + ", :typeId, :contacts)";
@@ -737,7 +841,15 @@ DataBaseEventLogWriter::DataBaseEventLogWriter(
 			"INSERT INTO event_auth_log VALUES (" +	lastIdFunction + ", :method, :origin, :userExists)";
 
 		mInsertReq[SqlCallQualityEventLogId] =
-			"INSERT INTO event_call_quality_log VALUES (" + lastIdFunction + ", :report)";
+			"INSERT INTO event_call_quality_statistics_log VALUES (" + lastIdFunction + ", :report)";
+
+		// Each worker holds one connection of the pool for its whole lifetime.
+		for (unsigned int i = 0; i < nbThreadsMax; i++) {
+			mWorkers.emplace_back(make_unique<Worker>(*this, *mConnectionPool));
+		}
+		for (auto &worker : mWorkers) {
+			worker->start();
+		}
 
 		mIsReady = true;
 	} catch (exception const &e) {
@@ -745,19 +857,28 @@ DataBaseEventLogWriter::DataBaseEventLogWriter(
 	}
 }
 
-void DataBaseEventLogWriter::writeEventLog(soci::session &session, const EventLog &evlog, int typeId) {
-	tm date;
-	auto from = sipDataToString(evlog.getFrom());
-	auto to = sipDataToString(evlog.getTo());
-	auto ua = sipDataToString(evlog.getUserAgent());
-	auto completed = boolToSqlString(evlog.isCompleted());
+DataBaseEventLogWriter::~DataBaseEventLogWriter() {
+	{
+		unique_lock<mutex> lock(mMutex);
+		mShutdown = true;
+	}
+	mCondition.notify_all();
+	for (auto &worker : mWorkers) {
+		worker->join();
+	}
+}
 
-	session << "INSERT INTO event_log "
-		"(type_id, sip_from, sip_to, user_agent, date, status_code, reason, completed, call_id, priority)"
-		"VALUES (:typeId, :sipFrom, :sipTo, :userAgent, :date, :statusCode, :reason, :completed, :callId, :priority)",
-		soci::use(typeId), soci::use(from), soci::use(to),
-		soci::use(ua), soci::use(*gmtime_r(&evlog.getDate(), &date)), soci::use(evlog.getStatusCode()),
-		soci::use(evlog.getReason()), soci::use(completed), soci::use(evlog.getCallId()), soci::use(evlog.getPriority());
+void DataBaseEventLogWriter::writeEventLog(EventRow &row, const EventLog &evlog, int typeId) {
+	row.typeId = typeId;
+	row.from = sipDataToString(evlog.getFrom());
+	row.to = sipDataToString(evlog.getTo());
+	row.userAgent = sipDataToString(evlog.getUserAgent());
+	gmtime_r(&evlog.getDate(), &row.date);
+	row.statusCode = evlog.getStatusCode();
+	row.reason = evlog.getReason();
+	row.completed = boolToSqlString(evlog.isCompleted());
+	row.callId = evlog.getCallId();
+	row.priority = evlog.getPriority();
 }
 
 // IMPORTANT
@@ -770,80 +891,187 @@ void DataBaseEventLogWriter::writeEventLog(soci::session &session, const EventLo
 // If 100 events are generated in one second, in 6 years we won't be able to use this value.
 // So the choice here is to use the `LAST_INSERT_ID()` and `last_insert_rowid()`
 // from MySQL and SQlite3 directly in SQL.
+//
+// This is also why the rows of a batch are not merged into a single multi-row INSERT:
+// each specialized row must be inserted right after its event_log row to get its id.
+// The rows of a batch share a single transaction and statements prepared once per
+// connection instead.
 
 void DataBaseEventLogWriter::writeRegistrationLog(const RegistrationLog &evlog) {
-	soci::session session{*mConnectionPool};
-	DB_TRANSACTION(&session) {
-		auto contact = sipDataToString(evlog.getContacts());
-		writeEventLog(session, evlog, SqlRegistrationEventLogId);
-		session << mInsertReq[SqlRegistrationEventLogId], soci::use(int(evlog.getType())), soci::use(contact);
-		tr.commit();
-	};
+	EventRow row{};
+	writeEventLog(row, evlog, SqlRegistrationEventLogId);
+	row.specificTypeId = int(evlog.getType());
+	row.specificColumns[0] = sipDataToString(evlog.getContacts());
+	enqueue(move(row));
 }
 
 void DataBaseEventLogWriter::writeCallLog(const CallLog &evlog) {
-	soci::session session{*mConnectionPool};
-	DB_TRANSACTION(&session) {
-		auto cancelled = boolToSqlString(evlog.isCancelled());
-		writeEventLog(session, evlog, SqlCallEventLogId);
-		session << mInsertReq[SqlCallEventLogId], soci::use(cancelled);
-		tr.commit();
-	};
+	EventRow row{};
+	writeEventLog(row, evlog, SqlCallEventLogId);
+	row.specificColumns[0] = boolToSqlString(evlog.isCancelled());
+	enqueue(move(row));
 }
 
 void DataBaseEventLogWriter::writeMessageLog(const MessageLog &evlog) {
-	soci::session session{*mConnectionPool};
-	DB_TRANSACTION(&session) {
-		auto uri = sipDataToString(evlog.getUri());
-		writeEventLog(session, evlog, SqlMessageEventLogId);
-		session << mInsertReq[SqlMessageEventLogId], soci::use(int(evlog.getReportType())), soci::use(uri);
-		tr.commit();
-	};
+	EventRow row{};
+	writeEventLog(row, evlog, SqlMessageEventLogId);
+	row.specificTypeId = int(evlog.getReportType());
+	row.specificColumns[0] = sipDataToString(evlog.getUri());
+	enqueue(move(row));
 }
 
 void DataBaseEventLogWriter::writeAuthLog(const AuthLog &evlog) {
-	soci::session session{*mConnectionPool};
-	DB_TRANSACTION(&session) {
-		auto origin = sipDataToString(evlog.getOrigin());
-		auto userExists = boolToSqlString(evlog.userExists());
-		writeEventLog(session, evlog, SqlAuthEventLogId);
-		session << mInsertReq[SqlAuthEventLogId], soci::use(evlog.getMethod()), soci::use(origin), soci::use(userExists);
-		tr.commit();
-	};
+	EventRow row{};
+	writeEventLog(row, evlog, SqlAuthEventLogId);
+	row.specificColumns[0] = evlog.getMethod();
+	row.specificColumns[1] = sipDataToString(evlog.getOrigin());
+	row.specificColumns[2] = boolToSqlString(evlog.userExists());
+	enqueue(move(row));
 }
 
 void DataBaseEventLogWriter::writeCallQualityStatisticsLog(const CallQualityStatisticsLog &evlog) {
-	soci::session session{*mConnectionPool};
-	DB_TRANSACTION(&session) {
-		writeEventLog(session, evlog, SqlCallQualityEventLogId);
-		session << mInsertReq[SqlCallQualityEventLogId], soci::use(evlog.getReport());
-		tr.commit();
-	};
+	EventRow row{};
+	writeEventLog(row, evlog, SqlCallQualityEventLogId);
+	row.specificColumns[0] = evlog.getReport();
+	enqueue(move(row));
 }
 
-void DataBaseEventLogWriter::writeEventFromQueue() {
-	mMutex.lock();
-	auto evlog = mListLogs.front();
-	mListLogs.pop();
-	mMutex.unlock();
+void DataBaseEventLogWriter::write(std::shared_ptr<const EventLog> evlog) {
 	evlog->write(*this);
 }
 
-void DataBaseEventLogWriter::write(std::shared_ptr<const EventLog> evlog) {
-	mMutex.lock();
+void DataBaseEventLogWriter::enqueue(EventRow &&row) {
+	size_t queueSize;
+	{
+		unique_lock<mutex> lock(mMutex);
+		if (mRows.size() >= mMaxQueueSize) {
+			mCountDroppedEvents->incr();
+			lock.unlock();
+			LOGE("DataBaseEventLogWriter: too many events in queue! (%i)", (int)mMaxQueueSize);
+			return;
+		}
+		row.enqueueTime = chrono::steady_clock::now();
+		mRows.push_back(move(row));
+		queueSize = mRows.size();
+	}
 
-	if (mListLogs.size() < mMaxQueueSize) {
-		mListLogs.push(move(evlog));
-		mMutex.unlock();
+	// Wake up a worker to arm the batch delay for the first event, then once per complete batch.
+	if (queueSize == 1 || queueSize % mBatchSize == 0) {
+		mCondition.notify_one();
+	}
+}
 
-		// Save event in database.
-		if (!mThreadPool->run(bind(&DataBaseEventLogWriter::writeEventFromQueue, this))) {
-			LOGE("DataBaseEventLogWriter: unable to enqueue event!");
+bool DataBaseEventLogWriter::popBatch(std::vector<EventRow> &batch) {
+	unique_lock<mutex> lock(mMutex);
+	while (true) {
+		mCondition.wait(lock, [this]() {return !mRows.empty() || mShutdown;});
+		if (mRows.empty()) return false; // Shutdown requested and nothing left to write.
+
+		if (mRows.size() < mBatchSize && !mShutdown) {
+			// Wait for the batch to be complete, at most until the oldest event reaches the max delay.
+			auto deadline = mRows.front().enqueueTime + mBatchMaxDelay;
+			mCondition.wait_until(lock, deadline, [this]() {return mRows.size() >= mBatchSize || mShutdown;});
+			// Another worker may have taken the pending events in the meantime.
+			if (mRows.empty()) continue;
 		}
-	} else {
-		mMutex.unlock();
-		LOGE("DataBaseEventLogWriter: too many events in queue! (%i)", (int)mMaxQueueSize);
+
+		auto latency = chrono::steady_clock::now() - mRows.front().enqueueTime;
+		auto count = min<size_t>(mRows.size(), mBatchSize);
+		batch.assign(make_move_iterator(mRows.begin()), make_move_iterator(mRows.begin() + count));
+		mRows.erase(mRows.begin(), mRows.begin() + count);
+
+		mLastBatchSize->set(count);
+		mLastQueueLatency->set(chrono::duration_cast<chrono::milliseconds>(latency).count());
+		return true;
+	}
+}
+
+void DataBaseEventLogWriter::onBatchWritten(std::size_t written, std::size_t dropped) {
+	unique_lock<mutex> lock(mMutex);
+	if (written > 0) {
+		mCountBatches->incr();
+		mCountWrittenEvents->set(mCountWrittenEvents->read() + written);
+	}
+	if (dropped > 0) {
+		mCountDroppedEvents->set(mCountDroppedEvents->read() + dropped);
+	}
+}
+
+DataBaseEventLogWriter::Worker::Worker(DataBaseEventLogWriter &writer, soci::connection_pool &pool) :
+	mWriter{writer}, mSession{pool} {}
+
+void DataBaseEventLogWriter::Worker::start() {
+	mThread = thread(&Worker::run, this);
+}
+
+void DataBaseEventLogWriter::Worker::join() {
+	if (mThread.joinable()) mThread.join();
+}
+
+void DataBaseEventLogWriter::Worker::run() {
+	vector<EventRow> batch{};
+	while (mWriter.popBatch(batch)) {
+		auto written = writeBatch(batch);
+		mWriter.onBatchWritten(written, batch.size() - written);
+		batch.clear();
+	}
+}
+
+void DataBaseEventLogWriter::Worker::prepareStatements() {
+	mEventStatement = make_unique<soci::statement>((mSession.prepare << mWriter.mInsertEventReq,
+		soci::use(mRow.typeId), soci::use(mRow.from), soci::use(mRow.to), soci::use(mRow.userAgent),
+		soci::use(mRow.date), soci::use(mRow.statusCode), soci::use(mRow.reason), soci::use(mRow.completed),
+		soci::use(mRow.callId), soci::use(mRow.priority)));
+
+	const auto &req = mWriter.mInsertReq;
+	auto &columns = mRow.specificColumns;
+	mSpecificStatements[SqlRegistrationEventLogId] = make_unique<soci::statement>((mSession.prepare <<
+		req[SqlRegistrationEventLogId], soci::use(mRow.specificTypeId), soci::use(columns[0])));
+	mSpecificStatements[SqlCallEventLogId] = make_unique<soci::statement>((mSession.prepare <<
+		req[SqlCallEventLogId], soci::use(columns[0])));
+	mSpecificStatements[SqlMessageEventLogId] = make_unique<soci::statement>((mSession.prepare <<
+		req[SqlMessageEventLogId], soci::use(mRow.specificTypeId), soci::use(columns[0])));
+	mSpecificStatements[SqlAuthEventLogId] = make_unique<soci::statement>((mSession.prepare <<
+		req[SqlAuthEventLogId], soci::use(columns[0]), soci::use(columns[1]), soci::use(columns[2])));
+	mSpecificStatements[SqlCallQualityEventLogId] = make_unique<soci::statement>((mSession.prepare <<
+		req[SqlCallQualityEventLogId], soci::use(columns[0])));
+}
+
+void DataBaseEventLogWriter::Worker::resetStatements() {
+	mEventStatement.reset();
+	for (auto &statement : mSpecificStatements) statement.reset();
+}
+
+std::size_t DataBaseEventLogWriter::Worker::writeBatch(const std::vector<EventRow> &batch) {
+	if (writeRows(batch.data(), batch.size())) return batch.size();
+	if (batch.size() == 1) return 0;
+
+	// A single bad row rolls the whole batch back: write the rows one by one so that only the bad ones are lost.
+	LOGW("DataBaseEventLogWriter: batch of %u events failed, writing them one by one", (unsigned)batch.size());
+	size_t written = 0;
+	for (const auto &row : batch) {
+		if (writeRows(&row, 1)) written++;
 	}
+	return written;
+}
+
+bool DataBaseEventLogWriter::Worker::writeRows(const EventRow *rows, std::size_t count) {
+	bool prepare = !mEventStatement;
+	bool success = DB_TRANSACTION(&mSession) {
+		// DB_TRANSACTION runs this again after a reconnection, when the statements belong to the lost connection.
+		if (prepare) prepareStatements();
+		prepare = true;
+		for (size_t i = 0; i < count; ++i) {
+			// Statements are bound to mRow, so it only has to be updated before each execution.
+			mRow = rows[i];
+			mEventStatement->execute(true);
+			mSpecificStatements[mRow.typeId]->execute(true);
+		}
+		tr.commit();
+	};
+	// The connection may have been reset, statements are prepared again by the next write.
+	if (!success) resetStatements();
+	return success;
 }
 
 } // flexisip namespace
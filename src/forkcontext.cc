@@ -24,6 +24,9 @@
 using namespace std;
 using namespace flexisip;
 
+static const Transaction::PropertyKey<ForkContext> sForkContextKey{"ForkContext"};
+static const Transaction::PropertyKey<BranchInfo> sBranchInfoKey{"BranchInfo"};
+
 const int ForkContext::sUrgentCodes[] = {401, 407, 415, 420, 484, 488, 606, 603, 0};
 
 const int ForkContext::sAllCodesUrgent[] = {-1, 0};
@@ -277,7 +280,7 @@ void ForkContext::addBranch(const shared_ptr<RequestSipEvent> &ev, const shared_
 	if (mIncoming && mWaitingBranches.size() == 0) {
 		/*for some reason shared_from_this() cannot be invoked within the ForkContext constructor, so we do this
 		 * initialization now*/
-		mIncoming->setProperty<ForkContext>("ForkContext", shared_from_this());
+		mIncoming->setProperty(sForkContextKey, shared_from_this());
 	}
 
 	// unlink the incoming and outgoing transactions which is done by default, since now the forkcontext is managing
@@ -289,7 +292,7 @@ void ForkContext::addBranch(const shared_ptr<RequestSipEvent> &ev, const shared_
 	br->mContact = contact;
 	br->mPriority = contact->mQ;
 
-	ot->setProperty("BranchInfo", weak_ptr<BranchInfo>{br});
+	ot->setProperty(sBranchInfoKey, weak_ptr<BranchInfo>{br});
 	
 	// Clear answered branches with same uid.
 	shared_ptr<BranchInfo> oldBr = findBranchByUid(br->mUid);
@@ -314,7 +317,7 @@ void ForkContext::addBranch(const shared_ptr<RequestSipEvent> &ev, const shared_
 }
 
 shared_ptr<ForkContext> ForkContext::get(const shared_ptr<IncomingTransaction> &tr) {
-	return tr->getProperty<ForkContext>("ForkContext");
+	return tr->getProperty(sForkContextKey);
 }
 
 shared_ptr<ForkContext> ForkContext::get(const shared_ptr<OutgoingTransaction> &tr) {
@@ -323,7 +326,7 @@ shared_ptr<ForkContext> ForkContext::get(const shared_ptr<OutgoingTransaction> &
 }
 
 shared_ptr<BranchInfo> ForkContext::getBranchInfo(const shared_ptr<OutgoingTransaction> &tr){
-	return tr->getProperty<BranchInfo>("BranchInfo");
+	return tr->getProperty(sBranchInfoKey);
 }
 
 bool ForkContext::processCancel(const shared_ptr<RequestSipEvent> &ev) {
@@ -509,11 +512,11 @@ void ForkContext::onNewBranch(const shared_ptr<BranchInfo> &br) {
 void ForkContext::onCancel(const shared_ptr<RequestSipEvent> &ev) {
 }
 
-void ForkContext::addKey(const string &key) {
+void ForkContext::addKey(const AorKey &key) {
      mKeys.push_back(key);
 }
 
-const list<string> &ForkContext::getKeys() const{
+const list<AorKey> &ForkContext::getKeys() const{
      return mKeys;
 }
 
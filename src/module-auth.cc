@@ -70,6 +70,10 @@ void Authentication::onDeclare(GenericStruct *mc) {
 			"file"
 		},
 		{Integer, "cache-expire", "Duration of the validity of the credentials added to the cache in seconds.", "1800"},
+		{Integer, "negative-cache-expire", "Duration in seconds during which a user unknown to the database is "
+			"remembered as such, sparing a database request for each attempt. 0 disables negative caching.", "30"},
+		{Integer, "cache-max-entries", "Maximum number of credentials kept in the cache. The least recently used "
+			"ones are evicted first. 0 means unbounded.", "100000"},
 
 		// deprecated parameters
 		{StringList, "trusted-client-certificates", "List of whitespace separated username or username@domain CN "
@@ -275,15 +279,6 @@ void Authentication::onResponse(shared_ptr<ResponseSipEvent> &ev) {
 	}
 }
 
-
-void Authentication::onIdle() {
-	for (auto &it : mAuthModules) {
-		AuthModule *am = it.second.get();
-		FlexisipAuthModule *fam = dynamic_cast<FlexisipAuthModule *>(am);
-		fam->nonceStore().cleanExpired();
-	}
-}
-
 bool Authentication::doOnConfigStateChanged(const ConfigValue &conf, ConfigState state) {
 	if (conf.getName() == "trusted-hosts" && state == ConfigState::Commited) {
 		loadTrustedHosts((const ConfigStringList &)conf);
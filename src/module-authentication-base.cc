@@ -76,6 +76,22 @@ void ModuleAuthenticationBase::onDeclare(GenericStruct *mc) {
 		"Expiration time before generating a new nonce.\n"
 		"Unit: second",
 		"3600"
+	}, {
+		String,
+		"nonce-secret",
+		"Secret used to generate stateless nonces. Such nonces carry their issue time and a HMAC made with this "
+		"secret, so that they can be validated without any storage by every Flexisip instance configured with the "
+		"same secret, whichever instance has issued them. Nonce counts of qop=auth are still checked on each "
+		"instance.\n"
+		"Empty to keep the nonces tracked by each instance.",
+		""
+	}, {
+		Integer,
+		"nonce-store-size",
+		"Number of nonces tracked by each authentication domain. Once the store is full, the oldest nonces are "
+		"forgotten before they expire, and the clients using them are challenged again.\n"
+		"0 to size it for 50 challenges per second during 'nonce-expires'.",
+		"0"
 	}, {
 		String,
 		"realm-regex",
@@ -92,6 +108,9 @@ void ModuleAuthenticationBase::onDeclare(GenericStruct *mc) {
 	};
 	mc->addChildrenValues(items);
 	mc->get<ConfigBoolean>("enabled")->setDefault("false");
+
+	mCountNonceEvictions = mc->createStat("count-nonce-evictions",
+		"Number of nonces forgotten before their expiration because the nonce store was full.");
 }
 
 void ModuleAuthenticationBase::onLoad(const GenericStruct *mc) {
@@ -110,9 +129,16 @@ void ModuleAuthenticationBase::onLoad(const GenericStruct *mc) {
 
 	bool disableQOPAuth = mc->get<ConfigBoolean>("disable-qop-auth")->read();
 	int nonceExpires = mc->get<ConfigInt>("nonce-expires")->read();
+	string nonceSecret = mc->get<ConfigString>("nonce-secret")->read();
+	int nonceStoreSize = mc->get<ConfigInt>("nonce-store-size")->read();
+	size_t nonceCapacity = nonceStoreSize > 0 ? size_t(nonceStoreSize)
+		: max(size_t(max(nonceExpires, 0)) * 50, NonceStore::sDefaultCapacity);
 
 	for (const string &domain : authDomains) {
 		unique_ptr<FlexisipAuthModuleBase> am(createAuthModule(domain, nonceExpires, !disableQOPAuth));
+		am->setNonceSecret(nonceSecret);
+		am->nonceStore().setCapacity(nonceCapacity);
+		am->nonceStore().setEvictionCounter(mCountNonceEvictions);
 		mAuthModules[domain] = move(am);
 	}
 
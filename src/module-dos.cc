@@ -22,15 +22,71 @@
 #include "utils/threadpool.hh"
 #include <sofia-sip/tport.h>
 #include <sofia-sip/msg_addr.h>
+#include <array>
+#include <chrono>
+#include <cstring>
+#include <list>
 #include <unordered_map>
 
 using namespace std;
 using namespace flexisip;
 
+/*
+ * Binary identifier of a UDP peer (address family, source address and source port),
+ * so that no string formatting is needed on the per-packet path.
+ */
+struct DosKey {
+	sa_family_t family = AF_UNSPEC;
+	uint16_t port = 0;
+	array<uint8_t, 16> address{};
+
+	bool operator==(const DosKey &other) const {
+		return family == other.family && port == other.port && address == other.address;
+	}
+};
+
+struct DosKeyHash {
+	size_t operator()(const DosKey &key) const {
+		// FNV-1a
+		uint64_t hash = 14695981039346656037ULL;
+		auto mix = [&hash](uint8_t byte) {
+			hash ^= byte;
+			hash *= 1099511628211ULL;
+		};
+		mix(uint8_t(key.family));
+		mix(uint8_t(key.port >> 8));
+		mix(uint8_t(key.port));
+		for (auto byte : key.address) mix(byte);
+		return size_t(hash);
+	}
+};
+
+static bool makeDosKey(const sockaddr *addr, DosKey &key) {
+	key.family = addr->sa_family;
+	if (addr->sa_family == AF_INET) {
+		auto sin = reinterpret_cast<const sockaddr_in *>(addr);
+		key.port = ntohs(sin->sin_port);
+		memcpy(key.address.data(), &sin->sin_addr, sizeof(sin->sin_addr));
+		return true;
+	}
+	if (addr->sa_family == AF_INET6) {
+		auto sin6 = reinterpret_cast<const sockaddr_in6 *>(addr);
+		key.port = ntohs(sin6->sin6_port);
+		memcpy(key.address.data(), &sin6->sin6_addr, sizeof(sin6->sin6_addr));
+		return true;
+	}
+	return false;
+}
+
+/*
+ * Token bucket of a UDP peer: it is refilled at [packet-rate-limit] tokens per second and holds
+ * at most the amount of packets allowed during [time-period]. Each packet consumes one token.
+ */
 typedef struct DosContext {
-	uint64_t recv_msg_count_since_last_check;
-	double last_check_recv_msg_check_time;
-	double packet_count_rate;
+	double tokens;
+	double last_refill_time;
+	double banned_until;
+	list<DosKey>::iterator activity_position; // position in the list of peers ordered by last activity
 } DosContext;
 
 class DoSProtection;
@@ -43,6 +99,10 @@ typedef struct BanContext {
 	su_timer_t *timer;
 } BanContext;
 
+static double getMonotonicTimeInMillis() {
+	return chrono::duration<double, milli>(chrono::steady_clock::now().time_since_epoch()).count();
+}
+
 class DoSProtection : public Module, ModuleToolbox {
 
   private:
@@ -52,18 +112,33 @@ class DoSProtection : public Module, ModuleToolbox {
 	int mBanTime;
 	bool mIptablesVersionChecked;
 	bool mIptablesSupportsWait;
+	bool mUseIpset;
+	int mBanBatchInterval;
 	list<string> mWhiteList;
-	unordered_map<string, DosContext> mDosContexts;
-	unordered_map<string, DosContext>::iterator mDOSHashtableIterator;
+	unsigned int mMaxTrackedPeers;
+	unordered_map<DosKey, DosContext, DosKeyHash> mDosContexts;
+	list<DosKey> mDosContextsByActivity; // Least recently active peer first.
 	ThreadPool *mThreadPool;
 	string mFlexisipChain;
+	string mIpsetV4;
+	string mIpsetV6;
+	string mPendingBans;
+	su_timer_t *mBanBatchTimer;
+	bool mIpsetUnavailableLogged;
 
 	int runIptables(const string & arguments, bool ipv6=false, bool dumpErrors=true){
+		return runCommand(string(ipv6 ? "/sbin/ip6tables" : "/sbin/iptables") + " " + arguments, dumpErrors);
+	}
+
+	int runIpset(const string &arguments, bool dumpErrors=true) {
+		return runCommand("/sbin/ipset " + arguments, dumpErrors);
+	}
+
+	int runCommand(const string &cmd, bool dumpErrors=true) {
 		ostringstream command;
 		char output[512] = { 0 };
-		
-		command << (ipv6 ? "/sbin/ip6tables" : "/sbin/iptables");
-		command << " " << arguments;
+
+		command << cmd;
 		command << " 2>&1";
 		FILE *f = popen(command.str().c_str(), "r");
 		if (f == nullptr){
@@ -91,7 +166,22 @@ class DoSProtection : public Module, ModuleToolbox {
 										   "millisecond(s) to consider it as a DoS attack.",
 			 "20"},
 			{Integer, "ban-time", "Number of minutes to ban the ip/port using iptables", "2"},
+			{Integer, "max-tracked-peers", "Maximum number of UDP ip/port whose packet rate is tracked. When this "
+			 "limit is reached, the least recently active peer is forgotten to make room for a new one. This bounds "
+			 "the memory used by the module during a flood with spoofed source addresses.",
+			 "500000"},
 			{String, "iptables-chain", "Name of the chain flexisip will create to store the banned IPs", "FLEXISIP"},
+			{String, "ban-backend", "How banned ip/port are blocked at kernel level:\n"
+			 " - 'iptables': one iptables rule is added, then removed, for each banned ip/port. Each ban and unban "
+			 "runs an iptables process.\n"
+			 " - 'ipset': banned ip/port are added to the ipsets [iptables-chain]-v4 and [iptables-chain]-v6, "
+			 "matched by a single rule of [iptables-chain]. Bans are sent to ipset in batches and are removed "
+			 "by the kernel when they expire.\n"
+			 "In both cases, packets of a banned peer that still reach Flexisip are discarded.",
+			 "iptables"},
+			{Integer, "ban-batch-interval", "Number of milliseconds during which bans are accumulated before being "
+			 "sent to ipset at once. Only used when 'ban-backend' is 'ipset'.",
+			 "100"},
 			config_item_end};
 		module_config->get<ConfigBoolean>("enabled")->setDefault("true");
 		module_config->addChildrenValues(configs);
@@ -102,7 +192,11 @@ class DoSProtection : public Module, ModuleToolbox {
 		mPacketRateLimit = mc->get<ConfigInt>("packet-rate-limit")->read();
 		mBanTime = mc->get<ConfigInt>("ban-time")->read();
 		mFlexisipChain = mc->get<ConfigString>("iptables-chain")->read();
-		mDOSHashtableIterator = mDosContexts.begin();
+		mUseIpset = mc->get<ConfigString>("ban-backend")->read() == "ipset";
+		mBanBatchInterval = mc->get<ConfigInt>("ban-batch-interval")->read();
+		mIpsetV4 = mFlexisipChain + "-v4";
+		mIpsetV6 = mFlexisipChain + "-v6";
+		mMaxTrackedPeers = mc->get<ConfigInt>("max-tracked-peers")->read();
 
 		GenericStruct *cluster = GenericManager::get()->getRoot()->get<GenericStruct>("cluster");
 		mWhiteList = cluster->get<ConfigStringList>("nodes")->read();
@@ -155,6 +249,21 @@ class DoSProtection : public Module, ModuleToolbox {
 		snprintf(iptables_cmd, sizeof(iptables_cmd), "%s -t filter -A INPUT -j %s", mIptablesSupportsWait ? "-w" : "", mFlexisipChain.c_str());
 		runIptables(iptables_cmd);
 		runIptables(iptables_cmd, true);
+
+		if (mUseIpset) {
+			// Entries of the sets are created with a timeout, so that the kernel unbans them by itself.
+			runIpset("-exist create " + mIpsetV4 + " hash:ip,port family inet timeout 0");
+			runIpset("-exist create " + mIpsetV6 + " hash:ip,port family inet6 timeout 0");
+			runIpset("flush " + mIpsetV4);
+			runIpset("flush " + mIpsetV6);
+			snprintf(iptables_cmd, sizeof(iptables_cmd), "%s -A %s -m set --match-set %s src,src -j REJECT",
+				mIptablesSupportsWait ? "-w" : "", mFlexisipChain.c_str(), mIpsetV4.c_str());
+			runIptables(iptables_cmd);
+			snprintf(iptables_cmd, sizeof(iptables_cmd), "%s -A %s -m set --match-set %s src,src -j REJECT",
+				mIptablesSupportsWait ? "-w" : "", mFlexisipChain.c_str(), mIpsetV6.c_str());
+			runIptables(iptables_cmd, true);
+			mBanBatchTimer = su_timer_create(su_root_task(mAgent->getRoot()), 0);
+		}
 	}
 
 	void onUnload() {
@@ -173,6 +282,15 @@ class DoSProtection : public Module, ModuleToolbox {
 		snprintf(iptables_cmd, sizeof(iptables_cmd), "%s -X %s", mIptablesSupportsWait ? "-w" : "", mFlexisipChain.c_str());
 		runIptables(iptables_cmd);
 		runIptables(iptables_cmd, true);
+
+		if (mUseIpset) {
+			if (mBanBatchTimer) {
+				su_timer_destroy(mBanBatchTimer);
+				mBanBatchTimer = nullptr;
+			}
+			runIpset("destroy " + mIpsetV4);
+			runIpset("destroy " + mIpsetV6);
+		}
 	}
 
 	virtual bool isValidNextConfig( const ConfigValue &value ) {
@@ -200,35 +318,59 @@ class DoSProtection : public Module, ModuleToolbox {
 	}
 
 	void onIdle() {
-		struct timeval now;
-		double started_time_in_millis, time_elapsed;
-
-		gettimeofday(&now, NULL);
-		started_time_in_millis = now.tv_sec * 1000 + (now.tv_usec / 1000);
+		static constexpr double maxInactivity = 3600 * 1000; // Forget peers without message in the past hour
+		double started_time_in_millis = getMonotonicTimeInMillis();
+		double now_in_millis = started_time_in_millis;
+		unsigned int count = 0;
+
+		// Peers are ordered by last activity, so only the expired ones are visited.
+		while (!mDosContextsByActivity.empty()) {
+			auto it = mDosContexts.find(mDosContextsByActivity.front());
+			DosContext &dos = it->second;
+			if (now_in_millis - dos.last_refill_time < maxInactivity) break;
+
+			if (dos.banned_until > now_in_millis) {
+				// Still banned: keep it until its ban is over. The bucket is full since the ban, so it can be refilled now.
+				dos.last_refill_time = now_in_millis;
+				mDosContextsByActivity.splice(mDosContextsByActivity.end(), mDosContextsByActivity, dos.activity_position);
+			} else {
+				mDosContextsByActivity.pop_front();
+				mDosContexts.erase(it);
+			}
 
-		if (mDOSHashtableIterator == mDosContexts.end()) {
-			mDOSHashtableIterator = mDosContexts.begin();
+			if (++count % 1024 == 0) {
+				now_in_millis = getMonotonicTimeInMillis();
+				if (now_in_millis - started_time_in_millis >= 100) { // Do not use more than 100ms to clean the hashtable
+					LOGW("Started to clean dos hashtable %fms ago, let's stop for now a continue later",
+						 now_in_millis - started_time_in_millis);
+					break;
+				}
+			}
 		}
-		for (; mDOSHashtableIterator != mDosContexts.end();) {
-			double now_in_millis;
-			DosContext dos = mDOSHashtableIterator->second;
-
-			gettimeofday(&now, NULL);
-			now_in_millis = now.tv_sec * 1000 + (now.tv_usec / 1000);
-			time_elapsed = now_in_millis - dos.last_check_recv_msg_check_time;
+	}
 
-			if (time_elapsed >= 3600 * 1000) { // If no message received in the past hour
-				mDOSHashtableIterator = mDosContexts.erase(mDOSHashtableIterator);
-			} else {
-				++mDOSHashtableIterator;
-			}
+	/*
+	 * Get the context of a UDP peer, creating it if needed, and mark the peer as the most recently active one.
+	 */
+	DosContext &touchDosContext(const DosKey &key, double now_in_millis, double bucket_size) {
+		auto result = mDosContexts.emplace(key, DosContext{bucket_size, now_in_millis, 0, {}});
+		DosContext &dosContext = result.first->second;
+		if (!result.second) {
+			mDosContextsByActivity.splice(mDosContextsByActivity.end(), mDosContextsByActivity,
+										  dosContext.activity_position);
+			return dosContext;
+		}
 
-			if (now_in_millis - started_time_in_millis >= 100) { // Do not use more than 100ms to clean the hashtable
-				LOGW("Started to clean dos hashtable %fms ago, let's stop for now a continue later",
-					 now_in_millis - started_time_in_millis);
-				break;
+		dosContext.activity_position = mDosContextsByActivity.insert(mDosContextsByActivity.end(), key);
+		if (mDosContexts.size() > mMaxTrackedPeers) {
+			// Evict the least recently active peer. It can't be the new one unless the limit is 0.
+			auto evicted = mDosContexts.find(mDosContextsByActivity.front());
+			if (&evicted->second != &dosContext) {
+				mDosContextsByActivity.pop_front();
+				mDosContexts.erase(evicted);
 			}
 		}
+		return dosContext;
 	}
 
 	bool isIpWhiteListed(const char *ip) {
@@ -261,6 +403,64 @@ class DoSProtection : public Module, ModuleToolbox {
 		}
 	}
 
+	/*
+	 * Ban an ip/port with the configured backend and discard the packets of this peer
+	 * that still reach Flexisip for the duration of the ban.
+	 */
+	void ban(const char *ip, const char *port, const char *protocol) {
+		if (mUseIpset) {
+			if (mBanBatchTimer == nullptr) {
+				// The sets are only created with root privileges, bans can't be applied.
+				if (!mIpsetUnavailableLogged) {
+					LOGE("DoSProtection: ipset isn't set up, peers can't be banned.");
+					mIpsetUnavailableLogged = true;
+				}
+				return;
+			}
+			bool is_ipv6 = strchr(ip, ':') != nullptr;
+			ostringstream entry;
+			entry << "add " << (is_ipv6 ? mIpsetV6 : mIpsetV4) << " " << ip << "," << protocol << ":" << port
+				  << " timeout " << mBanTime * 60 << "\n";
+			bool firstPendingBan = mPendingBans.empty();
+			mPendingBans += entry.str();
+			if (firstPendingBan) {
+				su_timer_set_interval(mBanBatchTimer, &DoSProtection::sOnBanBatchTimer, this, mBanBatchInterval);
+			}
+			return;
+		}
+		string sip(ip), sport(port), sprotocol(protocol);
+		mThreadPool->run([this, sip, sport, sprotocol] { banIP(sip.c_str(), sport.c_str(), sprotocol.c_str()); });
+		createBanContextAndPostInFuture(ip, port, protocol);
+	}
+
+	static void sOnBanBatchTimer(su_root_magic_t *magic, su_timer_t *t, su_timer_arg_t *arg) {
+		static_cast<DoSProtection *>(arg)->flushPendingBans();
+	}
+
+	/*
+	 * Send all the bans accumulated during [ban-batch-interval] to ipset with a single process.
+	 */
+	void flushPendingBans() {
+		if (mPendingBans.empty()) return;
+		string bans;
+		bans.swap(mPendingBans);
+		mThreadPool->run([bans] {
+			FILE *f = popen("/sbin/ipset -exist restore", "w");
+			if (f == nullptr) {
+				LOGE("DoSProtection: popen() failed: %s", strerror(errno));
+				return;
+			}
+			fwrite(bans.c_str(), 1, bans.size(), f);
+			int ret = pclose(f);
+			if (WIFEXITED(ret)) ret = WEXITSTATUS(ret);
+			if (ret != 0) {
+				LOGE("DoSProtection: 'ipset restore' failed with status %i.", ret);
+			} else {
+				LOGD("DoSProtection: 'ipset restore' executed.");
+			}
+		});
+	}
+
 	void unbanIP(BanContext *ctx) {
 		string protocol = ctx->protocol;
 		string ip = ctx->ip;
@@ -309,52 +509,50 @@ class DoSProtection : public Module, ModuleToolbox {
 			su_sockaddr_t su[1];
 			socklen_t len = sizeof su;
 			sockaddr *addr = NULL;
-			char ip[NI_MAXHOST], port[NI_MAXSERV];
-			int err;
+			DosKey key;
 
 			msg_get_address(msgSip->getMsg(), su, &len);
 			addr = &(su[0].su_sa);
+			if (!makeDosKey(addr, key)) return;
 
-			if ((err = getnameinfo(addr, len, ip, sizeof(ip), port, sizeof(port), NI_NUMERICHOST | NI_NUMERICSERV)) ==
-				0) {
-				string id = string(ip) + ":" + string(port);
-				struct timeval now;
-				DosContext &dosContext = mDosContexts[id];
-				double now_in_millis, time_elapsed;
-
-				dosContext.recv_msg_count_since_last_check++;
-				gettimeofday(&now, NULL);
-				now_in_millis = now.tv_sec * 1000 + (now.tv_usec / 1000);
-				if (dosContext.last_check_recv_msg_check_time == 0) {
-					dosContext.last_check_recv_msg_check_time = now_in_millis;
-				}
+			double now_in_millis = getMonotonicTimeInMillis();
+			double bucket_size = double(mPacketRateLimit) * mTimePeriod / 1000;
+			DosContext &dosContext = touchDosContext(key, now_in_millis, bucket_size);
 
-				time_elapsed = now_in_millis - dosContext.last_check_recv_msg_check_time;
-				if (time_elapsed < 0) {
-					dosContext.packet_count_rate = 0;
-					dosContext.recv_msg_count_since_last_check = 0;
-					dosContext.last_check_recv_msg_check_time = now_in_millis;
-				} else if (time_elapsed >= mTimePeriod) {
-					dosContext.packet_count_rate = dosContext.recv_msg_count_since_last_check / time_elapsed * 1000;
-					dosContext.recv_msg_count_since_last_check = 0;
-					dosContext.last_check_recv_msg_check_time = now_in_millis;
-				}
+			if (dosContext.banned_until > now_in_millis) {
+				ev->terminateProcessing(); // the peer is banned, the event is discarded
+				return;
+			}
 
-				if (dosContext.packet_count_rate >= mPacketRateLimit) {
-					LOGW("Packet count rate (%f) >= limit (%i), blocking ip/port %s/%s on protocol udp for %i minutes",
-						 dosContext.packet_count_rate, mPacketRateLimit, ip, port, mBanTime);
-					if (!isIpWhiteListed(ip)) {
-						mThreadPool->run([&, ip, port] { banIP(ip, port, "udp"); });
-						createBanContextAndPostInFuture(ip, port, "udp");
-						ev->terminateProcessing(); // the event is discarded
-					} else {
-						LOGW("IP %s should be banned but wasn't because in white list", ip);
-					}
-					dosContext.packet_count_rate = 0; // Reset it to not add the iptables rule twice by mistake
-				}
-			} else {
+			double time_elapsed = now_in_millis - dosContext.last_refill_time;
+			if (time_elapsed > 0) {
+				dosContext.tokens = min(bucket_size, dosContext.tokens + time_elapsed * mPacketRateLimit / 1000);
+			}
+			dosContext.last_refill_time = now_in_millis;
+
+			if (dosContext.tokens >= 1) {
+				dosContext.tokens -= 1;
+				return;
+			}
+
+			// The limit is exceeded: only now the address is formatted to ban it.
+			char ip[NI_MAXHOST], port[NI_MAXSERV];
+			int err;
+			if ((err = getnameinfo(addr, len, ip, sizeof(ip), port, sizeof(port), NI_NUMERICHOST | NI_NUMERICSERV)) !=
+				0) {
 				LOGW("getnameinfo() failed: %s", gai_strerror(err));
+				return;
+			}
+			LOGW("Packet count rate >= limit (%i), blocking ip/port %s/%s on protocol udp for %i minutes",
+				 mPacketRateLimit, ip, port, mBanTime);
+			if (!isIpWhiteListed(ip)) {
+				ban(ip, port, "udp");
+				dosContext.banned_until = now_in_millis + double(mBanTime) * 60 * 1000;
+				ev->terminateProcessing(); // the event is discarded
+			} else {
+				LOGW("IP %s should be banned but wasn't because in white list", ip);
 			}
+			dosContext.tokens = bucket_size; // Refill it to not ban the peer twice by mistake
 		} else {
 			unsigned long packet_count_rate = tport_get_packet_count_rate(tport);
 			if (packet_count_rate >= (unsigned long) mPacketRateLimit) {
@@ -368,8 +566,7 @@ class DoSProtection : public Module, ModuleToolbox {
 					LOGW("Packet count rate (%lu) >= limit (%i), blocking ip/port %s/%s on protocol tcp for %i minutes",
 						 packet_count_rate, mPacketRateLimit, ip, port, mBanTime);
 					if (!isIpWhiteListed(ip)) {
-						mThreadPool->run([&, ip, port] { banIP(ip, port, "tcp"); });
-						createBanContextAndPostInFuture(ip, port, "tcp");
+						ban(ip, port, "tcp");
 						ev->terminateProcessing(); // the event is discarded
 					} else {
 						LOGW("IP %s should be banned but wasn't because in white list", ip);
@@ -390,6 +587,11 @@ class DoSProtection : public Module, ModuleToolbox {
 	DoSProtection(Agent *ag) : Module(ag) {
 		mIptablesVersionChecked = false;
 		mIptablesSupportsWait = false;
+		mUseIpset = false;
+		mBanBatchInterval = 0;
+		mMaxTrackedPeers = 0;
+		mBanBatchTimer = nullptr;
+		mIpsetUnavailableLogged = false;
 		mThreadPool = new ThreadPool(1, 1000);
 	}
 
@@ -401,7 +603,7 @@ class DoSProtection : public Module, ModuleToolbox {
 ModuleInfo<DoSProtection> DoSProtection::sInfo(
 	"DoSProtection",
 	"This module bans user when they are sending too much packets within a given timeframe. "
-	"To see the list of currently banned IPs/ports, use iptables -L. ",
+	"To see the list of currently banned IPs/ports, use iptables -L, or ipset list when 'ban-backend' is 'ipset'. ",
 	{ "" },
 	ModuleInfoBase::ModuleOid::DoSProtection
 );
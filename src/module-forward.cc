@@ -22,7 +22,9 @@
 #include "flexisip/module-router.hh"
 
 #include "etchosts.hh"
+#include "dns-cache.hh"
 #include "domain-registrations.hh"
+#include <memory>
 #include <sstream>
 
 #include <sofia-sip/su_md5.h>
@@ -60,6 +62,10 @@ class ForwardModule : public Module, ModuleToolbox {
 	list<string> mClusterNodes;
 	bool mRewriteReqUri;
 	bool mAddPath;
+	unique_ptr<DnsCache> mDnsCache;
+	StatCounter64 *mCountDnsCacheHits = nullptr;
+	StatCounter64 *mCountDnsCacheMisses = nullptr;
+	StatCounter64 *mCountDnsCachePrefetches = nullptr;
 	static ModuleInfo<ForwardModule> sInfo;
 };
 
@@ -90,8 +96,23 @@ void ForwardModule::onDeclare(GenericStruct *module_config) {
 		{StringList, "params-to-remove",
 			 "List of URL and contact params to remove",
 			 "pn-tok pn-type app-id pn-msg-str pn-call-str pn-call-snd pn-msg-snd pn-timeout pn-silent pn-provider pn-prid pn-param"},
+		{Boolean, "dns-cache", "Resolve the next hops of the requests from a cache of the DNS records (NAPTR, SRV, A and "
+			"AAAA), refreshed in the background before the records expire. Destinations whose records aren't cached "
+			"yet, using TLS, or leading to several SRV targets or addresses, are still resolved by the transaction, "
+			"which selects among them by weight and fails over to the next ones.", "false"},
+		{Integer, "dns-cache-negative-ttl", "Time in seconds during which a name that couldn't be resolved isn't "
+			"queried again by the DNS cache.", "30"},
+		{String, "dns-cache-resolv-conf", "File listing the name servers queried by the DNS cache, in resolv.conf "
+			"format. The system name servers are used if empty.", ""},
 		config_item_end};
 	module_config->addChildrenValues(items);
+
+	mCountDnsCacheHits = module_config->createStat("count-dns-cache-hits",
+		"Number of next hops resolved from the DNS cache.");
+	mCountDnsCacheMisses = module_config->createStat("count-dns-cache-misses",
+		"Number of next hops not resolved from the DNS cache: records not cached yet, or several destinations.");
+	mCountDnsCachePrefetches = module_config->createStat("count-dns-cache-prefetches",
+		"Number of DNS records queried again before their expiration.");
 }
 
 void ForwardModule::onLoad(const GenericStruct *mc) {
@@ -106,6 +127,11 @@ void ForwardModule::onLoad(const GenericStruct *mc) {
 	mAddPath = mc->get<ConfigBoolean>("add-path")->read();
 	mParamsToRemove = mc->get<ConfigStringList>("params-to-remove")->read();
 	mDefaultTransport =  mc->get<ConfigString>("default-transport")->read();
+	if (mc->get<ConfigBoolean>("dns-cache")->read()) {
+		mDnsCache.reset(new DnsCache(getAgent()->getRoot(), mc->get<ConfigString>("dns-cache-resolv-conf")->read(),
+			mc->get<ConfigInt>("dns-cache-negative-ttl")->read()));
+		mDnsCache->setStats(mCountDnsCacheHits, mCountDnsCacheMisses, mCountDnsCachePrefetches);
+	}
 	if (mDefaultTransport == "udp") mDefaultTransport.clear();
 	else mDefaultTransport = "transport=" + mDefaultTransport;
 	/* The forward module needs the help of the router module to determine whether
@@ -284,11 +310,20 @@ void ForwardModule::sendRequest(shared_ptr<RequestSipEvent> &ev, url_t *dest) {
 	bool tport_error = false;
 
 	string ip;
+	DnsCache::Destination resolved;
 	if (EtcHostsResolver::get()->resolve(dest->url_host, &ip)) {
 		LOGD("Found %s in /etc/hosts", dest->url_host);
 		/* duplication of dest because we don't want to modify the message with our name resolution result*/
 		dest = url_hdup(ms->getHome(), dest);
 		dest->url_host = ip.c_str();
+	} else if (mDnsCache && mDnsCache->resolve(dest, resolved)) {
+		LOGD("Found %s in DNS cache: %s", dest->url_host, resolved.host.c_str());
+		dest = url_hdup(ms->getHome(), dest);
+		dest->url_host = su_strdup(ms->getHome(), resolved.host.c_str());
+		dest->url_port = resolved.port.empty() ? nullptr : su_strdup(ms->getHome(), resolved.port.c_str());
+		if (!resolved.transport.empty() && !url_has_param(dest, "transport")) {
+			url_param_add(ms->getHome(), dest, ("transport=" + resolved.transport).c_str());
+		}
 	}
 
 	if (dest->url_params != nullptr) {
@@ -19,27 +19,100 @@
 #include <flexisip/module.hh>
 #include <flexisip/agent.hh>
 
+#include <sofia-sip/msg_header.h>
+#include <sofia-sip/nta.h>
+#include <sofia-sip/sip_tag.h>
+#include <sofia-sip/url_tag.h>
+
+#include <algorithm>
+#include <cstdlib>
+#include <functional>
+#include <map>
+#include <memory>
+#include <string>
+#include <unordered_map>
 #include <vector>
 
 using namespace std;
 using namespace flexisip;
 
+/*
+ * Requests are balanced with a consistent hash ring: each route owns a number of points of the ring proportional to
+ * its weight and a request is sent to the route owning the first point following the hash of its keys. Adding or
+ * removing a route thus only moves the requests hashed to the points of that route.
+ */
 class LoadBalancer : public Module, public ModuleToolbox {
 public:
 	LoadBalancer(Agent *ag);
 	virtual ~LoadBalancer();
 	virtual void onDeclare(GenericStruct *module_config);
 	virtual void onLoad(const GenericStruct *modconf);
+	virtual void onUnload();
 	virtual void onRequest(shared_ptr<RequestSipEvent> &ev);
 	virtual void onResponse(shared_ptr<ResponseSipEvent> &ev);
+	virtual void onIdle();
 
 private:
-	vector<string> mRoutes;
-	int mRoutesCount;
+	enum class HashKey {CallId, From, To};
+
+	struct Route {
+		LoadBalancer *module;
+		string header; // route header prepended to the requests, without the weight parameter
+		url_t *url;
+		unsigned weight = 1;
+		bool healthy = true;
+		int failures = 0;
+		nta_leg_t *leg = nullptr;
+		nta_outgoing_t *probe = nullptr;
+	};
+
+	struct RingPoint {
+		size_t hash;
+		size_t route;
+
+		bool operator<(const RingPoint &other) const {return hash < other.hash;}
+	};
+
+	using StickyExpiry = multimap<time_t, string>; // call-ids of the sticky dialogs, by expiry date
+	struct StickyDialog {
+		size_t route;
+		uint32_t cseq; // of the request that created the dialog
+		StickyExpiry::iterator expiry;
+	};
+
+	// Number of points of the ring owned by a route of weight 1.
+	static constexpr unsigned sPointsPerWeight = 160;
+
+	bool addRoute(const string &header);
+	void buildRing();
+	size_t hashRequest(const sip_t *sip) const;
+	const Route *selectRoute(const sip_t *sip);
+	void addStickyDialog(const char *callId, uint32_t cseq, size_t route, time_t now);
+	void touchStickyDialog(unordered_map<string, StickyDialog>::iterator it, time_t now);
+	void eraseStickyDialog(unordered_map<string, StickyDialog>::iterator it);
+
+	void probeRoutes();
+	void onProbeResponse(Route &route, int status);
+	void setRouteHealth(Route &route, bool healthy);
+	static void sProbeTimerFunc(su_root_magic_t *magic, su_timer_t *t, void *data);
+	static int sProbeCallback(nta_outgoing_magic_t *magic, nta_outgoing_t *orq, const sip_t *sip);
+
+	sofiasip::Home mHome;
+	vector<unique_ptr<Route>> mRoutes;
+	vector<RingPoint> mRing;
+	vector<HashKey> mHashKeys;
+	unordered_map<string, StickyDialog> mStickyDialogs; // route of the dialogs, by call-id
+	StickyExpiry mStickyExpiry;
+	int mStickyDialogTimeout = 0;
+	int mMaxProbeFailures = 0;
+	bool mAnyHealthy = true;
+	su_timer_t *mProbeTimer = nullptr;
 
 	static ModuleInfo<LoadBalancer> sInfo;
 };
 
+constexpr unsigned LoadBalancer::sPointsPerWeight;
+
 LoadBalancer::LoadBalancer(Agent *ag) : Module(ag) {
 }
 
@@ -49,48 +122,276 @@ LoadBalancer::~LoadBalancer() {
 void LoadBalancer::onDeclare(GenericStruct *module_config) {
 	/*we need to be disabled by default*/
 	module_config->get<ConfigBoolean>("enabled")->setDefault("false");
-	ConfigItemDescriptor items[] = { { StringList,
-		"routes",
-		"Whitespace separated list of sip routes to balance the requests. Example: <sip:192.168.0.22> <sip:192.168.0.23>",
-		"" }, config_item_end };
+	ConfigItemDescriptor items[] = {
+		{StringList, "routes",
+			"Whitespace separated list of sip routes to balance the requests. A 'weight' parameter may be given to "
+			"a route to send it a proportional share of the requests, 1 being the default.\n"
+			"Example: <sip:192.168.0.22> <sip:192.168.0.23>;weight=2",
+			""},
+		{StringList, "hash-keys",
+			"Whitespace separated list of the request fields hashed to select the route of a request, among "
+			"'call-id', 'from' and 'to' ('from' and 'to' being the address of record of the header).",
+			"call-id"},
+		{Integer, "health-check-interval",
+			"Interval in seconds between two OPTIONS requests sent to each route to check its health. The routes "
+			"that don't answer are no longer given any request until they answer again. 0 disables the checks.",
+			"0"},
+		{Integer, "health-check-max-failures",
+			"Number of consecutive failed health checks after which a route is considered down.", "2"},
+		{Integer, "sticky-dialog-timeout",
+			"Time in seconds during which the requests of a dialog keep being sent to the route of the request "
+			"that created it, even when the set of routes available has changed. The timeout is restarted by each "
+			"request of the dialog.",
+			"3600"},
+		config_item_end};
 	module_config->addChildrenValues(items);
 }
 
+bool LoadBalancer::addRoute(const string &header) {
+	sip_route_t *route = sip_route_make(mHome.home(), header.c_str());
+	if (!route) return false;
+
+	unique_ptr<Route> r(new Route{});
+	r->module = this;
+	r->url = route->r_url;
+	const char *weight = msg_params_find(route->r_params, "weight=");
+	if (weight) {
+		r->weight = max(atoi(weight), 0);
+		msg_header_remove_param(reinterpret_cast<msg_common_t *>(route), "weight");
+	}
+	r->header = sip_header_as_string(mHome.home(), reinterpret_cast<sip_header_t *>(route));
+	LOGI("%s (weight %u)", r->header.c_str(), r->weight);
+	mRoutes.emplace_back(move(r));
+	return true;
+}
+
 void LoadBalancer::onLoad(const GenericStruct *modconf) {
 	list<string> routes = modconf->get<ConfigStringList>("routes")->read();
-	list<string>::iterator it;
 
 	LOGI("Load balancer configured to balance over:");
-	for (it = routes.begin(); it != routes.end(); ++it) {
-		mRoutes.push_back(*it);
-		LOGI("%s", (*it).c_str());
+	for (const auto &route : routes) {
+		if (!addRoute(route)) LOGF("Invalid route '%s' in module::LoadBalancer/routes", route.c_str());
+	}
+
+	for (const auto &key : modconf->get<ConfigStringList>("hash-keys")->read()) {
+		if (key == "call-id") mHashKeys.push_back(HashKey::CallId);
+		else if (key == "from") mHashKeys.push_back(HashKey::From);
+		else if (key == "to") mHashKeys.push_back(HashKey::To);
+		else LOGF("Invalid hash key '%s' in module::LoadBalancer/hash-keys", key.c_str());
+	}
+	if (mHashKeys.empty()) mHashKeys.push_back(HashKey::CallId);
+
+	mStickyDialogTimeout = modconf->get<ConfigInt>("sticky-dialog-timeout")->read();
+	mMaxProbeFailures = max(modconf->get<ConfigInt>("health-check-max-failures")->read(), 1);
+	buildRing();
+
+	int probeInterval = modconf->get<ConfigInt>("health-check-interval")->read();
+	if (probeInterval <= 0 || mRoutes.empty()) return;
+
+	// The probes are sent from the URI of this very node, the preferred route being only set in cluster mode.
+	const url_t *self = getAgent()->getNodeUri();
+	sip_from_t *from = self ? sip_from_create(mHome.home(), reinterpret_cast<const url_string_t *>(self)) : nullptr;
+	if (from == nullptr) {
+		LOGE("Load balancer health checks disabled: no URI to send them from");
+		return;
+	}
+	for (auto &route : mRoutes) {
+		route->leg = nta_leg_tcreate(getSofiaAgent(), nullptr, nullptr, NTATAG_METHOD("OPTIONS"),
+			SIPTAG_FROM(from),
+			SIPTAG_TO(sip_to_create(mHome.home(), reinterpret_cast<const url_string_t *>(route->url))),
+			URLTAG_URL(route->url), TAG_END());
+		if (!route->leg) LOGE("Could not create the health check leg of route %s", route->header.c_str());
+	}
+	mProbeTimer = getAgent()->createTimer(probeInterval * 1000, &LoadBalancer::sProbeTimerFunc, this);
+}
+
+void LoadBalancer::onUnload() {
+	if (mProbeTimer) {
+		su_timer_destroy(mProbeTimer);
+		mProbeTimer = nullptr;
+	}
+	for (auto &route : mRoutes) {
+		if (route->probe) nta_outgoing_destroy(route->probe);
+		if (route->leg) nta_leg_destroy(route->leg);
+	}
+	mRoutes.clear();
+	mRing.clear();
+	mStickyDialogs.clear();
+	mStickyExpiry.clear();
+}
+
+void LoadBalancer::buildRing() {
+	mAnyHealthy = any_of(mRoutes.cbegin(), mRoutes.cend(), [](const unique_ptr<Route> &r) {
+		return r->healthy && r->weight > 0;
+	});
+
+	mRing.clear();
+	for (size_t i = 0; i < mRoutes.size(); ++i) {
+		const auto &route = mRoutes[i];
+		// When every route is down, the requests are still balanced over all of them.
+		if (mAnyHealthy && !route->healthy) continue;
+		for (unsigned point = 0; point < route->weight * sPointsPerWeight; ++point) {
+			mRing.push_back(RingPoint{hash<string>()(route->header + "#" + to_string(point)), i});
+		}
+	}
+	sort(mRing.begin(), mRing.end());
+}
+
+size_t LoadBalancer::hashRequest(const sip_t *sip) const {
+	string key;
+	for (auto hashKey : mHashKeys) {
+		const url_t *url = nullptr;
+		switch (hashKey) {
+			case HashKey::CallId:
+				if (sip->sip_call_id) key += sip->sip_call_id->i_id;
+				break;
+			case HashKey::From:
+				if (sip->sip_from) url = sip->sip_from->a_url;
+				break;
+			case HashKey::To:
+				if (sip->sip_to) url = sip->sip_to->a_url;
+				break;
+		}
+		if (url) {
+			if (url->url_user) key.append(url->url_user).append("@");
+			if (url->url_host) key += url->url_host;
+		}
+		key += '\n';
 	}
-	mRoutesCount = mRoutes.size();
+	return hash<string>()(key);
+}
+
+const LoadBalancer::Route *LoadBalancer::selectRoute(const sip_t *sip) {
+	const char *callId = sip->sip_call_id ? sip->sip_call_id->i_id : nullptr;
+	bool inDialog = sip->sip_to && sip->sip_to->a_tag;
+	time_t now = getCurrentTime();
+
+	if (callId && inDialog) {
+		auto it = mStickyDialogs.find(callId);
+		if (it != mStickyDialogs.end()) {
+			Route &route = *mRoutes[it->second.route];
+			if (route.healthy || !mAnyHealthy) {
+				if (sip->sip_request->rq_method == sip_method_bye) eraseStickyDialog(it);
+				else touchStickyDialog(it, now);
+				return &route;
+			}
+			// The route of the dialog is down, the requests follow the ring from now.
+			eraseStickyDialog(it);
+		}
+	}
+
+	if (mRing.empty()) return nullptr;
+	auto point = upper_bound(mRing.cbegin(), mRing.cend(), RingPoint{hashRequest(sip), 0});
+	if (point == mRing.cend()) point = mRing.cbegin();
+
+	if (callId && !inDialog && mStickyDialogTimeout > 0 && sip->sip_cseq) {
+		auto method = sip->sip_request->rq_method;
+		if (method == sip_method_invite || method == sip_method_subscribe || method == sip_method_refer) {
+			addStickyDialog(callId, sip->sip_cseq->cs_seq, point->route, now);
+		}
+	}
+	return mRoutes[point->route].get();
+}
+
+void LoadBalancer::addStickyDialog(const char *callId, uint32_t cseq, size_t route, time_t now) {
+	auto it = mStickyDialogs.find(callId);
+	if (it != mStickyDialogs.end()) eraseStickyDialog(it);
+	auto expiry = mStickyExpiry.emplace(now + mStickyDialogTimeout, callId);
+	mStickyDialogs.emplace(callId, StickyDialog{route, cseq, expiry});
+}
+
+void LoadBalancer::touchStickyDialog(unordered_map<string, StickyDialog>::iterator it, time_t now) {
+	mStickyExpiry.erase(it->second.expiry);
+	it->second.expiry = mStickyExpiry.emplace(now + mStickyDialogTimeout, it->first);
+}
+
+void LoadBalancer::eraseStickyDialog(unordered_map<string, StickyDialog>::iterator it) {
+	mStickyExpiry.erase(it->second.expiry);
+	mStickyDialogs.erase(it);
 }
 
 void LoadBalancer::onRequest(shared_ptr<RequestSipEvent> &ev) {
 	const shared_ptr<MsgSip> &ms = ev->getMsgSip();
-	uint32_t call_hash;
 	sip_t *sip = ms->getSip();
-	int index;
 
-	if (mRoutesCount == 0)
+	if (mRoutes.empty())
 		return;
 
-	/* very simple load sharing algorithm, based on randomness of call id*/
-	if (sip->sip_call_id) {
-		const char *route;
-		call_hash = sip->sip_call_id->i_hash;
-		index = call_hash % mRoutesCount;
-		route = mRoutes[index].c_str();
-		cleanAndPrependRoute(getAgent(), ms->getMsg(), sip, sip_route_make(ms->getHome(), route));
-	} else {
+	if (!sip->sip_call_id) {
 		LOGW("request has no call id");
+		return;
+	}
+	const Route *route = selectRoute(sip);
+	if (route) {
+		cleanAndPrependRoute(getAgent(), ms->getMsg(), sip, sip_route_make(ms->getHome(), route->header.c_str()));
 	}
 }
 
 void LoadBalancer::onResponse(shared_ptr<ResponseSipEvent> &ev) {
-	/*nothing to do*/
+	const sip_t *sip = ev->getMsgSip()->getSip();
+	if (mStickyDialogs.empty() || !sip->sip_status || sip->sip_status->st_status < 300) return;
+	if (!sip->sip_call_id || !sip->sip_cseq) return;
+
+	// The request creating the dialog failed: there is no dialog to stick to.
+	auto it = mStickyDialogs.find(sip->sip_call_id->i_id);
+	if (it != mStickyDialogs.end() && it->second.cseq == sip->sip_cseq->cs_seq) eraseStickyDialog(it);
+}
+
+void LoadBalancer::onIdle() {
+	time_t now = getCurrentTime();
+	while (!mStickyExpiry.empty() && mStickyExpiry.begin()->first < now) {
+		mStickyDialogs.erase(mStickyExpiry.begin()->second);
+		mStickyExpiry.erase(mStickyExpiry.begin());
+	}
+}
+
+void LoadBalancer::sProbeTimerFunc(su_root_magic_t *magic, su_timer_t *t, void *data) {
+	static_cast<LoadBalancer *>(data)->probeRoutes();
+}
+
+int LoadBalancer::sProbeCallback(nta_outgoing_magic_t *magic, nta_outgoing_t *orq, const sip_t *sip) {
+	Route &route = *reinterpret_cast<Route *>(magic);
+	int status = nta_outgoing_status(orq);
+	if (status >= 200) {
+		nta_outgoing_destroy(orq);
+		route.probe = nullptr;
+		route.module->onProbeResponse(route, status);
+	}
+	return 0;
+}
+
+void LoadBalancer::probeRoutes() {
+	for (auto &route : mRoutes) {
+		if (!route->leg) continue;
+		if (route->probe) {
+			// No answer since the previous check.
+			nta_outgoing_destroy(route->probe);
+			route->probe = nullptr;
+			onProbeResponse(*route, 408);
+		}
+		route->probe = nta_outgoing_tcreate(route->leg, &LoadBalancer::sProbeCallback,
+			reinterpret_cast<nta_outgoing_magic_t *>(route.get()), nullptr, SIP_METHOD_OPTIONS,
+			reinterpret_cast<const url_string_t *>(route->url), TAG_END());
+		if (!route->probe) LOGE("Could not send the health check of route %s", route->header.c_str());
+	}
+}
+
+void LoadBalancer::onProbeResponse(Route &route, int status) {
+	// Any answer but a timeout or a server failure proves that the route is able to process requests.
+	bool success = status != 408 && status < 500;
+	if (success) {
+		route.failures = 0;
+		if (!route.healthy) setRouteHealth(route, true);
+	} else if (++route.failures >= mMaxProbeFailures && route.healthy) {
+		setRouteHealth(route, false);
+	}
+}
+
+void LoadBalancer::setRouteHealth(Route &route, bool healthy) {
+	if (healthy) LOGI("Route %s is up again", route.header.c_str());
+	else LOGW("Route %s is down", route.header.c_str());
+	route.healthy = healthy;
+	buildRing();
 }
 
 ModuleInfo<LoadBalancer> LoadBalancer::sInfo(
@@ -29,6 +29,8 @@ using namespace std;
 using namespace ::std::placeholders;
 using namespace flexisip;
 
+static const Transaction::PropertyKey<RelayedCall> sRelayedCallKey{"MediaRelay"};
+
 static bool isEarlyMedia(sip_t *sip) {
 	if (sip->sip_status->st_status == 180 || sip->sip_status->st_status == 183) {
 		sip_payload_t *payload = sip->sip_payload;
@@ -169,14 +171,13 @@ void MediaRelay::onUnload() {
 
 bool MediaRelay::processNewInvite(const shared_ptr<RelayedCall> &c, const shared_ptr<OutgoingTransaction>& transaction, const shared_ptr<RequestSipEvent> &ev) {
 	sip_t *sip = ev->getMsgSip()->getSip();
-	msg_t *msg = ev->getMsgSip()->getMsg();
 
 	if (sip->sip_from == NULL || sip->sip_from->a_tag == NULL) {
 		LOGW("No tag in from !");
 		return false;
 	}
 	c->updateActivity();
-	shared_ptr<SdpModifier> m = SdpModifier::createFromSipMsg(ev->getMsgSip()->getHome(), sip, mSdpMangledParam);
+	shared_ptr<SdpModifier> m = ev->getMsgSip()->getSdpModifier(mSdpMangledParam);
 	if (m == NULL) {
 		LOGW("Invalid SDP");
 		return false;
@@ -233,11 +234,7 @@ bool MediaRelay::processNewInvite(const shared_ptr<RelayedCall> &c, const shared
 	m->masqueradeInOffer(bind(&RelayedCall::getChannelSources, c, _1, to_tag, transaction->getBranchId()));
 
 	if (!mSdpMangledParam.empty()) m->addAttribute(mSdpMangledParam.c_str(), "yes");
-	if (m->update(msg, sip)==-1){
-		LOGE("Cannot update SDP in message.");
-		ev->reply(500, "Media relay SDP processing internal error", SIPTAG_SERVER_STR(getAgent()->getServerString()), TAG_END());
-		return false;
-	}
+	m->setModified();
 	c->getServer()->update();
 	return true;
 }
@@ -264,7 +261,7 @@ void MediaRelay::onRequest(shared_ptr<RequestSipEvent> &ev) {
 		shared_ptr<OutgoingTransaction> ot = ev->createOutgoingTransaction();
 		bool newContext=false;
 
-		c=it->getProperty<RelayedCall>(getModuleName());
+		c=it->getProperty(sRelayedCallKey);
 		/*if the transaction has no RelayedCall associated, then look for an established dialog (case of reINVITE) */
 		if (c==NULL) c=dynamic_pointer_cast<RelayedCall>(mCalls->find(getAgent(), sip, false));
 		if (c==NULL) {
@@ -278,14 +275,14 @@ void MediaRelay::onRequest(shared_ptr<RequestSipEvent> &ev) {
 			c->forcePublicAddress(mUsePublicIpForSdpMasquerading);
 			mCurServer = (mCurServer + 1) % mServers.size();
 			newContext=true;
-			it->setProperty<RelayedCall>(getModuleName(), c);
+			it->setProperty(sRelayedCallKey, c);
 			configureContext(c);
 		}
 		if (processNewInvite(c, ot, ev)) {
 			//be in the record-route
 			addRecordRouteIncoming(getAgent(),ev);
 			if (newContext) mCalls->store(c);
-			ot->setProperty(getModuleName(), c);
+			ot->setProperty(sRelayedCallKey, c);
 		}
 	}else if (sip->sip_request->rq_method == sip_method_bye) {
 		if ((c = dynamic_pointer_cast<RelayedCall>(mCalls->findEstablishedDialog(getAgent(), sip))) != NULL) {
@@ -294,7 +291,7 @@ void MediaRelay::onRequest(shared_ptr<RequestSipEvent> &ev) {
 	}else if (sip->sip_request->rq_method == sip_method_cancel) {
 		shared_ptr<IncomingTransaction> it=dynamic_pointer_cast<IncomingTransaction>(ev->getIncomingAgent());
 		/* need to match cancel from incoming transaction, because in this case the entire call context can be dropped immediately*/
-		if (it && (c = it->getProperty<RelayedCall>(getModuleName())) != NULL){
+		if (it && (c = it->getProperty(sRelayedCallKey)) != NULL){
 			LOGD("Relayed call terminated by incoming cancel.");
 			mCalls->remove(c);
 		}
@@ -303,7 +300,6 @@ void MediaRelay::onRequest(shared_ptr<RequestSipEvent> &ev) {
 
 void MediaRelay::processResponseWithSDP(const shared_ptr<RelayedCall> &c, const shared_ptr<OutgoingTransaction>& transaction, const shared_ptr<MsgSip> &msgSip) {
 	sip_t *sip = msgSip->getSip();
-	msg_t *msg = msgSip->getMsg();
 	bool isEarlyMedia=false;
 
 	LOGD("Processing 200 Ok or early media");
@@ -318,7 +314,7 @@ void MediaRelay::processResponseWithSDP(const shared_ptr<RelayedCall> &c, const
 		c->setEstablished(transaction->getBranchId());
 	}else isEarlyMedia=true;
 
-	shared_ptr<SdpModifier> m = SdpModifier::createFromSipMsg(msgSip->getHome(), sip, mSdpMangledParam);
+	shared_ptr<SdpModifier> m = msgSip->getSdpModifier(mSdpMangledParam);
 	if (m == NULL) {
 		LOGW("Invalid SDP");
 		return;
@@ -343,7 +339,7 @@ void MediaRelay::processResponseWithSDP(const shared_ptr<RelayedCall> &c, const
 
 	// masquerade c lines and ports for streams not handled by ICE.
 	m->masqueradeInAnswer(bind(&RelayedCall::getChannelSources, c, _1, sip->sip_from->a_tag, transaction->getBranchId()));
-	m->update(msg, sip);
+	m->setModified();
 }
 
 void MediaRelay::onResponse(shared_ptr<ResponseSipEvent> &ev) {
@@ -357,7 +353,7 @@ void MediaRelay::onResponse(shared_ptr<ResponseSipEvent> &ev) {
 	shared_ptr<IncomingTransaction> it=dynamic_pointer_cast<IncomingTransaction>(ev->getIncomingAgent());
 
 	if (ot != NULL) {
-		c = ot->getProperty<RelayedCall>(getModuleName());
+		c = ot->getProperty(sRelayedCallKey);
 		if (c) {
 			if (sip->sip_cseq && sip->sip_cseq->cs_method == sip_method_invite) {
 				fixAuthChallengeForSDP(ms->getHome(), msg, sip);
@@ -370,7 +366,7 @@ void MediaRelay::onResponse(shared_ptr<ResponseSipEvent> &ev) {
 		}
 	}
 
-	if (it && (c = it->getProperty<RelayedCall>(getModuleName()))!=NULL){
+	if (it && (c = it->getProperty(sRelayedCallKey))!=NULL){
 		//This is a response sent to the incoming transaction.
 		LOGD("call context %p",c.get());
 		if (sip->sip_cseq && sip->sip_cseq->cs_method == sip_method_invite){
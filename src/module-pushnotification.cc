@@ -120,6 +120,8 @@ private:
 
 using namespace std;
 
+static const Transaction::PropertyKey<PushNotificationContext> sPushNotificationContextKey{"PushNotification"};
+
 PushNotificationContext::PushNotificationContext(const std::shared_ptr<OutgoingTransaction> &transaction,
 		PushNotification *module,
 		const std::shared_ptr<PushNotificationRequest> &pnr,
@@ -708,7 +710,7 @@ void PushNotification::makePushNotification(const shared_ptr<MsgSip> &ms,
 			}
 		}
 		if (context) /*associate with transaction so that transaction can eventually cancel it if the device answers.*/
-			transaction->setProperty<weak_ptr<PushNotificationContext>>(getModuleName(), make_shared<weak_ptr<PushNotificationContext>>(context));
+			transaction->setProperty(sPushNotificationContextKey, weak_ptr<PushNotificationContext>{context});
 	}
 }
 
@@ -777,13 +779,10 @@ void PushNotification::onResponse(std::shared_ptr<ResponseSipEvent> &ev) {
 	if (transaction != NULL && code >= 180 && code != 503) {
 		/*any response >=180 except 503 (which is sofia's internal response for broken transports) should cancel the
 		 * push*/
-		shared_ptr<weak_ptr<PushNotificationContext>> value = transaction->getProperty<weak_ptr<PushNotificationContext>>(getModuleName());
-		if (value && !value->expired()) {
-			shared_ptr<PushNotificationContext> ctx = value->lock();
-			if (ctx) {
-				ctx->cancel();
-				removePushNotification(ctx.get());
-			}
+		shared_ptr<PushNotificationContext> ctx = transaction->getProperty(sPushNotificationContextKey);
+		if (ctx) {
+			ctx->cancel();
+			removePushNotification(ctx.get());
 		}
 	}
 }
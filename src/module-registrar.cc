@@ -19,19 +19,28 @@
 #include <flexisip/module-registrar.hh>
 #include <flexisip/logmanager.hh>
 
-#include <fstream>
 #include <sstream>
 #include <ostream>
 #include <string>
 #include <csignal>
+#include <cctype>
+#include <cerrno>
+#include <cstring>
+#include <ctime>
 #include <functional>
 #include <algorithm>
-#include <regex>
+#include <iterator>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 using namespace std;
 using namespace flexisip;
 
 static ModuleRegistrar *sRegistrarInstanceForSigAction = nullptr;
+static const Transaction::PropertyKey<ResponseContext> sResponseContextKey{"Registrar"};
 
 template <typename SipEventT>
 static void addEventLogRecordFound(shared_ptr<SipEventT> ev, const sip_contact_t *contacts) {
@@ -204,11 +213,10 @@ void FakeFetchListener::onInvalid() {
 void FakeFetchListener::onContactUpdated(const shared_ptr<ExtendedContact> &ec) {
 }
 
-shared_ptr<ResponseContext> ResponseContext::createInTransaction(shared_ptr<RequestSipEvent> ev, int globalDelta,
-														const string &tag) {
+shared_ptr<ResponseContext> ResponseContext::createInTransaction(shared_ptr<RequestSipEvent> ev, int globalDelta) {
 	auto otr = ev->createOutgoingTransaction();
 	auto context = make_shared<ResponseContext>(ev, globalDelta);
-	otr->setProperty(tag, context);
+	otr->setProperty(sResponseContextKey, context);
 	return context;
 }
 
@@ -353,6 +361,15 @@ void ModuleRegistrar::onDeclare(GenericStruct *mc) {
 			" - internal : contacts are stored in RAM. Of course, if flexisip is restarted, all the contact URIs are "
 			"lost until clients update their registration.\n"
 			"The redis backend is recommended, the internal being more adapted to very small deployments.", "internal"},
+		{String, "internal-snapshot-file",
+			"With the internal backend, path of a file where the registered contacts are periodically saved, and "
+			"from which they are reloaded at startup, so that devices don't need to register again after a restart. "
+			"Empty to disable.", ""},
+		{Integer, "internal-snapshot-period",
+			"Period in seconds between two saves of the internal backend snapshot.", "60"},
+		{Integer, "dump-time-slice",
+			"Time in milliseconds the main loop may spend at once serializing the records given by the "
+			"REGISTRAR_DUMP command of the CLI. The size of the batches is adjusted to stay within it.", "10"},
 
 		// Redis config support
 		{String, "redis-server-domain", "Hostname or address of the Redis server. ", "localhost"},
@@ -366,6 +383,15 @@ void ModuleRegistrar::onDeclare(GenericStruct *mc) {
 			"Note: This requires that all Redis instances have the same password. Otherwise the authentication "
 			"will fail.",
 			"60"},
+		{String, "redis-contact-encoding",
+			"Encoding of the contacts written in Redis, among:\n"
+			" - url-encoded : SIP Contact header with the binding information as URI parameters, as written by "
+			"older Flexisip versions.\n"
+			" - binary : compact versioned binary encoding, faster to write and to parse.\n"
+			"Both encodings are always understood when reading, but older Flexisip versions only understand "
+			"'url-encoded' and remove the contacts they can't parse. When upgrading Flexisip instances sharing the "
+			"same Redis database, first upgrade all of them while keeping 'url-encoded', then switch them to 'binary'.",
+			"url-encoded"},
 		{String, "service-route",
 			"Sequence of proxies (space-separated) where requests will be redirected through (RFC3608)", ""},
 		{String, "message-expires-param-name", "Name of the custom Contact header parameter which is to indicate the expire "
@@ -408,6 +434,7 @@ void ModuleRegistrar::onLoad(const GenericStruct *mc) {
 	for (auto it = mDomains.begin(); it != mDomains.end(); ++it) {
 		LOGD("Found registrar domain: %s", (*it).c_str());
 	}
+	mDomainMatcher = DomainMatcher(mDomains);
 	mUniqueIdParams = mc->get<ConfigStringList>("unique-id-parameters")->read();
 	mServiceRoute = mc->get<ConfigString>("service-route")->read();
 	// replace space-separated to comma-separated since sofia-sip is expecting this way
@@ -431,6 +458,7 @@ void ModuleRegistrar::onLoad(const GenericStruct *mc) {
 	}
 
 	if (!mStaticRecordsFile.empty()) {
+		mStaticBindingsTimer.reset(new sofiasip::Timer(mAgent->getRoot()));
 		readStaticRecords(); // read static records from configuration file
 		mStaticRecordsTimer = mAgent->createTimer(mStaticRecordsTimeout * 1000, &staticRoutesRereadTimerfunc, this);
 	}
@@ -457,6 +485,9 @@ void ModuleRegistrar::onUnload() {
 	if (mStaticRecordsTimer) {
 		su_timer_destroy(mStaticRecordsTimer);
 	}
+	mStaticBindingsTimer.reset();
+	mStaticBindings.clear();
+	mStaticRecords.clear();
 }
 
 void ModuleRegistrar::idle() {
@@ -469,7 +500,7 @@ void ModuleRegistrar::updateLocalRegExpire() {
 }
 
 bool ModuleRegistrar::isManagedDomain(const url_t *url) {
-	return ModuleToolbox::isManagedDomain(getAgent(), mDomains, url);
+	return ModuleToolbox::isManagedDomain(getAgent(), mDomainMatcher, url);
 }
 
 string ModuleRegistrar::routingKey(const url_t *sipUri) {
@@ -691,7 +722,7 @@ void ModuleRegistrar::onRequest(shared_ptr<RequestSipEvent> &ev) {
 		ev->createIncomingTransaction();
 		ev->reply(SIP_100_TRYING, SIPTAG_SERVER_STR(getAgent()->getServerString()), TAG_END());
 
-		auto context = ResponseContext::createInTransaction(ev, maindelta, getModuleName());
+		auto context = ResponseContext::createInTransaction(ev, maindelta);
 		// Contact route inserter should masquerade contact using domain
 		SLOGD << "Contacts :" << context->mContacts;
 		// Store a reference to the ResponseContext to prevent its destruction
@@ -731,7 +762,7 @@ void ModuleRegistrar::onResponse(shared_ptr<ResponseSipEvent> &ev) {
 		return;
 	}
 
-	auto context = transaction->getProperty<ResponseContext>(getModuleName());
+	auto context = transaction->getProperty(sResponseContextKey);
 	if (!context) {
 		LOGD("No response context found");
 		return;
@@ -775,84 +806,83 @@ void ModuleRegistrar::onResponse(shared_ptr<ResponseSipEvent> &ev) {
 	}
 }
 
+/*
+ * Static records are diffed against the previous load of the file by StaticRecords, the bindings being then sent by
+ * batches over several main loop iterations.
+ */
 void ModuleRegistrar::readStaticRecords() {
-	int linenum = 0;
-
 	if (mStaticRecordsFile.empty()) return;
 	LOGD("Reading static records file");
 
-	sofiasip::Home home;
-
-	ifstream file(mStaticRecordsFile);
-	if (!file.is_open()) {
+	int fd = open(mStaticRecordsFile.c_str(), O_RDONLY | O_CLOEXEC);
+	if (fd < 0) {
 		LOGE("Can't open file %s", mStaticRecordsFile.c_str());
 		return;
 	}
+	struct stat st;
+	if (fstat(fd, &st) != 0) {
+		LOGE("Can't stat file %s: %s", mStaticRecordsFile.c_str(), strerror(errno));
+		close(fd);
+		return;
+	}
+	size_t size = static_cast<size_t>(st.st_size);
+	void *map = nullptr;
+	if (size > 0) {
+		map = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+		if (map == MAP_FAILED) {
+			LOGE("Can't map file %s: %s", mStaticRecordsFile.c_str(), strerror(errno));
+			close(fd);
+			return;
+		}
+	}
+	close(fd);
 
-	string path = getAgent()->getPreferredRoute();
 	mStaticRecordsVersion++;
+	/* The bindings must have a CSeq greater than the ones they replace, including the ones bound before a restart
+	 * which are still in the registrar database: the time of the load is used, unless loads are closer than a
+	 * second. */
+	mStaticRecordsCSeq = max(static_cast<uint32_t>(time(nullptr)), mStaticRecordsCSeq + 1);
+	// Bindings are kept valid until the next refresh of their line, with a one round margin.
+	int expire = (StaticRecords::sRefreshRounds + 1) * mStaticRecordsTimeout + 5;
+	auto stats = mStaticRecords.load(static_cast<const char *>(map), size, expire, mStaticRecordsCSeq,
+		mStaticBindings, mStaticRecordsFile);
+	if (map) munmap(map, size);
+
+	LOGI("Static records file read: %zu lines added, %zu removed, %zu refreshed", stats.added, stats.removed,
+		stats.refreshed);
+	if (!mStaticBindings.empty() && !mStaticBindingsTimer->isRunning()) processStaticBindings();
+}
+
+void ModuleRegistrar::processStaticBindings() {
+	sofiasip::Home home;
+	string path = getAgent()->getPreferredRoute();
 
-	const regex isCommentRe(R"regex(^\s*#)regex");
-	const regex isRecordRe(R"regex(^\s*([[print]]+)\s+([[print]]+)\s*$)regex");
-	while (file.good() && !file.eof()) {
-		string line;
-		string from;
-		string contact_header;
-		smatch m;
-
-		getline(file, line), ++linenum;
+	for (size_t i = 0; i < sStaticBindingsBatchSize && !mStaticBindings.empty(); ++i) {
+		StaticRecords::Binding binding = move(mStaticBindings.front());
+		mStaticBindings.pop_front();
 
+		sip_contact_t *contact = sip_contact_make(home.home(), binding.contact.c_str());
+		if (!contact) continue;
 		try {
+			SipUri fromUri(binding.from);
+			BindingParameters parameter;
 
-			if (line.empty() || regex_match(line, m, isCommentRe)) continue;
-			else if (regex_match(line, m, isRecordRe)) {
-				from = m[1];
-				contact_header = m[2];
-			} else {
-				throw runtime_error("invalid line syntax");
-			}
-
-			// Create
-			sip_contact_t *url = sip_contact_make(home.home(), from.c_str());
-			sip_contact_t *contact = sip_contact_make(home.home(), contact_header.c_str());
-			int expire = mStaticRecordsTimeout + 5; // 5s to avoid race conditions
-
-			if (!url || !contact) {
-				throw runtime_error("one URI is invlaid");
-			}
-
-			try {
-				SipUri fromUri(url->m_url);
-				while (contact) {
-					BindingParameters parameter;
-					shared_ptr<OnStaticBindListener> listener;
-					string fakeCallId = "static-record-v" + to_string(su_random());
-					bool alias = isManagedDomain(contact->m_url);
-					sip_contact_t *sipContact = sip_contact_dup(home.home(), contact);
-
-					sipContact->m_next = nullptr;
-					listener = make_shared<OnStaticBindListener>(url->m_url, contact);
-
-					parameter.callId = fakeCallId;
-					parameter.path = path;
-					parameter.globalExpire = expire;
-					parameter.alias = alias;
-					parameter.version = mStaticRecordsVersion;
-
-					RegistrarDb::get()->bind(fromUri, sipContact, parameter, listener);
-					contact = contact->m_next;
-				}
-			} catch (const sofiasip::InvalidUrlError &e) {
-				ostringstream os;
-				os << "'" << e.getUrl() << "' isn't a valid SIP-URI: " << e.getReason();
-				throw runtime_error(os.str());
-			}
-
-		} catch (const runtime_error &e) {
-			SLOGW << "error while reading the static record file [" << mStaticRecordsFile << ":" << linenum << endl
-				<< "\t`" << line << "`: " << e.what();
+			// The call-id identifies the binding, so that it is replaced on refresh and removed on unbind.
+			parameter.callId = "static-record-" + to_string(hash<string>()(binding.from + " " + binding.contact));
+			parameter.cseq = binding.cseq;
+			parameter.path = path;
+			parameter.globalExpire = binding.expire;
+			parameter.alias = isManagedDomain(contact->m_url);
+			parameter.version = mStaticRecordsVersion;
+
+			RegistrarDb::get()->bind(fromUri, contact, parameter, make_shared<OnStaticBindListener>(fromUri.get(), contact));
+		} catch (const sofiasip::InvalidUrlError &e) {
+			SLOGW << "Can't bind static record '" << binding.from << "': " << e.getReason();
 		}
 	}
+	if (!mStaticBindings.empty()) {
+		mStaticBindingsTimer->set([this]() {processStaticBindings();});
+	}
 }
 
 void ModuleRegistrar::sighandler(int signum, siginfo_t *info, void *ptr) {
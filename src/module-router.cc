@@ -113,6 +113,7 @@ void ModuleRouter::onLoad(const GenericStruct *mc) {
 	const GenericStruct *mReg = cr->get<GenericStruct>("module::Registrar");
 
 	mDomains = mReg->get<ConfigStringList>("reg-domains")->read();
+	mDomainMatcher = DomainMatcher(mDomains);
 
 	//Forking configuration for INVITEs
 	mForkCfg = make_shared<ForkContextConfig>();
@@ -183,17 +184,15 @@ void ModuleRouter::sendReply(shared_ptr<RequestSipEvent> &ev, int code, const ch
 	}
 }
 
-string ModuleRouter::routingKey(const url_t *sipUri) {
-	ostringstream oss;
-	if (sipUri->url_user) {
-		oss << sipUri->url_user << "@";
-	}
-	if (mUseGlobalDomain) {
-		oss << "merged";
-	} else {
-		oss << sipUri->url_host;
-	}
-	return oss.str();
+AorKey ModuleRouter::routingKey(const url_t *sipUri) {
+	const char *host = mUseGlobalDomain ? "merged" : sipUri->url_host;
+	size_t userLen = sipUri->url_user ? strlen(sipUri->url_user) : 0;
+	size_t hostLen = host ? strlen(host) : 0;
+	string key;
+	key.reserve(userLen + 1 + hostLen);
+	if (sipUri->url_user) key.append(sipUri->url_user, userLen).append(1, '@');
+	if (host) key.append(host, hostLen);
+	return AorKey(move(key));
 }
 
 /**
@@ -347,8 +346,8 @@ void ModuleRouter::onContactRegistered(const shared_ptr<OnContactRegisteredListe
 	url_e(sipUriRef, sizeof(sipUriRef) - 1, &urlcopy);
 
 	// Find all contexts
-	const string key(routingKey(sipUri));
-	auto range = mForks.equal_range(key.c_str());
+	const AorKey key(routingKey(sipUri));
+	auto range = mForks.equal_range(key);
 	SLOGD << "Searching for fork context with key " << key;
 
 	if (range.first != range.second){
@@ -380,7 +379,7 @@ void ModuleRouter::onContactRegistered(const shared_ptr<OnContactRegisteredListe
 		// Find all contexts
 		contact = ec->toSofiaContact(home.home(), ec->mExpireAt - 1);
 		path = ec->toSofiaRoute(home.home());
-		auto rang = mForks.equal_range(ExtendedContact::urlToString(ec->mSipContact->m_url));
+		auto rang = mForks.equal_range(AorKey(ExtendedContact::urlToString(ec->mSipContact->m_url)));
 		for (auto ite = rang.first; ite != rang.second; ++ite) {
 			shared_ptr<ForkContext> context = ite->second;
 			forksFound = true;
@@ -569,7 +568,7 @@ void ModuleRouter::routeRequest(shared_ptr<RequestSipEvent> &ev, const shared_pt
 	}
 	if (context) {
 		if (context->getConfig()->mForkLate) {
-			const string key(routingKey(sipUri));
+			const AorKey key(routingKey(sipUri));
 			context->addKey(key);
 			mForks.insert(make_pair(key, context));
 			if (mForks.count(key) == 1) {
@@ -604,7 +603,7 @@ void ModuleRouter::routeRequest(shared_ptr<RequestSipEvent> &ev, const shared_pt
 					temp_ctt->m_url->url_host = "merged";
 					temp_ctt->m_url->url_port = NULL;
 				}
-				const string key(routingKey(temp_ctt->m_url));
+				const AorKey key(routingKey(temp_ctt->m_url));
 				context->addKey(key);
 				mForks.insert(make_pair(key, context));
 				if (mForks.count(key) == 1) {
@@ -880,12 +879,12 @@ void ModuleRouter::onResponse(shared_ptr<ResponseSipEvent> &ev) {
 void ModuleRouter::onForkContextFinished(shared_ptr<ForkContext> ctx) {
 	if (!ctx->getConfig()->mForkLate) return;
 
-	const list<string> & keys = ctx->getKeys();
+	const list<AorKey> & keys = ctx->getKeys();
 	for (auto it = keys.begin(); it != keys.end(); ++it) {
-		string key = *it;
+		const AorKey &key = *it;
 		LOGD("Looking at fork contexts with key %s", key.c_str());
 
-		auto range = mForks.equal_range(key.c_str());
+		auto range = mForks.equal_range(key);
 		for (auto it = range.first; it != range.second;) {
 			if (it->second == ctx) {
 				LOGD("Remove fork %s from store", it->first.c_str());
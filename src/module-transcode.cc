@@ -21,6 +21,8 @@
 using namespace std;
 using namespace flexisip;
 
+static const Transaction::PropertyKey<TranscodedCall> sTranscodedCallKey{"Transcoder"};
+
 ModuleInfo<Transcoder> Transcoder::sInfo(
 	"Transcoder",
 	"The purpose of the Transcoder module is to transparently transcode from one audio codec to another to make "
@@ -254,9 +256,8 @@ static void removeBandwidths(sdp_session_t *sdp) {
 
 int Transcoder::handleOffer(TranscodedCall *c, shared_ptr<SipEvent> ev) {
 	const shared_ptr<MsgSip> &ms = ev->getMsgSip();
-	msg_t *msg = ms->getMsg();
 	sip_t *sip = ms->getSip();
-	shared_ptr<SdpModifier> m = SdpModifier::createFromSipMsg(ms->getHome(), ms->getSip(), "");
+	shared_ptr<SdpModifier> m = ms->getSdpModifier();
 
 	if (m == NULL)
 		return -1;
@@ -300,7 +301,7 @@ int Transcoder::handleOffer(TranscodedCall *c, shared_ptr<SipEvent> ev) {
 			removeBandwidths(m->mSession);
 
 		m->replacePayloads(mSupportedAudioPayloads, c->getInitialOffer());
-		m->update(msg, sip);
+		m->setModified();
 
 		if (canDoRateControl(sip)) {
 			c->getFrontSide()->enableRc(true);
@@ -354,7 +355,7 @@ void Transcoder::onRequest(shared_ptr<RequestSipEvent> &ev) {
 		auto c = make_shared<TranscodedCall>(mFactory, sip, getAgent()->getRtpBindIp());
 		if (processInvite(c.get(), ev) == 0) {
 			mCalls.store(c);
-			ot->setProperty<TranscodedCall>(getModuleName(), c);
+			ot->setProperty(sTranscodedCallKey, c);
 		} else {
 			LOGD("Transcoder: couldn't process invite, stopping processing");
 			return;
@@ -391,7 +392,7 @@ int Transcoder::handleAnswer(TranscodedCall *ctx, shared_ptr<SipEvent> ev) {
 	const shared_ptr<MsgSip> &ms = ev->getMsgSip();
 	string addr;
 	int port;
-	shared_ptr<SdpModifier> m = SdpModifier::createFromSipMsg(ms->getHome(), ms->getSip());
+	shared_ptr<SdpModifier> m = ms->getSdpModifier();
 	int ptime;
 
 	if (m == NULL)
@@ -429,7 +430,7 @@ int Transcoder::handleAnswer(TranscodedCall *ctx, shared_ptr<SipEvent> ev) {
 	if (mRemoveBandwidthsLimits)
 		removeBandwidths(m->mSession);
 
-	m->update(ms->getMsg(), ms->getSip());
+	m->setModified();
 
 	normalizePayloads(common);
 	ctx->getFrontSide()->assignPayloads(common);
@@ -478,7 +479,7 @@ void Transcoder::onResponse(shared_ptr<ResponseSipEvent> &ev) {
 			return;
 		}
 
-		shared_ptr<TranscodedCall> c = transaction->getProperty<TranscodedCall>(getModuleName());
+		shared_ptr<TranscodedCall> c = transaction->getProperty(sTranscodedCallKey);
 		if (c == NULL) {
 			LOGD("No transcoded call context found");
 			return;
@@ -346,8 +346,8 @@ bool ModuleToolbox::matchesOneOf(const string &item, const list<string> &set) {
 			size_t wildcardPosition = value.find("*");
 			// if domain has a wildcard in it, try to match
 			if (wildcardPosition != string::npos) {
-				size_t beforeWildcard = item.find(value.substr(0, wildcardPosition));
-				size_t afterWildcard = item.find(value.substr(wildcardPosition + 1));
+				size_t beforeWildcard = item.find(tmp, 0, wildcardPosition);
+				size_t afterWildcard = item.find(tmp + wildcardPosition + 1);
 				if (beforeWildcard != string::npos && afterWildcard != string::npos) {
 					return true;
 				}
@@ -577,6 +577,19 @@ bool ModuleToolbox::isManagedDomain(const Agent *agent, const list<string> &doma
 	return check;
 }
 
+bool ModuleToolbox::isManagedDomain(const Agent *agent, const DomainMatcher &domains, const url_t *url) {
+	bool check = domains.match(url->url_host);
+	if (check) {
+		// additional check: if the domain is an ip address that is not this proxy, then it is not considered as a
+		// managed domain for the registrar.
+		// we need this to distinguish requests that needs registrar routing from already routed requests.
+		if (ModuleToolbox::isNumeric(url->url_host) && !agent->isUs(url, true)) {
+			check = false;
+		}
+	}
+	return check;
+}
+
 void ModuleToolbox::addRoutingParam(su_home_t *home, sip_contact_t *c, const string &routingParam, const char *domain) {
 	ostringstream oss;
 	oss << routingParam << "=" << domain;
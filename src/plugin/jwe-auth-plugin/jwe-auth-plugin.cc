@@ -19,7 +19,9 @@
 #include <array>
 #include <dirent.h>
 #include <fstream>
+#include <list>
 #include <unordered_map>
+#include <vector>
 
 extern "C" {
 	#include <jose/jose.h>
@@ -29,6 +31,8 @@ extern "C" {
 #include <flexisip/module-auth.hh>
 #include <flexisip/plugin.hh>
 
+#include "utils/threadpool.hh"
+
 // =============================================================================
 
 using namespace std;
@@ -180,6 +184,20 @@ error:
 	return nullptr;
 }
 
+// Returns the "kid" attr of the JWE protected header, or an empty string if there is none.
+static string getJweKid(const char *text) {
+	const char *separator = strchr(text, '.');
+	if (!separator || !isB64(text, separator - text))
+		return "";
+
+	json_auto_t *protectedHeader = json_stringn(text, separator - text);
+	json_auto_t *header = protectedHeader ? jose_b64_dec_load(protectedHeader) : nullptr;
+	const char *kid = nullptr;
+	if (!header || json_unpack(header, "{s:s}", "kid", &kid) < 0)
+		return "";
+	return kid;
+}
+
 static json_t *decryptJwe(const char *text, const json_t *jwk) {
 	json_auto_t *jwe = parseJwe(text);
 	if (!jwe)
@@ -278,6 +296,10 @@ struct JweContext {
 	string key;
 	su_timer_t *timer = nullptr;
 	bool consumed = false;
+
+	// Position in the LRU of the contexts which may still be used, i.e. not consumed yet.
+	list<JweContext *>::iterator lruPosition;
+	bool inLru = false;
 };
 
 class JweAuth : public Module {
@@ -285,7 +307,16 @@ public:
 	JweAuth(Agent *agent) : Module(agent) {}
 
 private:
-	json_t *decryptJwe(const char *text) const;
+	// Result of a decryption done by a worker, sent back to the main thread.
+	struct DecryptResult {
+		JweAuth *self;
+		string key;
+		json_t *jwt;
+	};
+
+	vector<const json_t *> selectJwks(const char *text) const;
+	bool decryptJweAsync(const string &jweKey);
+	static void onJweDecrypted(su_root_magic_t *magic, su_msg_r msg, void *arg) noexcept;
 
 	void onDeclare(GenericStruct *moduleConfig) override;
 	void onLoad(const GenericStruct *moduleConfig) override;
@@ -294,10 +325,17 @@ private:
 	void onRequest(shared_ptr<RequestSipEvent> &ev) override;
 	void onResponse(shared_ptr<ResponseSipEvent> &ev) override;
 
+	const char *checkJwt(json_t *jwt, const sip_t *sip, int *timeout) const;
+	void acceptRequest(const shared_ptr<RequestSipEvent> &ev, const shared_ptr<JweContext> &jweContext);
+	void rejectRequest(const shared_ptr<RequestSipEvent> &ev, const char *error);
+
 	void insertJweContext(string &&jweKey, const shared_ptr<JweContext> &jweContext, int timeout);
+	void touchJweContext(JweContext &jweContext);
+	void releaseJweContext(JweContext &jweContext);
 	static void removeJweContext(su_root_magic_t *magic, su_timer_t *timer, su_timer_arg_t *arg);
 
 	list<json_t *> mJwks;
+	unordered_map<string, const json_t *> mJwksByKid;
 
 	string mJweCustomHeader;
 	string mOidCustomHeader;
@@ -307,6 +345,13 @@ private:
 	list<pair<const char *, const char *>> mCustomHeadersToCheck;
 
 	unordered_map<string, shared_ptr<JweContext>> mJweContexts;
+	list<JweContext *> mJweContextsLru; // most recently used first
+	size_t mMaxJweContexts = 0;
+
+	// Requests suspended while their token is being decrypted, by token.
+	unordered_map<string, vector<shared_ptr<RequestSipEvent>>> mPendingDecryptions;
+	unique_ptr<ThreadPool> mDecryptWorkers;
+
 	Authentication *mAuthModule;
 };
 
@@ -323,20 +368,79 @@ FLEXISIP_DECLARE_PLUGIN(JweAuthInfo, JweAuthPluginName, JweAuthPluginVersion);
 
 // -----------------------------------------------------------------------------
 
-json_t *JweAuth::decryptJwe(const char *text) const {
-	for (const json_t *jwk : mJwks) {
-		json_t *jwt = ::decryptJwe(text, jwk);
-		if (jwt)
-			return jwt;
+// Only the key designated by the "kid" header is tried. Tokens without kid, or with an unknown one, are tried
+// with every key.
+vector<const json_t *> JweAuth::selectJwks(const char *text) const {
+	const string kid = getJweKid(text);
+	if (!kid.empty()) {
+		auto it = mJwksByKid.find(kid);
+		if (it != mJwksByKid.end())
+			return { it->second };
 	}
-	return nullptr;
-};
+	return vector<const json_t *>(mJwks.cbegin(), mJwks.cend());
+}
+
+bool JweAuth::decryptJweAsync(const string &jweKey) {
+	const vector<const json_t *> jwks = selectJwks(jweKey.c_str());
+	su_root_t *root = mAgent->getRoot();
+	return mDecryptWorkers->run([this, root, jweKey, jwks]() {
+		json_t *jwt = nullptr;
+		for (const json_t *jwk : jwks) {
+			if ((jwt = ::decryptJwe(jweKey.c_str(), jwk)))
+				break;
+		}
+
+		// The result is handled on the main thread.
+		su_msg_r msg = SU_MSG_R_INIT;
+		if (su_msg_create(msg, su_root_task(root), su_root_task(root), onJweDecrypted, sizeof(DecryptResult *)) == -1)
+			LOGF("Couldn't create JWE decryption message.");
+		*reinterpret_cast<DecryptResult **>(su_msg_data(msg)) = new DecryptResult{ this, jweKey, jwt };
+		if (su_msg_send(msg) == -1)
+			LOGF("Couldn't send JWE decryption message to main thread.");
+	});
+}
+
+void JweAuth::onJweDecrypted(su_root_magic_t *, su_msg_r msg, void *) noexcept {
+	unique_ptr<DecryptResult> result(*reinterpret_cast<DecryptResult **>(su_msg_data(msg)));
+	JweAuth *self = result->self;
+	json_auto_t *jwt = result->jwt;
+
+	auto it = self->mPendingDecryptions.find(result->key);
+	if (it == self->mPendingDecryptions.end())
+		return;
+	vector<shared_ptr<RequestSipEvent>> events = move(it->second);
+	self->mPendingDecryptions.erase(it);
+
+	for (const auto &ev : events) {
+		// A previous request holding the same token may have validated it already.
+		auto contextIt = self->mJweContexts.find(result->key);
+		if (contextIt != self->mJweContexts.end()) {
+			if (contextIt->second->consumed)
+				self->rejectRequest(ev, "JWE already consumed");
+			else
+				self->acceptRequest(ev, contextIt->second);
+			continue;
+		}
+
+		int timeout;
+		const char *error = jwt ? self->checkJwt(jwt, ev->getSip(), &timeout) : "Unable to decrypt JWE";
+		if (error) {
+			self->rejectRequest(ev, error);
+			continue;
+		}
+
+		auto jweContext = make_shared<JweContext>();
+		self->insertJweContext(string(result->key), jweContext, timeout);
+		self->acceptRequest(ev, jweContext);
+	}
+}
 
 void JweAuth::onDeclare(GenericStruct *moduleConfig) {
 	ConfigItemDescriptor configs[] = { {
 		String, "jwks-dir",
 		"Path to the directory where JSON Web Key (JWK) can be found."
-		" Any JWK must be put into a file with the `.jwk` suffix.",
+		" Any JWK must be put into a file with the `.jwk` suffix."
+		" When a JWK has a `kid` attr, the tokens giving this `kid` in their header are only decrypted with it.",
 		"/etc/flexisip/jwk/"
 	}, {
 		String, "jwe-custom-header", "The name of the JWE token custom header.", "X-token-jwe"
@@ -346,6 +450,20 @@ void JweAuth::onDeclare(GenericStruct *moduleConfig) {
 		String, "aud-custom-header", "The name of the aud custom header.", "X-token-aud"
 	}, {
 		String, "req-act-custom-header", "The name of the request action custom header.", "X-token-req_act"
+	}, {
+		Integer, "decrypt-threads",
+		"Number of threads decrypting the tokens. Requests are suspended while their token is being decrypted.",
+		"4"
+	}, {
+		Integer, "decrypt-max-queue-size",
+		"Maximum number of tokens waiting to be decrypted. Requests are rejected with a 503 beyond this limit.",
+		"1000"
+	}, {
+		Integer, "max-validated-tokens",
+		"Maximum number of validated tokens kept so that the following requests using them are accepted without "
+		"decrypting them again. The least recently used ones are forgotten first. Consumed tokens are kept until "
+		"their expiration anyway, so that they can't be used again.",
+		"10000"
 	}, config_item_end };
 	moduleConfig->addChildrenValues(configs);
 }
@@ -361,6 +479,10 @@ void JweAuth::onLoad(const GenericStruct *moduleConfig) {
 			if (jwk) {
 				SLOGI << "Registering JWK `" << path << "`";
 				mJwks.push_back(jwk);
+
+				const char *kid = nullptr;
+				if (json_unpack(jwk, "{s:s}", "kid", &kid) == 0)
+					mJwksByKid[kid] = jwk;
 			}
 		}
 	}
@@ -375,10 +497,19 @@ void JweAuth::onLoad(const GenericStruct *moduleConfig) {
 		{ "aud", mAudCustomHeader.c_str() },
 		{ "req_act", mReqActCustomHeader.c_str() }
 	};
+
+	const int nThreads = moduleConfig->get<ConfigInt>("decrypt-threads")->read();
+	const int maxQueueSize = moduleConfig->get<ConfigInt>("decrypt-max-queue-size")->read();
+	mDecryptWorkers.reset(new ThreadPool(max(nThreads, 1), max(maxQueueSize, 1)));
+	mMaxJweContexts = max(moduleConfig->get<ConfigInt>("max-validated-tokens")->read(), 1);
+
 	mAuthModule = dynamic_cast<Authentication*>(getAgent()->findModule("Authentication"));
 }
 
 void JweAuth::onUnload() {
+	// Wait for the decryptions in progress, which use the keys.
+	mDecryptWorkers.reset();
+
 	for (json_t *jwk : mJwks)
 		json_decref(jwk);
 }
@@ -397,7 +528,6 @@ void JweAuth::onRequest(shared_ptr<RequestSipEvent> &ev) {
 	}
 	
 	const char *error = nullptr;
-	shared_ptr<JweContext> jweContext;
 	const sip_unknown_t *header;
 	
 	if (!(header = ModuleToolbox::getCustomHeaderByName(sip, mOidCustomHeader.c_str())) || !header->un_value)
@@ -406,41 +536,40 @@ void JweAuth::onRequest(shared_ptr<RequestSipEvent> &ev) {
 		error = "Unable to match oid";
 	else if (!(header = ModuleToolbox::getCustomHeaderByName(sip, mJweCustomHeader.c_str())) || !header->un_value)
 		error = "No JWE token";
-	else {
-		string jweKey(header->un_value);
 
-		auto it = mJweContexts.find(jweKey);
-		if (it == mJweContexts.end()) {
-			int timeout;
-			json_auto_t *jwt = decryptJwe(header->un_value);
-			if (!jwt)
-				error = "Unable to decrypt JWE";
-			else if (!(error = checkJwtTime(jwt, &timeout))) {
-				for (const auto &data : mCustomHeadersToCheck)
-					if (!checkJwtAttrFromSipHeader(jwt, sip, data.first, data.second)) {
-						error = "JWT check attrs failed";
-						break;
-					}
-
-				if (!error) {
-					jweContext = make_shared<JweContext>();
-					insertJweContext(move(jweKey), jweContext, timeout);
-				}
-			}
+	if (error) {
+		rejectRequest(ev, error);
+		return;
+	}
+
+	string jweKey(header->un_value);
+	auto it = mJweContexts.find(jweKey);
+	if (it != mJweContexts.end()) {
+		// Already validated token, no need to decrypt it again.
+		if (it->second->consumed) {
+			rejectRequest(ev, "JWE already consumed");
 		} else {
-			jweContext = it->second;
-			if (jweContext->consumed)
-				error = "JWE already consumed";
+			touchJweContext(*it->second);
+			acceptRequest(ev, it->second);
 		}
+		return;
 	}
 
-	if (error) {
-		SLOGW << "Rejecting request because: `" << error << "`.";
-		ev->reply(403, error, SIPTAG_SERVER_STR(getAgent()->getServerString()), TAG_END());
+	// Absorb the retransmissions while the request is suspended.
+	ev->createIncomingTransaction();
+
+	auto pendingIt = mPendingDecryptions.find(jweKey);
+	if (pendingIt != mPendingDecryptions.end()) {
+		// The same token is already being decrypted for another request.
+		pendingIt->second.push_back(ev);
+	} else if (decryptJweAsync(jweKey)) {
+		mPendingDecryptions[jweKey].push_back(ev);
 	} else {
-		shared_ptr<IncomingTransaction> incomingTransaction = ev->createIncomingTransaction();
-		incomingTransaction->setProperty(getModuleName(), jweContext);
+		SLOGW << "Rejecting request because: `Too many JWE waiting for decryption`.";
+		ev->reply(503, "Service Unavailable", SIPTAG_SERVER_STR(getAgent()->getServerString()), TAG_END());
+		return;
 	}
+	ev->suspendProcessing();
 }
 
 void JweAuth::onResponse(shared_ptr<ResponseSipEvent> &ev) {
@@ -453,8 +582,46 @@ void JweAuth::onResponse(shared_ptr<ResponseSipEvent> &ev) {
 		return;
 
 	shared_ptr<JweContext> jweContext(incomingTransaction->getProperty<JweContext>(getModuleName()));
-	if (jweContext)
+	if (jweContext && !jweContext->consumed) {
 		jweContext->consumed = true;
+		// Consumed tokens are kept until their expiration, out of the LRU.
+		releaseJweContext(*jweContext);
+		if (!jweContext->timer)
+			return; // Expired token, the expiration check rejects it anyway.
+
+		// The context may have been evicted while the request was in flight: put it back so the token can't be
+		// replayed, replacing any context validated again for the same token in the meantime.
+		auto it = mJweContexts.find(jweContext->key);
+		if (it == mJweContexts.end()) {
+			mJweContexts.insert({ jweContext->key, jweContext });
+		} else if (it->second != jweContext) {
+			releaseJweContext(*it->second);
+			it->second = jweContext;
+		}
+	}
+}
+
+const char *JweAuth::checkJwt(json_t *jwt, const sip_t *sip, int *timeout) const {
+	const char *error = checkJwtTime(jwt, timeout);
+	if (error)
+		return error;
+
+	for (const auto &data : mCustomHeadersToCheck)
+		if (!checkJwtAttrFromSipHeader(jwt, sip, data.first, data.second))
+			return "JWT check attrs failed";
+	return nullptr;
+}
+
+void JweAuth::acceptRequest(const shared_ptr<RequestSipEvent> &ev, const shared_ptr<JweContext> &jweContext) {
+	shared_ptr<IncomingTransaction> incomingTransaction = ev->createIncomingTransaction();
+	incomingTransaction->setProperty(getModuleName(), jweContext);
+	if (ev->isSuspended())
+		getAgent()->injectRequestEvent(ev);
+}
+
+void JweAuth::rejectRequest(const shared_ptr<RequestSipEvent> &ev, const char *error) {
+	SLOGW << "Rejecting request because: `" << error << "`.";
+	ev->reply(403, error, SIPTAG_SERVER_STR(getAgent()->getServerString()), TAG_END());
 }
 
 void JweAuth::insertJweContext(string &&jweKey, const shared_ptr<JweContext> &jweContext, int timeout) {
@@ -464,6 +631,16 @@ void JweAuth::insertJweContext(string &&jweKey, const shared_ptr<JweContext> &jw
 	jweContext->timer = timer;
 
 	mJweContexts.insert({ move(jweKey), jweContext });
+	jweContext->lruPosition = mJweContextsLru.insert(mJweContextsLru.begin(), jweContext.get());
+	jweContext->inLru = true;
+
+	if (mJweContextsLru.size() > mMaxJweContexts) {
+		JweContext *oldest = mJweContextsLru.back();
+		releaseJweContext(*oldest);
+		// The timer is kept: an in-flight request may still hold the context and put it back once consumed.
+		const string oldestKey = oldest->key;
+		mJweContexts.erase(oldestKey); // May destroy the context.
+	}
 
 	if (timeout > 0) {
 		timeout *= 1000;
@@ -473,9 +650,26 @@ void JweAuth::insertJweContext(string &&jweKey, const shared_ptr<JweContext> &jw
 	su_timer_set_interval(timer, removeJweContext, jweContext.get(), timeout);
 }
 
+void JweAuth::touchJweContext(JweContext &jweContext) {
+	if (jweContext.inLru)
+		mJweContextsLru.splice(mJweContextsLru.begin(), mJweContextsLru, jweContext.lruPosition);
+}
+
+void JweAuth::releaseJweContext(JweContext &jweContext) {
+	if (jweContext.inLru) {
+		mJweContextsLru.erase(jweContext.lruPosition);
+		jweContext.inLru = false;
+	}
+}
+
 void JweAuth::removeJweContext(su_root_magic_t *, su_timer_t *timer, su_timer_arg_t *arg) {
 	JweContext *jweContext = static_cast<JweContext *>(arg);
 	su_timer_destroy(jweContext->timer);
 	jweContext->timer = nullptr;
-	jweContext->self->mJweContexts.erase(jweContext->key);
+	JweAuth *self = jweContext->self;
+	self->releaseJweContext(*jweContext);
+	// The key may be bound to another context if this one was evicted.
+	auto it = self->mJweContexts.find(jweContext->key);
+	if (it != self->mJweContexts.end() && it->second.get() == jweContext)
+		self->mJweContexts.erase(it); // May destroy the context.
 }
@@ -0,0 +1,303 @@
+/*
+	Flexisip, a flexible SIP proxy server with media capabilities.
+	Copyright (C) 2010-2019  Belledonne Communications SARL, All rights reserved.
+
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU Affero General Public License as
+	published by the Free Software Foundation, either version 3 of the
+	License, or (at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU Affero General Public License for more details.
+
+	You should have received a copy of the GNU Affero General Public License
+	along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <cstring>
+
+#include <sofia-sip/sip_header.h>
+#include <sofia-sip/sip_protos.h>
+
+#include <flexisip/common.hh>
+#include <flexisip/registrardb.hh>
+
+#include "recordserializer.hh"
+
+using namespace std;
+using namespace flexisip;
+
+namespace {
+
+enum WireType : uint8_t { Varint = 0, LengthDelimited = 2 };
+
+/* Field numbers must never be reused: decoders skip the fields they don't know. */
+enum ContactField : uint32_t {
+	FieldExpireAt = 1,
+	FieldExpireNotAtMessage = 2,
+	FieldUpdatedTime = 3,
+	FieldCSeq = 4,
+	FieldSipContact = 5,
+	FieldCallId = 6,
+	FieldPath = 7,
+	FieldAccept = 8,
+	FieldUserAgent = 9,
+	FieldFlags = 10,
+	FieldUniqueId = 11,
+	FieldContactId = 12
+};
+
+enum RecordField : uint32_t { FieldContact = 1 };
+
+enum ContactFlags : uint64_t { FlagAlias = 1 << 0, FlagUsedAsRoute = 1 << 1 };
+
+class Writer {
+public:
+	Writer(string &out) : mOut(out) {}
+
+	void header() {
+		mOut.push_back(static_cast<char>(RecordSerializerBinary::sMagic));
+		mOut.push_back(static_cast<char>(RecordSerializerBinary::sVersion));
+	}
+	void field(uint32_t number, uint64_t value) {
+		varint((number << 3) | Varint);
+		varint(value);
+	}
+	void field(uint32_t number, const char *data, size_t len) {
+		varint((number << 3) | LengthDelimited);
+		varint(len);
+		mOut.append(data, len);
+	}
+	void field(uint32_t number, const string &value) {
+		field(number, value.data(), value.size());
+	}
+
+private:
+	void varint(uint64_t value) {
+		while (value >= 0x80) {
+			mOut.push_back(static_cast<char>(value | 0x80));
+			value >>= 7;
+		}
+		mOut.push_back(static_cast<char>(value));
+	}
+
+	string &mOut;
+};
+
+class Reader {
+public:
+	Reader(const char *data, size_t len)
+		: mPos(reinterpret_cast<const uint8_t *>(data)), mEnd(reinterpret_cast<const uint8_t *>(data) + len) {}
+
+	/* Checks the magic and version bytes and moves past them. */
+	bool header() {
+		if (mEnd - mPos < 2 || mPos[0] != RecordSerializerBinary::sMagic) return false;
+		if (mPos[1] > RecordSerializerBinary::sVersion) {
+			LOGE("Unsupported binary contact version %u", (unsigned)mPos[1]);
+			return false;
+		}
+		mPos += 2;
+		return true;
+	}
+
+	bool atEnd() const {return mPos == mEnd;}
+
+	/*
+	 * Reads the next field. For varint fields, 'value' is set. For length-delimited ones, 'data' and 'value'
+	 * (the length) are set, 'data' pointing inside the input buffer.
+	 */
+	bool next(uint32_t &number, uint64_t &value, const char *&data) {
+		uint64_t key;
+		if (!varint(key)) return false;
+		number = static_cast<uint32_t>(key >> 3);
+		switch (key & 0x7) {
+			case Varint:
+				data = nullptr;
+				return varint(value);
+			case LengthDelimited:
+				if (!varint(value) || value > static_cast<uint64_t>(mEnd - mPos)) return false;
+				data = reinterpret_cast<const char *>(mPos);
+				mPos += value;
+				return true;
+			default:
+				return false;
+		}
+	}
+
+private:
+	bool varint(uint64_t &value) {
+		value = 0;
+		for (unsigned shift = 0; shift < 64 && mPos < mEnd; shift += 7) {
+			uint8_t byte = *mPos++;
+			value |= static_cast<uint64_t>(byte & 0x7f) << shift;
+			if (!(byte & 0x80)) return true;
+		}
+		return false;
+	}
+
+	const uint8_t *mPos;
+	const uint8_t *mEnd;
+};
+
+/* Decoded fields of a contact. The SIP contact is kept as a string until we know the binding is still valid. */
+struct BinaryContact {
+	time_t mExpireAt{0};
+	time_t mExpireNotAtMessage{0};
+	time_t mUpdatedTime{0};
+	uint32_t mCSeq{0};
+	uint64_t mFlags{0};
+	string mSipContact{};
+	string mCallId{};
+	string mUserAgent{};
+	string mUniqueId{};
+	string mContactId{};
+	list<string> mPath{};
+	list<string> mAccept{};
+};
+
+void encodeContact(Writer &writer, const ExtendedContact &ec, bool withIds) {
+	sofiasip::Home home;
+
+	writer.field(FieldExpireAt, static_cast<uint64_t>(ec.mExpireAt));
+	writer.field(FieldExpireNotAtMessage, static_cast<uint64_t>(ec.mExpireNotAtMessage));
+	writer.field(FieldUpdatedTime, static_cast<uint64_t>(ec.mUpdatedTime));
+	writer.field(FieldCSeq, ec.mCSeq);
+	if (ec.mSipContact) {
+		const char *contact = sip_header_as_string(home.home(), reinterpret_cast<const sip_header_t *>(ec.mSipContact));
+		if (contact) writer.field(FieldSipContact, contact, strlen(contact));
+	}
+	writer.field(FieldCallId, ec.mCallId);
+	for (const auto &path : ec.mPath) writer.field(FieldPath, path);
+	for (const auto &accept : ec.mAcceptHeader) writer.field(FieldAccept, accept);
+	if (!ec.mUserAgent.empty()) writer.field(FieldUserAgent, ec.mUserAgent);
+	writer.field(FieldFlags, (ec.mAlias ? FlagAlias : 0) | (ec.mUsedAsRoute ? FlagUsedAsRoute : 0));
+	if (withIds) {
+		writer.field(FieldUniqueId, ec.mUniqueId);
+		writer.field(FieldContactId, ec.mContactId);
+	}
+}
+
+/*
+ * The expiration time being the first field written, the decoding stops there for expired contacts so that their
+ * strings aren't copied.
+ */
+bool decodeContact(Reader &reader, BinaryContact &bc, time_t now) {
+	uint32_t number;
+	uint64_t value;
+	const char *data;
+
+	while (!reader.atEnd()) {
+		if (!reader.next(number, value, data)) return false;
+		switch (number) {
+			case FieldExpireAt:
+				bc.mExpireAt = static_cast<time_t>(value);
+				if (now >= bc.mExpireAt) return true;
+				break;
+			case FieldExpireNotAtMessage: bc.mExpireNotAtMessage = static_cast<time_t>(value); break;
+			case FieldUpdatedTime: bc.mUpdatedTime = static_cast<time_t>(value); break;
+			case FieldCSeq: bc.mCSeq = static_cast<uint32_t>(value); break;
+			case FieldFlags: bc.mFlags = value; break;
+			case FieldSipContact: if (data) bc.mSipContact.assign(data, value); break;
+			case FieldCallId: if (data) bc.mCallId.assign(data, value); break;
+			case FieldUserAgent: if (data) bc.mUserAgent.assign(data, value); break;
+			case FieldUniqueId: if (data) bc.mUniqueId.assign(data, value); break;
+			case FieldContactId: if (data) bc.mContactId.assign(data, value); break;
+			case FieldPath: if (data) bc.mPath.emplace_back(data, value); break;
+			case FieldAccept: if (data) bc.mAccept.emplace_back(data, value); break;
+			default: break; // Field added by a newer version, skip it.
+		}
+	}
+	return true;
+}
+
+bool insertContact(BinaryContact &bc, const char *contactId, const char *uniqueId, Record *r, time_t now,
+	const shared_ptr<ContactUpdateListener> &listener) {
+	if (now >= bc.mExpireAt) return false;
+
+	auto ec = make_shared<ExtendedContact>(contactId, uniqueId);
+	ec->mSipContact = sip_contact_make(ec->mHome.home(), bc.mSipContact.c_str());
+	if (!ec->mSipContact) {
+		LOGE("Couldn't parse binary contact '%s'", bc.mSipContact.c_str());
+		return false;
+	}
+	ec->mCallId = move(bc.mCallId);
+	ec->mPath = move(bc.mPath);
+	ec->mAcceptHeader = move(bc.mAccept);
+	ec->mUserAgent = move(bc.mUserAgent);
+	ec->mCSeq = bc.mCSeq;
+	ec->mUpdatedTime = bc.mUpdatedTime;
+	ec->mAlias = (bc.mFlags & FlagAlias) != 0;
+	ec->mUsedAsRoute = (bc.mFlags & FlagUsedAsRoute) != 0;
+	// init() computes q and the connection id from the contact; expiration times are taken as stored.
+	ec->init();
+	ec->mExpireAt = bc.mExpireAt;
+	ec->mExpireNotAtMessage = bc.mExpireNotAtMessage;
+	r->insertOrUpdateBinding(ec, listener);
+	return true;
+}
+
+} // namespace
+
+void RecordSerializerBinary::serializeContact(const ExtendedContact &ec, string &serialized) {
+	serialized.clear();
+	Writer writer(serialized);
+	writer.header();
+	encodeContact(writer, ec, false);
+}
+
+bool RecordSerializerBinary::parseContact(const char *str, size_t len, const char *key, const char *uid, Record *r,
+	const shared_ptr<ContactUpdateListener> &listener) {
+	Reader reader(str, len);
+	BinaryContact bc;
+	time_t now = getCurrentTime();
+	if (!reader.header() || !decodeContact(reader, bc, now)) {
+		LOGE("Invalid binary contact %s for record %s", uid, key);
+		return false;
+	}
+	return insertContact(bc, key, uid, r, now, listener);
+}
+
+bool RecordSerializerBinary::parse(const char *str, int len, Record *r) {
+	if (!str) return true;
+
+	Reader reader(str, len);
+	if (!reader.header()) return false;
+
+	uint32_t number;
+	uint64_t value;
+	const char *data;
+	time_t now = getCurrentTime();
+	while (!reader.atEnd()) {
+		if (!reader.next(number, value, data)) return false;
+		if (number != FieldContact || !data) continue;
+
+		Reader contactReader(data, value);
+		BinaryContact bc;
+		if (!decodeContact(contactReader, bc, now)) return false;
+		string contactId = bc.mContactId;
+		string uniqueId = bc.mUniqueId;
+		insertContact(bc, contactId.c_str(), uniqueId.c_str(), r, now, nullptr);
+	}
+	return true;
+}
+
+bool RecordSerializerBinary::serialize(Record *r, string &serialized, bool log) {
+	if (!r) return true;
+
+	serialized.clear();
+	Writer writer(serialized);
+	writer.header();
+	string contact;
+	for (const auto &ec : r->getExtendedContacts()) {
+		contact.clear();
+		Writer contactWriter(contact);
+		encodeContact(contactWriter, *ec, true);
+		writer.field(FieldContact, contact);
+	}
+	if (log) {
+		SLOGI << "Serialized size:" << serialized.length();
+	}
+	return true;
+}
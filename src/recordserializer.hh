@@ -55,6 +55,35 @@ class RecordSerializerJson : public RecordSerializer {
 	virtual bool serialize(Record *r, std::string &serialized, bool log);
 };
 
+/*
+ * Compact binary encoding, using the protobuf wire format (tagged varints and length-delimited fields)
+ * without depending on libprotobuf, so that it is always available.
+ * Each encoded contact starts with a magic byte and a version byte. The magic byte can't start a legacy
+ * url-encoded contact, which allows both formats to coexist in the Redis contact hashes.
+ */
+class RecordSerializerBinary : public RecordSerializer {
+  public:
+	static constexpr uint8_t sMagic = 0xfc;
+	static constexpr uint8_t sVersion = 1;
+
+	virtual bool parse(const char *str, int len, Record *r);
+	virtual bool serialize(Record *r, std::string &serialized, bool log);
+
+	static bool isBinaryContact(const char *str, size_t len) {
+		return len >= 2 && static_cast<uint8_t>(str[0]) == sMagic;
+	}
+	/* Encodes a contact as the value of a Redis hash field. The unique id is the field itself and isn't encoded. */
+	static void serializeContact(const ExtendedContact &ec, std::string &serialized);
+	/*
+	 * Decodes a contact and inserts it in the record. Returns false if the contact is invalid or expired, in which
+	 * case it should be removed from the database.
+	 * Parsing is only lazy for expired contacts, which are neither fully decoded nor parsed. The SIP contact of a valid
+	 * binding is parsed right away, since the record and ExtendedContact::init() need mSipContact to insert it.
+	 */
+	static bool parseContact(const char *str, size_t len, const char *key, const char *uid, Record *r,
+		const std::shared_ptr<ContactUpdateListener> &listener);
+};
+
 #ifdef ENABLE_PROTOBUF
 class RecordSerializerPb : public RecordSerializer {
   public:
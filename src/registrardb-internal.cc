@@ -18,10 +18,14 @@
 
 #include <flexisip/registrardb.hh>
 #include "registrardb-internal.hh"
+#include "recordserializer.hh"
 #include <flexisip/common.hh>
 
 #include <ctime>
 #include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <limits>
 #include <vector>
 #include <algorithm>
 
@@ -30,8 +34,125 @@
 using namespace std;
 using namespace flexisip;
 
-RegistrarDbInternal::RegistrarDbInternal(Agent *ag) : RegistrarDb(ag) {
+static time_t earliestExpire(const Record &r) {
+	time_t earliest = numeric_limits<time_t>::max();
+	for (const auto &ec : r.getExtendedContacts()) {
+		earliest = min(earliest, ec->mExpireAt);
+	}
+	return earliest;
+}
+
+RegistrarDbInternal::RegistrarDbInternal(Agent *ag, const string &snapshotPath, unsigned int snapshotPeriod)
+	: RegistrarDb(ag), mSnapshotPath(snapshotPath) {
 	mWritable = true;
+	if (!mSnapshotPath.empty()) {
+		loadSnapshot(mSnapshotPath);
+	}
+	if (ag) {
+		mPurgeTimer = ag->createTimer(sPurgePeriodMs, &sOnPurgeTimer, this);
+		if (!mSnapshotPath.empty() && snapshotPeriod > 0) {
+			mSnapshotTimer = ag->createTimer(snapshotPeriod * 1000, &sOnSnapshotTimer, this);
+			mSnapshotStepTimer = su_timer_create(su_root_task(ag->getRoot()), 0);
+			mSnapshotWorker.reset(new ThreadPool(1, 1));
+		}
+	}
+}
+
+RegistrarDbInternal::~RegistrarDbInternal() {
+	if (mPurgeTimer) su_timer_destroy(mPurgeTimer);
+	if (mSnapshotTimer) su_timer_destroy(mSnapshotTimer);
+	if (mSnapshotStepTimer) su_timer_destroy(mSnapshotStepTimer);
+	// Wait for the snapshot being written, if any, before writing the final one.
+	mSnapshotWorker.reset();
+	if (!mSnapshotPath.empty()) {
+		saveSnapshot(mSnapshotPath);
+	}
+}
+
+void RegistrarDbInternal::sOnPurgeTimer(void *unused, su_timer_t *t, void *data) {
+	static_cast<RegistrarDbInternal *>(data)->purgeExpired(getCurrentTime());
+}
+
+void RegistrarDbInternal::sOnSnapshotTimer(void *unused, su_timer_t *t, void *data) {
+	auto zis = static_cast<RegistrarDbInternal *>(data);
+	if (zis->mSnapshotInProgress.exchange(true)) {
+		LOGW("Previous registrar snapshot still being written, skipping this one");
+		return;
+	}
+
+	// The records are copied on the main loop, one shard per iteration so that requests keep being served in
+	// between. The serialization and the file writing are done by the worker.
+	zis->mSnapshotShard = 0;
+	zis->mSnapshotRecords = make_shared<SnapshotRecords>();
+	sOnSnapshotStep(nullptr, zis->mSnapshotStepTimer, zis);
+}
+
+void RegistrarDbInternal::sOnSnapshotStep(void *unused, su_timer_t *t, void *data) {
+	auto zis = static_cast<RegistrarDbInternal *>(data);
+	zis->copySnapshotShard(zis->mSnapshotShard++, *zis->mSnapshotRecords);
+	if (zis->mSnapshotShard < sShardCount) {
+		su_timer_set(t, (su_timer_f)&sOnSnapshotStep, data);
+		return;
+	}
+
+	auto records = move(zis->mSnapshotRecords);
+	string path = zis->mSnapshotPath;
+	bool queued = zis->mSnapshotWorker->run([zis, path, records]() {
+		writeSnapshot(path, *records);
+		zis->mSnapshotInProgress = false;
+	});
+	if (!queued) zis->mSnapshotInProgress = false;
+}
+
+void RegistrarDbInternal::updateExpiry(Shard &shard, unordered_map<AorKey, Entry>::iterator it) {
+	Entry &entry = it->second;
+	if (entry.mExpiry != shard.mExpiry.end()) {
+		shard.mExpiry.erase(entry.mExpiry);
+	}
+	entry.mExpiry = shard.mExpiry.emplace(earliestExpire(*entry.mRecord), it->first);
+}
+
+void RegistrarDbInternal::eraseRecord(Shard &shard, unordered_map<AorKey, Entry>::iterator it) {
+	if (it->second.mExpiry != shard.mExpiry.end()) {
+		shard.mExpiry.erase(it->second.mExpiry);
+	}
+	shard.mRecords.erase(it);
+}
+
+shared_ptr<Record> RegistrarDbInternal::findRecord(Shard &shard, const AorKey &key, const shared_ptr<ContactUpdateListener> &listener) {
+	auto it = shard.mRecords.find(key);
+	if (it == shard.mRecords.end()) return nullptr;
+
+	shared_ptr<Record> r = it->second.mRecord;
+	r->clean(getCurrentTime(), listener);
+	if (r->isEmpty()) {
+		eraseRecord(shard, it);
+		return nullptr;
+	}
+	updateExpiry(shard, it);
+	return r;
+}
+
+void RegistrarDbInternal::purgeExpired(time_t now) {
+	size_t purged = 0;
+	for (auto &shard : mShards) {
+		lock_guard<mutex> lock(shard.mMutex);
+		while (!shard.mExpiry.empty() && shard.mExpiry.begin()->first <= now) {
+			auto it = shard.mRecords.find(shard.mExpiry.begin()->second);
+			if (it == shard.mRecords.end()) {
+				shard.mExpiry.erase(shard.mExpiry.begin());
+				continue;
+			}
+			it->second.mRecord->clean(now, nullptr);
+			if (it->second.mRecord->isEmpty()) {
+				eraseRecord(shard, it);
+				purged++;
+			} else {
+				updateExpiry(shard, it);
+			}
+		}
+	}
+	if (purged > 0) LOGD("Purged %lu expired records", (unsigned long)purged);
 }
 
 void RegistrarDbInternal::doBind(const sip_t *sip, int globalExpire, bool alias, int version, const shared_ptr<ContactUpdateListener> &listener) {
@@ -42,104 +163,196 @@ void RegistrarDbInternal::doBind(const sip_t *sip, int globalExpire, bool alias,
 		throw InvalidAorError(sip->sip_from->a_url);
 	}
 
-	string key = Record::defineKeyFromUrl(fromUri.get());
-
-	auto it = mRecords.find(key);
+	AorKey key = Record::defineKeyFromUrl(fromUri.get());
+	Shard &shard = getShard(key);
 	shared_ptr<Record> r;
-	if (it == mRecords.end()) {
-		r = make_shared<Record>(move(fromUri));
-		mRecords.insert(make_pair(key, r));
-		LOGD("Creating AOR %s association", key.c_str());
-	} else {
-		LOGD("AOR %s found", key.c_str());
-		r = it->second;
+	bool invalid;
+	{
+		lock_guard<mutex> lock(shard.mMutex);
+		auto it = shard.mRecords.find(key);
+		if (it == shard.mRecords.end()) {
+			r = make_shared<Record>(move(fromUri));
+			it = shard.mRecords.emplace(r->getKey(), Entry{r, shard.mExpiry.end()}).first;
+			LOGD("Creating AOR %s association", key.c_str());
+		} else {
+			LOGD("AOR %s found", key.c_str());
+			r = it->second.mRecord;
+		}
+
+		invalid = sip->sip_call_id && sip->sip_cseq && r->isInvalidRegister(sip->sip_call_id->i_id, sip->sip_cseq->cs_seq);
+		if (!invalid) r->update(sip, globalExpire, alias, version, listener);
+		if (r->isEmpty()) {
+			eraseRecord(shard, it);
+		} else {
+			updateExpiry(shard, it);
+		}
 	}
 
-	if (sip->sip_call_id && sip->sip_cseq && r->isInvalidRegister(sip->sip_call_id->i_id, sip->sip_cseq->cs_seq)) {
+	if (invalid) {
 		LOGD("Invalid register");
 		if (listener) listener->onInvalid();
 		return;
 	}
 
-	r->update(sip, globalExpire, alias, version, listener);
-
 	mLocalRegExpire->update(r);
 	if (listener) listener->onRecordFound(r);
 }
 
 void RegistrarDbInternal::doFetch(const SipUri &url, const shared_ptr<ContactUpdateListener> &listener) {
-	string key = Record::defineKeyFromUrl(url.get());
-
-	auto it = mRecords.find(key);
-	shared_ptr<Record> r = NULL;
-	if (it != mRecords.end()) {
-		r = (*it).second;
-		r->clean(getCurrentTime(), listener);
-		if (r->isEmpty()) {
-			mRecords.erase(it);
-			r = nullptr;
-		}
+	AorKey key = Record::defineKeyFromUrl(url.get());
+	Shard &shard = getShard(key);
+	shared_ptr<Record> r;
+	{
+		lock_guard<mutex> lock(shard.mMutex);
+		r = findRecord(shard, key, listener);
 	}
 
 	listener->onRecordFound(r);
 }
 
 void RegistrarDbInternal::doFetchInstance(const SipUri &url, const string &uniqueId, const shared_ptr<ContactUpdateListener> &listener) {
-	string key(Record::defineKeyFromUrl(url.get()));
-	sofiasip::Home home;
+	AorKey key(Record::defineKeyFromUrl(url.get()));
+	Shard &shard = getShard(key);
+	shared_ptr<Record> retRecord;
+	{
+		lock_guard<mutex> lock(shard.mMutex);
+		shared_ptr<Record> r = findRecord(shard, key, listener);
+		if (r) {
+			retRecord = make_shared<Record>(url);
+			for (const auto &contact : r->getExtendedContacts()) {
+				if (contact->mUniqueId == uniqueId){
+					retRecord->pushContact(contact);
+					break;
+				}
+			}
+		}
+	}
+	listener->onRecordFound(retRecord);
+}
 
-	auto it = mRecords.find(key);
-	shared_ptr<Record> r = NULL;
+void RegistrarDbInternal::doFetchList(const vector<SipUri> &urls, const shared_ptr<ListContactUpdateListener> &listener) {
+	// Sort the keys by shard so that each shard is locked only once.
+	vector<pair<size_t, AorKey>> keys;
+	keys.reserve(urls.size());
+	for (const auto &url : urls) {
+		AorKey key = Record::defineKeyFromUrl(url.get());
+		keys.emplace_back(getShardIndex(key), move(key));
+	}
+	sort(keys.begin(), keys.end());
+
+	for (auto it = keys.cbegin(); it != keys.cend();) {
+		Shard &shard = mShards[it->first];
+		lock_guard<mutex> lock(shard.mMutex);
+		size_t shardIndex = it->first;
+		for (; it != keys.cend() && it->first == shardIndex; ++it) {
+			auto r = findRecord(shard, it->second, nullptr);
+			if (r) listener->records.push_back(r);
+		}
+	}
+	listener->onContactsUpdated();
+}
 
-	if (it == mRecords.end()) {
-		listener->onRecordFound(r);
-		return;
+void RegistrarDbInternal::loadDumpShard(DumpSnapshot &snapshot, size_t shardIndex) {
+	Shard &shard = mShards[shardIndex];
+	lock_guard<mutex> lock(shard.mMutex);
+	snapshot.mShard = shardIndex;
+	snapshot.mPosition = 0;
+	snapshot.mKeys.clear();
+	snapshot.mKeys.reserve(shard.mRecords.size());
+	for (const auto &entry : shard.mRecords) snapshot.mKeys.push_back(entry.first);
+}
+
+/*
+ * The shards are walked one after the other, only the keys of the current one being copied. Cursors are
+ * "<dump id>:<shard>:<position>", so that a dump whose state has expired restarts at the same shard and position.
+ */
+void RegistrarDbInternal::doDump(const string &cursor, size_t count, const shared_ptr<DumpListener> &listener) {
+	time_t now = getCurrentTime();
+	unique_lock<mutex> dumpsLock(mDumpsMutex);
+
+	for (auto it = mDumps.begin(); it != mDumps.end();) {
+		if (now - it->second.mLastUsed > sDumpTimeout) it = mDumps.erase(it);
+		else ++it;
 	}
 
-	r = (*it).second;
-	r->clean(getCurrentTime(), listener);
-	if (r->isEmpty()) {
-		mRecords.erase(it);
-		r = nullptr;
-		listener->onRecordFound(r);
-		return;
+	map<unsigned long, DumpSnapshot>::iterator dump;
+	if (cursor == "0") {
+		dump = mDumps.emplace(++mLastDumpId, DumpSnapshot()).first;
+		loadDumpShard(dump->second, 0);
+	} else {
+		unsigned long id;
+		size_t shardIndex, position;
+		int consumed = 0;
+		if (sscanf(cursor.c_str(), "%lu:%zu:%zu%n", &id, &shardIndex, &position, &consumed) != 3 ||
+			size_t(consumed) != cursor.size() || shardIndex >= sShardCount) {
+			dumpsLock.unlock();
+			LOGE("Invalid registrar dump cursor %s", cursor.c_str());
+			listener->onError();
+			return;
+		}
+		dump = mDumps.find(id);
+		if (dump == mDumps.end() || dump->second.mShard != shardIndex || dump->second.mPosition != position) {
+			LOGD("Resuming registrar dump %s from shard %zu", cursor.c_str(), shardIndex);
+			mLastDumpId = max(mLastDumpId, id); // So that new dumps don't reuse its id.
+			dump = mDumps.emplace(id, DumpSnapshot()).first;
+			loadDumpShard(dump->second, shardIndex);
+			dump->second.mPosition = min(position, dump->second.mKeys.size());
+		}
 	}
 
-	const list<shared_ptr<ExtendedContact>> &contacts = r->getExtendedContacts();
-	shared_ptr<Record> retRecord = make_shared<Record>(url);
-	for (const auto &contact : contacts) {
-		if (contact->mUniqueId == uniqueId){
-			retRecord->pushContact(contact);
-			break;
+	DumpSnapshot &snapshot = dump->second;
+	snapshot.mLastUsed = now;
+	vector<shared_ptr<Record>> records;
+	size_t remaining = max<size_t>(count, 1);
+	while (remaining > 0) {
+		if (snapshot.mPosition == snapshot.mKeys.size()) {
+			if (snapshot.mShard + 1 == sShardCount) break;
+			loadDumpShard(snapshot, snapshot.mShard + 1);
+			continue;
+		}
+		Shard &shard = mShards[snapshot.mShard];
+		lock_guard<mutex> lock(shard.mMutex);
+		for (; remaining > 0 && snapshot.mPosition < snapshot.mKeys.size(); ++snapshot.mPosition, --remaining) {
+			auto r = findRecord(shard, snapshot.mKeys[snapshot.mPosition], nullptr);
+			if (r) records.push_back(move(r));
 		}
 	}
-	listener->onRecordFound(retRecord);
+
+	string next = "0";
+	if (snapshot.mShard + 1 < sShardCount || snapshot.mPosition < snapshot.mKeys.size()) {
+		next = to_string(dump->first) + ":" + to_string(snapshot.mShard) + ":" + to_string(snapshot.mPosition);
+	} else {
+		mDumps.erase(dump);
+	}
+	dumpsLock.unlock();
+	listener->onRecordsDumped(records, next);
 }
 
 void RegistrarDbInternal::doClear(const sip_t *sip, const shared_ptr<ContactUpdateListener> &listener) {
-	string key = Record::defineKeyFromUrl(sip->sip_from->a_url);
+	AorKey key = Record::defineKeyFromUrl(sip->sip_from->a_url);
 
 	if (errorOnTooMuchContactInBind(sip->sip_contact, key, listener)) {
 		listener->onError();
 		return;
 	}
 
-	auto it = mRecords.find(key);
+	Shard &shard = getShard(key);
+	bool invalid = false;
+	{
+		lock_guard<mutex> lock(shard.mMutex);
+		auto it = shard.mRecords.find(key);
 
-	if (it == mRecords.end()) {
-		listener->onRecordFound(NULL);
-		return;
+		if (it != shard.mRecords.end()) {
+			LOGD("AOR %s found", key.c_str());
+			invalid = it->second.mRecord->isInvalidRegister(sip->sip_call_id->i_id, sip->sip_cseq->cs_seq);
+			if (!invalid) eraseRecord(shard, it);
+		}
 	}
 
-	LOGD("AOR %s found", key.c_str());
-	shared_ptr<Record> r = (*it).second;
-
-	if (r->isInvalidRegister(sip->sip_call_id->i_id, sip->sip_cseq->cs_seq)) {
+	if (invalid) {
 		listener->onInvalid();
 		return;
 	}
-
-	mRecords.erase(it);
 	mLocalRegExpire->remove(key);
 	listener->onRecordFound(NULL);
 }
@@ -149,10 +362,115 @@ void RegistrarDbInternal::doMigration() {
 }
 
 void RegistrarDbInternal::clearAll() {
-	mRecords.clear();
+	for (auto &shard : mShards) {
+		lock_guard<mutex> lock(shard.mMutex);
+		shard.mRecords.clear();
+		shard.mExpiry.clear();
+	}
 	mLocalRegExpire->clearAll();
 }
 
+/*
+ * Snapshot file format: a sequence of (aor length, aor, record length, record) where lengths are 32 bits
+ * integers in host byte order and records are encoded with RecordSerializerBinary.
+ */
+static void writeChunk(ostream &os, const string &chunk) {
+	uint32_t len = chunk.size();
+	os.write(reinterpret_cast<const char *>(&len), sizeof(len));
+	os.write(chunk.data(), len);
+}
+
+static bool readChunk(istream &is, string &chunk) {
+	uint32_t len;
+	if (!is.read(reinterpret_cast<char *>(&len), sizeof(len))) return false;
+	chunk.resize(len);
+	return bool(is.read(&chunk[0], len));
+}
+
+void RegistrarDbInternal::copySnapshotShard(size_t shardIndex, SnapshotRecords &records) {
+	Shard &shard = mShards[shardIndex];
+	time_t now = getCurrentTime();
+	lock_guard<mutex> lock(shard.mMutex);
+	records.reserve(records.size() + shard.mRecords.size());
+	for (const auto &entry : shard.mRecords) {
+		const Record *r = entry.second.mRecord.get();
+		if (r->latestExpire() <= now) continue;
+		auto copy = make_shared<Record>(r->getAor());
+		for (const auto &ec : r->getExtendedContacts()) copy->pushContact(make_shared<ExtendedContact>(*ec));
+		records.push_back(move(copy));
+	}
+}
+
+RegistrarDbInternal::SnapshotRecords RegistrarDbInternal::copySnapshotRecords() {
+	SnapshotRecords records;
+	for (size_t i = 0; i < sShardCount; ++i) copySnapshotShard(i, records);
+	return records;
+}
+
+bool RegistrarDbInternal::saveSnapshot(const string &path) {
+	return writeSnapshot(path, copySnapshotRecords());
+}
+
+bool RegistrarDbInternal::writeSnapshot(const string &path, const SnapshotRecords &records) {
+	string tmpPath = path + ".tmp";
+	ofstream ofs(tmpPath, ios::binary | ios::trunc);
+	if (!ofs) {
+		LOGE("Cannot open registrar snapshot file %s", tmpPath.c_str());
+		return false;
+	}
+
+	RecordSerializerBinary serializer;
+	string serialized;
+	for (const auto &r : records) {
+		serializer.serialize(r.get(), serialized);
+		writeChunk(ofs, r->getAor().str());
+		writeChunk(ofs, serialized);
+	}
+	ofs.close();
+	if (!ofs || rename(tmpPath.c_str(), path.c_str()) != 0) {
+		LOGE("Cannot write registrar snapshot file %s", path.c_str());
+		remove(tmpPath.c_str());
+		return false;
+	}
+	LOGI("Saved %lu records to registrar snapshot %s", (unsigned long)records.size(), path.c_str());
+	return true;
+}
+
+bool RegistrarDbInternal::loadSnapshot(const string &path) {
+	ifstream ifs(path, ios::binary);
+	if (!ifs) {
+		LOGI("No registrar snapshot to load from %s", path.c_str());
+		return false;
+	}
+
+	RecordSerializerBinary serializer;
+	string aor, serialized;
+	size_t count = 0;
+	while (readChunk(ifs, aor) && readChunk(ifs, serialized)) {
+		shared_ptr<Record> r;
+		try {
+			r = make_shared<Record>(SipUri(aor));
+		} catch (const exception &e) {
+			LOGW("Skipping invalid AOR [%s] in registrar snapshot: %s", aor.c_str(), e.what());
+			continue;
+		}
+		if (!serializer.parse(serialized, r.get()) || r->isEmpty()) continue;
+
+		Shard &shard = getShard(r->getKey());
+		{
+			lock_guard<mutex> lock(shard.mMutex);
+			auto it = shard.mRecords.find(r->getKey());
+			if (it != shard.mRecords.end()) eraseRecord(shard, it);
+			it = shard.mRecords.emplace(r->getKey(), Entry{r, shard.mExpiry.end()}).first;
+			updateExpiry(shard, it);
+		}
+		mLocalRegExpire->update(r);
+		count++;
+	}
+	LOGI("Loaded %lu records from registrar snapshot %s", (unsigned long)count, path.c_str());
+	return true;
+}
+
 void RegistrarDbInternal::publish(const string &topic, const string &uid) {
 	LOGD("Publish topic = %s, uid = %s", topic.c_str(), uid.c_str());
 	RegistrarDb::notifyContactListener(topic, uid);
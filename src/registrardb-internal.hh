@@ -19,24 +19,106 @@
 
 #pragma once
 
+#include <array>
+#include <atomic>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
 #include <flexisip/registrardb.hh>
 #include <sofia-sip/sip.h>
 
+#include "utils/threadpool.hh"
+
 namespace flexisip {
 
 class RegistrarDbInternal : public RegistrarDb {
   public:
-	RegistrarDbInternal(Agent *ag);
+	/*
+	 * If snapshotPath isn't empty, records are reloaded from it at startup and saved to it every snapshotPeriod
+	 * seconds, so that devices don't need to register again after a restart. Periodic snapshots are written by a
+	 * worker thread.
+	 */
+	RegistrarDbInternal(Agent *ag, const std::string &snapshotPath = "", unsigned int snapshotPeriod = 0);
+	~RegistrarDbInternal();
 	void clearAll();
+	/* Removes expired bindings and the records left empty. Only the expired entries are visited. */
+	void purgeExpired(time_t now);
+	bool saveSnapshot(const std::string &path);
+	bool loadSnapshot(const std::string &path);
 
   private:
+	static constexpr size_t sShardCount = 64;
+	static constexpr int sPurgePeriodMs = 5000;
+	// Dumps not continued during this time are abandoned.
+	static constexpr int sDumpTimeout = 60;
+
+	// Keys of the records, ordered by the earliest expiration of their bindings.
+	using ExpiryIndex = std::multimap<time_t, AorKey>;
+	struct Entry {
+		std::shared_ptr<Record> mRecord;
+		ExpiryIndex::iterator mExpiry;
+	};
+	// Records are spread over shards by key hash, each shard having its own lock.
+	struct Shard {
+		std::mutex mMutex;
+		std::unordered_map<AorKey, Entry> mRecords;
+		ExpiryIndex mExpiry;
+	};
+	using SnapshotRecords = std::vector<std::shared_ptr<Record>>;
+
+	// Shard walked through by a dump, with the keys it held when the dump reached it.
+	struct DumpSnapshot {
+		size_t mShard = 0;
+		std::vector<AorKey> mKeys;
+		size_t mPosition = 0;
+		time_t mLastUsed = 0;
+	};
+
 	virtual void doBind(const sip_t *sip, int globalExpire, bool alias, int version, const std::shared_ptr<ContactUpdateListener> &listener) override;
 	virtual void doClear(const sip_t *sip, const std::shared_ptr<ContactUpdateListener> &listener) override;
 	virtual void doFetch(const SipUri &url, const std::shared_ptr<ContactUpdateListener> &listener) override;
 	virtual void doFetchInstance(const SipUri &url, const std::string &uniqueId, const std::shared_ptr<ContactUpdateListener> &listener) override;
+	virtual void doFetchList(const std::vector<SipUri> &urls, const std::shared_ptr<ListContactUpdateListener> &listener) override;
+	virtual void doDump(const std::string &cursor, size_t count, const std::shared_ptr<DumpListener> &listener) override;
 	virtual void doMigration() override;
 	virtual void publish(const std::string &topic, const std::string &uid) override;
-	std::map<std::string, std::shared_ptr<Record>> mRecords;
+
+	static size_t getShardIndex(const AorKey &key) {
+		return key.hash() % sShardCount;
+	}
+	Shard &getShard(const AorKey &key) {
+		return mShards[getShardIndex(key)];
+	}
+	/* Returns the record after having cleaned its expired bindings, or nullptr. Must be called with the shard locked. */
+	std::shared_ptr<Record> findRecord(Shard &shard, const AorKey &key, const std::shared_ptr<ContactUpdateListener> &listener);
+	void updateExpiry(Shard &shard, std::unordered_map<AorKey, Entry>::iterator it);
+	void eraseRecord(Shard &shard, std::unordered_map<AorKey, Entry>::iterator it);
+	void loadDumpShard(DumpSnapshot &snapshot, size_t shardIndex);
+
+	static void sOnPurgeTimer(void *unused, su_timer_t *t, void *data);
+	static void sOnSnapshotTimer(void *unused, su_timer_t *t, void *data);
+	static void sOnSnapshotStep(void *unused, su_timer_t *t, void *data);
+	/* Appends copies of the unexpired records of a shard, so that they can be serialized out of the shards. */
+	void copySnapshotShard(size_t shardIndex, SnapshotRecords &records);
+	SnapshotRecords copySnapshotRecords();
+	static bool writeSnapshot(const std::string &path, const SnapshotRecords &records);
+
+	std::array<Shard, sShardCount> mShards;
+	std::mutex mDumpsMutex;
+	std::map<unsigned long, DumpSnapshot> mDumps; // by dump id
+	unsigned long mLastDumpId = 0;
+	std::string mSnapshotPath;
+	su_timer_t *mPurgeTimer = nullptr;
+	su_timer_t *mSnapshotTimer = nullptr;
+	// The periodic snapshot copies one shard per main loop iteration, rearming this timer between shards.
+	su_timer_t *mSnapshotStepTimer = nullptr;
+	size_t mSnapshotShard = 0;
+	std::shared_ptr<SnapshotRecords> mSnapshotRecords;
+	std::unique_ptr<ThreadPool> mSnapshotWorker;
+	std::atomic<bool> mSnapshotInProgress{false};
 };
 
 }
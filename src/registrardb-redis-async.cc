@@ -562,6 +562,14 @@ void RegistrarDbRedisAsync::sHandleFetch(redisAsyncContext *ac, redisReply *repl
 	data->self->handleFetch(reply, data);
 }
 
+void RegistrarDbRedisAsync::sHandleFetchList(redisAsyncContext *ac, redisReply *reply, RegistrarListUserData *data) {
+	data->self->handleFetchList(reply, data);
+}
+
+void RegistrarDbRedisAsync::sHandleDump(redisAsyncContext *ac, redisReply *reply, RegistrarDumpUserData *data) {
+	data->self->handleDump(reply, data);
+}
+
 void RegistrarDbRedisAsync::sHandleMigration(redisAsyncContext *ac, redisReply *reply, RegistrarUserData *data) {
 	data->self->handleMigration(reply, data);
 }
@@ -619,17 +627,25 @@ void RegistrarDbRedisAsync::serializeAndSendToRedis(RegistrarUserData *data, for
 	argv[1] = record_namespace;
 	argvlen[1] = strlen(argv[1]);
 
+	// Binary values may contain nul bytes: keep them as strings and pass their exact length.
+	vector<string> values{};
+	values.reserve(contacts.size());
 	int i = 2;
 	for (auto it = contacts.begin(); it != contacts.end(); ++it) {
 		shared_ptr<ExtendedContact> ec = (*it);
 
-		argv[i] = strdup(ec->getUniqueId().c_str());
-		argvlen[i] = strlen(argv[i]);
+		argv[i] = ec->getUniqueId().c_str();
+		argvlen[i] = ec->getUniqueId().size();
 		i += 1;
 
-		string contact = ec->serializeAsUrlEncodedParams();
-		argv[i] = strdup(contact.c_str());
-		argvlen[i] = strlen(argv[i]);
+		values.emplace_back();
+		if (mParams.mBinaryContacts) {
+			RecordSerializerBinary::serializeContact(*ec, values.back());
+		} else {
+			values.back() = ec->serializeAsUrlEncodedParams();
+		}
+		argv[i] = values.back().data();
+		argvlen[i] = values.back().size();
 		i += 1;
 	}
 
@@ -638,9 +654,6 @@ void RegistrarDbRedisAsync::serializeAndSendToRedis(RegistrarUserData *data, for
 	check_redis_command(redisAsyncCommandArgv(mContext, (void (*)(redisAsyncContext*, void*, void*))forward_fn,
 		data, argc, argv, argvlen), data);
 
-	for (i = 2; i < argc; i++) {
-		free((char *)argv[i]);
-	}
 	delete[] argv;
 	delete[] argvlen;
 }
@@ -741,6 +754,16 @@ void RegistrarDbRedisAsync::handleClear(redisReply *reply, RegistrarUserData *da
 	delete data;
 }
 
+bool RegistrarDbRedisAsync::parseContact(const char *key, const char *uid, const redisReply *value, RegistrarUserData *data) {
+	// Contacts written by older versions, or with 'redis-contact-encoding=url-encoded', are url-encoded strings.
+	if (RecordSerializerBinary::isBinaryContact(value->str, value->len)) {
+		LOGD("Parsing binary contact %s (%lu bytes)", uid, (unsigned long)value->len);
+		return RecordSerializerBinary::parseContact(value->str, value->len, key, uid, data->mRecord.get(), data->listener);
+	}
+	LOGD("Parsing contact %s => %s", uid, value->str);
+	return data->mRecord->updateFromUrlEncodedParams(key, uid, value->str, data->listener);
+}
+
 void RegistrarDbRedisAsync::parseAndClean(redisReply *reply, RegistrarUserData *data) {
 	const char *key = data->mRecord->getKey().c_str();
 	for (size_t i = 0; i < reply->elements; i+=2) {
@@ -748,9 +771,7 @@ void RegistrarDbRedisAsync::parseAndClean(redisReply *reply, RegistrarUserData *
 		redisReply *element = reply->element[i];
 		const char *uid = element->str;
 		element = reply->element[i+1];
-		const char *contact = element->str;
-		LOGD("Parsing contact %s => %s", uid, contact);
-		if (!data->mRecord->updateFromUrlEncodedParams(key, uid, contact, data->listener)) {
+		if (!parseContact(key, uid, element, data)) {
 			LOGD("Record %s seems to have an outdated contact %s, remove it from redis", key, uid);
 			check_redis_command(redisAsyncCommand(data->self->mContext, nullptr, nullptr, "HDEL fs:%s %s", key, uid), data);
 		}
@@ -789,7 +810,7 @@ void RegistrarDbRedisAsync::doClear(const sip_t *sip, const shared_ptr<ContactUp
 
 		const char *key = data->mRecord->getKey().c_str();
 		LOGD("Clearing fs:%s [%lu]", key, data->token);
-		mLocalRegExpire->remove(key);
+		mLocalRegExpire->remove(data->mRecord->getKey());
 		check_redis_command(redisAsyncCommand(mContext, (void (*)(redisAsyncContext*, void*, void*))sHandleClear,
 			data, "DEL fs:%s", key), data);
 	} catch (const sofiasip::InvalidUrlError &e) {
@@ -822,8 +843,10 @@ void RegistrarDbRedisAsync::handleFetch(redisReply *reply, RegistrarUserData *da
 		// This is only when we want a contact matching a given gruu
 		const char *gruu = data->mUniqueId.c_str();
 		if (reply->len > 0) {
-			LOGD("GOT fs:%s [%lu] for gruu %s --> %s", key, data->token, gruu, reply->str);
-			data->mRecord->updateFromUrlEncodedParams(key, gruu, reply->str, data->listener);
+			LOGD("GOT fs:%s [%lu] for gruu %s --> %s contact (%lu bytes)", key, data->token, gruu,
+				RecordSerializerBinary::isBinaryContact(reply->str, reply->len) ? "binary" : "url-encoded",
+				(unsigned long)reply->len);
+			parseContact(key, gruu, reply, data);
 			time_t now = getCurrentTime();
 			data->mRecord->clean(now, data->listener);
 			if (data->listener) data->listener->onRecordFound(data->mRecord);
@@ -852,6 +875,143 @@ void RegistrarDbRedisAsync::doFetch(const SipUri &url, const shared_ptr<ContactU
 		data, "HGETALL fs:%s", key), data);
 }
 
+/* Returns the HGETALL of every key as an array, so that a whole list is fetched with a single command. */
+static const char *sFetchListScript =
+	"local records = {}\n"
+	"for i, key in ipairs(KEYS) do records[i] = redis.call('HGETALL', key) end\n"
+	"return records";
+
+void RegistrarDbRedisAsync::doFetchList(const vector<SipUri> &urls, const shared_ptr<ListContactUpdateListener> &listener) {
+	auto recordsListener = make_shared<ListFetchContactUpdateListener>(listener, urls.size());
+
+	if (!isConnected() && !connect()) {
+		LOGE("Not connected to redis server");
+		for (size_t i = 0; i < urls.size(); i++) recordsListener->onError();
+		return;
+	}
+
+	RegistrarListUserData *data = new RegistrarListUserData(this);
+	vector<string> keys{};
+	keys.reserve(urls.size());
+	for (const auto &url : urls) {
+		auto fetch = new RegistrarUserData(this, url, recordsListener);
+		keys.push_back("fs:" + fetch->mRecord->getKey().str());
+		data->mFetches.push_back(fetch);
+	}
+
+	string keyCount = to_string(keys.size());
+	vector<const char *> argv{"EVAL", sFetchListScript, keyCount.c_str()};
+	vector<size_t> argvlen{4, strlen(sFetchListScript), keyCount.size()};
+	for (const auto &key : keys) {
+		argv.push_back(key.c_str());
+		argvlen.push_back(key.size());
+	}
+
+	LOGD("Fetching %lu records with a single command", (unsigned long)keys.size());
+	int status = redisAsyncCommandArgv(mContext, (void (*)(redisAsyncContext*, void*, void*))sHandleFetchList,
+		data, argv.size(), argv.data(), argvlen.data());
+	if (status != REDIS_OK) {
+		LOGE("Redis error for fetch list: %d", status);
+		for (auto fetch : data->mFetches) {
+			fetch->listener->onError();
+			delete fetch;
+		}
+		delete data;
+	}
+}
+
+void RegistrarDbRedisAsync::handleFetchList(redisReply *reply, RegistrarListUserData *data) {
+	if (!reply || reply->type != REDIS_REPLY_ARRAY || reply->elements != data->mFetches.size()) {
+		LOGE("Redis error while fetching list: %s", reply && reply->type == REDIS_REPLY_ERROR ? reply->str : "unexpected reply");
+		for (auto fetch : data->mFetches) {
+			fetch->listener->onError();
+			delete fetch;
+		}
+	} else {
+		for (size_t i = 0; i < reply->elements; i++) {
+			RegistrarUserData *fetch = data->mFetches[i];
+			redisReply *element = reply->element[i];
+			// Records still stored with the pre-hashmap layout are migrated at startup, not looked up here.
+			if (element->type == REDIS_REPLY_ARRAY && element->elements > 0) {
+				parseAndClean(element, fetch);
+				fetch->listener->onRecordFound(fetch->mRecord);
+			} else {
+				fetch->listener->onRecordFound(nullptr);
+			}
+			delete fetch;
+		}
+	}
+	delete data;
+}
+
+namespace {
+
+/* Gives the records fetched for a SCAN step to the listener of the dump, along with the cursor of the next step. */
+class DumpFetchListener : public ListContactUpdateListener {
+  public:
+	DumpFetchListener(const shared_ptr<DumpListener> &listener, const string &cursor)
+		: mListener(listener), mCursor(cursor) {}
+
+	void onContactsUpdated() override {
+		mListener->onRecordsDumped(records, mCursor);
+	}
+
+  private:
+	shared_ptr<DumpListener> mListener;
+	string mCursor;
+};
+
+} // namespace
+
+void RegistrarDbRedisAsync::doDump(const string &cursor, size_t count, const shared_ptr<DumpListener> &listener) {
+	if (!isConnected() && !connect()) {
+		LOGE("Not connected to redis server");
+		listener->onError();
+		return;
+	}
+
+	RegistrarDumpUserData *data = new RegistrarDumpUserData(this, listener);
+	string countStr = to_string(max<size_t>(count, 1));
+	LOGD("Scanning records from cursor %s", cursor.c_str());
+	int status = redisAsyncCommand(mContext, (void (*)(redisAsyncContext*, void*, void*))sHandleDump,
+		data, "SCAN %s MATCH fs:* COUNT %s", cursor.c_str(), countStr.c_str());
+	if (status != REDIS_OK) {
+		LOGE("Redis error for dump: %d", status);
+		listener->onError();
+		delete data;
+	}
+}
+
+void RegistrarDbRedisAsync::handleDump(redisReply *reply, RegistrarDumpUserData *data) {
+	if (!reply || reply->type != REDIS_REPLY_ARRAY || reply->elements != 2
+		|| reply->element[0]->type != REDIS_REPLY_STRING || reply->element[1]->type != REDIS_REPLY_ARRAY) {
+		LOGE("Redis error while scanning records: %s", reply && reply->type == REDIS_REPLY_ERROR ? reply->str : "unexpected reply");
+		data->listener->onError();
+		delete data;
+		return;
+	}
+
+	string cursor(reply->element[0]->str, reply->element[0]->len);
+	const redisReply *keys = reply->element[1];
+	vector<SipUri> urls{};
+	urls.reserve(keys->elements);
+	for (size_t i = 0; i < keys->elements; i++) {
+		const redisReply *key = keys->element[i];
+		if (key->type != REDIS_REPLY_STRING || key->len <= 3) continue;
+		try {
+			urls.emplace_back("sip:" + string(key->str + 3, key->len - 3));
+		} catch (const sofiasip::InvalidUrlError &e) {
+			LOGD("Skipping invalid record [%s]: %s", key->str, e.getReason().c_str());
+		}
+	}
+
+	// SCAN may give no key at all before the end of the walk, the listener is then called with the next cursor only.
+	auto fetchListener = make_shared<DumpFetchListener>(data->listener, cursor);
+	delete data;
+	if (urls.empty()) fetchListener->onContactsUpdated();
+	else doFetchList(urls, fetchListener);
+}
+
 void RegistrarDbRedisAsync::doFetchInstance(const SipUri &url, const string &uniqueId, const shared_ptr<ContactUpdateListener> &listener) {
 	// fetch only the contact in the AOR (HGET) and call the onRecordFound of the listener
 	RegistrarUserData *data = new RegistrarUserData(this, url, listener);
@@ -34,6 +34,7 @@ struct RedisParameters {
 	int port{0};
 	int timeout{0};
 	int mSlaveCheckTimeout{0};
+	bool mBinaryContacts{false};
 };
 
 /**
@@ -96,6 +97,23 @@ struct RegistrarUserData {
 		self(s), listener(listener), mRecord(std::make_shared<Record>(std::forward<T>(url))) {}
 };
 
+/* The fetches of a RegistrarDb::fetchList(), answered by a single Redis command. */
+struct RegistrarListUserData {
+	RegistrarDbRedisAsync *self = nullptr;
+	std::vector<RegistrarUserData *> mFetches;
+
+	RegistrarListUserData(RegistrarDbRedisAsync *s) : self(s) {}
+};
+
+/* A step of a RegistrarDb::dump(): the SCAN of the next keys, whose records are then fetched with doFetchList(). */
+struct RegistrarDumpUserData {
+	RegistrarDbRedisAsync *self = nullptr;
+	std::shared_ptr<DumpListener> listener;
+
+	RegistrarDumpUserData(RegistrarDbRedisAsync *s, const std::shared_ptr<DumpListener> &listener) :
+		self(s), listener(listener) {}
+};
+
 class RegistrarDbRedisAsync : public RegistrarDb {
   public:
 	RegistrarDbRedisAsync(const std::string &preferredRoute, su_root_t *root, RecordSerializer *serializer,
@@ -109,6 +127,8 @@ class RegistrarDbRedisAsync : public RegistrarDb {
 	void doClear(const sip_t *sip, const std::shared_ptr<ContactUpdateListener> &listener) override;
 	void doFetch(const SipUri &url, const std::shared_ptr<ContactUpdateListener> &listener) override;
 	void doFetchInstance(const SipUri &url, const std::string &uniqueId, const std::shared_ptr<ContactUpdateListener> &listener) override;
+	void doFetchList(const std::vector<SipUri> &urls, const std::shared_ptr<ListContactUpdateListener> &listener) override;
+	void doDump(const std::string &cursor, size_t count, const std::shared_ptr<DumpListener> &listener) override;
 	void doMigration() override;
 	void subscribe(const std::string &topic, const std::shared_ptr<ContactRegisteredListener> &listener) override;
 	void unsubscribe(const std::string &topic, const std::shared_ptr<ContactRegisteredListener> &listener) override;
@@ -144,6 +164,7 @@ class RegistrarDbRedisAsync : public RegistrarDb {
 	void subscribeTopic(const std::string &topic);
 	void subscribeAll();
 	void subscribeToKeyExpiration();
+	bool parseContact(const char *key, const char *uid, const redisReply *value, RegistrarUserData *data);
 	void parseAndClean(redisReply *reply, RegistrarUserData *data);
 
 	/* callbacks */
@@ -152,6 +173,8 @@ class RegistrarDbRedisAsync : public RegistrarDb {
 	void handleBindReplyAorSet(redisReply *reply, RegistrarUserData *data);
 	void handleClear(redisReply *reply, RegistrarUserData *data);
 	void handleFetch(redisReply *reply, RegistrarUserData *data);
+	void handleFetchList(redisReply *reply, RegistrarListUserData *data);
+	void handleDump(redisReply *reply, RegistrarDumpUserData *data);
 	void handleReplicationInfoReply(const char *str);
 	void handleMigration(redisReply *reply, RegistrarUserData *data);
 	void handleRecordMigration(redisReply *reply, RegistrarUserData *data);
@@ -172,6 +195,8 @@ class RegistrarDbRedisAsync : public RegistrarDb {
 	static void sHandleBindFinish(redisAsyncContext *ac, redisReply *reply, RegistrarUserData *data);
 	static void sHandleClear(redisAsyncContext *ac, redisReply *reply, RegistrarUserData *data);
 	static void sHandleFetch(redisAsyncContext *ac, redisReply *reply, RegistrarUserData *data);
+	static void sHandleFetchList(redisAsyncContext *ac, redisReply *reply, RegistrarListUserData *data);
+	static void sHandleDump(redisAsyncContext *ac, redisReply *reply, RegistrarDumpUserData *data);
 	static void sHandleInfoTimer(void *unused, su_timer_t *t, void *data);
 	static void sHandleReplicationInfoReply(redisAsyncContext *ac, void *r, void *privdata);
 	static void sHandleSet(redisAsyncContext *ac, void *r, void *privdata);
@@ -19,6 +19,7 @@
 #include <algorithm>
 #include <ctime>
 #include <cstdio>
+#include <cstring>
 #include <iomanip>
 #include <ostream>
 #include <sstream>
@@ -120,6 +121,68 @@ sip_route_t *ExtendedContact::toSofiaRoute(su_home_t *home) const {
 	return rbegin;
 }
 
+void Record::indexContact(Contacts::iterator it) {
+	const ExtendedContact &ec = **it;
+	IndexedContact indexed{it, mNextContactOrder++};
+	if (!ec.mUniqueId.empty()) mContactsByUniqueId.emplace(hash<string>()(ec.mUniqueId), indexed);
+	mContactsByCallId.emplace(hash<string>()(ec.mCallId), indexed);
+}
+
+template <typename Index, typename Iterator>
+static void removeFromIndex(Index &index, const string &key, Iterator contact) {
+	auto range = index.equal_range(hash<string>()(key));
+	for (auto it = range.first; it != range.second; ++it) {
+		if (it->second.mContact == contact) {
+			index.erase(it);
+			return;
+		}
+	}
+}
+
+void Record::unindexContact(Contacts::iterator it) {
+	if (!(*it)->mUniqueId.empty()) removeFromIndex(mContactsByUniqueId, (*it)->mUniqueId, it);
+	removeFromIndex(mContactsByCallId, (*it)->mCallId, it);
+}
+
+Record::Contacts::iterator Record::eraseContact(Contacts::iterator it) {
+	if (it == mContacts.end()) return it;
+	unindexContact(it);
+	return mContacts.erase(it);
+}
+
+Record::Contacts::iterator Record::removeContact(const shared_ptr<ExtendedContact> &ct) {
+	auto range = mContactsByCallId.equal_range(hash<string>()(ct->mCallId));
+	for (auto it = range.first; it != range.second; ++it) {
+		if (*it->second.mContact == ct) return eraseContact(it->second.mContact);
+	}
+	return mContacts.end();
+}
+
+void Record::clearContacts() {
+	mContacts.clear();
+	mContactsByUniqueId.clear();
+	mContactsByCallId.clear();
+}
+
+/*
+ * Returns the first contact, in contact order, among the ones indexed under the hash of 'key' and matching 'pred', or
+ * 'end'. 'pred' must check the indexed field, since several keys may share a hash.
+ */
+template <typename Index, typename Iterator, typename Predicate>
+static Iterator findIndexedContact(const Index &index, Iterator end, const string &key, Predicate pred) {
+	auto range = index.equal_range(hash<string>()(key));
+	Iterator found = end;
+	uint64_t foundOrder = 0;
+	for (auto it = range.first; it != range.second; ++it) {
+		if (!pred(**it->second.mContact)) continue;
+		if (found == end || it->second.mOrder < foundOrder) {
+			found = it->second.mContact;
+			foundOrder = it->second.mOrder;
+		}
+	}
+	return found;
+}
+
 sip_contact_t *Record::getContacts(su_home_t *home, time_t now) {
 	sip_contact_t *alist = nullptr;
 	for (auto it = mContacts.begin(); it != mContacts.end(); ++it) {
@@ -133,14 +196,12 @@ sip_contact_t *Record::getContacts(su_home_t *home, time_t now) {
 }
 
 bool Record::isInvalidRegister(const string &call_id, uint32_t cseq) {
-	for (auto it = mContacts.begin(); it != mContacts.end(); ++it) {
-		shared_ptr<ExtendedContact> ec = (*it);
-		if ((0 == strcmp(ec->callId(), call_id.c_str())) && cseq <= ec->mCSeq) {
-			LOGD("CallID %s already registered with CSeq %d (received %d)", call_id.c_str(), ec->mCSeq, cseq);
-			return true;
-		}
-	}
-	return false;
+	auto it = findIndexedContact(mContactsByCallId, mContacts.end(), call_id, [&call_id, cseq](const ExtendedContact &ec) {
+		return ec.mCallId == call_id && cseq <= ec.mCSeq;
+	});
+	if (it == mContacts.end()) return false;
+	LOGD("CallID %s already registered with CSeq %d (received %d)", call_id.c_str(), (*it)->mCSeq, cseq);
+	return true;
 }
 
 string Record::extractUniqueId(const sip_contact_t *contact) {
@@ -160,15 +221,14 @@ string Record::extractUniqueId(const sip_contact_t *contact) {
 }
 
 const shared_ptr<ExtendedContact> Record::extractContactByUniqueId(string uid) {
-	const auto contacts = getExtendedContacts();
-	for (auto it = contacts.begin(); it != contacts.end(); ++it) {
-		const shared_ptr<ExtendedContact> ec = *it;
-		if (ec && ec->mUniqueId.compare(uid) == 0) {
-			return ec;
-		}
+	Contacts::iterator it;
+	if (uid.empty()) {
+		// Contacts without unique id aren't indexed by it.
+		it = find_if(mContacts.begin(), mContacts.end(), [](const shared_ptr<ExtendedContact> &ec) {return ec->mUniqueId.empty();});
+	} else {
+		it = findIndexedContact(mContactsByUniqueId, mContacts.end(), uid, [&uid](const ExtendedContact &ec) {return ec.mUniqueId == uid;});
 	}
-	shared_ptr<ExtendedContact> noContact;
-	return noContact;
+	return it != mContacts.end() ? *it : nullptr;
 }
 
 /**
@@ -181,7 +241,7 @@ void Record::clean(time_t now, const shared_ptr<ContactUpdateListener> &listener
 		if (now >= ec->mExpireAt) {
 			if (listener)
 				listener->onContactUpdated(ec);
-			it = mContacts.erase(it);
+			it = eraseContact(it);
 		} else {
 			++it;
 		}
@@ -228,19 +288,19 @@ list<string> Record::route_to_stl(const sip_route_s *route) {
 	return res;
 }
 
-string Record::defineKeyFromUrl(const url_t *url) {
-	ostringstream ostr;
+AorKey Record::defineKeyFromUrl(const url_t *url) {
+	string key;
 	const char *user = url->url_user;
 	if (user && user[0] != '\0') {
-		if (!RegistrarDb::get()->useGlobalDomain()) {
-			ostr << user << "@" << url->url_host;
-		} else {
-			ostr << user << "@" << "merged";
-		}
-	} else {
-		ostr << url->url_host;
+		const char *host = RegistrarDb::get()->useGlobalDomain() ? "merged" : url->url_host;
+		size_t userLen = strlen(user);
+		size_t hostLen = host ? strlen(host) : 0;
+		key.reserve(userLen + 1 + hostLen);
+		key.append(user, userLen).append(1, '@').append(host ? host : "", hostLen);
+	} else if (url->url_host) {
+		key.assign(url->url_host);
 	}
-	return ostr.str();
+	return AorKey(move(key));
 }
 
 SipUri Record::makeUrlFromKey(const string &key) {
@@ -253,41 +313,49 @@ void Record::insertOrUpdateBinding(const shared_ptr<ExtendedContact> &ec, const
 	SLOGD << "Trying to insert new contact " << *ec;
 
 	if (sAssumeUniqueDomains && mIsDomain) {
-		mContacts.clear();
+		clearContacts();
 	}
 	for (auto it = mContacts.begin(); it != mContacts.end();) {
 		if (now >= (*it)->mExpireAt) {
 			SLOGD << "Cleaning expired contact " << (*it)->mContactId;
-			it = mContacts.erase(it);
-		} else if (!(*it)->mUniqueId.empty() && (*it)->mUniqueId == ec->mUniqueId) {
-			if (ec->mExpireAt == now){
-				/*case of ;expires=0 in contact header*/
-				if ((*it)->mCSeq == ec->mCSeq && (*it)->mCallId == ec->mCallId) {
-					/*this happens when a client (like Linphone) sends this kind of very ambiguous Contact header in a REGISTER
-					 * Contact: <sip:marie_-jSau@ip1:39936;transport=tcp>;+sip.instance="<urn:uuid:bfb7514b-f793-4d85-b322-232044dc3731>"
-					 * Contact: <sip:marie_-jSau@ip1:39934;transport=tcp>;+sip.instance="<urn:uuid:bfb7514b-f793-4d85-b322-232044dc3731>";expires=0
-					 *
-					 * We don't want the second line to unregister the first one, so don't touch anything*/
-					return;
-				} else {
-					/*this contact should be removed*/
-					it = mContacts.erase(it);
-					return;
-				}
-			}
-			SLOGD << "Cleaning older line '" << ec->mUniqueId << "' for contact " << (*it)->mContactId;
-			if (listener) listener->onContactUpdated(*it);
-			it = mContacts.erase(it);
-		} else if ((*it)->mUniqueId.empty() && (*it)->callId() && (*it)->mCallId == ec->mCallId) {
-			/*we don't accept to clean a contact from call-id if the unique id was set previously*/
-			SLOGD << "Cleaning same call id contact " << (*it)->mContactId << "(" << ec->mCallId << ")";
-			if (listener) listener->onContactUpdated(*it);
-			it = mContacts.erase(it);
+			it = eraseContact(it);
 		} else {
 			++it;
 		}
 	}
-	mContacts.push_back(ec);
+
+	auto sameLine = [&ec](const ExtendedContact &other) {return other.mUniqueId == ec->mUniqueId;};
+	for (auto it = ec->mUniqueId.empty() ? mContacts.end() : findIndexedContact(mContactsByUniqueId, mContacts.end(), ec->mUniqueId, sameLine);
+		it != mContacts.end(); it = findIndexedContact(mContactsByUniqueId, mContacts.end(), ec->mUniqueId, sameLine)) {
+		if (ec->mExpireAt == now){
+			/*case of ;expires=0 in contact header*/
+			if ((*it)->mCSeq == ec->mCSeq && (*it)->mCallId == ec->mCallId) {
+				/*this happens when a client (like Linphone) sends this kind of very ambiguous Contact header in a REGISTER
+				 * Contact: <sip:marie_-jSau@ip1:39936;transport=tcp>;+sip.instance="<urn:uuid:bfb7514b-f793-4d85-b322-232044dc3731>"
+				 * Contact: <sip:marie_-jSau@ip1:39934;transport=tcp>;+sip.instance="<urn:uuid:bfb7514b-f793-4d85-b322-232044dc3731>";expires=0
+				 *
+				 * We don't want the second line to unregister the first one, so don't touch anything*/
+				return;
+			} else {
+				/*this contact should be removed*/
+				eraseContact(it);
+				return;
+			}
+		}
+		SLOGD << "Cleaning older line '" << ec->mUniqueId << "' for contact " << (*it)->mContactId;
+		if (listener) listener->onContactUpdated(*it);
+		eraseContact(it);
+	}
+
+	/*we don't accept to clean a contact from call-id if the unique id was set previously*/
+	auto sameCallId = [&ec](const ExtendedContact &other) {return other.mUniqueId.empty() && other.mCallId == ec->mCallId;};
+	for (auto it = findIndexedContact(mContactsByCallId, mContacts.end(), ec->mCallId, sameCallId); it != mContacts.end();
+		it = findIndexedContact(mContactsByCallId, mContacts.end(), ec->mCallId, sameCallId)) {
+		SLOGD << "Cleaning same call id contact " << (*it)->mContactId << "(" << ec->mCallId << ")";
+		if (listener) listener->onContactUpdated(*it);
+		eraseContact(it);
+	}
+	pushContact(ec);
 
 	if (ec->mCallId.find("static-record") == string::npos) {
 		mOnlyStaticContacts = false;
@@ -350,10 +418,14 @@ void Record::applyMaxAor() {
 	if (mContacts.size() > (unsigned int)sMaxContacts) {
 		mContacts.sort(compare_contact_using_last_update);
 		do {
-			shared_ptr<ExtendedContact> front = mContacts.front();
-			mContacts.pop_front();
-			mContactsToRemove.push_back(front);
+			mContactsToRemove.push_back(mContacts.front());
+			eraseContact(mContacts.begin());
 		} while (mContacts.size() > (unsigned int)sMaxContacts);
+
+		// The sort changed the order of the contacts.
+		mContactsByUniqueId.clear();
+		mContactsByCallId.clear();
+		for (auto it = mContacts.begin(); it != mContacts.end(); ++it) indexContact(it);
 	}
 }
 
@@ -680,7 +752,7 @@ void Record::appendContactsFrom(const shared_ptr<Record> &src) {
 		return;
 
 	for (auto it = src->mContacts.begin(); it != src->mContacts.end(); ++it) {
-		mContacts.push_back(*it);
+		pushContact(*it);
 	}
 }
 
@@ -779,39 +851,44 @@ void RegistrarDb::notifyContactListener (const shared_ptr<Record> &r, const stri
 void RegistrarDb::LocalRegExpire::update(const shared_ptr<Record> &record) {
 	unique_lock<mutex> lock(mMutex);
 	time_t latest = record->latestExpire(mAgent);
+	auto it = mRegMap.find(record->getKey());
 	if (latest > 0) {
-		auto it = mRegMap.find(record->getKey());
 		if (it != mRegMap.end()) {
-			(*it).second = latest;
+			if (it->second->first != latest) {
+				mExpiryIndex.erase(it->second);
+				it->second = mExpiryIndex.emplace(latest, record->getKey());
+			}
 		} else {
 			if (!record->isEmpty() && !record->haveOnlyStaticContacts()) {
-				mRegMap.insert(make_pair(record->getKey(), latest));
+				mRegMap.emplace(record->getKey(), mExpiryIndex.emplace(latest, record->getKey()));
 				notifyLocalRegExpireListener(mRegMap.size());
 			}
 		}
 	} else {
-		mRegMap.erase(record->getKey());
+		if (it != mRegMap.end()) {
+			mExpiryIndex.erase(it->second);
+			mRegMap.erase(it);
+		}
 		notifyLocalRegExpireListener(mRegMap.size());
 	}
 }
 
 size_t RegistrarDb::LocalRegExpire::countActives() {
+	unique_lock<mutex> lock(mMutex);
 	return mRegMap.size();
 }
+
 void RegistrarDb::LocalRegExpire::removeExpiredBefore(time_t before) {
 	unique_lock<mutex> lock(mMutex);
 
-	for (auto it = mRegMap.begin(); it != mRegMap.end();) {
-		// LOGE("> %s [%lu]", (*it).first.c_str(), (*it).second-before);
-		if ((*it).second <= before) {
-			auto prevIt = it;
-			++it;
-			mRegMap.erase(prevIt);
-			notifyLocalRegExpireListener(mRegMap.size());
-		} else {
-			++it;
-		}
+	size_t removed = 0;
+	while (!mExpiryIndex.empty() && mExpiryIndex.begin()->first <= before) {
+		mRegMap.erase(mExpiryIndex.begin()->second);
+		mExpiryIndex.erase(mExpiryIndex.begin());
+		removed++;
 	}
+	// Listeners only need the final count: notify them once per sweep.
+	if (removed > 0) notifyLocalRegExpireListener(mRegMap.size());
 }
 
 void RegistrarDb::LocalRegExpire::subscribe(LocalRegExpireListener *listener) {
@@ -874,7 +951,8 @@ RegistrarDb *RegistrarDb::initialize(Agent *ag){
 	string mMessageExpiresName = mr->get<ConfigString>("message-expires-param-name")->read();
 	if ("internal" == dbImplementation) {
 		LOGI("RegistrarDB implementation is internal");
-		sUnique = new RegistrarDbInternal(ag);
+		sUnique = new RegistrarDbInternal(ag, mr->get<ConfigString>("internal-snapshot-file")->read(),
+			mr->get<ConfigInt>("internal-snapshot-period")->read());
 		sUnique->mUseGlobalDomain = useGlobalDomain;
 	}
 #ifdef ENABLE_REDIS
@@ -889,6 +967,7 @@ RegistrarDb *RegistrarDb::initialize(Agent *ag){
 		params.timeout = registrar->get<ConfigInt>("redis-server-timeout")->read();
 		params.auth = registrar->get<ConfigString>("redis-auth-password")->read();
 		params.mSlaveCheckTimeout = registrar->get<ConfigInt>("redis-slave-check-period")->read();
+		params.mBinaryContacts = registrar->get<ConfigString>("redis-contact-encoding")->read() == "binary";
 
 		sUnique = new RegistrarDbRedisAsync(ag, params);
 		sUnique->mUseGlobalDomain = useGlobalDomain;
@@ -1085,42 +1164,48 @@ void RegistrarDb::fetch(const SipUri &url, const shared_ptr<ContactUpdateListene
 			: listener);
 }
 
-void RegistrarDb::fetchList(const vector<SipUri> urls, const shared_ptr<ListContactUpdateListener> &listener) {
-	class InternalContactUpdateListener : public ContactUpdateListener {
-	public:
-		InternalContactUpdateListener(shared_ptr<ListContactUpdateListener> listener, size_t size) : listListener(listener), count(size) {}
-
-	private:
-		void onError() override{
-			SLOGE << "Error while fetching contact";
-			updateCount();
-		}
-		void onInvalid() override{
-			SLOGE << "Invalid fetch of contact";
-			updateCount();
-		}
-		void onRecordFound(const shared_ptr<Record> &r) override{
-			SLOGI << "Contact fetched";
-			if (r) listListener->records.push_back(r);
-			updateCount();
-		}
-		void onContactUpdated(const shared_ptr<ExtendedContact> &ec) override{}
-		void updateCount() {
-			count--;
-			if (count == 0)
-				listListener->onContactsUpdated();
-		}
+void ListFetchContactUpdateListener::onRecordFound(const shared_ptr<Record> &r) {
+	if (r) mListListener->records.push_back(r);
+	updateCount();
+}
 
-		shared_ptr<ListContactUpdateListener> listListener;
-		size_t count;
-	};
+void ListFetchContactUpdateListener::onError() {
+	SLOGE << "Error while fetching contact";
+	updateCount();
+}
+
+void ListFetchContactUpdateListener::onInvalid() {
+	SLOGE << "Invalid fetch of contact";
+	updateCount();
+}
 
-	shared_ptr<InternalContactUpdateListener> urlListener = make_shared<InternalContactUpdateListener>(listener, urls.size());
+void ListFetchContactUpdateListener::updateCount() {
+	if (--mCount == 0) mListListener->onContactsUpdated();
+}
+
+void RegistrarDb::fetchList(const vector<SipUri> urls, const shared_ptr<ListContactUpdateListener> &listener) {
+	if (urls.empty()) {
+		listener->onContactsUpdated();
+		return;
+	}
+	// Backends only batch plain AORs: GRUUs need a lookup of the matching instance.
+	bool hasGruu = any_of(urls.cbegin(), urls.cend(), [](const SipUri &url) {return url.hasParam("gr");});
+	if (hasGruu) RegistrarDb::doFetchList(urls, listener);
+	else doFetchList(urls, listener);
+}
+
+void RegistrarDb::doFetchList(const vector<SipUri> &urls, const shared_ptr<ListContactUpdateListener> &listener) {
+	auto urlListener = make_shared<ListFetchContactUpdateListener>(listener, urls.size());
 	for (const auto &url : urls) {
 		fetch(url, urlListener);
 	}
 }
 
+void RegistrarDb::doDump(const string &cursor, size_t count, const shared_ptr<DumpListener> &listener) {
+	LOGE("This registrar database backend cannot be dumped");
+	listener->onError();
+}
+
 void RegistrarDb::bind(const sip_t *sip, const BindingParameters &parameter, const shared_ptr<ContactUpdateListener> &listener) {
 	sofiasip::Home home;
 	bool gruu_assigned = false;
@@ -1169,6 +1254,7 @@ void RegistrarDb::bind(const SipUri &from, const sip_contact_t *contact, const B
 	if (parameter.withGruu) sip->sip_supported = reinterpret_cast<sip_supported_t *>(sip_header_format(homeSip, sip_supported_class, "gruu"));
 
 	if (!parameter.callId.empty()) sip->sip_call_id = sip_call_id_make(homeSip, parameter.callId.c_str());
+	if (parameter.cseq) sip->sip_cseq = sip_cseq_create(homeSip, parameter.cseq, sip_method_register, nullptr);
 	sip->sip_expires = sip_expires_create(homeSip, 0);
 
 	bind(sip, parameter, listener);
@@ -1236,6 +1322,8 @@ void RegistrarDb::fetchWithDomain(const SipUri &url, const shared_ptr<ContactUpd
 RecordSerializer *RecordSerializer::create(const string &name) {
 	if (name == "c") {
 		return new RecordSerializerC();
+	} else if (name == "binary") {
+		return new RecordSerializerBinary();
 	} else if (name == "json") {
 		return new RecordSerializerJson();
 	}
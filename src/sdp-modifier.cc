@@ -715,5 +715,6 @@ int SdpModifier::update(msg_t *msg, sip_t *sip){
 	}
 end:
 	if (printer) sdp_printer_free(printer);
+	if (err == 0) mModified = false;
 	return err;
 }
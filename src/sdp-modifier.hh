@@ -74,6 +74,7 @@ struct MasqueradeContextPair{
 
 /**
  * Utility class used to do various changes in an existing SDP message.
+ * Modules get the instance shared by all of them with MsgSip::getSdpModifier().
 **/
 class SdpModifier{
 	public:
@@ -106,7 +107,14 @@ class SdpModifier{
 		void addMediaAttribute(sdp_media_t *mline, const char *name, const char *value);
 		bool hasMediaAttribute(sdp_media_t *mline, const char *name);
 		bool hasIceCandidate(sdp_media_t *mline, const std::string &addr, int port);
+		/**
+		 * Print the SDP session and replace the body of the message with it.
+		 * Modules should rather call setModified() and let MsgSip::commitSdp() do it once for all.
+		**/
 		int update(msg_t *msg, sip_t *sip);
+		void setModified() {mModified = true;}
+		bool isModified() const {return mModified;}
+		void setNortproxy(const std::string &nortproxy) {mNortproxy = nortproxy;}
 		void setPtime(int ptime);
 		virtual ~SdpModifier();
 		SdpModifier(su_home_t *home, std::string nortproxy);
@@ -121,6 +129,7 @@ class SdpModifier{
 		sdp_parser_t *mParser;
 		su_home_t *mHome;
 		std::string mNortproxy;
+		bool mModified = false;
 };
 
 }
\ No newline at end of file
@@ -0,0 +1,129 @@
+/*
+	Flexisip, a flexible SIP proxy server with media capabilities.
+	Copyright (C) 2010-2015  Belledonne Communications SARL, All rights reserved.
+
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU Affero General Public License as
+	published by the Free Software Foundation, either version 3 of the
+	License, or (at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU Affero General Public License for more details.
+
+	You should have received a copy of the GNU Affero General Public License
+	along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/*
+ * Compares the registrar keys built as plain strings with AorKey: key creation, hash map lookups and insertion into
+ * an expiry index. Usage: flexisip_aor_key_benchmark [number of AORs, 100000 by default]
+ */
+
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include <flexisip/utils/aor-key.hh>
+
+using namespace std;
+using namespace flexisip;
+
+namespace {
+
+struct Aor {
+	string user;
+	string host;
+};
+
+size_t sSink = 0; // Keeps the compiler from dropping the measured work.
+
+template <typename Function> double nsPerOperation(size_t count, Function f) {
+	auto start = chrono::steady_clock::now();
+	f();
+	chrono::duration<double, nano> elapsed = chrono::steady_clock::now() - start;
+	return elapsed.count() / count;
+}
+
+void report(const char *name, double before, double after) {
+	cout << name << ": " << before << " ns with strings, " << after << " ns with AorKey" << endl;
+}
+
+// Same construction as the one of the registrar before AorKey.
+string makeStringKey(const Aor &aor) {
+	ostringstream os;
+	os << aor.user << "@" << aor.host;
+	return os.str();
+}
+
+// Same construction as Record::defineKeyFromUrl().
+AorKey makeAorKey(const Aor &aor) {
+	string key;
+	key.reserve(aor.user.size() + 1 + aor.host.size());
+	key.append(aor.user).append(1, '@').append(aor.host);
+	return AorKey(move(key));
+}
+
+} // namespace
+
+int main(int argc, char *argv[]) {
+	size_t count = argc > 1 ? strtoul(argv[1], nullptr, 10) : 100000;
+	if (count == 0) {
+		cerr << "Usage: " << argv[0] << " [number of AORs]" << endl;
+		return EXIT_FAILURE;
+	}
+
+	vector<Aor> aors;
+	aors.reserve(count);
+	for (size_t i = 0; i < count; ++i) {
+		aors.push_back({"user" + to_string(i), "sip" + to_string(i % 100) + ".example.org"});
+	}
+
+	vector<string> stringKeys;
+	vector<AorKey> aorKeys;
+	stringKeys.reserve(count);
+	aorKeys.reserve(count);
+	double before = nsPerOperation(count, [&]() {
+		for (const auto &aor : aors) stringKeys.push_back(makeStringKey(aor));
+	});
+	double after = nsPerOperation(count, [&]() {
+		for (const auto &aor : aors) aorKeys.push_back(makeAorKey(aor));
+	});
+	report("key creation", before, after);
+
+	unordered_map<string, size_t> stringMap;
+	unordered_map<AorKey, size_t> aorKeyMap;
+	for (size_t i = 0; i < count; ++i) {
+		stringMap.emplace(stringKeys[i], i);
+		aorKeyMap.emplace(aorKeys[i], i);
+	}
+	before = nsPerOperation(count, [&]() {
+		for (const auto &key : stringKeys) sSink += stringMap.find(key)->second;
+	});
+	after = nsPerOperation(count, [&]() {
+		for (const auto &key : aorKeys) sSink += aorKeyMap.find(key)->second;
+	});
+	report("unordered_map lookup", before, after);
+
+	multimap<time_t, string> stringIndex;
+	multimap<time_t, AorKey> aorKeyIndex;
+	time_t now = time(nullptr);
+	before = nsPerOperation(count, [&]() {
+		for (size_t i = 0; i < count; ++i) stringIndex.emplace(now + i % 3600, stringKeys[i]);
+	});
+	after = nsPerOperation(count, [&]() {
+		for (size_t i = 0; i < count; ++i) aorKeyIndex.emplace(now + i % 3600, aorKeys[i]);
+	});
+	report("expiry index insertion", before, after);
+
+	cout << "checksum: " << sSink << endl;
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,155 @@
+/*
+	Flexisip, a flexible SIP proxy server with media capabilities.
+	Copyright (C) 2010-2015  Belledonne Communications SARL, All rights reserved.
+
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU Affero General Public License as
+	published by the Free Software Foundation, either version 3 of the
+	License, or (at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU Affero General Public License for more details.
+
+	You should have received a copy of the GNU Affero General Public License
+	along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/*
+ * Compares the verification of a digest authentication response (qop=auth) computed with hexadecimal strings, as
+ * FlexisipAuthModule did before DigestValue, with the binary digests. Both use the bctoolbox hash functions.
+ * Usage: flexisip_digest_benchmark [number of responses, 200000 by default]
+ */
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <bctoolbox/crypto.h>
+
+#include "../utils/digest.hh"
+
+using namespace std;
+using namespace flexisip;
+
+namespace {
+
+struct Response {
+	string username = "alice";
+	string realm = "sip.example.org";
+	string nonce = "QmFzZTY0IGVuY29kZWQgbm9uY2UgdmFsdWU";
+	string cnonce = "0a4f113b";
+	string nc = "00000001";
+	string qop = "auth";
+	string uri = "sip:sip.example.org";
+	string method = "REGISTER";
+	string ha1; // stored password, in hexadecimal
+	string response; // sent by the client, in hexadecimal
+};
+
+size_t sSink = 0; // Keeps the compiler from dropping the measured work.
+
+template <typename Function> double nsPerOperation(size_t count, Function f) {
+	auto start = chrono::steady_clock::now();
+	f();
+	chrono::duration<double, nano> elapsed = chrono::steady_clock::now() - start;
+	return elapsed.count() / count;
+}
+
+void report(const string &name, double before, double after) {
+	cout << name << ": " << before << " ns with strings, " << after << " ns with DigestValue" << endl;
+}
+
+// Same computation as the one of Digest::compute<string>() before DigestValue.
+string legacyHexDigest(const string &algo, const string &data) {
+	vector<uint8_t> hash(algo == "MD5" ? 16 : 32);
+	if (algo == "MD5") bctbx_md5(reinterpret_cast<const uint8_t *>(data.data()), data.size(), hash.data());
+	else bctbx_sha256(reinterpret_cast<const uint8_t *>(data.data()), data.size(), hash.size(), hash.data());
+
+	char formatedByte[3];
+	string res;
+	res.reserve(hash.size() * 2);
+	for (const uint8_t &byte : hash) {
+		snprintf(formatedByte, sizeof(formatedByte), "%02hhx", byte);
+		res += formatedByte;
+	}
+	return res;
+}
+
+// Same verification as FlexisipAuthModule::checkPasswordForAlgorithm() before DigestValue.
+bool legacyCheck(const string &algo, const Response &r) {
+	ostringstream a2;
+	a2 << r.method << ':' << r.uri;
+	string ha2 = legacyHexDigest(algo, a2.str());
+	ostringstream input;
+	input << r.ha1 << ':' << r.nonce << ':' << r.nc << ':' << r.cnonce << ':' << r.qop << ':' << ha2;
+	return legacyHexDigest(algo, input.str()) == r.response;
+}
+
+// Same verification as FlexisipAuthModule::checkPasswordForAlgorithm(), with its reused input buffer.
+bool check(Digest &algo, const Response &r, string &buffer) {
+	DigestValue ha1;
+	if (!ha1.fromHex(r.ha1.data(), r.ha1.size()) || ha1.size() != algo.size()) return false;
+
+	buffer.clear();
+	buffer.append(r.method).append(1, ':').append(r.uri);
+	DigestValue ha2;
+	algo.compute(buffer.data(), buffer.size(), ha2);
+
+	char hex[2 * DigestValue::sMaxSize + 1];
+	buffer.clear();
+	ha1.toHex(hex);
+	buffer.append(hex).append(1, ':').append(r.nonce).append(1, ':').append(r.nc).append(1, ':').append(r.cnonce);
+	buffer.append(1, ':').append(r.qop).append(1, ':');
+	ha2.toHex(hex);
+	buffer.append(hex);
+	DigestValue response;
+	algo.compute(buffer.data(), buffer.size(), response);
+
+	DigestValue expected;
+	return expected.fromHex(r.response.data(), r.response.size()) && response == expected;
+}
+
+} // namespace
+
+int main(int argc, char *argv[]) {
+	size_t count = argc > 1 ? strtoul(argv[1], nullptr, 10) : 200000;
+	if (count == 0) {
+		cerr << "Usage: " << argv[0] << " [number of responses]" << endl;
+		return EXIT_FAILURE;
+	}
+
+	for (const string algoName : {"MD5", "SHA256"}) {
+		unique_ptr<Digest> algo(Digest::create(algoName));
+		Response r;
+		r.ha1 = legacyHexDigest(algoName, r.username + ":" + r.realm + ":secret");
+		ostringstream a2;
+		a2 << r.method << ':' << r.uri;
+		r.response = legacyHexDigest(algoName, r.ha1 + ":" + r.nonce + ":" + r.nc + ":" + r.cnonce + ":" + r.qop + ":"
+			+ legacyHexDigest(algoName, a2.str()));
+
+		string buffer;
+		if (!legacyCheck(algoName, r) || !check(*algo, r, buffer)) {
+			cerr << algoName << ": the response isn't verified" << endl;
+			return EXIT_FAILURE;
+		}
+
+		double before = nsPerOperation(count, [&]() {
+			for (size_t i = 0; i < count; ++i) sSink += legacyCheck(algoName, r);
+		});
+		double after = nsPerOperation(count, [&]() {
+			for (size_t i = 0; i < count; ++i) sSink += check(*algo, r, buffer);
+		});
+		report(algoName + " response verification", before, after);
+	}
+
+	cout << "checksum: " << sSink << endl;
+	return EXIT_SUCCESS;
+}
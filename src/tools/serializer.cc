@@ -16,6 +16,8 @@
 	along with this program.  If not, see <http://www.gnu.org/licenses/>.
 */
 
+#include <chrono>
+
 #include <flexisip/utils/sip-uri.hh>
 
 #include "tool_utils.hh"
@@ -111,11 +113,63 @@ int test_bind_without_ecc(ExtendedContactCommon &ecc, const unique_ptr<RecordSer
 	return 0;
 }
 
+template <typename FuncT> static double benchNsPerOp(int iterations, FuncT &&func) {
+	auto start = chrono::steady_clock::now();
+	for (int i = 0; i < iterations; ++i) func();
+	auto elapsed = chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - start);
+	return double(elapsed.count()) / iterations;
+}
+
+/* Measures the whole record serializer, then compares both per-contact encodings used in Redis hashes. */
+int bench(const unique_ptr<RecordSerializer> &serializer, int iterations, int contactCount, time_t now) {
+	Record initial(SipUri{});
+	list<string> accept{"application/sdp", "text/plain", "application/vnd.gsma.rcs-ft-http+xml"};
+	for (int i = 0; i < contactCount; ++i) {
+		string contactId = "192.168.0." + to_string(i + 1) + ":5223";
+		string contact = "sip:bench@" + contactId + ";transport=tls;+sip.instance=urn:uuid:" + to_string(i);
+		ExtendedContactCommon ecc(contactId.c_str(), {"sip:proxy.example.org;lr"}, "callid-" + to_string(i),
+			"line-" + to_string(i));
+		initial.update(ecc, contact.c_str(), now + 3600, 1, i + 1, now, false, accept, false, nullptr);
+	}
+
+	string serialized;
+	double serializeNs = benchNsPerOp(iterations, [&]() {serializer->serialize(&initial, serialized);});
+	double parseNs = benchNsPerOp(iterations, [&]() {
+		Record final(SipUri{});
+		serializer->parse(serialized, &final);
+	});
+	cout << "record with " << contactCount << " contacts: " << serialized.size() << " bytes, serialize "
+		<< serializeNs << " ns, parse " << parseNs << " ns" << endl;
+
+	auto ec = initial.getExtendedContacts().front();
+	const char *key = initial.getKey().c_str();
+	const char *uid = ec->getUniqueId().c_str();
+	string urlEncoded, binary;
+	double urlEncodeNs = benchNsPerOp(iterations, [&]() {urlEncoded = ec->serializeAsUrlEncodedParams();});
+	double urlParseNs = benchNsPerOp(iterations, [&]() {
+		Record final(SipUri{});
+		final.updateFromUrlEncodedParams(key, uid, urlEncoded.c_str(), nullptr);
+	});
+	double binaryEncodeNs = benchNsPerOp(iterations, [&]() {RecordSerializerBinary::serializeContact(*ec, binary);});
+	double binaryParseNs = benchNsPerOp(iterations, [&]() {
+		Record final(SipUri{});
+		RecordSerializerBinary::parseContact(binary.data(), binary.size(), key, uid, &final, nullptr);
+	});
+	cout << "url-encoded contact: " << urlEncoded.size() << " bytes, serialize " << urlEncodeNs << " ns, parse "
+		<< urlParseNs << " ns" << endl;
+	cout << "binary contact: " << binary.size() << " bytes, serialize " << binaryEncodeNs << " ns, parse "
+		<< binaryParseNs << " ns" << endl;
+	return 0;
+}
+
 SofiaHome home;
 
 int main(int argc, char **argv) {
-	if (argc != 2) {
-		cerr << "bad usage" << endl;
+	int benchIterations = 0;
+	if (argc == 4 && strcmp(argv[2], "--bench") == 0) {
+		benchIterations = atoi(argv[3]);
+	} else if (argc != 2) {
+		cerr << "bad usage: " << argv[0] << " <serializer> [--bench <iterations>]" << endl;
 		exit(-1);
 	}
 	init_tests();
@@ -145,6 +199,12 @@ int main(int argc, char **argv) {
 	sip_path_t *sip_path = path_fromstl(home.h, paths);
 	sip_accept_t *accept = NULL;
 
+	if (benchIterations > 0) {
+		// Debug logs would dominate the measure.
+		LogManager::get().setLogLevel(BCTBX_LOG_ERROR);
+		return bench(serializer, benchIterations, 5, now);
+	}
+
 	if (test_bind_with_ecc(ecc, serializer, contact, expireat, quality, cseq, now, alias, accept)) {
 		BAD("failure in bind with ecc");
 	}
@@ -0,0 +1,186 @@
+/*
+	Flexisip, a flexible SIP proxy server with media capabilities.
+	Copyright (C) 2010-2015  Belledonne Communications SARL, All rights reserved.
+
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU Affero General Public License as
+	published by the Free Software Foundation, either version 3 of the
+	License, or (at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU Affero General Public License for more details.
+
+	You should have received a copy of the GNU Affero General Public License
+	along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/*
+ * Compares the transaction properties stored in maps by name, as they were before PropertyKey, with the properties
+ * accessed through keys. The properties are the ones of a forked INVITE going through the registrar, the media relay
+ * and the push notification modules. Usage: flexisip_transaction_property_benchmark [number of transactions,
+ * 1000000 by default]
+ */
+
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <typeinfo>
+#include <unordered_map>
+#include <vector>
+
+#include <flexisip/transaction.hh>
+
+using namespace std;
+using namespace flexisip;
+
+namespace {
+
+struct ForkContextValue {int value = 1;};
+struct BranchInfoValue {int value = 2;};
+struct RelayedCallValue {int value = 3;};
+struct PushContextValue {int value = 4;};
+struct ResponseContextValue {int value = 5;};
+
+size_t sSink = 0; // Keeps the compiler from dropping the measured work.
+
+template <typename Function> double nsPerOperation(size_t count, Function f) {
+	auto start = chrono::steady_clock::now();
+	f();
+	chrono::duration<double, nano> elapsed = chrono::steady_clock::now() - start;
+	return elapsed.count() / count;
+}
+
+void report(const char *name, double before, double after) {
+	cout << name << ": " << before << " ns with names, " << after << " ns with keys" << endl;
+}
+
+// Same storage as the one of Transaction before PropertyKey.
+class NamedProperties {
+public:
+	template <typename T> void setProperty(const string &name, const shared_ptr<T> &value) {
+		mWeakProperties.erase(name);
+		mProperties[name] = Property{value, typeid(T).name()};
+	}
+	template <typename T> void setProperty(const string &name, const weak_ptr<T> &value) {
+		mProperties.erase(name);
+		mWeakProperties[name] = WProperty{value, typeid(T).name()};
+	}
+	template <typename T> shared_ptr<T> getProperty(const string &name) const {
+		Property prop;
+		auto it = mProperties.find(name);
+		if (it != mProperties.cend()) {
+			prop = it->second;
+		} else {
+			auto wit = mWeakProperties.find(name);
+			if (wit != mWeakProperties.cend()) prop = Property{wit->second.value.lock(), wit->second.type};
+		}
+		if (prop.value == nullptr) return nullptr;
+		if (strcmp(prop.type, typeid(T).name()) != 0) throw bad_cast{};
+		return static_pointer_cast<T>(prop.value);
+	}
+
+private:
+	struct Property {
+		shared_ptr<void> value{};
+		const char *type{nullptr};
+	};
+	struct WProperty {
+		weak_ptr<void> value{};
+		const char *type{nullptr};
+	};
+
+	unordered_map<string, Property> mProperties;
+	unordered_map<string, WProperty> mWeakProperties;
+};
+
+const Transaction::PropertyKey<ForkContextValue> sForkContextKey{"ForkContext"};
+const Transaction::PropertyKey<BranchInfoValue> sBranchInfoKey{"BranchInfo"};
+const Transaction::PropertyKey<RelayedCallValue> sRelayedCallKey{"MediaRelay"};
+const Transaction::PropertyKey<PushContextValue> sPushContextKey{"PushNotification"};
+const Transaction::PropertyKey<ResponseContextValue> sResponseContextKey{"Registrar"};
+
+struct Values {
+	shared_ptr<ForkContextValue> forkContext = make_shared<ForkContextValue>();
+	shared_ptr<BranchInfoValue> branchInfo = make_shared<BranchInfoValue>();
+	shared_ptr<RelayedCallValue> relayedCall = make_shared<RelayedCallValue>();
+	shared_ptr<PushContextValue> pushContext = make_shared<PushContextValue>();
+	shared_ptr<ResponseContextValue> responseContext = make_shared<ResponseContextValue>();
+};
+
+void setNamed(NamedProperties &tr, const Values &v) {
+	tr.setProperty("ForkContext", v.forkContext);
+	tr.setProperty("BranchInfo", weak_ptr<BranchInfoValue>{v.branchInfo});
+	tr.setProperty("MediaRelay", v.relayedCall);
+	tr.setProperty("PushNotification", weak_ptr<PushContextValue>{v.pushContext});
+	tr.setProperty("Registrar", v.responseContext);
+}
+
+void setKeyed(Transaction &tr, const Values &v) {
+	tr.setProperty(sForkContextKey, v.forkContext);
+	tr.setProperty(sBranchInfoKey, weak_ptr<BranchInfoValue>{v.branchInfo});
+	tr.setProperty(sRelayedCallKey, v.relayedCall);
+	tr.setProperty(sPushContextKey, weak_ptr<PushContextValue>{v.pushContext});
+	tr.setProperty(sResponseContextKey, v.responseContext);
+}
+
+// Properties read by the modules for each response.
+size_t readNamed(const NamedProperties &tr) {
+	return tr.getProperty<ForkContextValue>("ForkContext")->value + tr.getProperty<BranchInfoValue>("BranchInfo")->value
+		+ tr.getProperty<RelayedCallValue>("MediaRelay")->value
+		+ tr.getProperty<PushContextValue>("PushNotification")->value
+		+ tr.getProperty<ResponseContextValue>("Registrar")->value;
+}
+
+size_t readKeyed(const Transaction &tr) {
+	return tr.getProperty(sForkContextKey)->value + tr.getProperty(sBranchInfoKey)->value
+		+ tr.getProperty(sRelayedCallKey)->value + tr.getProperty(sPushContextKey)->value
+		+ tr.getProperty(sResponseContextKey)->value;
+}
+
+} // namespace
+
+int main(int argc, char *argv[]) {
+	size_t count = argc > 1 ? strtoul(argv[1], nullptr, 10) : 1000000;
+	if (count == 0) {
+		cerr << "Usage: " << argv[0] << " [number of transactions]" << endl;
+		return EXIT_FAILURE;
+	}
+	Values values;
+
+	double before = nsPerOperation(count, [&]() {
+		for (size_t i = 0; i < count; ++i) {
+			NamedProperties tr;
+			setNamed(tr, values);
+			sSink += readNamed(tr);
+		}
+	});
+	double after = nsPerOperation(count, [&]() {
+		for (size_t i = 0; i < count; ++i) {
+			Transaction tr(nullptr);
+			setKeyed(tr, values);
+			sSink += readKeyed(tr);
+		}
+	});
+	report("transaction creation with its properties", before, after);
+
+	NamedProperties named;
+	Transaction keyed(nullptr);
+	setNamed(named, values);
+	setKeyed(keyed, values);
+	before = nsPerOperation(count, [&]() {
+		for (size_t i = 0; i < count; ++i) sSink += readNamed(named);
+	});
+	after = nsPerOperation(count, [&]() {
+		for (size_t i = 0; i < count; ++i) sSink += readKeyed(keyed);
+	});
+	report("property reads per response", before, after);
+
+	cout << "checksum: " << sSink << endl;
+	return EXIT_SUCCESS;
+}
@@ -29,6 +29,25 @@ using namespace std;
 
 namespace flexisip {
 
+constexpr int Transaction::sPropertySlotCount;
+
+int Transaction::getPropertySlot(const std::string &name, bool create) noexcept {
+	// Only accessed from the main thread, like the transactions themselves.
+	static unordered_map<string, int> slots{};
+
+	auto it = slots.find(name);
+	if (it != slots.cend()) return it->second;
+	if (!create) return -1;
+	if (slots.size() >= sPropertySlotCount) {
+		LOGW("No transaction property slot left for '%s', it will be stored by name", name.c_str());
+		slots.emplace(name, -1);
+		return -1;
+	}
+	int slot = static_cast<int>(slots.size());
+	slots.emplace(name, slot);
+	return slot;
+}
+
 Transaction::Property Transaction::_getProperty(const std::string &name) const noexcept {
 	auto it = mProperties.find(name);
 	if (it != mProperties.cend()) {
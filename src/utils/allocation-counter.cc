@@ -0,0 +1,100 @@
+/*
+	Flexisip, a flexible SIP proxy server with media capabilities.
+	Copyright (C) 2010-2020  Belledonne Communications SARL, All rights reserved.
+
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU Affero General Public License as
+	published by the Free Software Foundation, either version 3 of the
+	License, or (at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU Affero General Public License for more details.
+
+	You should have received a copy of the GNU Affero General Public License
+	along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <cstdlib>
+#include <new>
+
+#include "flexisip-config.h"
+
+#include "allocation-counter.hh"
+
+#ifdef HAVE_ALLOCATION_COUNTER
+
+// Trivial type, so that it is usable from operator new without any thread_local initialization.
+static thread_local uint64_t sAllocationCount = 0;
+
+static void *countedAllocate(std::size_t size) noexcept {
+	sAllocationCount++;
+	return std::malloc(size ? size : 1);
+}
+
+void *operator new(std::size_t size) {
+	void *p = countedAllocate(size);
+	if (p == nullptr) throw std::bad_alloc{};
+	return p;
+}
+
+void *operator new[](std::size_t size) {
+	void *p = countedAllocate(size);
+	if (p == nullptr) throw std::bad_alloc{};
+	return p;
+}
+
+void *operator new(std::size_t size, const std::nothrow_t &) noexcept {
+	return countedAllocate(size);
+}
+
+void *operator new[](std::size_t size, const std::nothrow_t &) noexcept {
+	return countedAllocate(size);
+}
+
+void operator delete(void *p) noexcept {
+	std::free(p);
+}
+
+void operator delete[](void *p) noexcept {
+	std::free(p);
+}
+
+void operator delete(void *p, std::size_t) noexcept {
+	std::free(p);
+}
+
+void operator delete[](void *p, std::size_t) noexcept {
+	std::free(p);
+}
+
+void operator delete(void *p, const std::nothrow_t &) noexcept {
+	std::free(p);
+}
+
+void operator delete[](void *p, const std::nothrow_t &) noexcept {
+	std::free(p);
+}
+
+#endif
+
+namespace flexisip {
+
+bool AllocationCounter::isEnabled() noexcept {
+#ifdef HAVE_ALLOCATION_COUNTER
+	return true;
+#else
+	return false;
+#endif
+}
+
+uint64_t AllocationCounter::get() noexcept {
+#ifdef HAVE_ALLOCATION_COUNTER
+	return sAllocationCount;
+#else
+	return 0;
+#endif
+}
+
+} // namespace flexisip
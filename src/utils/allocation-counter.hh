@@ -0,0 +1,36 @@
+/*
+	Flexisip, a flexible SIP proxy server with media capabilities.
+	Copyright (C) 2010-2020  Belledonne Communications SARL, All rights reserved.
+
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU Affero General Public License as
+	published by the Free Software Foundation, either version 3 of the
+	License, or (at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU Affero General Public License for more details.
+
+	You should have received a copy of the GNU Affero General Public License
+	along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include <cstdint>
+
+namespace flexisip {
+
+/**
+ * Counts the allocations made through operator new, whatever malloc implementation is underneath.
+ * Only available when built with ENABLE_ALLOCATION_COUNTER, since it replaces the global operator new.
+ */
+class AllocationCounter {
+public:
+	static bool isEnabled() noexcept;
+	/* Number of allocations made by the calling thread so far. */
+	static uint64_t get() noexcept;
+};
+
+} // namespace flexisip
@@ -27,14 +27,66 @@ using namespace std;
 
 namespace flexisip {
 
+void DigestValue::toHex(char *out) const {
+	static const char digits[] = "0123456789abcdef";
+	for (size_t i = 0; i < mSize; i++) {
+		*out++ = digits[mBytes[i] >> 4];
+		*out++ = digits[mBytes[i] & 0x0f];
+	}
+	*out = '\0';
+}
+
+std::string DigestValue::toHex() const {
+	char hex[2 * sMaxSize + 1];
+	toHex(hex);
+	return string(hex, 2 * mSize);
+}
+
+static int hexDigitValue(char c) {
+	if (c >= '0' && c <= '9') return c - '0';
+	if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+	if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+	return -1;
+}
+
+bool DigestValue::fromHex(const char *hex, size_t len) {
+	if (len % 2 != 0 || len / 2 > sMaxSize) return false;
+	for (size_t i = 0; i < len / 2; i++) {
+		int high = hexDigitValue(hex[2 * i]);
+		int low = hexDigitValue(hex[2 * i + 1]);
+		if (high < 0 || low < 0) return false;
+		mBytes[i] = static_cast<uint8_t>((high << 4) | low);
+	}
+	mSize = len / 2;
+	return true;
+}
+
+bool DigestValue::operator==(const DigestValue &other) const {
+	if (mSize != other.mSize) return false;
+	uint8_t diff = 0;
+	for (size_t i = 0; i < mSize; i++) diff |= mBytes[i] ^ other.mBytes[i];
+	return diff == 0;
+}
+
 template <>
 std::vector<uint8_t> Digest::compute<std::vector<uint8_t>>(const void *data, size_t size) {
-	return computeBinaryDigest(data, size);
+	DigestValue value;
+	compute(data, size, value);
+	return vector<uint8_t>(value.data(), value.data() + value.size());
 }
 
 template <>
 std::string Digest::compute<std::string>(const void *data, size_t size) {
-	return computePrintableDigest(data, size);
+	DigestValue value;
+	compute(data, size, value);
+	return value.toHex();
+}
+
+template <>
+DigestValue Digest::compute<DigestValue>(const void *data, size_t size) {
+	DigestValue value;
+	compute(data, size, value);
+	return value;
 }
 
 Digest *Digest::create(const std::string &algo) {
@@ -43,31 +95,15 @@ Digest *Digest::create(const std::string &algo) {
 	else throw invalid_argument("unknown digest implementation: '" + algo + "'");
 }
 
-std::string Digest::toHexString(const std::vector<uint8_t> &data) {
-	char formatedByte[3];
-	string res;
-
-	res.reserve(data.size() * 2);
-	for (const uint8_t &byte : data) {
-		snprintf(formatedByte, sizeof(formatedByte), "%02hhx", byte);
-		res += formatedByte;
-	}
-	return res;
-}
-
-std::vector<uint8_t> Md5::computeBinaryDigest(const void *data, size_t size) {
-	vector<uint8_t> res(16);
-	bctbx_md5(static_cast<const uint8_t *>(data), size, res.data());
-	return res;
+void Md5::computeBinaryDigest(const void *data, size_t size, uint8_t *out) {
+	bctbx_md5(static_cast<const uint8_t *>(data), size, out);
 }
 
 const std::string Md5::sName = "MD5";
 
 
-std::vector<uint8_t> Sha256::computeBinaryDigest(const void *data, size_t size) {
-	vector<uint8_t> hash(32);
-	bctbx_sha256(static_cast<const uint8_t *>(data), size, hash.size(), hash.data());
-	return hash;
+void Sha256::computeBinaryDigest(const void *data, size_t size, uint8_t *out) {
+	bctbx_sha256(static_cast<const uint8_t *>(data), size, 32, out);
 }
 
 const std::string Sha256::sName = "SHA256";
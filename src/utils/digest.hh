@@ -18,6 +18,7 @@
 
 #pragma once
 
+#include <array>
 #include <cstdint>
 #include <cstring>
 #include <string>
@@ -25,11 +26,41 @@
 
 namespace flexisip {
 
+/*
+ * Binary value of a digest. The bytes are stored inline, large enough for any supported algorithm,
+ * so that computing, comparing or printing a digest never allocates.
+ */
+class DigestValue {
+public:
+	static constexpr size_t sMaxSize = 32;
+
+	const uint8_t *data() const {return mBytes.data();}
+	uint8_t *data() {return mBytes.data();}
+	size_t size() const {return mSize;}
+	void resize(size_t size) {mSize = size <= sMaxSize ? size : sMaxSize;}
+
+	/* Writes the lowercase hexadecimal form followed by a null character. 'out' must hold 2 * size() + 1 chars. */
+	void toHex(char *out) const;
+	std::string toHex() const;
+	/* Sets the value from its hexadecimal form, in any case. Returns false if 'hex' isn't a valid digest. */
+	bool fromHex(const char *hex, size_t len);
+
+	/* Comparison in constant time, to be used for credentials verification. */
+	bool operator==(const DigestValue &other) const;
+	bool operator!=(const DigestValue &other) const {return !(*this == other);}
+
+private:
+	std::array<uint8_t, sMaxSize> mBytes{};
+	size_t mSize{0};
+};
+
 class Digest {
 public:
 	virtual ~Digest() = default;
 
 	virtual const std::string &name() const = 0;
+	/* Size of the binary digest, in bytes. */
+	virtual size_t size() const = 0;
 
 	template <class ResultT, class DataT>
 	ResultT compute(const DataT &data) {
@@ -44,29 +75,35 @@ public:
 	template <class ResultT>
 	ResultT compute(const void *data, size_t size);
 
+	void compute(const void *data, size_t size, DigestValue &result) {
+		result.resize(this->size());
+		computeBinaryDigest(data, size, result.data());
+	}
+
 	static Digest *create(const std::string &algo);
 
 private:
-	virtual std::vector<uint8_t> computeBinaryDigest(const void *data, size_t size) = 0;
-	std::string computePrintableDigest(const void *data, size_t size) {
-		return toHexString(computeBinaryDigest(data, size));
-	}
-
-	static std::string toHexString(const std::vector<uint8_t> &data);
+	virtual void computeBinaryDigest(const void *data, size_t size, uint8_t *out) = 0;
 };
 
 class Md5 : public Digest {
-private:
+public:
 	const std::string &name() const override {return sName;}
-	std::vector<uint8_t> computeBinaryDigest(const void *data, size_t size) override;
+	size_t size() const override {return 16;}
+
+private:
+	void computeBinaryDigest(const void *data, size_t size, uint8_t *out) override;
 
 	static const std::string sName;
 };
 
 class Sha256 : public Digest {
-private:
+public:
 	const std::string &name() const override {return sName;}
-	std::vector<uint8_t> computeBinaryDigest(const void *data, size_t size) override;
+	size_t size() const override {return 32;}
+
+private:
+	void computeBinaryDigest(const void *data, size_t size, uint8_t *out) override;
 
 	static const std::string sName;
 };
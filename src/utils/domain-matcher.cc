@@ -0,0 +1,130 @@
+/*
+	Flexisip, a flexible SIP proxy server with media capabilities.
+	Copyright (C) 2010-2020  Belledonne Communications SARL, All rights reserved.
+
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU Affero General Public License as
+	published by the Free Software Foundation, either version 3 of the
+	License, or (at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU Affero General Public License for more details.
+
+	You should have received a copy of the GNU Affero General Public License
+	along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <arpa/inet.h>
+#include <cctype>
+#include <cstring>
+#include <strings.h>
+
+#include "flexisip/utils/domain-matcher.hh"
+
+using namespace std;
+
+namespace flexisip {
+
+namespace {
+
+// FNV-1a, optionally case-insensitive.
+size_t hashBytes(const void *data, size_t len, bool ignoreCase) {
+	const auto *bytes = static_cast<const unsigned char *>(data);
+	uint64_t hash = 14695981039346656037ULL;
+	for (size_t i = 0; i < len; i++) {
+		hash ^= ignoreCase ? static_cast<unsigned char>(tolower(bytes[i])) : bytes[i];
+		hash *= 1099511628211ULL;
+	}
+	return static_cast<size_t>(hash);
+}
+
+} // namespace
+
+DomainMatcher::DomainMatcher(const list<string> &domains) {
+	for (const auto &domain : domains) {
+		if (domain.empty()) continue;
+		if (domain[0] == '*') {
+			mMatchAll = true;
+			continue;
+		}
+		auto wildcardPosition = domain.find('*');
+		if (wildcardPosition != string::npos) {
+			mWildcards.emplace_back(domain.substr(0, wildcardPosition), domain.substr(wildcardPosition + 1));
+		}
+		mDomains.emplace(hashBytes(domain.data(), domain.size(), false), domain);
+	}
+}
+
+bool DomainMatcher::match(const char *item) const {
+	if (mMatchAll) return true;
+
+	size_t len = strlen(item);
+	auto range = mDomains.equal_range(hashBytes(item, len, false));
+	for (auto it = range.first; it != range.second; ++it) {
+		if (it->second.size() == len && memcmp(it->second.data(), item, len) == 0) return true;
+	}
+	for (const auto &wildcard : mWildcards) {
+		if (strstr(item, wildcard.first.c_str()) && strstr(item, wildcard.second.c_str())) return true;
+	}
+	return false;
+}
+
+bool HostMatcher::makeKey(const char *host, Key &key) {
+	size_t len = strlen(host);
+	if (len > 0 && host[len - 1] == '.') len--;
+	if (len >= 2 && host[0] == '[' && host[len - 1] == ']') {
+		host++;
+		len -= 2;
+	}
+	key.host = host;
+	key.len = len;
+	key.isIpv6 = memchr(host, ':', len) != nullptr;
+	if (key.isIpv6) {
+		/* Since there exist multiple text representations of IPv6 addresses, they are compared in binary form. */
+		char ip[INET6_ADDRSTRLEN + 1];
+		if (len >= sizeof(ip)) return false;
+		memcpy(ip, host, len);
+		ip[len] = '\0';
+		if (inet_pton(AF_INET6, ip, &key.ipv6) != 1) return false;
+		key.hash = hashBytes(&key.ipv6, sizeof(key.ipv6), false);
+	} else {
+		key.hash = hashBytes(host, len, true);
+	}
+	return true;
+}
+
+bool HostMatcher::matches(const Entry &entry, const Key &key, const char *port) {
+	if (!entry.port.empty() && (port == nullptr || entry.port != port)) return false;
+	if (key.isIpv6) return entry.host.empty() && memcmp(&entry.ipv6, &key.ipv6, sizeof(key.ipv6)) == 0;
+	return entry.host.size() == key.len && strncasecmp(entry.host.data(), key.host, key.len) == 0;
+}
+
+void HostMatcher::add(const char *host, const char *port) {
+	Key key;
+	if (!makeKey(host, key)) return;
+
+	Entry entry{};
+	if (!key.isIpv6) {
+		entry.host.assign(key.host, key.len);
+		for (auto &c : entry.host) c = static_cast<char>(tolower(static_cast<unsigned char>(c)));
+	} else {
+		entry.ipv6 = key.ipv6;
+	}
+	if (port) entry.port = port;
+	mHosts.emplace(key.hash, move(entry));
+}
+
+bool HostMatcher::match(const char *host, const char *port) const {
+	Key key;
+	if (!makeKey(host, key)) return false;
+
+	auto range = mHosts.equal_range(key.hash);
+	for (auto it = range.first; it != range.second; ++it) {
+		if (matches(it->second, key, port)) return true;
+	}
+	return false;
+}
+
+} // namespace flexisip
@@ -0,0 +1,137 @@
+/*
+	Flexisip, a flexible SIP proxy server with media capabilities.
+	Copyright (C) 2010-2020  Belledonne Communications SARL, All rights reserved.
+
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU Affero General Public License as
+	published by the Free Software Foundation, either version 3 of the
+	License, or (at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU Affero General Public License for more details.
+
+	You should have received a copy of the GNU Affero General Public License
+	along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <arpa/inet.h>
+#include <cstring>
+#include <netdb.h>
+
+#include <flexisip/common.hh>
+#include <flexisip/utils/network-table.hh>
+
+using namespace std;
+
+namespace flexisip {
+
+namespace {
+
+inline bool bitAt(const uint8_t *bytes, unsigned i) {
+	return (bytes[i / 8] >> (7 - i % 8)) & 1;
+}
+
+} // namespace
+
+NetworkTable::NetworkTable() {
+	clear();
+}
+
+int32_t NetworkTable::newNode() {
+	mNodes.emplace_back();
+	return static_cast<int32_t>(mNodes.size() - 1);
+}
+
+void NetworkTable::clear() {
+	mNodes.clear();
+	mEntries.clear();
+	mRootV4 = newNode();
+	mRootV6 = newNode();
+}
+
+bool NetworkTable::add(const struct sockaddr *addr, const struct sockaddr *netmask) {
+	const uint8_t *address, *mask;
+	unsigned maxBits;
+	socklen_t addrLen;
+
+	if (addr->sa_family == AF_INET) {
+		address = reinterpret_cast<const uint8_t *>(&reinterpret_cast<const struct sockaddr_in *>(addr)->sin_addr);
+		mask = reinterpret_cast<const uint8_t *>(&reinterpret_cast<const struct sockaddr_in *>(netmask)->sin_addr);
+		maxBits = 32;
+		addrLen = sizeof(struct sockaddr_in);
+	} else if (addr->sa_family == AF_INET6) {
+		address = reinterpret_cast<const struct sockaddr_in6 *>(addr)->sin6_addr.s6_addr;
+		mask = reinterpret_cast<const struct sockaddr_in6 *>(netmask)->sin6_addr.s6_addr;
+		maxBits = 128;
+		addrLen = sizeof(struct sockaddr_in6);
+	} else {
+		return false;
+	}
+
+	char ipAddress[NI_MAXHOST];
+	int err = getnameinfo(addr, addrLen, ipAddress, sizeof(ipAddress), nullptr, 0, NI_NUMERICHOST);
+	if (err != 0) {
+		LOGE("getnameinfo error: %s", gai_strerror(err));
+		return false;
+	}
+
+	// Netmasks are contiguous: the prefix ends at the first bit unset.
+	unsigned prefixLen = 0;
+	while (prefixLen < maxBits && bitAt(mask, prefixLen)) prefixLen++;
+
+	int32_t node = root(addr->sa_family);
+	for (unsigned i = 0; i < prefixLen; ++i) {
+		int bit = bitAt(address, i);
+		if (mNodes[node].children[bit] < 0) {
+			int32_t child = newNode(); // may reallocate mNodes
+			mNodes[node].children[bit] = child;
+		}
+		node = mNodes[node].children[bit];
+	}
+	// When several interfaces share a network, the last one added wins.
+	if (mNodes[node].entry < 0) {
+		mNodes[node].entry = static_cast<int32_t>(mEntries.size());
+		mEntries.emplace_back(ipAddress);
+	} else {
+		mEntries[mNodes[node].entry] = ipAddress;
+	}
+	return true;
+}
+
+const string *NetworkTable::lookup(int family, const void *addr) const {
+	if (family != AF_INET && family != AF_INET6) return nullptr;
+
+	const uint8_t *address = static_cast<const uint8_t *>(addr);
+	unsigned maxBits = (family == AF_INET) ? 32 : 128;
+	int32_t node = (family == AF_INET) ? mRootV4 : mRootV6;
+	int32_t entry = mNodes[node].entry;
+	for (unsigned i = 0; i < maxBits; ++i) {
+		node = mNodes[node].children[bitAt(address, i)];
+		if (node < 0) break;
+		if (mNodes[node].entry >= 0) entry = mNodes[node].entry;
+	}
+	return entry >= 0 ? &mEntries[entry] : nullptr;
+}
+
+bool NetworkTable::parseAddress(const char *host, int &family, void *addr) {
+	if (strchr(host, ':') == nullptr) {
+		family = AF_INET;
+		return inet_pton(AF_INET, host, addr) == 1;
+	}
+
+	char buffer[INET6_ADDRSTRLEN];
+	size_t len = strlen(host);
+	if (host[0] == '[' && len >= 2 && host[len - 1] == ']') {
+		host++;
+		len -= 2;
+	}
+	if (len >= sizeof(buffer)) return false;
+	memcpy(buffer, host, len);
+	buffer[len] = '\0';
+	family = AF_INET6;
+	return inet_pton(AF_INET6, buffer, addr) == 1;
+}
+
+} // namespace flexisip
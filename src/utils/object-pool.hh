@@ -0,0 +1,124 @@
+/*
+	Flexisip, a flexible SIP proxy server with media capabilities.
+	Copyright (C) 2010-2020  Belledonne Communications SARL, All rights reserved.
+
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU Affero General Public License as
+	published by the Free Software Foundation, either version 3 of the
+	License, or (at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU Affero General Public License for more details.
+
+	You should have received a copy of the GNU Affero General Public License
+	along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include <cstddef>
+#include <memory>
+#include <new>
+#include <utility>
+
+namespace flexisip {
+
+/**
+ * Per thread list of the freed memory blocks of a given size, kept to be reused by the next allocations
+ * of the same size instead of going back to the system allocator.
+ */
+template <std::size_t Size, std::size_t Align> class BlockFreeList {
+public:
+	static constexpr std::size_t sMaxBlocks = 1024;
+
+	static void *pop() noexcept {
+		auto &list = get();
+		Node *node = list.head;
+		if (node == nullptr) return nullptr;
+		list.head = node->next;
+		list.count--;
+		return node;
+	}
+
+	/* Returns false if the block wasn't taken, the caller must then release it. */
+	static bool push(void *block) noexcept {
+		auto &list = get();
+		if (list.released || list.count >= sMaxBlocks) return false;
+		list.head = new (block) Node{list.head};
+		list.count++;
+		return true;
+	}
+
+private:
+	static_assert(Size >= sizeof(void *), "block too small to be linked in the free list");
+
+	struct Node {
+		Node *next;
+	};
+	struct List {
+		~List() {
+			while (head) {
+				Node *node = head;
+				head = node->next;
+				::operator delete(node);
+			}
+			released = true;
+		}
+
+		Node *head = nullptr;
+		std::size_t count = 0;
+		bool released = false; // blocks freed during the thread exit are not cached anymore
+	};
+
+	static List &get() noexcept {
+		static thread_local List list{};
+		return list;
+	}
+};
+
+/**
+ * Allocator recycling single object allocations through a BlockFreeList.
+ * Meant to be used with std::allocate_shared() for the objects created for each processed message:
+ * the object and its control block are allocated as one block that is reused once released.
+ */
+template <typename T> class PoolAllocator {
+public:
+	using value_type = T;
+
+	PoolAllocator() noexcept = default;
+	template <typename U> PoolAllocator(const PoolAllocator<U> &) noexcept {}
+
+	T *allocate(std::size_t n) {
+		if (n == 1) {
+			void *block = FreeList::pop();
+			if (block) return static_cast<T *>(block);
+		}
+		return static_cast<T *>(::operator new(n * sizeof(T)));
+	}
+
+	void deallocate(T *p, std::size_t n) noexcept {
+		if (n == 1 && FreeList::push(p)) return;
+		::operator delete(p);
+	}
+
+private:
+	using FreeList = BlockFreeList<(sizeof(T) < sizeof(void *) ? sizeof(void *) : sizeof(T)), alignof(T)>;
+};
+
+template <typename T, typename U> bool operator==(const PoolAllocator<T> &, const PoolAllocator<U> &) noexcept {
+	return true;
+}
+template <typename T, typename U> bool operator!=(const PoolAllocator<T> &, const PoolAllocator<U> &) noexcept {
+	return false;
+}
+
+/**
+ * Same as std::make_shared(), the memory being taken from the pool of blocks of that size.
+ */
+template <typename T, typename... Args> std::shared_ptr<T> makePooledShared(Args &&... args) {
+	return std::allocate_shared<T>(PoolAllocator<T>{}, std::forward<Args>(args)...);
+}
+
+} // namespace flexisip
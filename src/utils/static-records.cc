@@ -0,0 +1,152 @@
+/*
+	Flexisip, a flexible SIP proxy server with media capabilities.
+	Copyright (C) 2010-2020  Belledonne Communications SARL, All rights reserved.
+
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU Affero General Public License as
+	published by the Free Software Foundation, either version 3 of the
+	License, or (at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU Affero General Public License for more details.
+
+	You should have received a copy of the GNU Affero General Public License
+	along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <algorithm>
+#include <cctype>
+#include <cstring>
+#include <iterator>
+#include <sstream>
+#include <stdexcept>
+
+#include <sofia-sip/sip_header.h>
+
+#include "flexisip/logmanager.hh"
+#include "flexisip/sofia-wrapper/home.hh"
+#include "flexisip/utils/sip-uri.hh"
+#include "flexisip/utils/static-records.hh"
+
+using namespace std;
+
+namespace flexisip {
+
+constexpr int StaticRecords::sRefreshRounds;
+
+namespace {
+
+uint64_t hashLine(const char *begin, const char *end) {
+	// FNV-1a, computed on the mapped bytes to avoid copying every line of the file.
+	uint64_t hash = 14695981039346656037ULL;
+	for (const char *c = begin; c != end; ++c) {
+		hash ^= static_cast<unsigned char>(*c);
+		hash *= 1099511628211ULL;
+	}
+	return hash;
+}
+
+} // namespace
+
+void StaticRecords::parse(const string &line, Record &record) {
+	sofiasip::Home home;
+
+	auto separator = line.find_first_of(" \t");
+	if (separator == string::npos) throw runtime_error("invalid line syntax");
+	string from = line.substr(0, separator);
+	string contactHeader = line.substr(line.find_first_not_of(" \t", separator));
+
+	sip_contact_t *url = sip_contact_make(home.home(), from.c_str());
+	sip_contact_t *contact = sip_contact_make(home.home(), contactHeader.c_str());
+	if (!url || !contact) {
+		throw runtime_error("one URI is invlaid");
+	}
+
+	try {
+		record.from = SipUri(url->m_url).str();
+	} catch (const sofiasip::InvalidUrlError &e) {
+		ostringstream os;
+		os << "'" << e.getUrl() << "' isn't a valid SIP-URI: " << e.getReason();
+		throw runtime_error(os.str());
+	}
+	for (; contact; contact = contact->m_next) {
+		sip_contact_t *sipContact = sip_contact_dup(home.home(), contact);
+		sipContact->m_next = nullptr;
+		record.contacts.emplace_back(sip_header_as_string(home.home(), reinterpret_cast<sip_header_t *>(sipContact)));
+	}
+}
+
+void StaticRecords::queueBindings(deque<Binding> &queue, const Record &record, int expire, uint32_t cseq) {
+	for (const auto &contact : record.contacts) {
+		queue.push_back(Binding{record.from, contact, expire, cseq});
+	}
+}
+
+StaticRecords::LoadStats StaticRecords::load(const char *data, size_t size, int expire, uint32_t cseq,
+	deque<Binding> &bindings, const string &fileName) {
+	LoadStats stats;
+	unsigned refreshRound = mLoads++ % sRefreshRounds;
+	unordered_map<uint64_t, Record> records;
+	records.reserve(mRecords.size());
+	deque<Binding> added;
+	int linenum = 0;
+
+	const char *end = data + size;
+	for (const char *lineBegin = data; lineBegin < end;) {
+		const char *lineEnd = static_cast<const char *>(memchr(lineBegin, '\n', end - lineBegin));
+		if (lineEnd == nullptr) lineEnd = end;
+		const char *first = lineBegin;
+		const char *last = lineEnd;
+		lineBegin = lineEnd + 1;
+		++linenum;
+
+		while (first != last && isspace(static_cast<unsigned char>(*first))) ++first;
+		while (last != first && isspace(static_cast<unsigned char>(*(last - 1)))) --last;
+		if (first == last || *first == '#') continue;
+
+		uint64_t hash = hashLine(first, last);
+		if (records.find(hash) != records.end()) continue; // duplicated line
+
+		auto previous = mRecords.find(hash);
+		if (previous != mRecords.end()) {
+			if (hash % sRefreshRounds == refreshRound) {
+				queueBindings(added, previous->second, expire, cseq);
+				stats.refreshed++;
+			}
+			records.emplace(hash, move(previous->second));
+			mRecords.erase(previous);
+			continue;
+		}
+
+		string line(first, last);
+		Record record;
+		try {
+			parse(line, record);
+		} catch (const runtime_error &e) {
+			SLOGW << "error while reading the static record file [" << fileName << ":" << linenum << endl
+				<< "\t`" << line << "`: " << e.what();
+		}
+		// Invalid lines are remembered too, so that they are reported only once.
+		queueBindings(added, record, expire, cseq);
+		records.emplace(hash, move(record));
+		stats.added++;
+	}
+
+	// The lines left are the ones that have been removed or changed.
+	stats.removed = mRecords.size();
+	for (const auto &record : mRecords) {
+		queueBindings(bindings, record.second, 0, cseq);
+	}
+	move(added.begin(), added.end(), back_inserter(bindings));
+	mRecords = move(records);
+	return stats;
+}
+
+void StaticRecords::clear() {
+	mRecords.clear();
+	mLoads = 0;
+}
+
+}
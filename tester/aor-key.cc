@@ -0,0 +1,108 @@
+/*
+ * Copyright (C) 2020  Belledonne Communications SARL
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#include <cstring>
+#include <map>
+#include <unordered_map>
+
+#include "flexisip/utils/aor-key.hh"
+
+#include "tester.hh"
+
+using namespace flexisip;
+using namespace std;
+
+static void empty_key(void) {
+	AorKey key;
+	BC_ASSERT_TRUE(key.empty());
+	BC_ASSERT_EQUAL(key.size(), 0, size_t, "%zu");
+	BC_ASSERT_STRING_EQUAL(key.c_str(), "");
+	BC_ASSERT_TRUE(key == AorKey(""));
+	BC_ASSERT_EQUAL(key.hash(), AorKey("").hash(), size_t, "%zu");
+}
+
+static void value_and_hash(void) {
+	AorKey key("alice@sip.example.org");
+	BC_ASSERT_FALSE(key.empty());
+	BC_ASSERT_STRING_EQUAL(key.c_str(), "alice@sip.example.org");
+	BC_ASSERT_EQUAL(key.size(), strlen("alice@sip.example.org"), size_t, "%zu");
+	BC_ASSERT_EQUAL(key.hash(), std::hash<string>()("alice@sip.example.org"), size_t, "%zu");
+	BC_ASSERT_EQUAL(std::hash<AorKey>()(key), key.hash(), size_t, "%zu");
+
+	const string &str = key;
+	BC_ASSERT_TRUE(str == "alice@sip.example.org");
+}
+
+static void copies_share_the_value(void) {
+	AorKey key("alice@sip.example.org");
+	AorKey copy = key;
+	// Copies point to the same string, which isn't duplicated.
+	BC_ASSERT_PTR_EQUAL(copy.c_str(), key.c_str());
+	BC_ASSERT_TRUE(copy == key);
+
+	AorKey moved = move(copy);
+	BC_ASSERT_PTR_EQUAL(moved.c_str(), key.c_str());
+}
+
+static void comparisons(void) {
+	AorKey alice("alice@sip.example.org");
+	AorKey otherAlice(string("alice@sip.example.org"));
+	AorKey bob("bob@sip.example.org");
+
+	// Keys built separately from the same string are equal.
+	BC_ASSERT_PTR_NOT_EQUAL(alice.c_str(), otherAlice.c_str());
+	BC_ASSERT_TRUE(alice == otherAlice);
+	BC_ASSERT_FALSE(alice != otherAlice);
+	BC_ASSERT_TRUE(alice != bob);
+	BC_ASSERT_TRUE(alice < bob);
+	BC_ASSERT_FALSE(bob < alice);
+	BC_ASSERT_FALSE(alice < otherAlice);
+}
+
+static void containers(void) {
+	unordered_map<AorKey, int> byKey;
+	byKey.emplace(AorKey("alice@sip.example.org"), 1);
+	byKey.emplace(AorKey("bob@sip.example.org"), 2);
+	BC_ASSERT_FALSE(byKey.emplace(AorKey("alice@sip.example.org"), 3).second);
+
+	auto it = byKey.find(AorKey("alice@sip.example.org"));
+	BC_ASSERT_TRUE(it != byKey.end() && it->second == 1);
+	BC_ASSERT_TRUE(byKey.find(AorKey("carol@sip.example.org")) == byKey.end());
+
+	// Ordered by the key strings, as the string keys were.
+	map<AorKey, int> ordered{{AorKey("bob@sip.example.org"), 2}, {AorKey("alice@sip.example.org"), 1}};
+	BC_ASSERT_STRING_EQUAL(ordered.begin()->first.c_str(), "alice@sip.example.org");
+}
+
+static test_t tests[] = {
+	TEST_NO_TAG("Empty key", empty_key),
+	TEST_NO_TAG("Value and hash", value_and_hash),
+	TEST_NO_TAG("Copies share the value", copies_share_the_value),
+	TEST_NO_TAG("Comparisons", comparisons),
+	TEST_NO_TAG("Containers", containers)
+};
+
+test_suite_t aor_key_suite = {
+	"AOR keys",
+	NULL,
+	NULL,
+	NULL,
+	NULL,
+	sizeof(tests) / sizeof(tests[0]),
+	tests
+};
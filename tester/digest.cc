@@ -0,0 +1,132 @@
+/*
+ * Copyright (C) 2020  Belledonne Communications SARL
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#include <cstring>
+#include <memory>
+#include <stdexcept>
+
+#include "utils/digest.hh"
+
+#include "tester.hh"
+
+using namespace flexisip;
+using namespace std;
+
+static bool fromHex(DigestValue &value, const char *hex) {
+	return value.fromHex(hex, strlen(hex));
+}
+
+static void hex_conversions(void) {
+	DigestValue value;
+	BC_ASSERT_TRUE(fromHex(value, "00ff7f80a5"));
+	BC_ASSERT_EQUAL(value.size(), 5, size_t, "%zu");
+	if (value.size() != 5) return;
+	BC_ASSERT_EQUAL(value.data()[0], 0x00, int, "%d");
+	BC_ASSERT_EQUAL(value.data()[1], 0xff, int, "%d");
+	BC_ASSERT_EQUAL(value.data()[4], 0xa5, int, "%d");
+	BC_ASSERT_STRING_EQUAL(value.toHex().c_str(), "00ff7f80a5");
+
+	char hex[2 * DigestValue::sMaxSize + 1];
+	value.toHex(hex);
+	BC_ASSERT_STRING_EQUAL(hex, "00ff7f80a5");
+
+	// Uppercase digits are accepted, but always written in lowercase.
+	BC_ASSERT_TRUE(fromHex(value, "DEADbeef"));
+	BC_ASSERT_STRING_EQUAL(value.toHex().c_str(), "deadbeef");
+
+	BC_ASSERT_TRUE(fromHex(value, ""));
+	BC_ASSERT_EQUAL(value.size(), 0, size_t, "%zu");
+	BC_ASSERT_STRING_EQUAL(value.toHex().c_str(), "");
+
+	string longest(2 * DigestValue::sMaxSize, 'a');
+	BC_ASSERT_TRUE(value.fromHex(longest.data(), longest.size()));
+	BC_ASSERT_STRING_EQUAL(value.toHex().c_str(), longest.c_str());
+}
+
+static void invalid_hex(void) {
+	DigestValue value;
+	BC_ASSERT_FALSE(fromHex(value, "abc"));
+	BC_ASSERT_FALSE(fromHex(value, "0g"));
+	BC_ASSERT_FALSE(fromHex(value, "0x12"));
+	BC_ASSERT_FALSE(fromHex(value, "12 4"));
+
+	string tooLong(2 * DigestValue::sMaxSize + 2, '0');
+	BC_ASSERT_FALSE(value.fromHex(tooLong.data(), tooLong.size()));
+}
+
+static void comparison(void) {
+	DigestValue a, b;
+	BC_ASSERT_TRUE(fromHex(a, "0123456789abcdef"));
+	BC_ASSERT_TRUE(fromHex(b, "0123456789ABCDEF"));
+	BC_ASSERT_TRUE(a == b);
+	BC_ASSERT_FALSE(a != b);
+
+	// A difference in the last byte only.
+	BC_ASSERT_TRUE(fromHex(b, "0123456789abcdee"));
+	BC_ASSERT_FALSE(a == b);
+	BC_ASSERT_TRUE(a != b);
+
+	// Values of different sizes are never equal, even when one is the prefix of the other.
+	BC_ASSERT_TRUE(fromHex(b, "0123456789abcd"));
+	BC_ASSERT_FALSE(a == b);
+	BC_ASSERT_TRUE(fromHex(b, "0123456789abcdef00"));
+	BC_ASSERT_FALSE(a == b);
+}
+
+static void known_digests(void) {
+	unique_ptr<Digest> md5(Digest::create("MD5"));
+	BC_ASSERT_EQUAL(md5->size(), 16, size_t, "%zu");
+	BC_ASSERT_STRING_EQUAL(md5->compute<string>("abc").c_str(), "900150983cd24fb0d6963f7d28e17f72");
+
+	DigestValue expected, value;
+	BC_ASSERT_TRUE(fromHex(expected, "900150983cd24fb0d6963f7d28e17f72"));
+	md5->compute("abc", 3, value);
+	BC_ASSERT_TRUE(value == expected);
+
+	unique_ptr<Digest> sha256(Digest::create("SHA-256"));
+	BC_ASSERT_EQUAL(sha256->size(), 32, size_t, "%zu");
+	const char *abcSha256 = "ba7816bf8f01cfea414140de5dae2223b00361a396177a9cb410ff61f20015ad";
+	BC_ASSERT_STRING_EQUAL(sha256->compute<string>("abc").c_str(), abcSha256);
+	BC_ASSERT_TRUE(fromHex(expected, abcSha256));
+	BC_ASSERT_TRUE(sha256->compute<DigestValue>("abc") == expected);
+
+	bool thrown = false;
+	try {
+		unique_ptr<Digest> unknown(Digest::create("SHA-512-256"));
+	} catch (const invalid_argument &) {
+		thrown = true;
+	}
+	BC_ASSERT_TRUE(thrown);
+}
+
+static test_t tests[] = {
+	TEST_NO_TAG("Hexadecimal conversions", hex_conversions),
+	TEST_NO_TAG("Invalid hexadecimal digests", invalid_hex),
+	TEST_NO_TAG("Comparison", comparison),
+	TEST_NO_TAG("Known digests", known_digests)
+};
+
+test_suite_t digest_suite = {
+	"Digest",
+	NULL,
+	NULL,
+	NULL,
+	NULL,
+	sizeof(tests) / sizeof(tests[0]),
+	tests
+};
@@ -0,0 +1,305 @@
+/*
+ * Copyright (C) 2020  Belledonne Communications SARL
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <cstdio>
+#include <map>
+#include <mutex>
+#include <thread>
+
+#include <sofia-sip/su_wait.h>
+#include <sofia-sip/url.h>
+
+#include "flexisip/sofia-wrapper/home.hh"
+
+#include "dns-cache.hh"
+#include "tester.hh"
+
+using namespace flexisip;
+using namespace std;
+
+/*
+ * Minimal DNS server answering on the loopback from a static set of records, and counting the queries it receives.
+ */
+class StubDnsServer {
+public:
+	StubDnsServer() {
+		mSocket = socket(AF_INET, SOCK_DGRAM, 0);
+		sockaddr_in addr{};
+		addr.sin_family = AF_INET;
+		addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+		bind(mSocket, reinterpret_cast<sockaddr *>(&addr), sizeof(addr));
+		socklen_t len = sizeof(addr);
+		getsockname(mSocket, reinterpret_cast<sockaddr *>(&addr), &len);
+		mPort = ntohs(addr.sin_port);
+
+		// Name servers listening on another port than 53 are set with sofia's 'port' extension of resolv.conf.
+		mResolvConf = bcTesterFile("dns-cache-resolv.conf");
+		FILE *f = fopen(mResolvConf.c_str(), "w");
+		fprintf(f, "nameserver 127.0.0.1\nport %u\noptions timeout:1 attempts:1\n", mPort);
+		fclose(f);
+
+		mThread = thread([this]() {run();});
+	}
+	~StubDnsServer() {
+		mRunning = false;
+		mThread.join();
+		close(mSocket);
+		remove(mResolvConf.c_str());
+	}
+
+	const string &resolvConf() const {return mResolvConf;}
+
+	void addA(const string &name, const char *address, uint32_t ttl) {
+		string rdata(4, '\0');
+		inet_pton(AF_INET, address, &rdata[0]);
+		addRecord(name, 1, ttl, rdata);
+	}
+	void addSrv(const string &name, uint16_t priority, uint16_t weight, uint16_t port, const string &target, uint32_t ttl) {
+		addRecord(name, 33, ttl, u16(priority) + u16(weight) + u16(port) + encodeName(target));
+	}
+	void addNaptr(const string &name, uint16_t order, uint16_t preference, const string &services,
+		const string &replacement, uint32_t ttl) {
+		string rdata = u16(order) + u16(preference) + characterString("s") + characterString(services)
+			+ characterString("") + encodeName(replacement);
+		addRecord(name, 35, ttl, rdata);
+	}
+
+	int queries(const string &name, uint16_t type) {
+		lock_guard<mutex> lock(mMutex);
+		return mQueries[make_pair(name, type)];
+	}
+
+private:
+	struct Record {
+		uint32_t ttl;
+		string rdata;
+	};
+	using Key = pair<string, uint16_t>;
+
+	static string u16(uint16_t value) {return string{char(value >> 8), char(value & 0xff)};}
+	static string u32(uint32_t value) {return u16(uint16_t(value >> 16)) + u16(uint16_t(value));}
+	static string characterString(const string &value) {return char(value.size()) + value;}
+	static string encodeName(const string &name) {
+		string encoded;
+		size_t start = 0;
+		while (start < name.size()) {
+			size_t end = name.find('.', start);
+			if (end == string::npos) end = name.size();
+			encoded += char(end - start) + name.substr(start, end - start);
+			start = end + 1;
+		}
+		return encoded + '\0';
+	}
+
+	void addRecord(const string &name, uint16_t type, uint32_t ttl, const string &rdata) {
+		lock_guard<mutex> lock(mMutex);
+		mRecords[make_pair(name, type)].push_back(Record{ttl, rdata});
+		mNames[name] = true;
+	}
+
+	void run() {
+		while (mRunning) {
+			pollfd pfd{mSocket, POLLIN, 0};
+			if (poll(&pfd, 1, 100) <= 0) continue;
+
+			char query[512];
+			sockaddr_in from{};
+			socklen_t fromLen = sizeof(from);
+			ssize_t size = recvfrom(mSocket, query, sizeof(query), 0, reinterpret_cast<sockaddr *>(&from), &fromLen);
+			if (size < 12) continue;
+
+			// Question: the labels of the name, then its type and class.
+			string name;
+			size_t pos = 12;
+			while (pos < size_t(size) && query[pos] != 0) {
+				size_t len = uint8_t(query[pos]);
+				if (!name.empty()) name += '.';
+				for (size_t i = 1; i <= len && pos + i < size_t(size); ++i) name += char(tolower(query[pos + i]));
+				pos += len + 1;
+			}
+			pos += 5;
+			if (pos > size_t(size)) continue;
+			uint16_t type = uint16_t((uint8_t(query[pos - 4]) << 8) | uint8_t(query[pos - 3]));
+
+			string answers;
+			uint16_t count = 0;
+			bool exists;
+			{
+				lock_guard<mutex> lock(mMutex);
+				mQueries[make_pair(name, type)]++;
+				exists = mNames.count(name) != 0;
+				for (const auto &record : mRecords[make_pair(name, type)]) {
+					// The owner name points to the question.
+					answers += u16(0xc00c) + u16(type) + u16(1) + u32(record.ttl) + u16(uint16_t(record.rdata.size()))
+						+ record.rdata;
+					count++;
+				}
+			}
+
+			string response(query, 4);
+			response[2] = char(0x81); // response, recursion desired
+			response[3] = char(exists ? 0x80 : 0x83); // recursion available, NXDOMAIN for unknown names
+			response += u16(1) + u16(count) + u16(0) + u16(0);
+			response += string(query + 12, pos - 12);
+			response += answers;
+			sendto(mSocket, response.data(), response.size(), 0, reinterpret_cast<sockaddr *>(&from), fromLen);
+		}
+	}
+
+	int mSocket = -1;
+	uint16_t mPort = 0;
+	string mResolvConf;
+	atomic<bool> mRunning{true};
+	thread mThread;
+	mutex mMutex;
+	map<Key, vector<Record>> mRecords;
+	map<string, bool> mNames;
+	map<Key, int> mQueries;
+};
+
+struct DnsCacheFixture {
+	DnsCacheFixture() : root(su_root_create(nullptr)) {
+		cache.reset(new DnsCache(root, server.resolvConf(), 30));
+		cache->setStats(&hits, &misses, &prefetches);
+	}
+	~DnsCacheFixture() {
+		cache.reset();
+		su_root_destroy(root);
+	}
+
+	/* Resolves the URI until it is found in the cache, letting the answers of the stub server arrive meanwhile. */
+	bool resolve(const char *uri, DnsCache::Destination &destination, int timeoutMs = 3000) {
+		url_t *url = url_make(home.home(), uri);
+		for (int elapsed = 0;; elapsed += 20) {
+			if (cache->resolve(url, destination)) return true;
+			if (elapsed >= timeoutMs) return false;
+			su_root_step(root, 20);
+		}
+	}
+
+	StubDnsServer server;
+	sofiasip::Home home;
+	su_root_t *root;
+	unique_ptr<DnsCache> cache;
+	StatCounter64 hits{"hits", "", 1};
+	StatCounter64 misses{"misses", "", 2};
+	StatCounter64 prefetches{"prefetches", "", 3};
+};
+
+static void naptr_srv_a_chain(void) {
+	DnsCacheFixture fixture;
+	fixture.server.addNaptr("chain.test", 10, 10, "SIP+D2U", "_sip._udp.chain.test", 60);
+	fixture.server.addSrv("_sip._udp.chain.test", 0, 0, 5070, "sbc.chain.test", 60);
+	fixture.server.addA("sbc.chain.test", "10.0.0.1", 60);
+
+	DnsCache::Destination destination;
+	BC_ASSERT_TRUE(fixture.resolve("sip:chain.test", destination));
+	BC_ASSERT_STRING_EQUAL(destination.host.c_str(), "10.0.0.1");
+	BC_ASSERT_STRING_EQUAL(destination.port.c_str(), "5070");
+	BC_ASSERT_STRING_EQUAL(destination.transport.c_str(), "udp");
+	// Each record of the chain has been queried once, and the first attempts were misses.
+	BC_ASSERT_EQUAL(fixture.server.queries("chain.test", 35), 1, int, "%d");
+	BC_ASSERT_EQUAL(fixture.server.queries("_sip._udp.chain.test", 33), 1, int, "%d");
+	BC_ASSERT_EQUAL(fixture.server.queries("sbc.chain.test", 1), 1, int, "%d");
+	BC_ASSERT_TRUE(fixture.misses.read() > 0);
+	BC_ASSERT_EQUAL((int)fixture.hits.read(), 1, int, "%d");
+
+	// Now entirely answered from the cache.
+	BC_ASSERT_TRUE(fixture.resolve("sip:chain.test", destination, 0));
+	BC_ASSERT_EQUAL((int)fixture.hits.read(), 2, int, "%d");
+	BC_ASSERT_EQUAL(fixture.server.queries("chain.test", 35), 1, int, "%d");
+}
+
+static void negative_answers(void) {
+	DnsCacheFixture fixture;
+
+	DnsCache::Destination destination;
+	BC_ASSERT_FALSE(fixture.resolve("sip:missing.test:5060", destination, 1000));
+	BC_ASSERT_EQUAL(fixture.server.queries("missing.test", 1), 1, int, "%d");
+	BC_ASSERT_EQUAL((int)fixture.hits.read(), 0, int, "%d");
+	// The unknown name is remembered for the negative TTL and not queried again.
+	BC_ASSERT_FALSE(fixture.resolve("sip:missing.test:5060", destination, 200));
+	BC_ASSERT_EQUAL(fixture.server.queries("missing.test", 1), 1, int, "%d");
+	BC_ASSERT_TRUE(fixture.misses.read() > 1);
+}
+
+static void several_destinations(void) {
+	DnsCacheFixture fixture;
+	fixture.server.addA("pool.test", "10.0.0.1", 60);
+	fixture.server.addA("pool.test", "10.0.0.2", 60);
+	fixture.server.addSrv("_sip._udp.srv.test", 0, 50, 5060, "a.srv.test", 60);
+	fixture.server.addSrv("_sip._udp.srv.test", 0, 50, 5060, "b.srv.test", 60);
+
+	// Several addresses or SRV targets are left to the transaction, which fails over between them.
+	DnsCache::Destination destination;
+	BC_ASSERT_FALSE(fixture.resolve("sip:pool.test:5060", destination, 1000));
+	BC_ASSERT_EQUAL(fixture.server.queries("pool.test", 1), 1, int, "%d");
+	BC_ASSERT_FALSE(fixture.resolve("sip:srv.test;transport=udp", destination, 1000));
+	BC_ASSERT_EQUAL(fixture.server.queries("_sip._udp.srv.test", 33), 1, int, "%d");
+	BC_ASSERT_EQUAL((int)fixture.hits.read(), 0, int, "%d");
+}
+
+static void prefetch(void) {
+	DnsCacheFixture fixture;
+	fixture.server.addA("short.test", "10.0.0.3", 3);
+
+	DnsCache::Destination destination;
+	BC_ASSERT_TRUE(fixture.resolve("sip:short.test:5060", destination));
+	BC_ASSERT_EQUAL(fixture.server.queries("short.test", 1), 1, int, "%d");
+
+	// Keep using the record: it is queried again during the last tenth of its TTL, before it expires.
+	for (int elapsed = 0; elapsed < 4000 && fixture.prefetches.read() == 0; elapsed += 100) {
+		fixture.resolve("sip:short.test:5060", destination, 0);
+		su_root_step(fixture.root, 100);
+	}
+	BC_ASSERT_TRUE(fixture.prefetches.read() > 0);
+	BC_ASSERT_TRUE(fixture.server.queries("short.test", 1) >= 2);
+}
+
+static int beforeSuite() {
+	return su_init();
+}
+
+static int afterSuite() {
+	su_deinit();
+	return 0;
+}
+
+static test_t tests[] = {
+	TEST_NO_TAG("NAPTR, SRV and A resolution", naptr_srv_a_chain),
+	TEST_NO_TAG("Negative answers", negative_answers),
+	TEST_NO_TAG("Several destinations", several_destinations),
+	TEST_NO_TAG("Prefetch", prefetch)
+};
+
+test_suite_t dns_cache_suite = {
+	"DNS cache",
+	beforeSuite,
+	afterSuite,
+	NULL,
+	NULL,
+	sizeof(tests) / sizeof(tests[0]),
+	tests
+};
@@ -0,0 +1,130 @@
+/*
+ * Copyright (C) 2020  Belledonne Communications SARL
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#include "flexisip/utils/domain-matcher.hh"
+
+#include "tester.hh"
+
+using namespace flexisip;
+using namespace std;
+
+static void empty_domain_matcher(void) {
+	DomainMatcher matcher;
+	BC_ASSERT_TRUE(matcher.empty());
+	BC_ASSERT_FALSE(matcher.match("sip.example.org"));
+
+	DomainMatcher fromEmptyEntries({""});
+	BC_ASSERT_TRUE(fromEmptyEntries.empty());
+}
+
+static void exact_domains(void) {
+	DomainMatcher matcher({"sip.example.org", "example.com"});
+	BC_ASSERT_FALSE(matcher.empty());
+	BC_ASSERT_TRUE(matcher.match("sip.example.org"));
+	BC_ASSERT_TRUE(matcher.match("example.com"));
+	BC_ASSERT_FALSE(matcher.match("example.org"));
+	BC_ASSERT_FALSE(matcher.match("sip.example.org.evil"));
+	BC_ASSERT_FALSE(matcher.match(""));
+	// Same as ModuleToolbox::matchesOneOf(): domains are case sensitive.
+	BC_ASSERT_FALSE(matcher.match("SIP.example.org"));
+}
+
+static void wildcard_domains(void) {
+	DomainMatcher all({"example.com", "*"});
+	BC_ASSERT_TRUE(all.match("anything.net"));
+	BC_ASSERT_TRUE(all.match(""));
+
+	// Items containing both the part before and the part after the '*' match.
+	DomainMatcher matcher({"sip*.example.org"});
+	BC_ASSERT_TRUE(matcher.match("sip1.example.org"));
+	BC_ASSERT_TRUE(matcher.match("sip.example.org"));
+	BC_ASSERT_TRUE(matcher.match("sip-eu.example.org"));
+	BC_ASSERT_TRUE(matcher.match("a.sip2.example.org.b"));
+	BC_ASSERT_FALSE(matcher.match("proxy.example.org"));
+	BC_ASSERT_FALSE(matcher.match("sip1.example.com"));
+}
+
+static void host_case_and_trailing_dot(void) {
+	HostMatcher matcher;
+	matcher.add("Sip.Example.org");
+	BC_ASSERT_TRUE(matcher.match("sip.example.org"));
+	BC_ASSERT_TRUE(matcher.match("SIP.EXAMPLE.ORG"));
+	BC_ASSERT_TRUE(matcher.match("sip.example.org."));
+	BC_ASSERT_FALSE(matcher.match("sip.example.org.."));
+	BC_ASSERT_FALSE(matcher.match("example.org"));
+
+	matcher.add("192.168.0.1");
+	BC_ASSERT_TRUE(matcher.match("192.168.0.1"));
+	BC_ASSERT_FALSE(matcher.match("192.168.0.10"));
+
+	matcher.clear();
+	BC_ASSERT_FALSE(matcher.match("sip.example.org"));
+	BC_ASSERT_FALSE(matcher.match("192.168.0.1"));
+}
+
+static void host_ipv6(void) {
+	HostMatcher matcher;
+	matcher.add("[2001:db8::1]");
+	BC_ASSERT_TRUE(matcher.match("2001:db8::1"));
+	BC_ASSERT_TRUE(matcher.match("[2001:db8::1]"));
+	// Other text representations of the same address.
+	BC_ASSERT_TRUE(matcher.match("2001:0db8:0000:0000:0000:0000:0000:0001"));
+	BC_ASSERT_TRUE(matcher.match("[2001:DB8:0::1]"));
+	BC_ASSERT_FALSE(matcher.match("2001:db8::2"));
+	BC_ASSERT_FALSE(matcher.match("[not:an:address]"));
+
+	// Invalid addresses are ignored.
+	matcher.add("[zz::1]");
+	BC_ASSERT_FALSE(matcher.match("[zz::1]"));
+}
+
+static void host_ports(void) {
+	HostMatcher matcher;
+	matcher.add("sip.example.org", "5060");
+	matcher.add("proxy.example.org");
+	BC_ASSERT_TRUE(matcher.match("sip.example.org", "5060"));
+	BC_ASSERT_FALSE(matcher.match("sip.example.org", "5061"));
+	BC_ASSERT_FALSE(matcher.match("sip.example.org"));
+	BC_ASSERT_TRUE(matcher.match("proxy.example.org"));
+	BC_ASSERT_TRUE(matcher.match("proxy.example.org", "5061"));
+
+	// The same host may be bound to several ports.
+	matcher.add("sip.example.org", "5061");
+	BC_ASSERT_TRUE(matcher.match("sip.example.org", "5060"));
+	BC_ASSERT_TRUE(matcher.match("sip.example.org", "5061"));
+	BC_ASSERT_FALSE(matcher.match("sip.example.org", "5062"));
+}
+
+static test_t tests[] = {
+	TEST_NO_TAG("Empty domain matcher", empty_domain_matcher),
+	TEST_NO_TAG("Exact domains", exact_domains),
+	TEST_NO_TAG("Wildcard domains", wildcard_domains),
+	TEST_NO_TAG("Host case and trailing dot", host_case_and_trailing_dot),
+	TEST_NO_TAG("IPv6 hosts", host_ipv6),
+	TEST_NO_TAG("Host ports", host_ports)
+};
+
+test_suite_t domain_matcher_suite = {
+	"Domain matchers",
+	NULL,
+	NULL,
+	NULL,
+	NULL,
+	sizeof(tests) / sizeof(tests[0]),
+	tests
+};
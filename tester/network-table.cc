@@ -0,0 +1,139 @@
+/*
+ * Copyright (C) 2020  Belledonne Communications SARL
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#include <arpa/inet.h>
+#include <cstring>
+
+#include "flexisip/utils/network-table.hh"
+
+#include "tester.hh"
+
+using namespace flexisip;
+using namespace std;
+
+static bool addNetwork(NetworkTable &table, const char *address, const char *netmask) {
+	struct sockaddr_storage addr, mask;
+	memset(&addr, 0, sizeof(addr));
+	memset(&mask, 0, sizeof(mask));
+	if (strchr(address, ':')) {
+		auto *addr6 = reinterpret_cast<struct sockaddr_in6 *>(&addr);
+		auto *mask6 = reinterpret_cast<struct sockaddr_in6 *>(&mask);
+		addr6->sin6_family = mask6->sin6_family = AF_INET6;
+		if (inet_pton(AF_INET6, address, &addr6->sin6_addr) != 1) return false;
+		if (inet_pton(AF_INET6, netmask, &mask6->sin6_addr) != 1) return false;
+	} else {
+		auto *addr4 = reinterpret_cast<struct sockaddr_in *>(&addr);
+		auto *mask4 = reinterpret_cast<struct sockaddr_in *>(&mask);
+		addr4->sin_family = mask4->sin_family = AF_INET;
+		if (inet_pton(AF_INET, address, &addr4->sin_addr) != 1) return false;
+		if (inet_pton(AF_INET, netmask, &mask4->sin_addr) != 1) return false;
+	}
+	return table.add(reinterpret_cast<struct sockaddr *>(&addr), reinterpret_cast<struct sockaddr *>(&mask));
+}
+
+/* Returns the interface address found for a host, or an empty string. */
+static string lookup(const NetworkTable &table, const char *host) {
+	int family;
+	struct in6_addr addr;
+	if (!NetworkTable::parseAddress(host, family, &addr)) return "invalid";
+	const string *found = table.lookup(family, &addr);
+	return found ? *found : "";
+}
+
+static void parse_address(void) {
+	int family;
+	struct in6_addr addr;
+	BC_ASSERT_TRUE(NetworkTable::parseAddress("192.168.1.2", family, &addr));
+	BC_ASSERT_EQUAL(family, AF_INET, int, "%d");
+	BC_ASSERT_TRUE(NetworkTable::parseAddress("2001:db8::1", family, &addr));
+	BC_ASSERT_EQUAL(family, AF_INET6, int, "%d");
+	BC_ASSERT_TRUE(NetworkTable::parseAddress("[2001:db8::1]", family, &addr));
+	BC_ASSERT_EQUAL(family, AF_INET6, int, "%d");
+	BC_ASSERT_FALSE(NetworkTable::parseAddress("sip.example.org", family, &addr));
+	BC_ASSERT_FALSE(NetworkTable::parseAddress("192.168.1", family, &addr));
+	BC_ASSERT_FALSE(NetworkTable::parseAddress("[2001:db8::zz]", family, &addr));
+}
+
+static void longest_prefix_match(void) {
+	NetworkTable table;
+	BC_ASSERT_TRUE(table.empty());
+	BC_ASSERT_STRING_EQUAL(lookup(table, "10.0.0.1").c_str(), "");
+
+	BC_ASSERT_TRUE(addNetwork(table, "10.0.0.1", "255.0.0.0"));
+	BC_ASSERT_TRUE(addNetwork(table, "10.1.2.1", "255.255.255.0"));
+	BC_ASSERT_TRUE(addNetwork(table, "192.168.1.1", "255.255.255.0"));
+	BC_ASSERT_FALSE(table.empty());
+
+	BC_ASSERT_STRING_EQUAL(lookup(table, "10.1.2.200").c_str(), "10.1.2.1");
+	BC_ASSERT_STRING_EQUAL(lookup(table, "10.1.3.4").c_str(), "10.0.0.1");
+	BC_ASSERT_STRING_EQUAL(lookup(table, "10.200.0.1").c_str(), "10.0.0.1");
+	BC_ASSERT_STRING_EQUAL(lookup(table, "192.168.1.254").c_str(), "192.168.1.1");
+	BC_ASSERT_STRING_EQUAL(lookup(table, "192.168.2.1").c_str(), "");
+	BC_ASSERT_STRING_EQUAL(lookup(table, "11.0.0.1").c_str(), "");
+}
+
+static void ipv6_networks(void) {
+	NetworkTable table;
+	BC_ASSERT_TRUE(addNetwork(table, "2001:db8::1", "ffff:ffff::"));
+	BC_ASSERT_TRUE(addNetwork(table, "2001:db8:1::1", "ffff:ffff:ffff:ffff::"));
+	BC_ASSERT_TRUE(addNetwork(table, "10.0.0.1", "255.0.0.0"));
+
+	BC_ASSERT_STRING_EQUAL(lookup(table, "2001:db8:1::42").c_str(), "2001:db8:1::1");
+	BC_ASSERT_STRING_EQUAL(lookup(table, "[2001:db8:2::42]").c_str(), "2001:db8::1");
+	BC_ASSERT_STRING_EQUAL(lookup(table, "2001:db9::1").c_str(), "");
+	// The address families have their own networks.
+	BC_ASSERT_STRING_EQUAL(lookup(table, "::ffff:10.0.0.2").c_str(), "");
+}
+
+static void default_route_and_replacement(void) {
+	NetworkTable table;
+	// A null netmask makes a network containing every address of the family.
+	BC_ASSERT_TRUE(addNetwork(table, "192.168.1.1", "0.0.0.0"));
+	BC_ASSERT_STRING_EQUAL(lookup(table, "8.8.8.8").c_str(), "192.168.1.1");
+	BC_ASSERT_STRING_EQUAL(lookup(table, "2001:db8::1").c_str(), "");
+
+	// The last interface added on a network wins.
+	BC_ASSERT_TRUE(addNetwork(table, "192.168.1.2", "0.0.0.0"));
+	BC_ASSERT_STRING_EQUAL(lookup(table, "8.8.8.8").c_str(), "192.168.1.2");
+
+	table.clear();
+	BC_ASSERT_TRUE(table.empty());
+	BC_ASSERT_STRING_EQUAL(lookup(table, "8.8.8.8").c_str(), "");
+
+	struct sockaddr unsupported;
+	memset(&unsupported, 0, sizeof(unsupported));
+	unsupported.sa_family = AF_UNIX;
+	BC_ASSERT_FALSE(table.add(&unsupported, &unsupported));
+}
+
+static test_t tests[] = {
+	TEST_NO_TAG("Address parsing", parse_address),
+	TEST_NO_TAG("Longest prefix match", longest_prefix_match),
+	TEST_NO_TAG("IPv6 networks", ipv6_networks),
+	TEST_NO_TAG("Default route and replacement", default_route_and_replacement)
+};
+
+test_suite_t network_table_suite = {
+	"Network table",
+	NULL,
+	NULL,
+	NULL,
+	NULL,
+	sizeof(tests) / sizeof(tests[0]),
+	tests
+};
@@ -0,0 +1,115 @@
+/*
+ * Copyright (C) 2020  Belledonne Communications SARL
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#include <cinttypes>
+
+#include "flexisip/auth/nonce-store.hh"
+#include "flexisip/configmanager.hh"
+
+#include "tester.hh"
+
+using namespace flexisip;
+using namespace std;
+
+static void insert_and_find(void) {
+	NonceStore store;
+	BC_ASSERT_EQUAL(store.getNc("unknown"), -1, int, "%d");
+
+	store.insert("nonce-1");
+	store.insert("nonce-2");
+	BC_ASSERT_EQUAL(store.getNc("nonce-1"), 0, int, "%d");
+	BC_ASSERT_EQUAL(store.getNc("nonce-2"), 0, int, "%d");
+	BC_ASSERT_EQUAL(store.getNc("nonce-3"), -1, int, "%d");
+
+	store.erase("nonce-1");
+	BC_ASSERT_EQUAL(store.getNc("nonce-1"), -1, int, "%d");
+	BC_ASSERT_EQUAL(store.getNc("nonce-2"), 0, int, "%d");
+}
+
+static void nonce_count_updates(void) {
+	NonceStore store;
+	BC_ASSERT_FALSE(store.updateNc("unknown", 1));
+
+	store.insert("nonce");
+	BC_ASSERT_TRUE(store.updateNc("nonce", 1));
+	BC_ASSERT_EQUAL(store.getNc("nonce"), 1, int, "%d");
+	// Replays and older counts are rejected.
+	BC_ASSERT_FALSE(store.updateNc("nonce", 1));
+	BC_ASSERT_FALSE(store.updateNc("nonce", 0));
+	BC_ASSERT_TRUE(store.updateNc("nonce", 5));
+	BC_ASSERT_EQUAL(store.getNc("nonce"), 5, int, "%d");
+	BC_ASSERT_FALSE(store.updateNc("nonce", 3));
+
+	// Inserting a known nonce again resets its count.
+	store.insert("nonce");
+	BC_ASSERT_EQUAL(store.getNc("nonce"), 0, int, "%d");
+}
+
+static void eviction_when_full(void) {
+	StatCounter64 evictions("count-nonce-evictions", "Nonces evicted from the nonce store", 1);
+	NonceStore store(1); // Rounded up to the smallest table, whose probe window covers every slot.
+	store.setEvictionCounter(&evictions);
+
+	const int count = 64;
+	for (int i = 0; i < count; ++i) store.insert("nonce-" + to_string(i));
+
+	int stored = 0;
+	for (int i = 0; i < count; ++i) {
+		if (store.getNc("nonce-" + to_string(i)) >= 0) stored++;
+	}
+	BC_ASSERT_LOWER(stored, count - 1, int, "%d");
+	BC_ASSERT_GREATER(stored, 1, int, "%d");
+	BC_ASSERT_EQUAL(evictions.read(), count - stored, uint64_t, "%" PRIu64);
+	// The most recent nonce is always kept.
+	BC_ASSERT_EQUAL(store.getNc("nonce-" + to_string(count - 1)), 0, int, "%d");
+}
+
+static void capacity(void) {
+	StatCounter64 evictions("count-nonce-evictions", "Nonces evicted from the nonce store", 1);
+	NonceStore store(1);
+	store.setEvictionCounter(&evictions);
+	store.insert("forgotten");
+	store.setCapacity(4096);
+	BC_ASSERT_EQUAL(store.getNc("forgotten"), -1, int, "%d");
+
+	const int count = 1024;
+	for (int i = 0; i < count; ++i) store.insert("nonce-" + to_string(i));
+	int stored = 0;
+	for (int i = 0; i < count; ++i) {
+		if (store.getNc("nonce-" + to_string(i)) >= 0) stored++;
+	}
+	BC_ASSERT_EQUAL(stored, count, int, "%d");
+	BC_ASSERT_EQUAL(evictions.read(), 0, uint64_t, "%" PRIu64);
+}
+
+static test_t tests[] = {
+	TEST_NO_TAG("Insert and find", insert_and_find),
+	TEST_NO_TAG("Nonce count updates", nonce_count_updates),
+	TEST_NO_TAG("Eviction when full", eviction_when_full),
+	TEST_NO_TAG("Capacity", capacity)
+};
+
+test_suite_t nonce_store_suite = {
+	"Nonce store",
+	NULL,
+	NULL,
+	NULL,
+	NULL,
+	sizeof(tests) / sizeof(tests[0]),
+	tests
+};
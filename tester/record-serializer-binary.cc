@@ -0,0 +1,187 @@
+/*
+ * Copyright (C) 2020  Belledonne Communications SARL
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#include <cstring>
+#include <ctime>
+
+#include "flexisip/registrardb.hh"
+
+#include "recordserializer.hh"
+#include "tester.hh"
+
+using namespace flexisip;
+using namespace std;
+
+static int beforeSuite() {
+	// Avoids reading the registrar configuration, as the serializer tool does.
+	Record::sLineFieldNames = {"+sip.instance", "pn-tok", "line"};
+	Record::sMaxContacts = 10;
+	return 0;
+}
+
+static void fillRecord(Record &record, time_t now) {
+	list<string> accept{"application/sdp", "text/plain"};
+	ExtendedContactCommon first("192.168.0.1:5223", {"sip:proxy1.example.org;lr", "sip:proxy2.example.org;lr"},
+		"callid-1", "line-1");
+	record.update(first, "sip:alice@192.168.0.1:5223;transport=tls;line=line-1", now + 3600, 1, 12, now, false, accept,
+		true, nullptr);
+	ExtendedContactCommon second("192.168.0.2:5060", {}, "callid-2", "line-2");
+	record.update(second, "sip:alice@192.168.0.2:5060;line=line-2", now + 600, 1, 3, now - 10, true, {}, false, nullptr);
+}
+
+static ExtendedContact *findContact(const Record &record, const string &callId) {
+	for (const auto &ec : record.getExtendedContacts()) {
+		if (ec->mCallId == callId) return ec.get();
+	}
+	return nullptr;
+}
+
+static void checkSameContact(const ExtendedContact &expected, const ExtendedContact *actual) {
+	if (!BC_ASSERT_PTR_NOT_NULL(actual)) return;
+	BC_ASSERT_TRUE(actual->mContactId == expected.mContactId);
+	BC_ASSERT_TRUE(actual->mUniqueId == expected.mUniqueId);
+	BC_ASSERT_TRUE(actual->mPath == expected.mPath);
+	BC_ASSERT_TRUE(actual->mAcceptHeader == expected.mAcceptHeader);
+	BC_ASSERT_TRUE(actual->mUserAgent == expected.mUserAgent);
+	BC_ASSERT_EQUAL(actual->mCSeq, expected.mCSeq, uint32_t, "%u");
+	BC_ASSERT_EQUAL(actual->mExpireAt, expected.mExpireAt, long, "%ld");
+	BC_ASSERT_EQUAL(actual->mExpireNotAtMessage, expected.mExpireNotAtMessage, long, "%ld");
+	BC_ASSERT_EQUAL(actual->mUpdatedTime, expected.mUpdatedTime, long, "%ld");
+	BC_ASSERT_EQUAL(actual->mAlias, expected.mAlias, int, "%d");
+	BC_ASSERT_EQUAL(actual->mUsedAsRoute, expected.mUsedAsRoute, int, "%d");
+	BC_ASSERT_STRING_EQUAL(ExtendedContact::urlToString(actual->mSipContact->m_url).c_str(),
+		ExtendedContact::urlToString(expected.mSipContact->m_url).c_str());
+}
+
+static void record_round_trip(void) {
+	time_t now = getCurrentTime();
+	Record initial(SipUri{});
+	fillRecord(initial, now);
+	BC_ASSERT_EQUAL(initial.count(), 2, int, "%d");
+
+	unique_ptr<RecordSerializer> serializer(RecordSerializer::create("binary"));
+	string serialized;
+	BC_ASSERT_TRUE(serializer->serialize(&initial, serialized));
+	BC_ASSERT_TRUE(RecordSerializerBinary::isBinaryContact(serialized.data(), serialized.size()));
+
+	Record final(SipUri{});
+	BC_ASSERT_TRUE(serializer->parse(serialized, &final));
+	BC_ASSERT_EQUAL(final.count(), 2, int, "%d");
+	for (const auto &ec : initial.getExtendedContacts()) checkSameContact(*ec, findContact(final, ec->mCallId));
+
+	// An empty record gives an empty, but valid, serialization.
+	Record empty(SipUri{});
+	BC_ASSERT_TRUE(serializer->serialize(&empty, serialized));
+	Record parsed(SipUri{});
+	BC_ASSERT_TRUE(serializer->parse(serialized, &parsed));
+	BC_ASSERT_TRUE(parsed.isEmpty());
+}
+
+static void expired_contacts(void) {
+	time_t now = getCurrentTime();
+	Record initial(SipUri{});
+	fillRecord(initial, now);
+	ExtendedContact *expired = findContact(initial, "callid-2");
+	if (!BC_ASSERT_PTR_NOT_NULL(expired)) return;
+	expired->mExpireAt = now - 1;
+
+	unique_ptr<RecordSerializer> serializer(RecordSerializer::create("binary"));
+	string serialized;
+	BC_ASSERT_TRUE(serializer->serialize(&initial, serialized));
+	Record final(SipUri{});
+	BC_ASSERT_TRUE(serializer->parse(serialized, &final));
+	BC_ASSERT_EQUAL(final.count(), 1, int, "%d");
+	BC_ASSERT_PTR_NOT_NULL(findContact(final, "callid-1"));
+	BC_ASSERT_PTR_NULL(findContact(final, "callid-2"));
+
+	string contact;
+	RecordSerializerBinary::serializeContact(*expired, contact);
+	BC_ASSERT_FALSE(RecordSerializerBinary::parseContact(contact.data(), contact.size(), "alice", "line-2", &final,
+		nullptr));
+}
+
+static void contact_round_trip(void) {
+	time_t now = getCurrentTime();
+	Record initial(SipUri{});
+	fillRecord(initial, now);
+	const ExtendedContact *ec = findContact(initial, "callid-1");
+	if (!BC_ASSERT_PTR_NOT_NULL(ec)) return;
+
+	string contact;
+	RecordSerializerBinary::serializeContact(*ec, contact);
+	BC_ASSERT_TRUE(RecordSerializerBinary::isBinaryContact(contact.data(), contact.size()));
+	BC_ASSERT_FALSE(RecordSerializerBinary::isBinaryContact("expires%3D3600", strlen("expires%3D3600")));
+
+	Record final(SipUri{});
+	BC_ASSERT_TRUE(RecordSerializerBinary::parseContact(contact.data(), contact.size(), ec->mContactId.c_str(),
+		ec->mUniqueId.c_str(), &final, nullptr));
+	BC_ASSERT_EQUAL(final.count(), 1, int, "%d");
+	checkSameContact(*ec, findContact(final, "callid-1"));
+
+	// Fields added by later versions of the encoding are skipped.
+	string extended = contact;
+	extended.push_back(char(15 << 3)); // field 15, varint
+	extended.push_back(char(42));
+	Record withUnknownField(SipUri{});
+	BC_ASSERT_TRUE(RecordSerializerBinary::parseContact(extended.data(), extended.size(), ec->mContactId.c_str(),
+		ec->mUniqueId.c_str(), &withUnknownField, nullptr));
+	BC_ASSERT_EQUAL(withUnknownField.count(), 1, int, "%d");
+}
+
+static void invalid_input(void) {
+	time_t now = getCurrentTime();
+	Record initial(SipUri{});
+	fillRecord(initial, now);
+	unique_ptr<RecordSerializer> serializer(RecordSerializer::create("binary"));
+	string serialized;
+	BC_ASSERT_TRUE(serializer->serialize(&initial, serialized));
+
+	Record final(SipUri{});
+	BC_ASSERT_FALSE(serializer->parse(serialized.data(), 0, &final));
+	BC_ASSERT_FALSE(serializer->parse("not binary", strlen("not binary"), &final));
+	Record truncated(SipUri{});
+	BC_ASSERT_FALSE(serializer->parse(serialized.data(), serialized.size() - 1, &truncated));
+
+	// Versions newer than the supported one are rejected.
+	string newer = serialized;
+	newer[1] = char(RecordSerializerBinary::sVersion + 1);
+	BC_ASSERT_FALSE(serializer->parse(newer, &final));
+
+	string contact;
+	RecordSerializerBinary::serializeContact(*initial.getExtendedContacts().front(), contact);
+	BC_ASSERT_FALSE(RecordSerializerBinary::parseContact(contact.data(), contact.size() - 1, "alice", "line-1",
+		&final, nullptr));
+	BC_ASSERT_TRUE(final.isEmpty());
+}
+
+static test_t tests[] = {
+	TEST_NO_TAG("Record round trip", record_round_trip),
+	TEST_NO_TAG("Expired contacts", expired_contacts),
+	TEST_NO_TAG("Contact round trip", contact_round_trip),
+	TEST_NO_TAG("Invalid input", invalid_input)
+};
+
+test_suite_t record_serializer_binary_suite = {
+	"Binary record serializer",
+	beforeSuite,
+	NULL,
+	NULL,
+	NULL,
+	sizeof(tests) / sizeof(tests[0]),
+	tests
+};
@@ -0,0 +1,173 @@
+/*
+ * Copyright (C) 2020  Belledonne Communications SARL
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#include <set>
+
+#include "flexisip/utils/static-records.hh"
+
+#include "tester.hh"
+
+using namespace flexisip;
+using namespace std;
+
+static const int sExpire = 60;
+
+static StaticRecords::LoadStats load(StaticRecords &records, const string &content, uint32_t cseq,
+	deque<StaticRecords::Binding> &bindings) {
+	bindings.clear();
+	return records.load(content.data(), content.size(), sExpire, cseq, bindings, "static-records.conf");
+}
+
+static bool hasContact(const StaticRecords::Binding &binding, const char *host) {
+	return binding.contact.find(host) != string::npos;
+}
+
+static void added_and_removed_lines(void) {
+	StaticRecords records;
+	deque<StaticRecords::Binding> bindings;
+
+	auto stats = load(records,
+		"# comment\n"
+		"sip:alice@example.org <sip:alice@192.168.0.1>\n"
+		"\n"
+		"sip:bob@example.org <sip:bob@192.168.0.2>, <sip:bob@192.168.0.3>\n",
+		1, bindings);
+	BC_ASSERT_EQUAL(stats.added, 2, size_t, "%zu");
+	BC_ASSERT_EQUAL(stats.removed, 0, size_t, "%zu");
+	BC_ASSERT_EQUAL(records.size(), 2, size_t, "%zu");
+	BC_ASSERT_EQUAL(bindings.size(), 3, size_t, "%zu");
+	if (bindings.size() != 3) return;
+	for (const auto &binding : bindings) {
+		BC_ASSERT_EQUAL(binding.expire, sExpire, int, "%d");
+		BC_ASSERT_EQUAL(binding.cseq, 1, uint32_t, "%u");
+	}
+	BC_ASSERT_STRING_EQUAL(bindings[0].from.c_str(), "sip:alice@example.org");
+	BC_ASSERT_TRUE(hasContact(bindings[0], "192.168.0.1"));
+
+	// Alice's line is removed and Carol's one added: the removed contacts are unbound first.
+	stats = load(records,
+		"sip:bob@example.org <sip:bob@192.168.0.2>, <sip:bob@192.168.0.3>\n"
+		"sip:carol@example.org <sip:carol@192.168.0.4>\n",
+		2, bindings);
+	BC_ASSERT_EQUAL(stats.added, 1, size_t, "%zu");
+	BC_ASSERT_EQUAL(stats.removed, 1, size_t, "%zu");
+	BC_ASSERT_EQUAL(records.size(), 2, size_t, "%zu");
+	BC_ASSERT_GREATER(bindings.size(), 2, size_t, "%zu");
+	if (bindings.size() < 2) return;
+	BC_ASSERT_STRING_EQUAL(bindings[0].from.c_str(), "sip:alice@example.org");
+	BC_ASSERT_EQUAL(bindings[0].expire, 0, int, "%d");
+	BC_ASSERT_EQUAL(bindings[0].cseq, 2, uint32_t, "%u");
+	BC_ASSERT_STRING_EQUAL(bindings.back().from.c_str(), "sip:carol@example.org");
+	BC_ASSERT_EQUAL(bindings.back().expire, sExpire, int, "%d");
+	BC_ASSERT_EQUAL(bindings.back().cseq, 2, uint32_t, "%u");
+
+	// A changed line is a removed line and an added one.
+	stats = load(records,
+		"sip:bob@example.org <sip:bob@192.168.0.2>\n"
+		"sip:carol@example.org <sip:carol@192.168.0.4>\n",
+		3, bindings);
+	BC_ASSERT_EQUAL(stats.added, 1, size_t, "%zu");
+	BC_ASSERT_EQUAL(stats.removed, 1, size_t, "%zu");
+	BC_ASSERT_GREATER(bindings.size(), 3, size_t, "%zu");
+	if (bindings.size() < 3) return;
+	BC_ASSERT_EQUAL(bindings[0].expire, 0, int, "%d");
+	BC_ASSERT_EQUAL(bindings[1].expire, 0, int, "%d");
+	const auto &rebound = bindings[2];
+	BC_ASSERT_STRING_EQUAL(rebound.from.c_str(), "sip:bob@example.org");
+	BC_ASSERT_TRUE(hasContact(rebound, "192.168.0.2"));
+	BC_ASSERT_EQUAL(rebound.expire, sExpire, int, "%d");
+
+	stats = load(records, "", 4, bindings);
+	BC_ASSERT_EQUAL(stats.removed, 2, size_t, "%zu");
+	BC_ASSERT_EQUAL(records.size(), 0, size_t, "%zu");
+	BC_ASSERT_EQUAL(bindings.size(), 2, size_t, "%zu");
+	for (const auto &binding : bindings) BC_ASSERT_EQUAL(binding.expire, 0, int, "%d");
+}
+
+static void refreshed_lines(void) {
+	StaticRecords records;
+	deque<StaticRecords::Binding> bindings;
+	const int lineCount = 32;
+	string content;
+	for (int i = 0; i < lineCount; ++i) {
+		content += "sip:user" + to_string(i) + "@example.org <sip:user" + to_string(i) + "@192.168.0.1>\n";
+	}
+	load(records, content, 1, bindings);
+	BC_ASSERT_EQUAL(bindings.size(), lineCount, size_t, "%zu");
+
+	// Each unchanged line is refreshed exactly once in sRefreshRounds loads.
+	set<string> refreshed;
+	size_t refreshCount = 0;
+	for (int round = 0; round < StaticRecords::sRefreshRounds; ++round) {
+		uint32_t cseq = 2 + round;
+		auto stats = load(records, content, cseq, bindings);
+		BC_ASSERT_EQUAL(stats.added, 0, size_t, "%zu");
+		BC_ASSERT_EQUAL(stats.removed, 0, size_t, "%zu");
+		BC_ASSERT_EQUAL(stats.refreshed, bindings.size(), size_t, "%zu");
+		refreshCount += stats.refreshed;
+		for (const auto &binding : bindings) {
+			BC_ASSERT_EQUAL(binding.expire, sExpire, int, "%d");
+			BC_ASSERT_EQUAL(binding.cseq, cseq, uint32_t, "%u");
+			refreshed.insert(binding.from);
+		}
+	}
+	BC_ASSERT_EQUAL(refreshCount, lineCount, size_t, "%zu");
+	BC_ASSERT_EQUAL(refreshed.size(), lineCount, size_t, "%zu");
+}
+
+static void invalid_and_duplicated_lines(void) {
+	StaticRecords records;
+	deque<StaticRecords::Binding> bindings;
+
+	// Lines are compared without their surrounding whitespaces.
+	auto stats = load(records,
+		"invalid-line\n"
+		"sip:alice@example.org <sip:alice@192.168.0.1>\n"
+		"  sip:alice@example.org <sip:alice@192.168.0.1>\t\r\n",
+		1, bindings);
+	BC_ASSERT_EQUAL(stats.added, 2, size_t, "%zu");
+	BC_ASSERT_EQUAL(records.size(), 2, size_t, "%zu");
+	BC_ASSERT_EQUAL(bindings.size(), 1, size_t, "%zu");
+
+	// The invalid line is kept, so that it isn't reported again, but has no binding to refresh nor to remove.
+	stats = load(records, "invalid-line\n sip:alice@example.org <sip:alice@192.168.0.1>", 2, bindings);
+	BC_ASSERT_EQUAL(stats.added, 0, size_t, "%zu");
+	BC_ASSERT_EQUAL(stats.removed, 0, size_t, "%zu");
+	stats = load(records, "sip:alice@example.org <sip:alice@192.168.0.1>", 3, bindings);
+	BC_ASSERT_EQUAL(stats.removed, 1, size_t, "%zu");
+	for (const auto &binding : bindings) BC_ASSERT_NOT_EQUAL(binding.expire, 0, int, "%d");
+
+	records.clear();
+	BC_ASSERT_EQUAL(records.size(), 0, size_t, "%zu");
+}
+
+static test_t tests[] = {
+	TEST_NO_TAG("Added and removed lines", added_and_removed_lines),
+	TEST_NO_TAG("Refreshed lines", refreshed_lines),
+	TEST_NO_TAG("Invalid and duplicated lines", invalid_and_duplicated_lines)
+};
+
+test_suite_t static_records_suite = {
+	"Static records",
+	NULL,
+	NULL,
+	NULL,
+	NULL,
+	sizeof(tests) / sizeof(tests[0]),
+	tests
+};
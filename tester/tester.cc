@@ -75,6 +75,14 @@ void flexisip_tester_init(void(*ftester_printf)(int level, const char *fmt, va_l
 	bc_tester_init(ftester_printf, BCTBX_LOG_MESSAGE, BCTBX_LOG_ERROR, ".");
 
 	bc_tester_add_suite(&boolean_expressions_suite);
+	bc_tester_add_suite(&dns_cache_suite);
+	bc_tester_add_suite(&aor_key_suite);
+	bc_tester_add_suite(&domain_matcher_suite);
+	bc_tester_add_suite(&network_table_suite);
+	bc_tester_add_suite(&nonce_store_suite);
+	bc_tester_add_suite(&record_serializer_binary_suite);
+	bc_tester_add_suite(&static_records_suite);
+	bc_tester_add_suite(&digest_suite);
 
 
 }
@@ -39,6 +39,14 @@ extern "C" {
 #endif
 
 extern test_suite_t boolean_expressions_suite;
+extern test_suite_t dns_cache_suite;
+extern test_suite_t aor_key_suite;
+extern test_suite_t domain_matcher_suite;
+extern test_suite_t network_table_suite;
+extern test_suite_t nonce_store_suite;
+extern test_suite_t record_serializer_binary_suite;
+extern test_suite_t static_records_suite;
+extern test_suite_t digest_suite;
 
 
 void flexisip_tester_init(void(*ftester_printf)(int level, const char *fmt, va_list args));